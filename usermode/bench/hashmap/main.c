@@ -0,0 +1,461 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Throughput of the persistent hash map (library/phash) against 
+ * memcached-mtm's hash table (assoc.c) run inside durability transactions,
+ * which is how Mnemosyne applications have built persistent maps so far.
+ *
+ * For each implementation and thread count the benchmark runs three timed
+ * phases over a fixed set of 16-byte keys and prints a CSV line for each:
+ *
+ *   insert   every key once, partitioned among the threads; the table 
+ *            grows from its minimum size along the way
+ *   mixed    random keys, --read-pct of them lookups and the rest value
+ *            updates in place
+ *   remove   every key once, partitioned among the threads
+ *
+ * phash lookups run outside any transaction and bypass the transactional 
+ * memory; assoc lookups run in read-only transactions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <memcached.h>
+#include <phash.h>
+
+#define MAX_LIST   32
+#define KEY_SIZE   16
+
+struct impl_s;
+
+typedef struct thread_arg_s {
+	pthread_t            thread;
+	int                  id;
+	int                  nthreads;
+	const struct impl_s  *impl;
+	uint64_t             ops;
+	uint64_t             seed;
+	uint64_t             hits;
+	double               secs[3];
+} thread_arg_t;
+
+typedef struct impl_s {
+	char     *name;
+	int      (*init)(void);
+	void     (*insert)(const char *key, uint64_t value);
+	int      (*lookup)(const char *key, uint64_t *valuep);
+	void     (*update)(const char *key, uint64_t value);
+	void     (*remove)(const char *key);
+} impl_t;
+
+static const char *phase_names[] = {"insert", "mixed", "remove"};
+
+char                      *prog_name = "hashmap";
+static pthread_barrier_t  phase_barrier;
+static char               *keys;
+static uint64_t           nkeys = 100000;
+static int                read_pct = 90;
+static phash_t            *map;
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static inline uint64_t
+next_rand(uint64_t *seed)
+{
+	uint64_t x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (*seed = x);
+}
+
+
+static inline const char *
+key_of(uint64_t k)
+{
+	return keys + k * KEY_SIZE;
+}
+
+
+static int
+phash_impl_init(void)
+{
+	return (map = phash_open("bench.hashmap")) != NULL ? 0 : -1;
+}
+
+
+static void
+phash_impl_insert(const char *key, uint64_t value)
+{
+	phash_put(map, key, KEY_SIZE, (void *) value);
+}
+
+
+static int
+phash_impl_lookup(const char *key, uint64_t *valuep)
+{
+	return phash_get(map, key, KEY_SIZE, (void **) valuep);
+}
+
+
+static void
+phash_impl_remove(const char *key)
+{
+	phash_remove(map, key, KEY_SIZE);
+}
+
+
+static int
+assoc_impl_init(void)
+{
+	assoc_init();
+	return 0;
+}
+
+
+/* The item is allocated as memcached-mtm's thread.c would, minus the data. */
+static void
+assoc_impl_insert(const char *key, uint64_t value)
+{
+	item *it;
+
+	PTx {
+		if ((it = (item *) pmalloc(sizeof(item) + KEY_SIZE + 1)) != NULL) {
+			it->nkey = KEY_SIZE;
+			it->cas_id = value;
+			memcpy(ITEM_key(it), key, KEY_SIZE);
+			ITEM_key(it)[KEY_SIZE] = '\0';
+			assoc_insert(it);
+		}
+	}
+}
+
+
+static int
+assoc_impl_lookup(const char *key, uint64_t *valuep)
+{
+	item *it;
+
+	PTx_RO {
+		if ((it = assoc_find(key, KEY_SIZE)) != NULL) {
+			*valuep = it->cas_id;
+		}
+	}
+	return it != NULL;
+}
+
+
+static void
+assoc_impl_update(const char *key, uint64_t value)
+{
+	item *it;
+
+	PTx {
+		if ((it = assoc_find(key, KEY_SIZE)) != NULL) {
+			it->cas_id = value;
+		}
+	}
+}
+
+
+static void
+assoc_impl_remove(const char *key)
+{
+	item *it;
+
+	PTx {
+		if ((it = assoc_find(key, KEY_SIZE)) != NULL) {
+			assoc_delete(key, KEY_SIZE);
+			pfree(it);
+		}
+	}
+}
+
+
+static impl_t impls[] = {
+	{"phash", phash_impl_init, phash_impl_insert, phash_impl_lookup, phash_impl_insert, phash_impl_remove},
+	{"assoc", assoc_impl_init, assoc_impl_insert, assoc_impl_lookup, assoc_impl_update, assoc_impl_remove},
+};
+
+#define NUM_IMPLS (sizeof(impls)/sizeof(impls[0]))
+
+
+static
+void *
+worker(void *arg)
+{
+	thread_arg_t  *targ = (thread_arg_t *) arg;
+	const impl_t  *impl = targ->impl;
+	uint64_t      value;
+	uint64_t      r;
+	uint64_t      k;
+	uint64_t      i;
+	uint64_t      start;
+
+	pthread_barrier_wait(&phase_barrier);
+	start = monotonic_ns();
+	for (k = targ->id; k < nkeys; k += targ->nthreads) {
+		impl->insert(key_of(k), k);
+	}
+	targ->secs[0] = (monotonic_ns() - start) / 1e9;
+
+	pthread_barrier_wait(&phase_barrier);
+	start = monotonic_ns();
+	for (i = 0; i < targ->ops; i++) {
+		r = next_rand(&targ->seed);
+		k = (r >> 8) % nkeys;
+		if ((int) (r % 100) < read_pct) {
+			targ->hits += impl->lookup(key_of(k), &value);
+		} else {
+			impl->update(key_of(k), i);
+		}
+	}
+	targ->secs[1] = (monotonic_ns() - start) / 1e9;
+
+	pthread_barrier_wait(&phase_barrier);
+	start = monotonic_ns();
+	for (k = targ->id; k < nkeys; k += targ->nthreads) {
+		impl->remove(key_of(k));
+	}
+	targ->secs[2] = (monotonic_ns() - start) / 1e9;
+	return NULL;
+}
+
+
+static void
+run_point(const impl_t *impl, int nthreads, uint64_t ops)
+{
+	thread_arg_t *targs;
+	uint64_t     hits = 0;
+	uint64_t     phase_ops;
+	double       max_secs;
+	int          p;
+	int          i;
+
+	targs = (thread_arg_t *) calloc(nthreads, sizeof(thread_arg_t));
+	pthread_barrier_init(&phase_barrier, NULL, nthreads);
+	for (i=0; i<nthreads; i++) {
+		targs[i].id = i;
+		targs[i].nthreads = nthreads;
+		targs[i].impl = impl;
+		targs[i].ops = ops;
+		targs[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		pthread_create(&targs[i].thread, NULL, worker, &targs[i]);
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(targs[i].thread, NULL);
+		hits += targs[i].hits;
+	}
+	for (p = 0; p < 3; p++) {
+		max_secs = 0;
+		for (i=0; i<nthreads; i++) {
+			if (targs[i].secs[p] > max_secs) {
+				max_secs = targs[i].secs[p];
+			}
+		}
+		phase_ops = p == 1 ? ops * nthreads : nkeys;
+		printf("%s,%s,%d,%llu,%d,%llu,%.6f,%.0f\n",
+		       impl->name, phase_names[p], nthreads, (unsigned long long) nkeys, 
+		       p == 1 ? read_pct : 0, (unsigned long long) phase_ops, 
+		       max_secs, max_secs > 0 ? phase_ops / max_secs : 0.0);
+	}
+	fflush(stdout);
+	if (hits == 0 && read_pct > 0 && ops > 0) {
+		fprintf(stderr, "%s: %s: no lookup found its key\n", prog_name, impl->name);
+	}
+
+	pthread_barrier_destroy(&phase_barrier);
+	free(targs);
+}
+
+
+/* Parses a comma-separated list of positive integers; returns their count. */
+static int
+parse_list(const char *str, uint64_t *list)
+{
+	char *copy = strdup(str);
+	char *save;
+	char *tok;
+	int  n = 0;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_LIST || (list[n] = strtoull(tok, NULL, 10)) == 0) {
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	free(copy);
+	return n;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [--impl=LIST] [--threads=LIST] [--keys=N] [--ops=N] [--read-pct=P] [--no-header]\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --impl        implementations to run: phash, assoc (default: both)\n");
+	fprintf(fout, "  --threads     thread counts to sweep (default: 1,2,4,8)\n");
+	fprintf(fout, "  --keys        number of keys (default: 100000)\n");
+	fprintf(fout, "  --ops         operations per thread in the mixed phase (default: 1000000)\n");
+	fprintf(fout, "  --read-pct    percentage of lookups in the mixed phase (default: 90)\n");
+	fprintf(fout, "  --no-header   do not print the CSV header line\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char     *impl_list = NULL;
+	uint64_t threads[MAX_LIST];
+	int      nthreads_list;
+	uint64_t ops = 1000000;
+	int      header = 1;
+	int      selected[NUM_IMPLS];
+	char     *copy;
+	char     *save;
+	char     *tok;
+	uint64_t k;
+	int      c;
+	int      m;
+	int      t;
+
+	nthreads_list = parse_list("1,2,4,8", threads);
+	while (1) {
+		static struct option long_options[] = {
+			{"impl", required_argument, 0, 'm'},
+			{"threads", required_argument, 0, 't'},
+			{"keys", required_argument, 0, 'k'},
+			{"ops", required_argument, 0, 'o'},
+			{"read-pct", required_argument, 0, 'r'},
+			{"no-header", no_argument, 0, 'n'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:t:k:o:r:nh", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'm':
+				impl_list = optarg;
+				break;
+			case 't':
+				if ((nthreads_list = parse_list(optarg, threads)) <= 0) {
+					usage(stderr, prog_name);
+				}
+				break;
+			case 'k':
+				nkeys = strtoull(optarg, NULL, 10);
+				break;
+			case 'o':
+				ops = strtoull(optarg, NULL, 10);
+				break;
+			case 'r':
+				read_pct = atoi(optarg);
+				break;
+			case 'n':
+				header = 0;
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (nkeys == 0 || read_pct < 0 || read_pct > 100) {
+		usage(stderr, prog_name);
+	}
+
+	for (m=0; m<NUM_IMPLS; m++) {
+		selected[m] = impl_list == NULL;
+	}
+	if (impl_list) {
+		copy = strdup(impl_list);
+		for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+			for (m=0; m<NUM_IMPLS && strcmp(impls[m].name, tok) != 0; m++);
+			if (m == NUM_IMPLS) {
+				fprintf(stderr, "%s: unknown implementation %s\n", prog_name, tok);
+				usage(stderr, prog_name);
+			}
+			selected[m] = 1;
+		}
+		free(copy);
+	}
+
+	/* Keys are generated up front so formatting them is not timed */
+	keys = (char *) malloc(nkeys * KEY_SIZE + 1);
+	for (k = 0; k < nkeys; k++) {
+		snprintf(keys + k * KEY_SIZE, KEY_SIZE + 1, "key%013llu", (unsigned long long) k);
+	}
+
+	if (header) {
+		printf("impl,phase,threads,keys,read_pct,ops,seconds,ops_per_sec\n");
+	}
+	for (m=0; m<NUM_IMPLS; m++) {
+		if (!selected[m]) {
+			continue;
+		}
+		if (impls[m].init() != 0) {
+			fprintf(stderr, "%s: cannot initialize %s\n", prog_name, impls[m].name);
+			exit(1);
+		}
+		for (t=0; t<nthreads_list; t++) {
+			run_point(&impls[m], (int) threads[t], ops);
+		}
+	}
+	free(keys);
+	return 0;
+}
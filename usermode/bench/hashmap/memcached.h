@@ -0,0 +1,59 @@
+/*
+ * Stand-in for memcached-1.2.4-mtm/memcached.h, so that the hash table
+ * (assoc.c) and its helpers can be built into the hashmap benchmark 
+ * without the rest of memcached. It provides only what those files use; 
+ * the item layout matches memcached's.
+ */
+#ifndef _HASHMAP_MEMCACHED_H
+#define _HASHMAP_MEMCACHED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#define ENDIAN_LITTLE 1
+
+#include <ptx.h>
+#include <helper.h>
+#include <pvar.h>
+
+typedef unsigned int rel_time_t;
+
+struct stats {
+	unsigned int curr_items;
+};
+
+struct settings {
+	int verbose;
+};
+
+extern struct stats stats;
+extern struct settings settings;
+extern rel_time_t current_time;
+
+typedef struct _stritem {
+	struct _stritem *next;
+	struct _stritem *prev;
+	struct _stritem *h_next;    /* hash chain next */
+	rel_time_t      time;       /* least recent access */
+	rel_time_t      exptime;    /* expire time */
+	int             nbytes;     /* size of data */
+	unsigned short  refcount;
+	uint8_t         nsuffix;    /* length of flags-and-length string */
+	uint8_t         it_flags;   /* ITEM_* above */
+	uint8_t         slabs_clsid;/* slab class id : which slab class we're in */
+	uint8_t         nkey;       /* key length, w/terminating null and padding */
+	uint64_t        cas_id;     /* the CAS identifier */
+	void * end[];
+	/* then null-terminated key */
+} item;
+
+#define ITEM_key(item) ((char*)&((item)->end[0]))
+
+#include "assoc.h"
+
+#endif
@@ -0,0 +1,754 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Load generator for memcached-mtm, used by run.sh to measure 
+ * throughput, tail latency, restart-to-serving time and how much of the 
+ * cache survives a crash.
+ *
+ * Speaks the memcached text protocol over one connection per thread. Keys
+ * are numbered 0..keys-1 and every value is derived from its key, so a 
+ * later --mode=verify can tell a hit from a corrupt value no matter which
+ * set reached the server last. Each invocation prints one JSON object.
+ *
+ *   fill    set every key once
+ *   load    random gets and sets with the given get ratio
+ *   verify  get every key, counting hits and corrupt values
+ *   wait    poll the server until it answers, reporting how long it took
+ */
+
+#define _GNU_SOURCE  /* memmem */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_KEY_SIZE    250
+#define CONN_BUF_SIZE   (64*1024)
+
+/* Log-linear latency histogram: 8 sub-buckets per power of two of ns. */
+#define HIST_SUB_BITS   3
+#define HIST_NUM_BUCKETS (64 << HIST_SUB_BITS)
+
+enum {
+	MODE_FILL = 0,
+	MODE_LOAD,
+	MODE_VERIFY,
+	MODE_WAIT
+};
+
+static const char *mode_names[] = { "fill", "load", "verify", "wait" };
+
+typedef struct hist_s {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HIST_NUM_BUCKETS];
+} hist_t;
+
+typedef struct conn_s {
+	int    fd;
+	char   buf[CONN_BUF_SIZE];
+	size_t pos;
+	size_t len;
+} conn_t;
+
+typedef struct thread_arg_s {
+	pthread_t thread;
+	int       id;
+	conn_t    *conn;
+	uint64_t  first_key;
+	uint64_t  last_key;     /* exclusive */
+	uint64_t  hits;
+	uint64_t  misses;
+	uint64_t  corrupt;
+	uint64_t  errors;
+	hist_t    get_hist;
+	hist_t    set_hist;
+} thread_arg_t;
+
+static struct {
+	char     *server;
+	char     *port;
+	char     *label;
+	int      mode;
+	int      nthreads;
+	uint64_t nkeys;
+	uint64_t nops;
+	double   duration;
+	double   get_ratio;
+	int      key_size;
+	int      value_size;
+	double   timeout;
+	uint64_t since_ns;
+} opt = { "127.0.0.1", "11211", "", MODE_LOAD, 4, 100000, 100000, 0, 0.9, 16, 64, 60, 0 };
+
+char                      *prog_name = "mcload";
+static pthread_barrier_t  start_barrier;
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static uint64_t
+realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static inline
+uint64_t
+xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+
+static inline
+int
+hist_bucket(uint64_t val)
+{
+	int msb;
+
+	if (val < (1 << HIST_SUB_BITS)) {
+		return (int) val;
+	}
+	msb = 63 - __builtin_clzll(val);
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + 
+	       (int) ((val >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+
+static
+uint64_t
+hist_bucket_low(int bucket)
+{
+	int exp = bucket >> HIST_SUB_BITS;
+	int sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+
+	if (exp == 0) {
+		return sub;
+	}
+	return ((uint64_t) ((1 << HIST_SUB_BITS) | sub)) << (exp - 1);
+}
+
+
+static inline
+void
+hist_record(hist_t *hist, uint64_t ns)
+{
+	hist->count++;
+	hist->sum += ns;
+	if (ns > hist->max) {
+		hist->max = ns;
+	}
+	hist->buckets[hist_bucket(ns)]++;
+}
+
+
+static
+void
+hist_add(hist_t *dst, const hist_t *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+	for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+
+/* Returns the highest latency, in microseconds, of the bucket holding pct. */
+static
+double
+hist_percentile_us(const hist_t *hist, double pct)
+{
+	uint64_t target;
+	uint64_t seen = 0;
+	uint64_t high;
+	int      i;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+	target = (uint64_t) ((pct / 100.0) * hist->count + 0.5);
+	if (target == 0) {
+		target = 1;
+	}
+	for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			high = i + 1 < HIST_NUM_BUCKETS ? hist_bucket_low(i + 1) - 1 : hist->max;
+			return (high < hist->max ? high : hist->max) / 1e3;
+		}
+	}
+	return hist->max / 1e3;
+}
+
+
+static
+void
+print_hist(const char *name, const hist_t *hist)
+{
+	printf("\"%s\": {\"count\": %llu, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+	       "\"p90_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+	       name, (unsigned long long) hist->count, 
+	       hist->count ? hist->sum / 1e3 / hist->count : 0.0,
+	       hist_percentile_us(hist, 50), hist_percentile_us(hist, 90),
+	       hist_percentile_us(hist, 99), hist_percentile_us(hist, 99.9),
+	       hist->max / 1e3);
+}
+
+
+static
+int
+conn_open(conn_t *conn)
+{
+	struct addrinfo hints;
+	struct addrinfo *res;
+	struct addrinfo *ai;
+	int             one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(opt.server, opt.port, &hints, &res) != 0) {
+		return -1;
+	}
+	conn->fd = -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((conn->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		if (connect(conn->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	freeaddrinfo(res);
+	if (conn->fd < 0) {
+		return -1;
+	}
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	conn->pos = conn->len = 0;
+	return 0;
+}
+
+
+static
+void
+conn_close(conn_t *conn)
+{
+	if (conn->fd >= 0) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+}
+
+
+static
+int
+conn_write(conn_t *conn, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(conn->fd, buf, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static
+int
+conn_fill(conn_t *conn)
+{
+	ssize_t n;
+
+	if (conn->pos > 0) {
+		memmove(conn->buf, conn->buf + conn->pos, conn->len - conn->pos);
+		conn->len -= conn->pos;
+		conn->pos = 0;
+	}
+	if (conn->len == CONN_BUF_SIZE) {
+		return -1;
+	}
+	do {
+		n = read(conn->fd, conn->buf + conn->len, CONN_BUF_SIZE - conn->len);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		return -1;
+	}
+	conn->len += n;
+	return 0;
+}
+
+
+/* Returns the next line without its "\r\n"; valid until the next read. */
+static
+char *
+conn_read_line(conn_t *conn)
+{
+	char *line;
+	char *end;
+
+	while (1) {
+		line = conn->buf + conn->pos;
+		end = memmem(line, conn->len - conn->pos, "\r\n", 2);
+		if (end) {
+			*end = '\0';
+			conn->pos = end + 2 - conn->buf;
+			return line;
+		}
+		if (conn_fill(conn) < 0) {
+			return NULL;
+		}
+	}
+}
+
+
+/* Returns the next len bytes plus the "\r\n" after them. */
+static
+char *
+conn_read_data(conn_t *conn, size_t len)
+{
+	char *data;
+
+	while (conn->len - conn->pos < len + 2) {
+		if (conn_fill(conn) < 0) {
+			return NULL;
+		}
+	}
+	data = conn->buf + conn->pos;
+	conn->pos += len + 2;
+	return data;
+}
+
+
+static inline
+int
+make_key(char *key, uint64_t k)
+{
+	return snprintf(key, MAX_KEY_SIZE + 1, "k%0*llu", opt.key_size - 1, (unsigned long long) k);
+}
+
+
+static inline
+void
+make_value(char *value, uint64_t k)
+{
+	int i;
+
+	for (i = 0; i < opt.value_size; i++) {
+		value[i] = 'a' + (k + i) % 26;
+	}
+}
+
+
+static
+int
+do_set(conn_t *conn, char *req, uint64_t k)
+{
+	char *line;
+	int  len;
+
+	len = sprintf(req, "set ");
+	len += make_key(req + len, k);
+	len += sprintf(req + len, " 0 0 %d\r\n", opt.value_size);
+	make_value(req + len, k);
+	len += opt.value_size;
+	req[len++] = '\r';
+	req[len++] = '\n';
+	if (conn_write(conn, req, len) < 0 || !(line = conn_read_line(conn))) {
+		return -1;
+	}
+	return strcmp(line, "STORED") == 0 ? 0 : 1;
+}
+
+
+/* Returns 0 on a hit with the right value, 1 on a miss, 2 if corrupt. */
+static
+int
+do_get(conn_t *conn, char *req, char *expected, uint64_t k)
+{
+	char         *line;
+	char         *data;
+	unsigned int flags;
+	int          bytes;
+	int          len;
+	int          ret = 1;
+
+	len = sprintf(req, "get ");
+	len += make_key(req + len, k);
+	req[len++] = '\r';
+	req[len++] = '\n';
+	if (conn_write(conn, req, len) < 0) {
+		return -1;
+	}
+	while ((line = conn_read_line(conn))) {
+		if (strcmp(line, "END") == 0) {
+			return ret;
+		}
+		if (sscanf(line, "VALUE %*s %u %d", &flags, &bytes) != 2 ||
+		    !(data = conn_read_data(conn, bytes))) 
+		{
+			return -1;
+		}
+		make_value(expected, k);
+		ret = (bytes == opt.value_size && memcmp(data, expected, bytes) == 0) ? 0 : 2;
+	}
+	return -1;
+}
+
+
+static
+void *
+worker(void *arg)
+{
+	thread_arg_t *targ = (thread_arg_t *) arg;
+	uint64_t     state = 0x9E3779B97F4A7C15ULL * (targ->id + 1);
+	char         *req;
+	char         *expected;
+	uint64_t     i;
+	uint64_t     k;
+	uint64_t     start;
+	uint64_t     deadline = 0;
+	int          ret;
+
+	req = (char *) malloc(MAX_KEY_SIZE + opt.value_size + 64);
+	expected = (char *) malloc(opt.value_size + 1);
+	pthread_barrier_wait(&start_barrier);
+	if (opt.duration > 0) {
+		deadline = monotonic_ns() + (uint64_t) (opt.duration * 1e9);
+	}
+	for (i = 0; ; i++) {
+		if (opt.mode == MODE_LOAD) {
+			if (deadline ? (i % 64 == 0 && monotonic_ns() >= deadline) : i >= opt.nops) {
+				break;
+			}
+			k = xorshift64(&state) % opt.nkeys;
+		} else {
+			k = targ->first_key + i;
+			if (k >= targ->last_key) {
+				break;
+			}
+		}
+		start = monotonic_ns();
+		if (opt.mode == MODE_FILL || 
+		    (opt.mode == MODE_LOAD && (xorshift64(&state) % 10000) >= opt.get_ratio * 10000)) 
+		{
+			ret = do_set(targ->conn, req, k);
+			hist_record(&targ->set_hist, monotonic_ns() - start);
+		} else {
+			ret = do_get(targ->conn, req, expected, k);
+			hist_record(&targ->get_hist, monotonic_ns() - start);
+			if (ret == 0) {
+				targ->hits++;
+			} else if (ret == 1) {
+				targ->misses++;
+			} else if (ret == 2) {
+				targ->corrupt++;
+			}
+		}
+		if (ret < 0) {
+			targ->errors++;
+			break;  /* lost the connection */
+		}
+		if (ret == 1 && opt.mode == MODE_FILL) {
+			targ->errors++;
+		}
+	}
+	free(req);
+	free(expected);
+	return NULL;
+}
+
+
+/* Polls the server until it answers a version request. */
+static
+int
+wait_server()
+{
+	conn_t   *conn = (conn_t *) malloc(sizeof(conn_t));
+	uint64_t start = opt.since_ns ? opt.since_ns : realtime_ns();
+	uint64_t deadline = realtime_ns() + (uint64_t) (opt.timeout * 1e9);
+	uint64_t attempts = 0;
+	char     *line;
+	int      ready = 0;
+
+	while (!ready && realtime_ns() < deadline) {
+		attempts++;
+		if (conn_open(conn) == 0) {
+			if (conn_write(conn, "version\r\n", 9) == 0 && 
+			    (line = conn_read_line(conn)) && 
+			    strncmp(line, "VERSION", 7) == 0) 
+			{
+				ready = 1;
+			}
+			conn_close(conn);
+		}
+		if (!ready) {
+			usleep(1000);
+		}
+	}
+	printf("{\"mode\": \"wait\", \"label\": \"%s\", \"ready\": %s, \"ready_ms\": %.2f, \"attempts\": %llu}\n",
+	       opt.label, ready ? "true" : "false", (realtime_ns() - start) / 1e6, 
+	       (unsigned long long) attempts);
+	free(conn);
+	return ready ? 0 : 1;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [options]\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --mode         fill, load, verify or wait (default: load)\n");
+	fprintf(fout, "  --server       server address (default: 127.0.0.1)\n");
+	fprintf(fout, "  --port         server port (default: 11211)\n");
+	fprintf(fout, "  --threads      client threads, one connection each (default: 4)\n");
+	fprintf(fout, "  --keys         number of distinct keys (default: 100000)\n");
+	fprintf(fout, "  --key-size     key length in bytes (default: 16)\n");
+	fprintf(fout, "  --value-size   value length in bytes (default: 64)\n");
+	fprintf(fout, "  --get-ratio    fraction of gets in load mode (default: 0.9)\n");
+	fprintf(fout, "  --ops          operations per thread in load mode (default: 100000)\n");
+	fprintf(fout, "  --duration     run load mode for SECONDS instead of --ops\n");
+	fprintf(fout, "  --timeout      give up waiting for the server after SECONDS (default: 60)\n");
+	fprintf(fout, "  --since        wait mode measures from this CLOCK_REALTIME ns timestamp\n");
+	fprintf(fout, "  --label        free-form tag copied into the output\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	thread_arg_t *targs;
+	hist_t       *get_hist;
+	hist_t       *set_hist;
+	uint64_t     hits = 0;
+	uint64_t     misses = 0;
+	uint64_t     corrupt = 0;
+	uint64_t     errors = 0;
+	uint64_t     start;
+	double       secs;
+	int          c;
+	int          i;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"mode", required_argument, 0, 'm'},
+			{"server", required_argument, 0, 's'},
+			{"port", required_argument, 0, 'p'},
+			{"threads", required_argument, 0, 't'},
+			{"keys", required_argument, 0, 'k'},
+			{"key-size", required_argument, 0, 'K'},
+			{"value-size", required_argument, 0, 'V'},
+			{"get-ratio", required_argument, 0, 'g'},
+			{"ops", required_argument, 0, 'n'},
+			{"duration", required_argument, 0, 'd'},
+			{"timeout", required_argument, 0, 'T'},
+			{"since", required_argument, 0, 'S'},
+			{"label", required_argument, 0, 'l'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:s:p:t:k:K:V:g:n:d:T:S:l:h", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'm':
+				for (opt.mode = 0; opt.mode <= MODE_WAIT; opt.mode++) {
+					if (strcmp(optarg, mode_names[opt.mode]) == 0) {
+						break;
+					}
+				}
+				if (opt.mode > MODE_WAIT) {
+					usage(stderr, prog_name);
+				}
+				break;
+			case 's':
+				opt.server = optarg;
+				break;
+			case 'p':
+				opt.port = optarg;
+				break;
+			case 't':
+				opt.nthreads = atoi(optarg);
+				break;
+			case 'k':
+				opt.nkeys = strtoull(optarg, NULL, 10);
+				break;
+			case 'K':
+				opt.key_size = atoi(optarg);
+				break;
+			case 'V':
+				opt.value_size = atoi(optarg);
+				break;
+			case 'g':
+				opt.get_ratio = atof(optarg);
+				break;
+			case 'n':
+				opt.nops = strtoull(optarg, NULL, 10);
+				break;
+			case 'd':
+				opt.duration = atof(optarg);
+				break;
+			case 'T':
+				opt.timeout = atof(optarg);
+				break;
+			case 'S':
+				opt.since_ns = strtoull(optarg, NULL, 10);
+				break;
+			case 'l':
+				opt.label = optarg;
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (opt.nthreads < 1 || opt.nkeys == 0 || opt.value_size < 1 ||
+	    opt.key_size < 2 || opt.key_size > MAX_KEY_SIZE ||
+	    opt.get_ratio < 0 || opt.get_ratio > 1) 
+	{
+		usage(stderr, prog_name);
+	}
+	if (opt.mode == MODE_WAIT) {
+		return wait_server();
+	}
+
+	targs = (thread_arg_t *) calloc(opt.nthreads, sizeof(thread_arg_t));
+	for (i = 0; i < opt.nthreads; i++) {
+		targs[i].id = i;
+		targs[i].first_key = opt.nkeys * i / opt.nthreads;
+		targs[i].last_key = opt.nkeys * (i + 1) / opt.nthreads;
+		targs[i].conn = (conn_t *) malloc(sizeof(conn_t));
+		if (conn_open(targs[i].conn) < 0) {
+			fprintf(stderr, "%s: cannot connect to %s:%s\n", prog_name, opt.server, opt.port);
+			exit(1);
+		}
+	}
+	pthread_barrier_init(&start_barrier, NULL, opt.nthreads + 1);
+	for (i = 0; i < opt.nthreads; i++) {
+		pthread_create(&targs[i].thread, NULL, worker, &targs[i]);
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = monotonic_ns();
+
+	get_hist = (hist_t *) calloc(1, sizeof(hist_t));
+	set_hist = (hist_t *) calloc(1, sizeof(hist_t));
+	for (i = 0; i < opt.nthreads; i++) {
+		pthread_join(targs[i].thread, NULL);
+		hist_add(get_hist, &targs[i].get_hist);
+		hist_add(set_hist, &targs[i].set_hist);
+		hits += targs[i].hits;
+		misses += targs[i].misses;
+		corrupt += targs[i].corrupt;
+		errors += targs[i].errors;
+		conn_close(targs[i].conn);
+		free(targs[i].conn);
+	}
+	secs = (monotonic_ns() - start) / 1e9;
+
+	printf("{\"mode\": \"%s\", \"label\": \"%s\", \"threads\": %d, \"keys\": %llu, "
+	       "\"key_size\": %d, \"value_size\": %d, ",
+	       mode_names[opt.mode], opt.label, opt.nthreads, (unsigned long long) opt.nkeys,
+	       opt.key_size, opt.value_size);
+	if (opt.mode == MODE_LOAD) {
+		printf("\"get_ratio\": %.3f, ", opt.get_ratio);
+	}
+	printf("\"seconds\": %.3f, \"ops_per_sec\": %.0f, \"hits\": %llu, \"misses\": %llu, "
+	       "\"corrupt\": %llu, \"errors\": %llu, ",
+	       secs, secs > 0 ? (get_hist->count + set_hist->count) / secs : 0.0,
+	       (unsigned long long) hits, (unsigned long long) misses,
+	       (unsigned long long) corrupt, (unsigned long long) errors);
+	if (opt.mode == MODE_VERIFY) {
+		printf("\"hit_ratio\": %.4f, ", get_hist->count ? (double) hits / get_hist->count : 0.0);
+	}
+	print_hist("get", get_hist);
+	printf(", ");
+	print_hist("set", set_hist);
+	printf("}\n");
+
+	pthread_barrier_destroy(&start_barrier);
+	free(get_hist);
+	free(set_hist);
+	free(targs);
+	return errors || corrupt ? 2 : 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Drives memcached-mtm on loopback with mcload: fills the cache, runs every
+# get/set mix for every client thread count, then kill -9s the server, 
+# restarts it and measures restart-to-serving time and the warm-hit ratio.
+#
+# Usage (from usermode/): bench/mcload/run.sh
+#
+# Every result is one JSON object per line, appended to $RESULTS. Knobs:
+#   SERVER_THREADS  memcached worker threads                (default: 4)
+#   CLIENT_THREADS  client thread counts to sweep           (default: "1 4")
+#   GET_RATIOS      get fractions to sweep                  (default: "0.9 0.5")
+#   KEYS KEY_SIZE VALUE_SIZE DURATION PORT                  (see mcload --help)
+server=./build/bench/memcached/memcached-1.2.4-mtm/memcached
+client=./build/bench/mcload/mcload
+
+SERVER_THREADS=${SERVER_THREADS:-4}
+CLIENT_THREADS=${CLIENT_THREADS:-"1 4"}
+GET_RATIOS=${GET_RATIOS:-"0.9 0.5"}
+KEYS=${KEYS:-100000}
+KEY_SIZE=${KEY_SIZE:-16}
+VALUE_SIZE=${VALUE_SIZE:-64}
+DURATION=${DURATION:-10}
+PORT=${PORT:-11211}
+RESULTS=${RESULTS:-mcload.json}
+
+export LD_LIBRARY_PATH=`pwd`/library/:$LD_LIBRARY_PATH
+opts="--port=$PORT --keys=$KEYS --key-size=$KEY_SIZE --value-size=$VALUE_SIZE"
+
+start_server()
+{
+	since=`date +%s%N`
+	$server -u root -p $PORT -l 127.0.0.1 -t $SERVER_THREADS &
+	pid=$!
+	$client --mode=wait --port=$PORT --since=$since --label=$1 | tee -a $RESULTS
+}
+
+killall -q memcached
+
+# Cold start on empty segments
+MCORE_RESET_SEGMENTS=1 start_server cold
+$client --mode=fill --threads=4 $opts --label=fill | tee -a $RESULTS
+for threads in $CLIENT_THREADS
+do
+	for ratio in $GET_RATIOS
+	do
+		$client --mode=load --threads=$threads --get-ratio=$ratio \
+			--duration=$DURATION $opts --label=load | tee -a $RESULTS
+	done
+done
+
+# Crash, then recover from the persistent segments
+{ kill -9 $pid; wait $pid; } 2>/dev/null
+MCORE_RESET_SEGMENTS=0 start_server restart
+$client --mode=verify --threads=4 $opts --label=warm | tee -a $RESULTS
+
+{ kill $pid; wait $pid; } 2>/dev/null
@@ -0,0 +1,563 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Microbenchmarks for the costs of the persistent-memory runtime.
+ *
+ * Each benchmark runs a tight loop over one runtime operation in every 
+ * thread, sweeping the thread counts and sizes given on the command line,
+ * and prints one CSV line per (benchmark, size, threads) point:
+ *
+ *   txn      durable transaction storing a single word       (size unused)
+ *   txn_ro   read-only transaction loading a single word     (size unused)
+ *   store    transactional stores, per word                  (size: words per transaction)
+ *   load     transactional loads, per word                   (size: words per transaction)
+ *   log      m_phlog_tornbit_write, per word; flush per record (size: words per record)
+ *   trunc    m_phlog_tornbit_truncate_sync, per truncation   (size: words per record)
+ *   pmalloc  pmalloc + pfree pair, per allocation            (size: bytes)
+ *
+ * Threads work on private data so the numbers reflect the runtime's own
+ * path rather than conflicts. The store and load figures include the 
+ * begin/commit cost amortized over size words; subtract the txn line to 
+ * isolate the barriers. The log benchmarks drive a private tornbit
+ * physical log per thread, bypassing the log manager; full logs are
+ * truncated outside the timed region.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ptx.h>
+#include <pcm.h>
+#include <log.h>
+
+#define MAX_LIST        32
+#define PMALLOC_BATCH   16
+
+struct bench_s;
+
+typedef struct thread_arg_s {
+	pthread_t              thread;
+	int                    id;
+	const struct bench_s   *bench;
+	uint64_t               size;
+	uint64_t               iterations;
+	uint64_t               ops;          /**< units of work done */
+	double                 secs;         /**< time spent doing them */
+	uint64_t               *words;       /**< private persistent words */
+	void                   *nvregion;    /**< private physical log: metadata, then the log */
+	m_phlog_tornbit_t      *phlog;
+	pcm_storeset_t         *set;
+} thread_arg_t;
+
+typedef struct bench_s {
+	char     *name;
+	char     *default_sizes;
+	int      bytes_per_unit;             /**< bytes per word of size moved by each op, 0 if n/a */
+	int      (*setup)(thread_arg_t *targ);
+	void     (*run)(thread_arg_t *targ);
+	void     (*teardown)(thread_arg_t *targ);
+} bench_t;
+
+char                      *prog_name = "micro";
+static pthread_barrier_t  start_barrier;
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static int
+words_setup(thread_arg_t *targ)
+{
+	uint64_t *words;
+	size_t   nbytes = targ->size * sizeof(uint64_t);
+
+	PTx { words = (uint64_t *) pmalloc(nbytes); }
+	if (words == NULL) {
+		return -1;
+	}
+	targ->words = words;
+	return 0;
+}
+
+
+static void
+words_teardown(thread_arg_t *targ)
+{
+	uint64_t *words = targ->words;
+
+	PTx { pfree(words); }
+	targ->words = NULL;
+}
+
+
+static void
+txn_run(thread_arg_t *targ)
+{
+	uint64_t *words = targ->words;
+	uint64_t i;
+	uint64_t start;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i++) {
+		PTx { words[0] = i; }
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	targ->ops = targ->iterations;
+}
+
+
+static void
+txn_ro_run(thread_arg_t *targ)
+{
+	uint64_t          *words = targ->words;
+	volatile uint64_t sink = 0;
+	uint64_t          val;
+	uint64_t          i;
+	uint64_t          start;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i++) {
+		PTx_RO { val = words[0]; }
+		sink += val;
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	targ->ops = targ->iterations;
+}
+
+
+static void
+store_run(thread_arg_t *targ)
+{
+	uint64_t *words = targ->words;
+	uint64_t size = targ->size;
+	uint64_t i;
+	uint64_t j;
+	uint64_t start;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i++) {
+		PTx {
+			for (j=0; j<size; j++) {
+				words[j] = i;
+			}
+		}
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	targ->ops = targ->iterations * size;
+}
+
+
+static void
+load_run(thread_arg_t *targ)
+{
+	uint64_t          *words = targ->words;
+	uint64_t          size = targ->size;
+	volatile uint64_t sink = 0;
+	uint64_t          sum;
+	uint64_t          i;
+	uint64_t          j;
+	uint64_t          start;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i++) {
+		PTx_RO {
+			sum = 0;
+			for (j=0; j<size; j++) {
+				sum += words[j];
+			}
+		}
+		sink += sum;
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	targ->ops = targ->iterations * size;
+}
+
+
+static int
+log_setup(thread_arg_t *targ)
+{
+	size_t                 nbytes = CHUNK_SIZE + PHYSICAL_LOG_SIZE;
+	m_phlog_tornbit_nvmd_t *nvmd;
+	pcm_word_t             *nvphlog;
+
+	targ->nvregion = m_pmap(0, nbytes, PROT_READ|PROT_WRITE, 0);
+	if (targ->nvregion == MAP_FAILED) {
+		return -1;
+	}
+	/* Keep the log cacheline aligned, as the log manager does */
+	nvmd = (m_phlog_tornbit_nvmd_t *) targ->nvregion;
+	nvphlog = (pcm_word_t *) ((char *) targ->nvregion + CHUNK_SIZE);
+	targ->set = pcm_storeset_get();
+	/* The log manager does not know about this log, so it carries no type */
+	if (m_phlog_tornbit_alloc(&targ->phlog) != M_R_SUCCESS ||
+	    m_phlog_tornbit_format(targ->set, nvmd, nvphlog, LF_TYPE_FREE) != M_R_SUCCESS ||
+	    m_phlog_tornbit_init(targ->phlog, nvmd, nvphlog) != M_R_SUCCESS)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+
+static void
+log_teardown(thread_arg_t *targ)
+{
+	free(targ->phlog);
+	targ->phlog = NULL;
+	m_punmap(targ->nvregion, CHUNK_SIZE + PHYSICAL_LOG_SIZE);
+	targ->nvregion = NULL;
+}
+
+
+/* Appends a record and makes it durable; returns 0 if the log is full. */
+static inline int
+log_append(thread_arg_t *targ, uint64_t record)
+{
+	uint64_t size = targ->size;
+	uint64_t j;
+
+	/* 
+	 * A record is at most a few chunks, so checking the space up front 
+	 * keeps a full log from splitting it.
+	 */
+	if (((targ->phlog->head - targ->phlog->tail - 1) & (PHYSICAL_LOG_NUM_ENTRIES-1)) < 
+	    2 * (size + CHUNK_SIZE/sizeof(pcm_word_t))) 
+	{
+		return 0;
+	}
+	for (j=0; j<size; j++) {
+		m_phlog_tornbit_write(targ->set, targ->phlog, (pcm_word_t) (record + j));
+	}
+	m_phlog_tornbit_flush(targ->set, targ->phlog);
+	return 1;
+}
+
+
+static void
+log_run(thread_arg_t *targ)
+{
+	uint64_t i;
+	uint64_t start;
+	uint64_t elapsed = 0;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i++) {
+		if (!log_append(targ, i)) {
+			elapsed += monotonic_ns() - start;
+			m_phlog_tornbit_truncate_sync(targ->set, targ->phlog);
+			start = monotonic_ns();
+			log_append(targ, i);
+		}
+	}
+	elapsed += monotonic_ns() - start;
+	targ->secs = elapsed / 1e9;
+	targ->ops = targ->iterations * targ->size;
+}
+
+
+static void
+trunc_run(thread_arg_t *targ)
+{
+	uint64_t i;
+	uint64_t start;
+	uint64_t elapsed = 0;
+
+	for (i=0; i<targ->iterations; i++) {
+		log_append(targ, i);
+		start = monotonic_ns();
+		m_phlog_tornbit_truncate_sync(targ->set, targ->phlog);
+		elapsed += monotonic_ns() - start;
+	}
+	targ->secs = elapsed / 1e9;
+	targ->ops = targ->iterations;
+}
+
+
+static void
+pmalloc_run(thread_arg_t *targ)
+{
+	void     *ptrs[PMALLOC_BATCH];
+	size_t   size = targ->size;
+	uint64_t i;
+	int      j;
+	uint64_t start;
+
+	start = monotonic_ns();
+	for (i=0; i<targ->iterations; i += PMALLOC_BATCH) {
+		PTx {
+			for (j=0; j<PMALLOC_BATCH; j++) {
+				ptrs[j] = pmalloc(size);
+			}
+		}
+		PTx {
+			for (j=0; j<PMALLOC_BATCH; j++) {
+				pfree(ptrs[j]);
+			}
+		}
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	targ->ops = i;
+}
+
+
+static bench_t benches[] = {
+	{"txn",     "1",                   0, words_setup, txn_run,     words_teardown},
+	{"txn_ro",  "1",                   0, words_setup, txn_ro_run,  words_teardown},
+	{"store",   "1,8,64",              8, words_setup, store_run,   words_teardown},
+	{"load",    "1,8,64",              8, words_setup, load_run,    words_teardown},
+	{"log",     "1,8,64",              8, log_setup,   log_run,     log_teardown},
+	{"trunc",   "1,8,64",              0, log_setup,   trunc_run,   log_teardown},
+	{"pmalloc", "16,64,256,1024,4096", 0, NULL,        pmalloc_run, NULL},
+};
+
+#define NUM_BENCHES (sizeof(benches)/sizeof(benches[0]))
+
+
+static
+void *
+worker(void *arg)
+{
+	thread_arg_t  *targ = (thread_arg_t *) arg;
+	const bench_t *bench = targ->bench;
+	int           failed = 0;
+
+	if (bench->setup && bench->setup(targ) != 0) {
+		fprintf(stderr, "%s: %s setup failed in thread %d\n", 
+		        prog_name, bench->name, targ->id);
+		failed = 1;
+	}
+	/* Everybody reaches the barrier so a failed setup cannot hang the others */
+	pthread_barrier_wait(&start_barrier);
+	if (failed) {
+		exit(1);
+	}
+	bench->run(targ);
+	if (bench->teardown) {
+		bench->teardown(targ);
+	}
+	return NULL;
+}
+
+
+static void
+run_point(const bench_t *bench, uint64_t size, int nthreads, uint64_t iterations)
+{
+	thread_arg_t *targs;
+	uint64_t     ops = 0;
+	double       max_secs = 0;
+	double       sum_ns_per_op = 0;
+	int          i;
+
+	targs = (thread_arg_t *) calloc(nthreads, sizeof(thread_arg_t));
+	pthread_barrier_init(&start_barrier, NULL, nthreads);
+	for (i=0; i<nthreads; i++) {
+		targs[i].id = i;
+		targs[i].bench = bench;
+		targs[i].size = size;
+		targs[i].iterations = iterations;
+		pthread_create(&targs[i].thread, NULL, worker, &targs[i]);
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(targs[i].thread, NULL);
+		ops += targs[i].ops;
+		if (targs[i].secs > max_secs) {
+			max_secs = targs[i].secs;
+		}
+		if (targs[i].ops) {
+			sum_ns_per_op += targs[i].secs * 1e9 / targs[i].ops;
+		}
+	}
+	printf("%s,%d,%llu,%llu,%.6f,%.0f,%.2f,%.2f\n",
+	       bench->name, nthreads, (unsigned long long) size, (unsigned long long) ops, 
+	       max_secs, 
+	       max_secs > 0 ? ops / max_secs : 0.0,
+	       sum_ns_per_op / nthreads,
+	       max_secs > 0 ? (double) ops * bench->bytes_per_unit / max_secs / 1e6 : 0.0);
+	fflush(stdout);
+
+	pthread_barrier_destroy(&start_barrier);
+	free(targs);
+}
+
+
+/* Parses a comma-separated list of positive integers; returns their count. */
+static int
+parse_list(const char *str, uint64_t *list)
+{
+	char *copy = strdup(str);
+	char *save;
+	char *tok;
+	int  n = 0;
+
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_LIST || (list[n] = strtoull(tok, NULL, 10)) == 0) {
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	free(copy);
+	return n;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	int i;
+
+	fprintf(fout, "usage: %s [--bench=LIST] [--threads=LIST] [--sizes=LIST] [--iterations=N] [--no-header]\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --bench       benchmarks to run (default: all)\n");
+	fprintf(fout, "  --threads     thread counts to sweep (default: 1,2,4,8)\n");
+	fprintf(fout, "  --sizes       sizes to sweep, overriding each benchmark's default\n");
+	fprintf(fout, "  --iterations  loop iterations per thread (default: 100000)\n");
+	fprintf(fout, "  --no-header   do not print the CSV header line\n");
+	fprintf(fout, "\n");
+	fprintf(fout, "  %-8s %s\n", "bench", "default sizes");
+	for (i=0; i<NUM_BENCHES; i++) {
+		fprintf(fout, "  %-8s %s\n", benches[i].name, benches[i].default_sizes);
+	}
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char     *bench_list = NULL;
+	char     *sizes_list = NULL;
+	uint64_t threads[MAX_LIST];
+	uint64_t sizes[MAX_LIST];
+	int      nthreads_list;
+	int      nsizes;
+	uint64_t iterations = 100000;
+	int      header = 1;
+	int      selected[NUM_BENCHES];
+	char     *copy;
+	char     *save;
+	char     *tok;
+	int      c;
+	int      b;
+	int      s;
+	int      t;
+
+	nthreads_list = parse_list("1,2,4,8", threads);
+	while (1) {
+		static struct option long_options[] = {
+			{"bench", required_argument, 0, 'b'},
+			{"threads", required_argument, 0, 't'},
+			{"sizes", required_argument, 0, 's'},
+			{"iterations", required_argument, 0, 'i'},
+			{"no-header", no_argument, 0, 'n'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "b:t:s:i:nh", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'b':
+				bench_list = optarg;
+				break;
+			case 't':
+				nthreads_list = parse_list(optarg, threads);
+				break;
+			case 's':
+				sizes_list = optarg;
+				break;
+			case 'i':
+				iterations = strtoull(optarg, NULL, 10);
+				break;
+			case 'n':
+				header = 0;
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (nthreads_list <= 0 || iterations == 0 || 
+	    (sizes_list && parse_list(sizes_list, sizes) <= 0)) 
+	{
+		usage(stderr, prog_name);
+	}
+	for (b=0; b<NUM_BENCHES; b++) {
+		selected[b] = (bench_list == NULL);
+	}
+	copy = strdup(bench_list ? bench_list : "");
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (b=0; b<NUM_BENCHES && strcmp(tok, benches[b].name) != 0; b++);
+		if (b == NUM_BENCHES) {
+			fprintf(stderr, "%s: unknown benchmark %s\n", prog_name, tok);
+			usage(stderr, prog_name);
+		}
+		selected[b] = 1;
+	}
+	free(copy);
+
+	if (header) {
+		printf("bench,threads,size,ops,seconds,ops_per_sec,ns_per_op,mb_per_sec\n");
+	}
+	for (b=0; b<NUM_BENCHES; b++) {
+		if (!selected[b]) {
+			continue;
+		}
+		nsizes = parse_list(sizes_list ? sizes_list : benches[b].default_sizes, sizes);
+		for (s=0; s<nsizes; s++) {
+			for (t=0; t<nthreads_list; t++) {
+				run_point(&benches[b], sizes[s], (int) threads[t], iterations);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Random-write throughput over a freshly mapped persistent segment.
+ *
+ * Maps a segment with m_pmap, then has each thread store random words into
+ * it. The segment mapping policy (page size, prefaulting, madvise hint) is
+ * taken from the mcore configuration, so run the benchmark once per policy
+ * with e.g. MCORE_PMAP_PAGESIZE=2m MCORE_PMAP_PREFAULT=populate (see run.sh).
+ * The time to map the segment is reported separately since that is where
+ * prefaulting pays its cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <mnemosyne.h>
+
+typedef struct thread_arg_s {
+	pthread_t     thread;
+	int           id;
+	uint64_t      *segment;
+	uint64_t      nwords;
+	uint64_t      nwrites;
+	double        secs;
+} thread_arg_t;
+
+char                      *prog_name = "segwrite";
+static pthread_barrier_t  start_barrier;
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static inline
+uint64_t
+xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+
+static
+void *
+writer(void *arg)
+{
+	thread_arg_t *targ = (thread_arg_t *) arg;
+	uint64_t     state = 0x9E3779B97F4A7C15ULL * (targ->id + 1);
+	uint64_t     *segment = targ->segment;
+	uint64_t     nwords = targ->nwords;
+	uint64_t     i;
+	uint64_t     start;
+
+	pthread_barrier_wait(&start_barrier);
+	start = monotonic_ns();
+	for (i=0; i<targ->nwrites; i++) {
+		segment[xorshift64(&state) % nwords] = i;
+	}
+	targ->secs = (monotonic_ns() - start) / 1e9;
+	return NULL;
+}
+
+
+static
+char *
+env_or_default(char *name, char *def)
+{
+	char *val = getenv(name);
+	return val ? val : def;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [--size=MB] [--threads=N] [--writes=N]\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --size       segment size in MB (default: 1024)\n");
+	fprintf(fout, "  --threads    number of writer threads (default: 1)\n");
+	fprintf(fout, "  --writes     random 8-byte writes per thread (default: 10000000)\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long size = 1024ULL * 1024 * 1024;
+	int                nthreads = 1;
+	uint64_t           nwrites = 10000000;
+	thread_arg_t       *targs;
+	uint64_t           *segment;
+	uint64_t           map_start;
+	double             map_secs;
+	double             max_secs;
+	int                c;
+	int                i;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"size", required_argument, 0, 's'},
+			{"threads", required_argument, 0, 't'},
+			{"writes", required_argument, 0, 'w'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "s:t:w:h", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 's':
+				size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+				break;
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'w':
+				nwrites = strtoull(optarg, NULL, 10);
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (size == 0 || nthreads < 1 || nwrites == 0) {
+		usage(stderr, prog_name);
+	}
+
+	map_start = monotonic_ns();
+	segment = (uint64_t *) m_pmap(0, size, PROT_READ|PROT_WRITE, 0);
+	map_secs = (monotonic_ns() - map_start) / 1e9;
+	if (segment == MAP_FAILED) {
+		fprintf(stderr, "%s: cannot map a %llu MB persistent segment\n", 
+		        prog_name, size >> 20);
+		exit(1);
+	}
+
+	targs = (thread_arg_t *) calloc(nthreads, sizeof(thread_arg_t));
+	pthread_barrier_init(&start_barrier, NULL, nthreads);
+	for (i=0; i<nthreads; i++) {
+		targs[i].id = i;
+		targs[i].segment = segment;
+		targs[i].nwords = size / sizeof(uint64_t);
+		targs[i].nwrites = nwrites;
+		pthread_create(&targs[i].thread, NULL, writer, &targs[i]);
+	}
+	max_secs = 0;
+	for (i=0; i<nthreads; i++) {
+		pthread_join(targs[i].thread, NULL);
+		if (targs[i].secs > max_secs) {
+			max_secs = targs[i].secs;
+		}
+	}
+
+	printf("%-8s %-9s %-11s %8s %8s %12s %12s\n", 
+	       "pagesize", "prefault", "advice", "size_mb", "threads", "map_ms", "Mwrites/s");
+	printf("%-8s %-9s %-11s %8llu %8d %12.2f %12.2f\n",
+	       env_or_default("MCORE_PMAP_PAGESIZE", "config"),
+	       env_or_default("MCORE_PMAP_PREFAULT", "config"),
+	       env_or_default("MCORE_PMAP_ADVICE", "config"),
+	       size >> 20, nthreads, map_secs * 1e3,
+	       (double) nwrites * nthreads / max_secs / 1e6);
+
+	m_punmap(segment, size);
+	pthread_barrier_destroy(&start_barrier);
+	free(targs);
+	return 0;
+}
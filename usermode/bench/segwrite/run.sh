@@ -0,0 +1,36 @@
+#!/bin/bash
+# Runs the random-write benchmark once per pmap segment policy.
+#
+# Usage: bench/segwrite/run.sh [segwrite options]
+#
+# Set HUGEPAGES_DIR to a hugetlbfs mount to back the 2m/1g runs with 
+# hugetlbfs; otherwise they use huge-page aligned files with MADV_HUGEPAGE.
+bin=./build/bench/segwrite/segwrite
+
+export MCORE_RESET_SEGMENTS=1
+if [[ -n $HUGEPAGES_DIR ]]
+then
+	export MCORE_HUGEPAGES_DIR=$HUGEPAGES_DIR
+fi
+
+lines=2
+for pagesize in 4k 2m 1g
+do
+	for prefault in none populate touch
+	do
+		if [[ $pagesize == '4k' ]]
+		then
+			advices="random normal"
+		else
+			advices="hugepage"
+		fi
+		for advice in $advices
+		do
+			MCORE_PMAP_PAGESIZE=$pagesize \
+			MCORE_PMAP_PREFAULT=$prefault \
+			MCORE_PMAP_ADVICE=$advice \
+				$bin "$@" | tail -n $lines
+			lines=1
+		done
+	done
+done
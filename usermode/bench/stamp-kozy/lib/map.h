@@ -258,6 +258,35 @@
 #  define TMMAP_REMOVE(map, key)      TMRBTREE_DELETE(map, (void*)(key))
 
 
+#elif defined(MAP_USE_BPTREE)
+
+/* Persistent B+-tree of library/pbtree; keys are the integer ids */
+#  include <pbtree.h>
+
+#  define MAP_T                       pbtree_t
+
+/* Sequential operations */
+#  define MAP_ALLOC(hash, cmp)        pbtree_alloc()
+#  define MAP_FREE(map)               pbtree_free(map)
+#  define MAP_CONTAINS(map, key)      pbtree_get(map, (uint64_t)(key), NULL)
+#  define MAP_FIND(map, key) \
+    ({ \
+        void* dataPtr = NULL; \
+        pbtree_get(map, (uint64_t)(key), &dataPtr); \
+        dataPtr; \
+     })
+#  define MAP_INSERT(map, key, data) \
+    (pbtree_insert(map, (uint64_t)(key), (void*)(data)) == 1)
+#  define MAP_REMOVE(map, key)        pbtree_remove(map, (uint64_t)(key))
+
+/* Transaction operations */
+#  define TMMAP_ALLOC(hash, cmp)      MAP_ALLOC(hash, cmp)
+#  define TMMAP_FREE(map)             MAP_FREE(map)
+#  define TMMAP_CONTAINS(map, key)    MAP_CONTAINS(map, key)
+#  define TMMAP_FIND(map, key)        MAP_FIND(map, key)
+#  define TMMAP_INSERT(map, key, data) MAP_INSERT(map, key, data)
+#  define TMMAP_REMOVE(map, key)      MAP_REMOVE(map, key)
+
 #elif defined(MAP_USE_SKIPLIST)
 
 #  include "skiplist.h"
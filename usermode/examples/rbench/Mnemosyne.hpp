@@ -19,6 +19,19 @@ namespace mnemosyne {
  *
  */
 class Mnemosyne {
+    /* Objects live in the runtime's root directory as "rbench.<idx>" */
+    TM_SAFE static const char* object_name(int idx, char* name) {
+        char digits[16];
+        int  n = 0;
+        int  len = 0;
+        const char* prefix = "rbench.";
+        while (prefix[len]) { name[len] = prefix[len]; len++; }
+        do { digits[n++] = '0' + idx % 10; idx /= 10; } while (idx > 0);
+        while (n > 0) name[len++] = digits[--n];
+        name[len] = '\0';
+        return name;
+    }
+
 public:
     Mnemosyne()  { }
 
@@ -30,14 +43,14 @@ public:
 
     template <typename T>
     inline T* get_object(int idx) {
-        return nullptr;
-        //return (T*)per->objects[idx];  // TODO: fix me
+        char name[32];
+        return (T*)m_root_get(object_name(idx, name));
     }
 
     template <typename T>
     inline void put_object(int idx, T* obj) {
-        //per->objects[idx] = obj;  // TODO: fix me
-        //PWB(&per->objects[idx]);
+        char name[32];
+        m_root_set(object_name(idx, name), obj);
     }
 
 
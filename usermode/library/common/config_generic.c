@@ -164,7 +164,7 @@ m_config_setting_lookup_int(config_t *cfg,
 				min = va_arg(ap, int);
 				max = va_arg(ap, int);
 				va_end(ap);
-				if (*value >= min && *value <= max) {
+				if (val >= min && val <= max) {
 					*value = val;
 					return CONFIG_TRUE;
 				}
@@ -75,25 +75,15 @@ void m_debug_print_L(int debug_level, const char *strformat, ...);
 void m_print_trace (void);
 
 #define TSTR_SZ		128
-#define MAX_TBUF_SZ	512*1024*1024	/* bytes */
 
-extern __thread struct timeval mtm_time;
 extern __thread int mtm_tid;
 
 extern __thread char tstr[TSTR_SZ];
 extern __thread int tsz;
-extern __thread unsigned long long tbuf_ptr;
 
-extern char *tbuf;
-extern unsigned long long tbuf_sz;
-extern pthread_spinlock_t tbuf_lock;
 extern pthread_spinlock_t tot_epoch_lock;
 extern int mtm_enable_trace;
-extern int mtm_debug_buffer;
 extern int trace_marker, tracing_on;
-extern struct timeval glb_time;
-extern unsigned long long start_buf_drain, end_buf_drain, buf_drain_period;
-extern unsigned long long glb_tv_sec, glb_tv_usec, glb_start_time;
 
 extern void __pm_trace_print(char* format, ...);
 
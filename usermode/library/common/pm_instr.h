@@ -23,6 +23,9 @@
 #include <sys/syscall.h>
 #include <debug.h>
 #include <string.h>
+#ifdef _ENABLE_TRACE
+#include <pm_trace.h>
+#endif
 
 #define LOC1 	__func__	/* str ["0"]: can be __func__, __FILE__ */	
 #define LOC2	__LINE__        /* int [0]  : can be __LINE__ */
@@ -66,59 +69,15 @@
 
 
 #ifdef _ENABLE_TRACE
-#define time_since_start							\
-	({									\
-		gettimeofday(&mtm_time, NULL);					\
-		(((1000000*mtm_time.tv_sec + 					\
-				mtm_time.tv_usec)				\
-		- (glb_start_time)) - buf_drain_period);			\
-	})
-
-#define TENTRY_ID								\
-	(mtm_tid == -1 ? 							\
-		({mtm_tid = syscall(SYS_gettid); mtm_tid;}) : mtm_tid), 	\
-	(time_since_start)				
-
+/* 
+ * Lock-free binary tracer, see pm_trace.h. Thread id and timestamp are
+ * taken by the recorder, so TENTRY_ID only keeps the argument layout.
+ */
+#define TENTRY_ID (int)0, (unsigned long long)0
 #define pm_trace_print(format, args ...)					\
     {										\
 	if(mtm_enable_trace) {							\
-	pthread_spin_lock(&tbuf_lock);						\
-       	sprintf(tstr, format, args);    					\
-	tsz = strlen(tstr);							\
-	if(tsz < MAX_TBUF_SZ - tbuf_sz)						\
-	{									\
-		memcpy(tbuf+tbuf_sz, 						\
-				tstr, tsz);					\
-		tbuf_sz += tsz;							\
-	}									\
-	else {									\
-		tbuf_ptr = 0;							\
-		if(mtm_debug_buffer)						\
-		{								\
-			fprintf(m_err, 						\
-			"start_buf_drain - %llu us\n",				\
-			(start_buf_drain = time_since_start));			\
-		}								\
-		while(tbuf_ptr < tbuf_sz)					\
-		{								\
-			tbuf_ptr = tbuf_ptr + 1 + 				\
-				fprintf(m_out,"%s", 				\
-				tbuf + tbuf_ptr);				\
-		}								\
-		tbuf_sz = 0; 							\
-		memset(tbuf,'\0', MAX_TBUF_SZ);					\
-		if(mtm_debug_buffer)						\
-		{								\
-			fprintf(m_err, 						\
-			"end_buf_drain - %llu us\n",				\
-			(end_buf_drain = time_since_start));			\
-		}								\
-		memcpy(tbuf, tstr, tsz);					\
-		tbuf_sz += tsz;							\
-		buf_drain_period += (end_buf_drain -				\
-					start_buf_drain) + 1;			\
-	}									\
-	pthread_spin_unlock(&tbuf_lock);					\
+		__pm_trace_record(args);					\
 	}									\
     }
 #elif _ENABLE_FTRACE
@@ -151,7 +110,7 @@
 			TENTRY_ID,		    	\
                         PM_WRT_MARKER,              	\
                         (pm_dst),                   	\
-                        bytes,			    	\
+                        (unsigned long)(bytes),	    	\
                         LOC1,                   	\
                         LOC2);                  	\
     })
@@ -281,11 +240,11 @@
 
 #define PM_STRCPY(pm_dst, src)                      	\
     ({                                              	\
-            PM_TRACE("%d:%llu:%s:%p:%u:%s:%d\n",     	\
+            PM_TRACE("%d:%llu:%s:%p:%lu:%s:%d\n",    	\
 			TENTRY_ID,		    	\
                         PM_WRT_MARKER,              	\
                         (pm_dst),                   	\
-                        (int)strlen((src)),    	    	\
+                        (unsigned long)strlen((src)),	\
                         LOC1,                   	\
                         LOC2);                  	\
             strcpy(pm_dst, src);                    	\
@@ -400,8 +359,8 @@
 			TENTRY_ID,		    	\
                     PM_FLUSH_MARKER,                	\
                     (pm_dst),                       	\
-                    done,                           	\
-                    count,                          	\
+                    (unsigned int)(done),           	\
+                    (unsigned int)(count),          	\
                     LOC1,                       	\
                     LOC2                        	\
                 );                                  	\
@@ -413,8 +372,8 @@
 			TENTRY_ID,		    	\
                     PM_FLUSHOPT_MARKER,                	\
                     (pm_dst),                       	\
-                    done,                           	\
-                    count,                          	\
+                    (unsigned int)(done),           	\
+                    (unsigned int)(count),          	\
                     LOC1,                       	\
                     LOC2                        	\
                 );                                  	\
@@ -0,0 +1,438 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file pm_trace.c
+ *
+ * \brief Lock-free per-thread PM trace rings and their background drainer.
+ *
+ * Each traced thread owns a power-of-two ring of pm_trace_rec_t. The owner
+ * is the only writer of head and the drainer the only writer of tail, so a
+ * release store on each side is all the synchronization needed. A thread
+ * that finds its ring full waits for the drainer instead of dropping the
+ * event; such stalls are counted and reported in the trace file.
+ *
+ * Rings are never unmapped while tracing is on. When a thread exits its
+ * ring is marked free and handed to the next thread that needs one once the
+ * drainer has emptied it.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "hrtime.h"
+#include "pm_instr.h"   /* PM_CL_SIZE */
+#include "pm_trace.h"
+
+#define PM_TRACE_RING_FREE         0
+#define PM_TRACE_RING_USED         1
+
+#define PM_TRACE_MIN_RING_RECORDS  1024
+#define PM_TRACE_DRAIN_PERIOD_US   1000
+#define PM_TRACE_OUTBUF_SIZE       (1024*1024)
+
+typedef struct pm_trace_ring_s pm_trace_ring_t;
+
+struct pm_trace_ring_s {
+	volatile uint64_t head;                    /* written by the owner only */
+	char              pad0[PM_CL_SIZE - sizeof(uint64_t)];
+	volatile uint64_t tail;                    /* written by the drainer only */
+	char              pad1[PM_CL_SIZE - sizeof(uint64_t)];
+	volatile int      state;
+	volatile uint64_t stalls;
+	pm_trace_ring_t   *next;
+	pm_trace_rec_t    *recs;
+};
+
+static pm_trace_ring_t * volatile ring_list = NULL;
+static uint64_t                   ring_mask;
+static size_t                     ring_mapsize;
+static volatile int               trace_on = 0;
+static volatile int               drainer_stop = 0;
+static pthread_t                  drainer;
+static pthread_key_t              ring_key;
+static FILE                       *trace_out = NULL;
+static char                       *trace_outbuf = NULL;
+
+static __thread pm_trace_ring_t   *my_ring = NULL;
+static __thread uint32_t          my_tid = 0;
+
+/* Function-name addresses already written to the trace. Drainer-only. */
+static uint64_t                   *func_seen = NULL;
+static unsigned int               func_seen_size = 0;
+static unsigned int               func_seen_nb = 0;
+
+
+static inline int
+marker_to_op(const char *marker)
+{
+	switch (marker[3]) {
+		case 'W': return PM_TRACE_OP_WRT;
+		case 'D': return marker[4] == 'W' ? PM_TRACE_OP_DWRT : PM_TRACE_OP_DI;
+		case 'R': return PM_TRACE_OP_RD;
+		case 'I': return PM_TRACE_OP_NTI;
+		case 'L': return PM_TRACE_OP_FLUSH;
+		case 'O': return PM_TRACE_OP_FLUSHOPT;
+		case 'X': return marker[4] == 'S' ? PM_TRACE_OP_TX_START : PM_TRACE_OP_TX_END;
+		case 'N': return PM_TRACE_OP_FENCE;
+		case 'C': return PM_TRACE_OP_COMMIT;
+		case 'B': return PM_TRACE_OP_BARRIER;
+	}
+	return PM_TRACE_OP_WRT;
+}
+
+
+static void
+ring_release(void *arg)
+{
+	pm_trace_ring_t *ring = (pm_trace_ring_t *) arg;
+
+	my_ring = NULL;
+	__atomic_store_n(&ring->state, PM_TRACE_RING_FREE, __ATOMIC_RELEASE);
+}
+
+
+static pm_trace_ring_t *
+ring_acquire(void)
+{
+	pm_trace_ring_t *ring;
+	void            *map;
+
+	/* Reuse the ring of a thread that has exited, once it has been drained */
+	for (ring = ring_list; ring; ring = ring->next) {
+		if (ring->state == PM_TRACE_RING_FREE &&
+		    ring->tail == ring->head &&
+		    __sync_bool_compare_and_swap(&ring->state, 
+		                                 PM_TRACE_RING_FREE, 
+		                                 PM_TRACE_RING_USED))
+		{
+			goto found;
+		}
+	}
+
+	/* Use mmap rather than malloc to avoid interaction with the heap */
+	map = mmap(0, ring_mapsize, PROT_READ | PROT_WRITE, 
+	           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	ring = (pm_trace_ring_t *) map;
+	ring->recs = (pm_trace_rec_t *) ((char *) map + sizeof(pm_trace_ring_t));
+	ring->state = PM_TRACE_RING_USED;
+	do {
+		ring->next = ring_list;
+	} while (!__sync_bool_compare_and_swap(&ring_list, ring->next, ring));
+
+found:
+	if (my_tid == 0) {
+		my_tid = (uint32_t) syscall(SYS_gettid);
+	}
+	my_ring = ring;
+	pthread_setspecific(ring_key, ring);
+	return ring;
+}
+
+
+void
+__pm_trace_record(int unused_tid, unsigned long long unused_time, 
+                  const char *marker, ...)
+{
+	pm_trace_ring_t *ring;
+	pm_trace_rec_t  *rec;
+	uint64_t        head;
+	va_list         ap;
+	int             op;
+
+	if (!trace_on) {
+		return;
+	}
+	if ((ring = my_ring) == NULL && (ring = ring_acquire()) == NULL) {
+		return;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring_mask) {
+		ring->stalls++;
+		while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring_mask) {
+			if (!trace_on) {
+				return;
+			}
+			sched_yield();
+		}
+	}
+
+	op = marker_to_op(marker);
+	rec = &ring->recs[head & ring_mask];
+	rec->tsc = hrtime_cycles();
+	rec->tid = my_tid;
+	rec->op = op;
+
+	va_start(ap, marker);
+	switch (op) {
+		case PM_TRACE_OP_TX_START:
+		case PM_TRACE_OP_TX_END:
+		case PM_TRACE_OP_FENCE:
+		case PM_TRACE_OP_COMMIT:
+		case PM_TRACE_OP_BARRIER:
+			rec->addr = 0;
+			rec->size = 0;
+			rec->count = 0;
+			break;
+		case PM_TRACE_OP_FLUSH:
+		case PM_TRACE_OP_FLUSHOPT:
+			rec->addr = (uintptr_t) va_arg(ap, void *);
+			rec->size = va_arg(ap, unsigned int);
+			rec->count = va_arg(ap, unsigned int);
+			break;
+		case PM_TRACE_OP_NTI:
+			rec->addr = (uintptr_t) va_arg(ap, void *);
+			rec->size = (uint32_t) va_arg(ap, unsigned long);
+			rec->count = (uint32_t) va_arg(ap, unsigned long);
+			break;
+		default:
+			rec->addr = (uintptr_t) va_arg(ap, void *);
+			rec->size = (uint32_t) va_arg(ap, unsigned long);
+			rec->count = 0;
+	}
+	rec->func = (uintptr_t) va_arg(ap, const char *);
+	rec->line = (uint16_t) va_arg(ap, int);
+	va_end(ap);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static void
+chunk_write(uint32_t type, uint32_t nb, uint64_t arg, uint64_t arg2, 
+            const void *payload, size_t len)
+{
+	pm_trace_chunk_t chunk;
+
+	chunk.type = type;
+	chunk.nb = nb;
+	chunk.arg = arg;
+	chunk.arg2 = arg2;
+	fwrite(&chunk, sizeof(chunk), 1, trace_out);
+	if (len) {
+		fwrite(payload, len, 1, trace_out);
+	}
+}
+
+
+static void
+sync_write(void)
+{
+	struct timeval tv;
+	uint64_t       tsc;
+
+	tsc = hrtime_cycles();
+	gettimeofday(&tv, NULL);
+	chunk_write(PM_TRACE_CHUNK_SYNC, 0, tsc, 
+	            1000000ULL * tv.tv_sec + tv.tv_usec, NULL, 0);
+}
+
+
+static void
+func_resolve(uint64_t func)
+{
+	unsigned int i;
+	unsigned int j;
+	uint64_t     *old;
+	unsigned int old_size;
+	const char   *name = (const char *) (uintptr_t) func;
+
+	if (func == 0) {
+		return;
+	}
+	for (i = (func >> 3) & (func_seen_size - 1); 
+	     func_seen[i]; 
+	     i = (i + 1) & (func_seen_size - 1)) 
+	{
+		if (func_seen[i] == func) {
+			return;
+		}
+	}
+	func_seen[i] = func;
+	chunk_write(PM_TRACE_CHUNK_STR, strlen(name), func, 0, name, strlen(name));
+
+	if (++func_seen_nb * 2 > func_seen_size) {
+		old = func_seen;
+		old_size = func_seen_size;
+		func_seen_size *= 2;
+		func_seen = (uint64_t *) calloc(func_seen_size, sizeof(uint64_t));
+		for (j = 0; j < old_size; j++) {
+			if (old[j] == 0) {
+				continue;
+			}
+			for (i = (old[j] >> 3) & (func_seen_size - 1); 
+			     func_seen[i]; 
+			     i = (i + 1) & (func_seen_size - 1));
+			func_seen[i] = old[j];
+		}
+		free(old);
+	}
+}
+
+
+static uint64_t
+ring_drain(pm_trace_ring_t *ring)
+{
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t i;
+	uint64_t first;
+	uint64_t span;
+
+	if (head == tail) {
+		return 0;
+	}
+	for (i = tail; i != head; i++) {
+		func_resolve(ring->recs[i & ring_mask].func);
+	}
+	first = tail & ring_mask;
+	span = head - tail;
+	if (first + span > ring_mask + 1) {
+		span = ring_mask + 1 - first;
+	}
+	chunk_write(PM_TRACE_CHUNK_REC, span, 0, 0, 
+	            &ring->recs[first], span * sizeof(pm_trace_rec_t));
+	if (span < head - tail) {
+		chunk_write(PM_TRACE_CHUNK_REC, head - tail - span, 0, 0, 
+		            &ring->recs[0], (head - tail - span) * sizeof(pm_trace_rec_t));
+	}
+	__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+	return head - tail;
+}
+
+
+static void *
+drainer_main(void *arg)
+{
+	pm_trace_ring_t *ring;
+	uint64_t        n;
+	int             stop;
+
+	do {
+		stop = __atomic_load_n(&drainer_stop, __ATOMIC_ACQUIRE);
+		n = 0;
+		for (ring = ring_list; ring; ring = ring->next) {
+			n += ring_drain(ring);
+		}
+		if (n) {
+			sync_write();
+		} else if (!stop) {
+			usleep(PM_TRACE_DRAIN_PERIOD_US);
+		}
+	} while (!stop);
+	return NULL;
+}
+
+
+int
+pm_trace_init(const char *path, unsigned int ring_records)
+{
+	pm_trace_file_hdr_t hdr;
+	struct timeval      tv;
+	uint64_t            nrecs;
+
+	if (trace_on) {
+		return 0;
+	}
+	for (nrecs = PM_TRACE_MIN_RING_RECORDS; nrecs < ring_records; nrecs <<= 1);
+	ring_mask = nrecs - 1;
+	ring_mapsize = sizeof(pm_trace_ring_t) + nrecs * sizeof(pm_trace_rec_t);
+
+	if ((trace_out = fopen(path, "w")) == NULL) {
+		return -1;
+	}
+	trace_outbuf = (char *) malloc(PM_TRACE_OUTBUF_SIZE);
+	setvbuf(trace_out, trace_outbuf, _IOFBF, PM_TRACE_OUTBUF_SIZE);
+	func_seen_size = 1024;
+	func_seen_nb = 0;
+	func_seen = (uint64_t *) calloc(func_seen_size, sizeof(uint64_t));
+
+	gettimeofday(&tv, NULL);
+	hdr.magic = PM_TRACE_MAGIC;
+	hdr.version = PM_TRACE_VERSION;
+	hdr.rec_size = sizeof(pm_trace_rec_t);
+	hdr.start_tsc = hrtime_cycles();
+	hdr.start_usec = 1000000ULL * tv.tv_sec + tv.tv_usec;
+	fwrite(&hdr, sizeof(hdr), 1, trace_out);
+
+	pthread_key_create(&ring_key, ring_release);
+	drainer_stop = 0;
+	if (pthread_create(&drainer, NULL, drainer_main, NULL) != 0) {
+		fclose(trace_out);
+		trace_out = NULL;
+		return -1;
+	}
+	__atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+void
+pm_trace_fini(void)
+{
+	pm_trace_ring_t *ring;
+	uint64_t        stalls = 0;
+
+	if (!trace_on) {
+		return;
+	}
+	__atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&drainer_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(drainer, NULL);
+
+	for (ring = ring_list; ring; ring = ring->next) {
+		stalls += ring->stalls;
+	}
+	sync_write();
+	chunk_write(PM_TRACE_CHUNK_STALL, 0, stalls, 0, NULL, 0);
+	fclose(trace_out);
+	trace_out = NULL;
+	free(trace_outbuf);
+	free(func_seen);
+	func_seen = NULL;
+	if (stalls) {
+		fprintf(stderr, "pm_trace: writers waited on a full ring %llu times, "
+		        "consider a larger trace_ring_records\n", 
+		        (unsigned long long) stalls);
+	}
+}
@@ -0,0 +1,133 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file pm_trace.h
+ *
+ * \brief Per-thread binary trace rings for the PM_* instrumentation.
+ *
+ * When built with _ENABLE_TRACE, each PM_* event is encoded as a fixed-size
+ * record and appended to a single-producer/single-consumer ring owned by the
+ * calling thread. A background drainer thread moves records from all rings
+ * to a compact binary file; the writer never takes a lock, formats text or
+ * performs I/O. The file is turned back into the PM_W/PM_L/PM_N text format
+ * by tool/pmtrace.
+ */
+
+#ifndef _PM_TRACE_H
+#define _PM_TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Event kinds, one per PM_*_MARKER in pm_instr.h */
+enum {
+	PM_TRACE_OP_WRT = 0,    /* PM_W  */
+	PM_TRACE_OP_DWRT,       /* PM_DW */
+	PM_TRACE_OP_DI,         /* PM_DI */
+	PM_TRACE_OP_RD,         /* PM_R  */
+	PM_TRACE_OP_NTI,        /* PM_I  */
+	PM_TRACE_OP_FLUSH,      /* PM_L  */
+	PM_TRACE_OP_FLUSHOPT,   /* PM_O  */
+	PM_TRACE_OP_TX_START,   /* PM_XS */
+	PM_TRACE_OP_FENCE,      /* PM_N  */
+	PM_TRACE_OP_COMMIT,     /* PM_C  */
+	PM_TRACE_OP_BARRIER,    /* PM_B  */
+	PM_TRACE_OP_TX_END,     /* PM_XE */
+	PM_TRACE_OP_NUM
+};
+
+/* 
+ * One traced event. For writes and reads size is the access size in bytes;
+ * for PM_I it is the number of bytes copied and for PM_L/PM_O the number of
+ * bytes flushed so far, with count holding the total. func is the address
+ * of the __func__ string of the call site, resolved by the drainer.
+ */
+typedef struct pm_trace_rec_s {
+	uint64_t tsc;
+	uint64_t addr;
+	uint64_t func;
+	uint32_t size;
+	uint32_t count;
+	uint32_t tid;
+	uint16_t op;
+	uint16_t line;
+} pm_trace_rec_t;
+
+
+/* 
+ * On-disk format: a header followed by a stream of chunks. Record chunks
+ * carry nb records of the thread they were drained from; string chunks bind
+ * a func address to its name (nb bytes follow, not NUL terminated); sync
+ * chunks pair a tsc value with wall-clock microseconds so the decoder can
+ * convert cycles to time.
+ */
+#define PM_TRACE_MAGIC    0x3145434152544e4dULL  /* "MNTRACE1" */
+#define PM_TRACE_VERSION  1
+
+enum {
+	PM_TRACE_CHUNK_REC = 1,
+	PM_TRACE_CHUNK_STR,
+	PM_TRACE_CHUNK_SYNC,
+	PM_TRACE_CHUNK_STALL
+};
+
+typedef struct pm_trace_file_hdr_s {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t rec_size;
+	uint64_t start_tsc;
+	uint64_t start_usec;
+} pm_trace_file_hdr_t;
+
+typedef struct pm_trace_chunk_s {
+	uint32_t type;
+	uint32_t nb;
+	uint64_t arg;       /* REC: unused, STR: func address, SYNC: tsc, 
+	                       STALL: number of times a writer found its ring full */
+	uint64_t arg2;      /* SYNC: wall-clock microseconds */
+} pm_trace_chunk_t;
+
+
+int  pm_trace_init(const char *path, unsigned int ring_records);
+void pm_trace_fini(void);
+void __pm_trace_record(int unused_tid, unsigned long long unused_time, 
+                       const char *marker, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PM_TRACE_H */
@@ -197,6 +197,15 @@ LOCK_IDX_SWAP = True
 #
 #   The priority contention manager can be activated only after a
 #   configurable number of retries.  Until then, CM_SUICIDE is used.
+#
+# On top of the compile-time strategy, a policy can be selected at
+# runtime through the mtm.cm_policy setting (or MTM_CM_POLICY):
+# suicide (default, adds nothing), backoff, karma, timestamp, and
+# adaptive.  Karma and timestamp let the transaction with more work
+# (respectively the older one) wait for a bounded time for the lock
+# owner instead of aborting.  Adaptive keeps a per atomic-block abort
+# profile and serializes the instances of blocks whose abort rate
+# exceeds mtm.cm_serialize_threshold percent, backing off otherwise.
 ########################################################################
 
 CM = 'CM_SUICIDE'
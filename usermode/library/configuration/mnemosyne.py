@@ -124,6 +124,8 @@ class Environment(SCons.Environment.Environment):
 			False),
 		('M_PCM_EMULATE_LATENCY',    'PCM emulation layer emulates latency.',
 			False),
+		('M_PCM_EMULATE_NVM',        'PCM macros call the runtime NVM emulator, configured by the mcore nvm_* settings.',
+			False),
 	]
 
 	#: Build variables which have enumerated values.
@@ -34,6 +34,7 @@
 #define _CONFIG_H
 
 #include "config_generic.h"
+#include "mnemosyne.h"
 
 
 #define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)          \
@@ -43,7 +44,64 @@
          CONFIG_NO_CHECK, 0)                                                   \
   ACTION(config, values, group, stats, bool, int, 0, CONFIG_NO_CHECK, 0)       \
   ACTION(config, values, group, stats_file, string, char *, "mcore.stats",     \
-         CONFIG_NO_CHECK, 0)
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, flush_insn, string, char *, "auto",            \
+         CONFIG_LIST_CHECK, 4, "auto", "clflush", "clflushopt", "clwb")    \
+  ACTION(config, values, group, persist_domain, string, char *, "auto",        \
+         CONFIG_LIST_CHECK, 4, "auto", "emulated", "adr", "eadr")              \
+  ACTION(config, values, group, nvm_flush_latency_ns, int, int, 0,             \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, nvm_fence_latency_ns, int, int, 0,             \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, nvm_write_bandwidth_mb, int, int, 0,           \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, crash_point, int, int, 0,                      \
+         CONFIG_RANGE_CHECK, 0, 0x7fffffff)                                    \
+  ACTION(config, values, group, crash_seed, int, int, 0,                       \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, crash_evict_likelihood, int, int, 10000,       \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, crash_torn_cdf, string, char *, "none",        \
+         CONFIG_LIST_CHECK, 2, "none", "uniform")                              \
+  ACTION(config, values, group, trace_file, string, char *,                    \
+         "mnemosyne.trace", CONFIG_NO_CHECK, 0)                                \
+  ACTION(config, values, group, trace_ring_records, int, int, 1 << 16,         \
+         CONFIG_RANGE_CHECK, 1024, 1 << 26)                                    \
+  ACTION(config, values, group, hugepages_dir, string, char *, "",             \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, prefault_threads, int, int, 4,                 \
+         CONFIG_RANGE_CHECK, 1, 256)                                           \
+  ACTION(config, values, group, reincarnation_threads, int, int, 4,            \
+         CONFIG_RANGE_CHECK, 1, 64)                                            \
+  ACTION(config, values, group, max_processes, int, int, 1,                    \
+         CONFIG_RANGE_CHECK, 1, M_MAX_PROCESS_GROUP)                           \
+  ACTION(config, values, group, tier_dir, string, char *, "",                  \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, tier_extent_kb, int, int, 256,                 \
+         CONFIG_RANGE_CHECK, 4, 1 << 20)                                       \
+  ACTION(config, values, group, tier_scan_interval_ms, int, int, 1000,         \
+         CONFIG_RANGE_CHECK, 10, 3600000)                                      \
+  ACTION(config, values, group, tier_cold_after_s, int, int, 60,               \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, tier_migrate_per_scan, int, int, 16,           \
+         CONFIG_RANGE_CHECK, 1, 1 << 20)                                       \
+  FOREACH_SEGMENT_CLASS_CONFIG_SETTING(ACTION, group, config, values, pmap)    \
+  FOREACH_SEGMENT_CLASS_CONFIG_SETTING(ACTION, group, config, values, log)     \
+  FOREACH_SEGMENT_CLASS_CONFIG_SETTING(ACTION, group, config, values, section)
+
+/* 
+ * Mapping policy of a class of persistent segments: pmap segments (e.g. the
+ * pmalloc heap), the log pool, and .persistent sections. The defaults keep
+ * 4K pages, no prefaulting and MADV_RANDOM.
+ */
+#define FOREACH_SEGMENT_CLASS_CONFIG_SETTING(ACTION, group, config, values, cl) \
+  ACTION(config, values, group, cl##_pagesize, string, char *, "4k",           \
+         CONFIG_LIST_CHECK, 3, "4k", "2m", "1g")                               \
+  ACTION(config, values, group, cl##_prefault, string, char *, "none",         \
+         CONFIG_LIST_CHECK, 3, "none", "populate", "touch")                    \
+  ACTION(config, values, group, cl##_advice, string, char *, "random",         \
+         CONFIG_LIST_CHECK, 5, "random", "normal", "sequential", "willneed",   \
+         "hugepage")
 
 
 typedef CONFIG_GROUP_STRUCT(mcore) mcore_config_t;
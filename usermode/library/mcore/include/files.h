@@ -69,4 +69,22 @@ void mkdir_r(const char *dir, mode_t mode);
  */
 mnemosyne_result_t path2file(char *path, char **file);
 
+/*!
+ * Copies size bytes from the start of the open file sfd to the start of 
+ * the empty file dfd. Shares the blocks (reflink) when the file system 
+ * supports it, and copies them otherwise. Does not sync dfd.
+ *
+ * \return 0 on success, or -1 with errno set.
+ */
+int file_copy_fd(int sfd, int dfd, off_t size);
+
+/*!
+ * Copies the file src into the new file dst and syncs it. Shares the 
+ * blocks of src (reflink) when the file system supports it, and copies 
+ * them otherwise.
+ *
+ * \return 0 on success, or -1 with errno set; dst does not exist then.
+ */
+int file_clone(const char *src, const char *dst);
+
 #endif /* end of include guard: FILES_H_SSO60IIC */
@@ -0,0 +1,51 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Process groups: several processes sharing one segments_dir.
+ *
+ * Each process of a group claims a slot, which selects its log pool and
+ * pmalloc arena. Slots and the group lock are flock(2) locks on files next
+ * to segments_dir, so the kernel releases them when a process dies.
+ */
+#ifndef GROUP_H_Q2MZ7LKD
+#define GROUP_H_Q2MZ7LKD
+
+#include "mnemosyne.h"
+
+void m_group_init(void);
+void m_group_fini(void);
+void m_group_check_size(void);
+int  m_group_alone(void);
+
+#endif /* end of include guard: GROUP_H_Q2MZ7LKD */
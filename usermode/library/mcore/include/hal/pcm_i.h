@@ -96,6 +96,9 @@ extern "C" {
 # error "RAND_MAX must be at least equal to PROB_TOTAL_OUTCOMES_NUM."
 #endif
 
+/** Exit status of a process crashed by crash injection (see pcm_crash_init). */
+#define PCM_CRASH_EXIT_STATUS 86
+
 
 #define NS2CYCLE(__ns) ((__ns) * M_PCM_CPUFREQ / 1000)
 #define CYCLE2NS(__cycles) ((__cycles) * 1000 / M_PCM_CPUFREQ)
@@ -173,11 +176,24 @@ struct pcm_storeset_s {
 
 extern unsigned int pcm_likelihood_store_blockwaits;  
 extern volatile arch_spinlock_t ticket_lock;
+extern int pcm_flush_insn;
+extern int pcm_persist_domain;
+extern int pcm_emulate_enabled;
+extern double pcm_emulate_cycles_per_ns;
+extern __thread uint64_t pcm_emulate_pending_bytes;
 
 /* 
  * Prototypes
  */
 
+void pcm_flush_init(const char *flush_insn);
+const char *pcm_flush_insn_name(int insn);
+int pcm_flush_insn_supported(int insn);
+void pcm_persist_domain_init(const char *domain, const char *dir);
+const char *pcm_persist_domain_name(int domain);
+int pcm_emulate_init(int flush_latency_ns, int fence_latency_ns, int write_bandwidth_mb);
+void pcm_emulate_flush();
+void pcm_emulate_fence();
 int pcm_storeset_create(pcm_storeset_t **setp);
 void pcm_storeset_destroy(pcm_storeset_t *set);
 pcm_storeset_t* pcm_storeset_get(void);
@@ -186,6 +202,9 @@ void pcm_wb_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr,
 void pcm_wb_flush_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr);
 void pcm_nt_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_word_t val);
 void pcm_nt_flush_emulate_crash(pcm_storeset_t *set);
+void pcm_wb_fence_emulate_crash(pcm_storeset_t *set);
+void pcm_crash_init(uint64_t point, unsigned int seed, int evict_likelihood, const char *torn_cdf);
+uint64_t pcm_crash_point_count(void);
 
 
 /*
@@ -260,13 +279,88 @@ static inline unsigned long long asm_rdtscp(void)
 #define asm_clflush(addr)					\
 ({								\
 	__asm__ __volatile__ ("clflush %0" : : "m"(*addr));	\
-	/* __asm__ __volatile__ ("clflushopt %0" : : "m"(*addr)); */	\
 	/* PM_FLUSH((addr), PM_CL_SIZE, sizeof(addr)); */	\
 })
 /*
 #define asm_clflush(addr) {;}
 */
 
+/* 
+ * CLFLUSHOPT and CLWB are encoded by hand (66-prefixed CLFLUSH and XSAVEOPT
+ * respectively) so that older assemblers accept them. Unlike CLFLUSH, they 
+ * are not ordered with respect to each other or to older stores to other 
+ * lines, so a batch of them must be followed by a fence (SFENCE suffices).
+ */
+#define asm_clflushopt(addr)					\
+({								\
+	__asm__ __volatile__ (".byte 0x66; clflush %0" : "+m"(*(volatile char *)(addr)));	\
+	/* PM_FLUSHOPT((addr), PM_CL_SIZE, sizeof(addr)); */	\
+})
+
+#define asm_clwb(addr)						\
+({								\
+	__asm__ __volatile__ (".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)(addr)));	\
+	/* PM_FLUSHOPT((addr), PM_CL_SIZE, sizeof(addr)); */	\
+})
+
+
+/* Cache-line write-back instructions; selected once by pcm_flush_init. */
+#define PCM_FLUSH_INSN_CLFLUSH      0
+#define PCM_FLUSH_INSN_CLFLUSHOPT   1
+#define PCM_FLUSH_INSN_CLWB         2
+#define PCM_FLUSH_INSN_NUM          3
+/* No write-back at all; selected by pcm_persist_domain_init on eADR. */
+#define PCM_FLUSH_INSN_NONE         PCM_FLUSH_INSN_NUM
+
+/* 
+ * Persistence domains; selected once by pcm_persist_domain_init.
+ *
+ * EMULATED: segments live in DRAM (tmpfs or a page-cached file); flushes 
+ *           only model the cost of real persistent memory.
+ * ADR:      segments are DAX mapped and the memory controller is in the
+ *           persistence domain; cache lines must be written back.
+ * EADR:     the CPU caches are in the persistence domain too; cache-line
+ *           write-backs are elided. Fences are kept since they also drain 
+ *           non-temporal stores out of the write-combining buffers.
+ */
+#define PCM_PERSIST_DOMAIN_EMULATED 0
+#define PCM_PERSIST_DOMAIN_ADR      1
+#define PCM_PERSIST_DOMAIN_EADR     2
+#define PCM_PERSIST_DOMAIN_NUM      3
+
+#ifndef MAP_SHARED_VALIDATE
+# define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+# define MAP_SYNC 0x80000
+#endif
+
+/* 
+ * Sharing flags for mapping persistent segments. On real persistent memory
+ * MAP_SYNC guarantees the file system metadata backing a DAX mapping is 
+ * durable before a write fault completes, so flushed data cannot be lost 
+ * to a later block allocation.
+ */
+#define pcm_persist_domain_map_flags()					\
+	((pcm_persist_domain == PCM_PERSIST_DOMAIN_EMULATED) ?		\
+	 MAP_SHARED : (MAP_SHARED_VALIDATE | MAP_SYNC))
+
+/* 
+ * Writes back the line holding addr using the best instruction the CPU 
+ * supports. The branch always goes the same way so it is predicted 
+ * perfectly after the first few flushes.
+ */
+#define asm_flush(addr)						\
+({								\
+	if (likely(pcm_flush_insn == PCM_FLUSH_INSN_CLWB)) {	\
+		asm_clwb(addr);					\
+	} else if (pcm_flush_insn == PCM_FLUSH_INSN_CLFLUSHOPT) {	\
+		asm_clflushopt(addr);				\
+	} else if (pcm_flush_insn == PCM_FLUSH_INSN_CLFLUSH) {	\
+		asm_clflush(addr);				\
+	}							\
+})
+
 // static inline void asm_mfence(void)
 #define asm_mfence()				\
 ({						\
@@ -283,6 +377,56 @@ static inline unsigned long long asm_rdtscp(void)
 })
 
 
+/* 
+ * Hooks into the runtime NVM emulator (see pcm_emulate.c). Without the 
+ * M_PCM_EMULATE_NVM build directive they compile to nothing.
+ */
+#ifdef M_PCM_EMULATE_NVM
+# define pcm_emulate_flush_hook()					\
+	({ if (unlikely(pcm_emulate_enabled)) pcm_emulate_flush(); })
+# define pcm_emulate_fence_hook()					\
+	({ if (unlikely(pcm_emulate_enabled)) pcm_emulate_fence(); })
+# define pcm_emulate_store_hook(nbytes)					\
+	({ if (unlikely(pcm_emulate_enabled)) pcm_emulate_pending_bytes += (nbytes); })
+#else
+# define pcm_emulate_flush_hook()        ((void) 0)
+# define pcm_emulate_fence_hook()        ((void) 0)
+# define pcm_emulate_store_hook(nbytes)  ((void) 0)
+#endif
+
+
+/* 
+ * Hooks into the crash emulation (see pcm.c). Each one is also a crash point.
+ * Without the M_PCM_EMULATE_CRASH build directive they compile to nothing.
+ */
+#ifdef M_PCM_EMULATE_CRASH
+# define pcm_crash_wb_store_hook(set, addr, val)				\
+	pcm_wb_store_emulate_crash(set, (volatile pcm_word_t *) (addr), (pcm_word_t) (val))
+# define pcm_crash_wb_flush_hook(set, addr)					\
+	pcm_wb_flush_emulate_crash(set, (volatile pcm_word_t *) (addr))
+# define pcm_crash_wb_fence_hook(set)						\
+	pcm_wb_fence_emulate_crash(set)
+# define pcm_crash_nt_store_hook(set, addr, val)				\
+	pcm_nt_store_emulate_crash(set, (volatile pcm_word_t *) (addr), (pcm_word_t) (val))
+# define pcm_crash_nt_store_64B_hook(set, addr, val)				\
+	({									\
+		int __w;							\
+		for (__w = 0; __w < CACHELINE_SIZE/sizeof(pcm_word_t); __w++) {	\
+			pcm_crash_nt_store_hook(set, &(addr)[__w], (val)[__w]);	\
+		}								\
+	})
+# define pcm_crash_nt_flush_hook(set)						\
+	pcm_nt_flush_emulate_crash(set)
+#else
+# define pcm_crash_wb_store_hook(set, addr, val)      ((void) 0)
+# define pcm_crash_wb_flush_hook(set, addr)           ((void) 0)
+# define pcm_crash_wb_fence_hook(set)                 ((void) 0)
+# define pcm_crash_nt_store_hook(set, addr, val)      ((void) 0)
+# define pcm_crash_nt_store_64B_hook(set, addr, val)  ((void) 0)
+# define pcm_crash_nt_flush_hook(set)                 ((void) 0)
+#endif
+
+
 static inline
 int rand_int(unsigned int *seed)
 {
@@ -395,37 +539,42 @@ emulate_latency_ns(int ns)
 )		
 
 #define PCM_WB_STORE_MASKED(set, addr, val, mask)				\
-		write_aligned_masked(addr, val, mask);				
+	({ pcm_crash_wb_store_hook(set, addr, val); write_aligned_masked(addr, val, mask); })
 
 #define PCM_WB_STORE_ALIGNED_MASKED(set, addr, val, mask)			\
 		PCM_WB_STORE_MASKED(set, addr, val, mask);
 
 #define PCM_WB_FENCE(set)							\
-	asm_mfence(); 
+	({ pcm_crash_wb_fence_hook(set); asm_mfence(); pcm_emulate_fence_hook(); })
 
 #define PCM_WB_FLUSH(set, addr)							\
-	asm_clflush(addr); 							\
+	({ pcm_crash_wb_flush_hook(set, addr); asm_flush(addr); pcm_emulate_flush_hook(); })
 
 #define PCM_NT_STORE(set, addr, val)						\
-	asm_movnti(addr, val);
+	({ pcm_crash_nt_store_hook(set, addr, val); asm_movnti(addr, val); 	\
+	   pcm_emulate_store_hook(sizeof(pcm_word_t)); })
 
 #define PCM_NT_FLUSH(set)							\
-	asm_sfence();
+	({ pcm_crash_nt_flush_hook(set); asm_sfence(); pcm_emulate_fence_hook(); })
 
 #define PCM_SEQSTREAM_STORE(set, addr, val)					\
-	asm_movnti(addr, val);
+	({ pcm_crash_nt_store_hook(set, addr, val); asm_movnti(addr, val);	\
+	   pcm_emulate_store_hook(sizeof(pcm_word_t)); })
 
 #define PCM_SEQSTREAM_STORE_64B_FIRST_WORD(set, addr, val)			\
-	asm_movnti(addr, val);
+	({ pcm_crash_nt_store_hook(set, addr, val); asm_movnti(addr, val);	\
+	   pcm_emulate_store_hook(sizeof(pcm_word_t)); })
 
 #define PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, addr, val)			\
-	asm_movnti(addr, val);
+	({ pcm_crash_nt_store_hook(set, addr, val); asm_movnti(addr, val);	\
+	   pcm_emulate_store_hook(sizeof(pcm_word_t)); })
 
 #define PCM_SEQSTREAM_STORE_64B(set, addr, val)					\
-	asm_sse_write_block64(addr, val);
+	({ pcm_crash_nt_store_64B_hook(set, addr, val); asm_sse_write_block64(addr, val); \
+	   pcm_emulate_store_hook(CACHELINE_SIZE); })
 
 #define PCM_SEQSTREAM_FLUSH(set)						\
-	asm_sfence();
+	({ pcm_crash_nt_flush_hook(set); asm_sfence(); pcm_emulate_fence_hook(); })
 
 #define PCM_SEQSTREAM_INIT(set) {;}
 
@@ -146,6 +146,9 @@ m_result_t m_logmgr_register_logtype(pcm_storeset_t *set, int type, m_log_ops_t
 m_result_t m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **log_dscp);
 m_result_t m_logmgr_free_log(m_log_dsc_t *log_dsc);
 m_result_t m_logmgr_do_recovery(pcm_storeset_t *set);
+m_result_t m_logmgr_recover_slot(pcm_storeset_t *set, int slot);
+void m_logmgr_lock(void);
+void m_logmgr_unlock(void);
 m_result_t m_logtrunc_truncate(pcm_storeset_t *set);
 void m_logmgr_stat_print();
 
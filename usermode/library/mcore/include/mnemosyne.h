@@ -50,6 +50,7 @@
 #define MNEMOSYNE_H_4EOVRWJH
 
 #include <sys/types.h>
+#include <stdint.h>
 
 /*!
  * Allows the declaration of a persistent global variable. A programmer making use
@@ -67,6 +68,9 @@
 # define PSEGMENT_RESERVED_REGION_SIZE    0x0000010000000000 /* 1 TB */
 #endif
 
+/*! Most processes that can share one segments_dir (see m_process_slot). */
+#define M_MAX_PROCESS_GROUP 16
+
 # ifdef __cplusplus
 extern "C" {
 # endif
@@ -88,12 +92,155 @@ extern "C" {
  */
 void mnemosyne_reincarnation_callback_register(void(*initializer)());
 
+/*!
+ * Like mnemosyne_reincarnation_callback_register, but the callback only waits
+ * for the segments it names rather than the whole persistent address space.
+ * Segments are reincarnated in parallel in the background, so such a 
+ * callback can start while unrelated segments are still being mapped.
+ * Persistent globals are always valid by the time any callback runs.
+ *
+ * \param initialize will be called once the segments are mapped.
+ * \param segments addresses, one within each segment the callback touches.
+ *  Addresses outside any existing segment are ignored. The array is copied.
+ * \param nsegments number of addresses; 0 means wait for all segments.
+ */
+void mnemosyne_reincarnation_callback_register_segments(void(*initializer)(), void *segments[], int nsegments);
+
 void *m_pmap(void *start, unsigned long long length, int prot, int flags);
 void *m_pmap2(void *start, unsigned long long  length, int prot, int flags);
 int  m_punmap(void *start, unsigned long long length);
 
+/*!
+ * Like m_pmap, but the segment is mapped elsewhere in the reserved region
+ * when its old address range is taken at reincarnation (e.g. by an ASLR 
+ * placed library), instead of failing. Absolute pointers into such a 
+ * segment do not survive a restart; store based pointers (m_pptr_t) in
+ * persistent memory instead.
+ */
+void *m_pmap_relocatable(void *start, unsigned long long length, int prot, int flags);
+
+/*!
+ * Like m_pmap, but extents of the segment (mcore.tier_extent_kb each) 
+ * that go unwritten for a while are moved out of persistent memory into
+ * a file in mcore.tier_dir, normally on an SSD, and back once accessed 
+ * again. The segment keeps its address range whichever tier an extent is
+ * in. Writes to cold extents are made durable with msync, which makes
+ * them much slower than writes to persistent memory. 
+ *
+ * Fails with ENOTSUP unless tier_dir is set and the heap has a single 
+ * process.
+ */
+void *m_pmap_tiered(void *start, unsigned long long length, int prot, int flags);
+
+/*!
+ * Brings the extents of a tiered segment covering [addr, addr+length) 
+ * back into persistent memory and keeps them there until unpinned. Pins
+ * do not survive a restart.
+ *
+ * \return 0 on success, or -1 with errno set; EINVAL if the range is not
+ *  within one tiered segment.
+ */
+int m_ptier_pin(void *addr, size_t length);
+int m_ptier_unpin(void *addr, size_t length);
+
+/*!
+ * Moves the unpinned extents of a tiered segment covering 
+ * [addr, addr+length) to tier_dir now.
+ */
+int m_ptier_demote(void *addr, size_t length);
+
+/*!
+ * Returns how much of the tiered segments is in tier_dir.
+ */
+size_t m_ptier_cold_bytes(void);
+
+/*!
+ * A based pointer: a segment and an offset within it, so it stays valid 
+ * wherever the segment is mapped. The segment is the upper bits (its 
+ * segment table index plus one) and the offset the lower 
+ * M_PPTR_OFFSET_BITS. The null based pointer is 0.
+ */
+typedef uint64_t m_pptr_t;
+
+#define M_PPTR_NULL          ((m_pptr_t) 0)
+#define M_PPTR_OFFSET_BITS   40
+#define M_PPTR_OFFSET_MASK   ((((m_pptr_t) 1) << M_PPTR_OFFSET_BITS) - 1)
+
+/*! 
+ * Where each segment is mapped in this process, by segment table index 
+ * plus one. Entry 0 is always NULL so that M_PPTR_NULL converts to NULL.
+ */
+extern void * volatile m_segment_base[];
+
+/*!
+ * Converts a persistent pointer to a based pointer. 
+ *
+ * \return M_PPTR_NULL for NULL or an address outside any segment.
+ */
+__attribute__((transaction_pure)) m_pptr_t m_pptr_make(void *addr);
+
+/*! Converts a based pointer back to a pointer. */
+__attribute__((transaction_pure)) static inline 
+void *
+m_pptr_get(m_pptr_t pptr)
+{
+	return (char *) m_segment_base[pptr >> M_PPTR_OFFSET_BITS] + (pptr & M_PPTR_OFFSET_MASK);
+}
+
+/*! 
+ * Converts a pointer known to be in the same segment as near, without 
+ * looking the segment up.
+ */
+__attribute__((transaction_pure)) static inline 
+m_pptr_t
+m_pptr_make_near(m_pptr_t near, void *addr)
+{
+	m_pptr_t segment = near & ~M_PPTR_OFFSET_MASK;
+
+	if (!addr) {
+		return M_PPTR_NULL;
+	}
+	return segment | (m_pptr_t) ((char *) addr - (char *) m_segment_base[segment >> M_PPTR_OFFSET_BITS]);
+}
+
 void mnemosyne_init_global(void);
 
+/*!
+ * Process groups. With max_processes > 1 in the configuration, up to that
+ * many processes may use the same segments_dir at once. They see the same
+ * persistent globals and segments at the same addresses, so persistent 
+ * pointers are valid in all of them. Each process gets a slot with its own
+ * log pool and pmalloc arena; memory allocated by one process may be freed
+ * by any other. The logs of a process that crashed are recovered by the 
+ * next process to take the group lock or its slot, whichever comes first;
+ * a process that takes over a slot holds the group lock until the logs 
+ * left in it are recovered.
+ *
+ * Durability transactions are isolated only from the other threads of the
+ * same process. Data updated by several processes must be partitioned
+ * among them or guarded with m_group_lock.
+ *
+ * \return the slot of this process, from 0 to m_process_group_size()-1.
+ */
+int  m_process_slot(void);
+int  m_process_group_size(void);
+
+/*!
+ * Takes or releases the lock that serializes the processes of the group.
+ * It is recursive and is held by the runtime while it creates or destroys
+ * segments. Does nothing for a single process.
+ */
+void m_group_lock(void);
+void m_group_unlock(void);
+
+/*!
+ * Maps the segments other processes of the group created with m_pmap since
+ * this process last looked, and unmaps those they destroyed. Call it before 
+ * following a persistent pointer into a segment another process may have 
+ * just created.
+ */
+void m_segment_sync(void);
+
 # ifdef __cplusplus
 }
 # endif
@@ -45,11 +45,15 @@
 /*! \see mnemosyne.h */
 void mnemosyne_reincarnation_callback_register(void(*initializer)());
 
+/*! \see mnemosyne.h */
+void mnemosyne_reincarnation_callback_register_segments(void(*initializer)(), void *segments[], int nsegments);
+
 /*!
  * Runs all currently-registered callbacks given by clients of the mnemosyne library.
  * These callbacks will execute under the assumption that persistent memory has been
  * mapped for all global objects and that dynamically-allocated persistent segments
- * have been re-mapped.
+ * have been re-mapped, or at least the segments the callback declared it needs.
+ * Waits for background segment mapping as needed.
  */
 void mnemosyne_reincarnation_callback_execute_all();
 
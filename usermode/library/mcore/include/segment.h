@@ -65,10 +65,17 @@
 #define SGTB_TYPE_SECTION             0x2    /* a segment of a .persistent section */
 #define SGTB_VALID_ENTRY              0x4
 #define SGTB_VALID_DATA               0x8
+#define SGTB_HUGETLB_2M               0x10   /* backing store lives on hugetlbfs with 2M pages */
+#define SGTB_HUGETLB_1G               0x20   /* backing store lives on hugetlbfs with 1G pages */
+#define SGTB_HUGETLB_MASK             (SGTB_HUGETLB_2M | SGTB_HUGETLB_1G)
+#define SGTB_RELOCATABLE              0x40   /* may be mapped elsewhere if its range is taken (see m_pmap_relocatable) */
+#define SGTB_TIERED                   0x80   /* cold extents may live in tier_dir (see m_pmap_tiered) */
 
 typedef struct m_segtbl_entry_s m_segtbl_entry_t;
 typedef struct m_segidx_entry_s m_segidx_entry_t;
 typedef struct m_segidx_s       m_segidx_t;
+typedef struct m_segidx_range_s m_segidx_range_t;
+typedef struct m_segidx_array_s m_segidx_array_t;
 typedef struct m_segtbl_s       m_segtbl_t;
 
 /** Persistent segment table index entry. */
@@ -80,12 +87,37 @@ struct m_segidx_entry_s {
 };
 
 
+/** Address range of a mapped segment as cached by the sorted index. */
+struct m_segidx_range_s {
+	uintptr_t        start;          /**< first byte of the segment */
+	uintptr_t        end;            /**< one past the last byte of the segment */
+	m_segidx_entry_t *entry;         /**< the segment index entry */
+};
+
+
+/** 
+ * Immutable snapshot of the mapped segments ordered by start address.
+ *
+ * Writers build a new snapshot under the index mutex and publish it with a 
+ * single pointer store; readers binary search whatever snapshot they find
+ * without taking the mutex. A replaced snapshot is freed only after all 
+ * readers that could have seen it are gone (see segidx_synchronize).
+ */
+struct m_segidx_array_s {
+	int              nranges;
+	m_segidx_range_t ranges[];
+};
+
+
 /* Persistent segment table index. */
 struct m_segidx_s {
 	pthread_mutex_t  mutex;          /**< synchronizes access to the index */
 	m_segidx_entry_t *all_entries;   /**< all the segment index entries */
 	m_segidx_entry_t mapped_entries; /**< the head of the mapped segments list; we keep this list ordered by start address; no overlaps allowed */
 	m_segidx_entry_t free_entries;   /**< the head of the free segments list */
+	m_segidx_array_t * volatile sorted; /**< snapshot used by lock-free address lookups */
+	volatile unsigned int rcu_epoch; /**< selects the reader counter new readers register with */
+	volatile unsigned int rcu_readers[2] __attribute__((aligned(64))); /**< readers currently inside a lookup, per epoch */
 };
 
 
@@ -109,8 +141,15 @@ extern m_segtbl_t m_segtbl;
 
 m_result_t m_segmentmgr_init();
 m_result_t m_segmentmgr_fini();
+void m_segmentmgr_reincarnation_finish();
+
+int m_segment_is_reincarnated(void *addr);
+int m_segment_reincarnation_done();
+void m_segment_reincarnation_wait_progress(int *seen);
 
 void *m_pmap2(void *start, unsigned long long length, int prot, int flags);
+int m_punmap(void *start, unsigned long long length);
+void m_segment_sync(void);
 m_result_t m_segment_find_using_addr(void *addr, m_segidx_entry_t **entryp);
 
 #endif /* _MNEMOSYNE_SEGMENT_H */
@@ -0,0 +1,115 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Point-in-time snapshots of the persistent segments.
+ *
+ * Whatever makes committed data durable (writing a commit record, writing
+ * the data back, truncating the log) passes through the snapshot gate.
+ * A snapshot closes the gate, waits for everyone inside to leave and then
+ * copies the segments; nobody is in the middle of a commit, so the copy
+ * holds exactly the transactions that committed before the gate closed.
+ * Uncommitted log records may be copied half written; recovery skips them
+ * the same way it skips them after a crash.
+ *
+ * The gate counts writers in per-thread slots so that taking it costs a
+ * commit one uncontended atomic operation.
+ */
+#ifndef SNAPSHOT_H_K3V8QWZA
+#define SNAPSHOT_H_K3V8QWZA
+
+#include <stdint.h>
+#include <result.h>
+
+#define M_SNAPSHOT_GATE_SLOTS 64
+
+typedef struct m_snapshot_gate_slot_s m_snapshot_gate_slot_t;
+
+struct m_snapshot_gate_slot_s {
+	volatile uint32_t writers;
+	char              pad[60];
+} __attribute__((aligned(64)));
+
+extern m_snapshot_gate_slot_t m_snapshot_gate[M_SNAPSHOT_GATE_SLOTS];
+extern volatile uint32_t      m_snapshot_closed;
+extern __thread int           m_snapshot_slot;
+
+int  m_snapshot_slot_assign(void);
+void m_snapshot_gate_wait(void);
+void m_snapshot_freeze(void);
+void m_snapshot_thaw(void);
+int  m_segment_snapshot(const char *dir, uint64_t sqn);
+
+
+static inline
+volatile uint32_t *
+m_snapshot_writers(void)
+{
+	int slot = m_snapshot_slot;
+
+	if (slot == 0) {
+		slot = m_snapshot_slot_assign();
+	}
+	return &m_snapshot_gate[slot - 1].writers;
+}
+
+
+/**
+ * \brief Enters the gate; waits while a snapshot is being taken.
+ */
+static inline
+void
+m_snapshot_gate_enter(void)
+{
+	volatile uint32_t *writers = m_snapshot_writers();
+
+	while (1) {
+		/* Full barrier: the snapshot either sees us or we see it closed */
+		__sync_fetch_and_add(writers, 1);
+		if (!m_snapshot_closed) {
+			return;
+		}
+		__sync_fetch_and_sub(writers, 1);
+		m_snapshot_gate_wait();
+	}
+}
+
+
+static inline
+void
+m_snapshot_gate_exit(void)
+{
+	__sync_fetch_and_sub(m_snapshot_writers(), 1);
+}
+
+#endif /* end of include guard: SNAPSHOT_H_K3V8QWZA */
@@ -0,0 +1,123 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Tiered segments: pmap segments whose cold extents are moved out of 
+ * persistent memory into a file on slower storage (mcore.tier_dir), 
+ * usually an SSD.
+ *
+ * A tiered segment stays one mapping of fixed-size extents. Each extent 
+ * is mapped either from the segment's backing store (hot) or from the 
+ * same offset of its cold file (cold), so the address space does not 
+ * change when an extent moves. Accesses to a cold extent go through the
+ * page cache of the cold file; the kernel faults its pages back in on
+ * demand.
+ *
+ * Stores to a cold extent reach the cold file only through msync, so 
+ * whatever writes back persistent lines (see mtm_dirtyset_flush) hands 
+ * them to m_tier_flush_lines first. The logs live in persistent memory 
+ * as before and cover both tiers until that write-back is done.
+ *
+ * Extents move under m_snapshot_freeze, while nobody commits, and are 
+ * read-only while they are copied: a plain store to one (before an 
+ * m_persist_new, say) faults and is retried once the extent is mapped
+ * from its new tier. Stores by the kernel, as in read(2), fail with 
+ * EFAULT instead. Hot extents count as written when a transaction or
+ * m_persist_new writes them back. The cold 
+ * file ends with the extent size and a byte per extent telling whether
+ * the extent lives there; it is synced before the mappings change, so a
+ * crash at any point finds each extent in the tier the byte names, with 
+ * the same contents in both tiers while the move was in progress.
+ */
+#ifndef TIER_H_R7N2XKQD
+#define TIER_H_R7N2XKQD
+
+#include <stddef.h>
+#include <stdint.h>
+#include <result.h>
+
+#define M_TIER_MAX_SEGMENTS 64
+
+/* Extent states */
+#define M_TIER_HOT          0x0
+#define M_TIER_COLD         0x1
+#define M_TIER_PINNED       0x2   /* volatile only: never demoted */
+#define M_TIER_MOVING       0x4   /* volatile only: read-only while copied */
+
+typedef struct m_tier_segment_s m_tier_segment_t;
+
+struct m_tier_segment_s {
+	uintptr_t         start;
+	uintptr_t         end;
+	size_t            extent_size;
+	int               extent_shift;
+	int               nextents;
+	int               prot;
+	int               pm_fd;       /**< backing store */
+	int               cold_fd;     /**< cold file in tier_dir */
+	uint32_t          index;       /**< segment table index */
+	volatile uint8_t  *state;      /**< M_TIER_* per extent */
+	volatile uint32_t *last_write; /**< scan in which an extent was last written */
+};
+
+extern m_tier_segment_t  *m_tier_segments[M_TIER_MAX_SEGMENTS];
+extern volatile int      m_tier_nsegments;
+extern volatile uint32_t m_tier_scan;
+
+m_result_t m_tiermgr_init(void);
+m_result_t m_tiermgr_fini(void);
+size_t m_tier_extent_size(void);
+int  m_tier_attach(uint32_t index, uintptr_t start, size_t size, int prot, const char *pm_path, int create);
+void m_tier_detach(uint32_t index);
+void m_tier_cold_path(char *path, uint32_t index);
+int  m_tier_flush_lines(uintptr_t *lines, int n);
+int  m_tier_writeback(uintptr_t addr);
+
+
+static inline
+m_tier_segment_t *
+m_tier_find(uintptr_t addr)
+{
+	m_tier_segment_t *seg;
+	int              i;
+
+	for (i = 0; i < M_TIER_MAX_SEGMENTS; i++) {
+		seg = m_tier_segments[i];
+		if (seg && addr >= seg->start && addr < seg->end) {
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+#endif /* end of include guard: TIER_H_R7N2XKQD */
@@ -38,7 +38,12 @@
  */
 #include "files.h"
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <linux/fs.h>
 
 
 void 
@@ -76,3 +81,74 @@ path2file(char *path, char **file)
 	}
 	return M_R_FAILURE;
 }
+
+
+int
+file_copy_fd(int sfd, int dfd, off_t size)
+{
+	char    buf[65536];
+	ssize_t n;
+	ssize_t w;
+	ssize_t m;
+
+#ifdef FICLONE
+	if (ioctl(dfd, FICLONE, sfd) == 0) {
+		return 0;
+	}
+#endif
+	/* Lets the file system share or offload the copy where it can */
+	while ((n = copy_file_range(sfd, NULL, dfd, NULL, size, 0)) > 0) {
+		;
+	}
+	if (n == 0 && lseek(dfd, 0, SEEK_CUR) == size) {
+		return 0;
+	}
+	if (lseek(sfd, 0, SEEK_SET) < 0 || lseek(dfd, 0, SEEK_SET) < 0) {
+		return -1;
+	}
+	while ((n = read(sfd, buf, sizeof(buf))) > 0) {
+		for (w = 0; w < n; w += m) {
+			if ((m = write(dfd, buf + w, n - w)) < 0) {
+				return -1;
+			}
+		}
+	}
+	return (n < 0) ? -1 : 0;
+}
+
+
+int
+file_clone(const char *src, const char *dst)
+{
+	int         sfd;
+	int         dfd;
+	struct stat st;
+	int         saved_errno;
+
+	if ((sfd = open(src, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if ((dfd = open(dst, O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR)) < 0) {
+		goto err_src;
+	}
+	if (fstat(sfd, &st) < 0 || file_copy_fd(sfd, dfd, st.st_size) < 0 || 
+	    fsync(dfd) < 0) 
+	{
+		goto err;
+	}
+	close(dfd);
+	close(sfd);
+	return 0;
+err:
+	saved_errno = errno;
+	close(dfd);
+	unlink(dst);
+	close(sfd);
+	errno = saved_errno;
+	return -1;
+err_src:
+	saved_errno = errno;
+	close(sfd);
+	errno = saved_errno;
+	return -1;
+}
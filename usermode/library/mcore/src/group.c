@@ -0,0 +1,284 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Implements process groups (see group.h).
+ *
+ * With max_processes = 1 (the default) there is no group: the process is
+ * slot 0 and the group lock is a no-op.
+ */
+
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <debug.h>
+#include <pm_instr.h>
+#include "hal/pcm_i.h"
+#include "log/log_i.h"
+#include "files.h"
+#include "group.h"
+#include "config.h"
+
+/** The group size segments_dir was created with; 0 for a single process. */
+__attribute__ ((section("PERSISTENT"))) pcm_word_t group_nprocs = 0;
+
+static int             group_size = 1;
+static int             group_slot = 0;
+static char            group_dir[256];
+static int             group_lock_fd = -1;
+static int             group_slot_fd = -1;
+static pthread_mutex_t group_mutex;
+static int             group_depth = 0;
+
+
+static
+int
+slot_open(int slot)
+{
+	char path[256+16];
+
+	snprintf(path, sizeof(path), "%s/slot.%d", group_dir, slot);
+	return open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+}
+
+
+/**
+ * \brief Claims the first free slot of the group and returns with the 
+ * group lock held.
+ *
+ * The slot is claimed under the group lock so that no other process takes
+ * the lock, and finds the slot in use, before we recover the logs of the
+ * slot's previous process (see m_group_lock).
+ *
+ * The lock files live in <segments_dir>.group rather than in segments_dir
+ * so that reset_segments cannot remove them from under running processes.
+ */
+void
+m_group_init(void)
+{
+	pthread_mutexattr_t attr;
+	char                path[256+16];
+	size_t              len;
+	int                 fd;
+	int                 i;
+
+	if (mcore_runtime_settings.max_processes <= 1) {
+		return;
+	}
+	group_size = mcore_runtime_settings.max_processes;
+	snprintf(group_dir, sizeof(group_dir) - 8, "%s", mcore_runtime_settings.segments_dir);
+	len = strlen(group_dir);
+	while (len > 1 && group_dir[len-1] == '/') {
+		group_dir[--len] = '\0';
+	}
+	strcat(group_dir, ".group");
+	mkdir_r(group_dir, S_IRWXU);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&group_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	snprintf(path, sizeof(path), "%s/lock", group_dir);
+	if ((group_lock_fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+		M_INTERNALERROR("Cannot open group lock %s.\n", path);
+	}
+	m_group_lock();
+	for (i=0; i<group_size; i++) {
+		if ((fd = slot_open(i)) < 0) {
+			M_INTERNALERROR("Cannot open slot %d of group %s.\n", i, group_dir);
+		}
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			group_slot = i;
+			group_slot_fd = fd;
+			break;
+		}
+		close(fd);
+	}
+	if (group_slot_fd < 0) {
+		M_ERROR("All %d process slots of %s are taken.\n", group_size, 
+		        mcore_runtime_settings.segments_dir);
+	}
+	M_WARNING("Process slot %d of %d\n", group_slot, group_size);
+}
+
+
+void
+m_group_fini(void)
+{
+	if (group_slot_fd >= 0) {
+		close(group_slot_fd);
+		group_slot_fd = -1;
+	}
+}
+
+
+/**
+ * \brief Checks that segments_dir is used with the group size it was 
+ * created with.
+ *
+ * Log pools and arenas are laid out per slot, so the group size cannot 
+ * change once they exist. Called once the .persistent sections are mapped.
+ */
+void
+m_group_check_size(void)
+{
+	pcm_word_t nprocs = (group_size > 1) ? group_size : 0;
+
+	if (group_nprocs == nprocs) {
+		return;
+	}
+	if (group_nprocs == 0 && nprocs) {
+		PM_EQU(group_nprocs, nprocs); /* PCM STORE */
+		PCM_WB_FLUSH(NULL, &group_nprocs);
+		PCM_WB_FENCE(NULL);
+		return;
+	}
+	M_ERROR("%s was created for %d processes but max_processes is %d.\n",
+	        mcore_runtime_settings.segments_dir, 
+	        group_nprocs ? (int) group_nprocs : 1, group_size);
+}
+
+
+/**
+ * \brief Returns whether no other process of the group is running.
+ */
+int
+m_group_alone(void)
+{
+	int fd;
+	int i;
+	int alone = 1;
+
+	for (i=0; i<group_size && alone; i++) {
+		if (i == group_slot) {
+			continue;
+		}
+		if ((fd = slot_open(i)) < 0) {
+			continue;
+		}
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			flock(fd, LOCK_UN);
+		} else {
+			alone = 0;
+		}
+		close(fd);
+	}
+	return alone;
+}
+
+
+int
+m_process_slot(void)
+{
+	return group_slot;
+}
+
+
+int
+m_process_group_size(void)
+{
+	return group_size;
+}
+
+
+/**
+ * \brief Recovers the logs of the slots whose process died.
+ *
+ * A slot whose lock we can take has no process. Holding its lock keeps 
+ * new processes off it while its logs are replayed.
+ */
+static
+void
+recover_dead_slots(void)
+{
+	int fd;
+	int i;
+
+	for (i=0; i<group_size; i++) {
+		if (i == group_slot) {
+			continue;
+		}
+		if ((fd = slot_open(i)) < 0) {
+			continue;
+		}
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			m_logmgr_recover_slot(pcm_storeset_get(), i);
+			flock(fd, LOCK_UN);
+		}
+		close(fd);
+	}
+}
+
+
+/**
+ * \brief Takes the lock that serializes the processes of the group.
+ *
+ * Recursive within a process. The runtime holds it while it creates or
+ * destroys segments; applications may use it to guard updates to data the
+ * processes share.
+ *
+ * Whoever takes the lock first after a process died replays that 
+ * process's logs, so they cannot overwrite updates made after the crash
+ * under the lock.
+ */
+void
+m_group_lock(void)
+{
+	if (group_size == 1) {
+		return;
+	}
+	pthread_mutex_lock(&group_mutex);
+	if (group_depth++ == 0) {
+		while (flock(group_lock_fd, LOCK_EX) < 0 && errno == EINTR);
+		recover_dead_slots();
+	}
+}
+
+
+void
+m_group_unlock(void)
+{
+	if (group_size == 1) {
+		return;
+	}
+	if (--group_depth == 0) {
+		flock(group_lock_fd, LOCK_UN);
+	}
+	pthread_mutex_unlock(&group_mutex);
+}
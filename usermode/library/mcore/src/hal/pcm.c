@@ -32,6 +32,15 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include <mmintrin.h>
 #include <list.h>
@@ -106,9 +115,25 @@ pcm_storeset_list_t pcm_storeset_list = { 0,
 
 #define NO_PARTIAL_CRASH {{0,0,0,0,0,0,0,0,1000000}}
 
+/* Any number of words, including none or all, is equally likely. */
+#define UNIFORM_PARTIAL_CRASH {{111111,111111,111111,111111,111111,111111,111111,111111,111112}}
+
 cacheline_crash_cdf_t cacheline_crash_cdf = NO_PARTIAL_CRASH;
 
 
+/* 
+ * Crash injection. Every store, write-back, fence and write-combining drain 
+ * that goes through the crash emulation hooks is a crash point. Crash points
+ * are numbered from 1 in the order the process passes them; the process 
+ * crashes when it reaches the target one.
+ */
+static struct {
+	uint64_t          target;     /* 0 never crashes */
+	unsigned int      seed;       /* seeds eviction and torn line outcomes */
+	volatile uint64_t count;      /* crash points passed so far */
+} pcm_crash = { 0, 0, 0 };
+
+
 /* Likelihood a store will block wait. */
 unsigned int pcm_likelihood_store_blockwaits = 1000;  
 
@@ -117,10 +142,218 @@ unsigned int pcm_likelihood_evicted_cacheline = 10000;
 
 volatile arch_spinlock_t ticket_lock = {0};
 
+/* Cache-line write-back instruction used by PCM_WB_FLUSH. */
+int pcm_flush_insn = PCM_FLUSH_INSN_CLFLUSH;
+
+static const char *pcm_flush_insn_names[PCM_FLUSH_INSN_NUM] = {
+	"clflush",
+	"clflushopt",
+	"clwb"
+};
+
 
 __thread pcm_storeset_t* _thread_pcm_storeset;
 
 
+/* Persistence domain of the persistent segments. */
+int pcm_persist_domain = PCM_PERSIST_DOMAIN_EMULATED;
+
+static const char *pcm_persist_domain_names[PCM_PERSIST_DOMAIN_NUM] = {
+	"emulated",
+	"adr",
+	"eadr"
+};
+
+
+const char *
+pcm_flush_insn_name(int insn)
+{
+	if (insn == PCM_FLUSH_INSN_NONE) {
+		return "none";
+	}
+	if (insn < 0 || insn >= PCM_FLUSH_INSN_NUM) {
+		return "unknown";
+	}
+	return pcm_flush_insn_names[insn];
+}
+
+
+const char *
+pcm_persist_domain_name(int domain)
+{
+	if (domain < 0 || domain >= PCM_PERSIST_DOMAIN_NUM) {
+		return "unknown";
+	}
+	return pcm_persist_domain_names[domain];
+}
+
+
+/**
+ * \brief Returns non-zero if the CPU implements the given write-back 
+ * instruction, as reported by CPUID leaf 7 (EBX bit 23 for CLFLUSHOPT, 
+ * bit 24 for CLWB).
+ */
+int
+pcm_flush_insn_supported(int insn)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	switch (insn) {
+		case PCM_FLUSH_INSN_CLFLUSH:
+			return 1;
+		case PCM_FLUSH_INSN_CLFLUSHOPT:
+		case PCM_FLUSH_INSN_CLWB:
+			if (__get_cpuid_max(0, NULL) < 7) {
+				return 0;
+			}
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			if (insn == PCM_FLUSH_INSN_CLFLUSHOPT) {
+				return (ebx >> 23) & 1;
+			}
+			return (ebx >> 24) & 1;
+		default:
+			return 0;
+	}
+}
+
+
+/**
+ * \brief Selects the write-back instruction used by PCM_WB_FLUSH.
+ *
+ * With "auto" (or NULL) we prefer CLWB, which leaves the line in the cache,
+ * then CLFLUSHOPT, then CLFLUSH. An explicitly requested instruction the CPU
+ * does not implement falls back to CLFLUSH.
+ */
+void
+pcm_flush_init(const char *flush_insn)
+{
+	int insn;
+
+	if (flush_insn == NULL || strcmp(flush_insn, "auto") == 0) {
+		if (pcm_flush_insn_supported(PCM_FLUSH_INSN_CLWB)) {
+			pcm_flush_insn = PCM_FLUSH_INSN_CLWB;
+		} else if (pcm_flush_insn_supported(PCM_FLUSH_INSN_CLFLUSHOPT)) {
+			pcm_flush_insn = PCM_FLUSH_INSN_CLFLUSHOPT;
+		} else {
+			pcm_flush_insn = PCM_FLUSH_INSN_CLFLUSH;
+		}
+		return;
+	}
+	for (insn = 0; insn < PCM_FLUSH_INSN_NUM; insn++) {
+		if (strcmp(flush_insn, pcm_flush_insn_names[insn]) == 0) {
+			break;
+		}
+	}
+	if (insn < PCM_FLUSH_INSN_NUM && pcm_flush_insn_supported(insn)) {
+		pcm_flush_insn = insn;
+	} else {
+		pcm_flush_insn = PCM_FLUSH_INSN_CLFLUSH;
+	}
+}
+
+
+/**
+ * \brief Returns non-zero if files in dir can be mapped with MAP_SYNC, 
+ * i.e. dir is on a DAX file system backed by persistent memory.
+ */
+static
+int
+persist_domain_probe_dax(const char *dir)
+{
+	char path[256];
+	int  fd;
+	void *addr;
+	int  dax = 0;
+
+	snprintf(path, sizeof(path), "%s/.map_sync_probe.%d", dir, (int) getpid());
+	if ((fd = open(path, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0) {
+		return 0;
+	}
+	if (ftruncate(fd, 4096) == 0) {
+		addr = mmap(NULL, 4096, PROT_READ|PROT_WRITE, 
+		            MAP_SHARED_VALIDATE|MAP_SYNC, fd, 0);
+		if (addr != MAP_FAILED) {
+			dax = 1;
+			munmap(addr, 4096);
+		}
+	}
+	close(fd);
+	unlink(path);
+	return dax;
+}
+
+
+/**
+ * \brief Returns non-zero if every NVDIMM region reports the CPU cache as 
+ * its persistence domain (ACPI NFIT platform capabilities, as exported by
+ * the Linux libnvdimm driver).
+ */
+static
+int
+persist_domain_probe_eadr()
+{
+	glob_t gl;
+	FILE   *fp;
+	char   buf[64];
+	size_t i;
+	int    eadr;
+
+	if (glob("/sys/bus/nd/devices/region*/persistence_domain", 0, NULL, &gl) != 0) {
+		return 0;
+	}
+	eadr = (gl.gl_pathc > 0);
+	for (i = 0; i < gl.gl_pathc && eadr; i++) {
+		if (!(fp = fopen(gl.gl_pathv[i], "r"))) {
+			eadr = 0;
+			break;
+		}
+		if (!fgets(buf, sizeof(buf), fp) || strncmp(buf, "cpu_cache", 9) != 0) {
+			eadr = 0;
+		}
+		fclose(fp);
+	}
+	globfree(&gl);
+	return eadr;
+}
+
+
+/**
+ * \brief Selects the persistence domain, which decides how segments are 
+ * mapped and whether PCM_WB_FLUSH writes anything back.
+ *
+ * With "auto" (or NULL) we probe dir, the directory holding the segment 
+ * backing stores: if it is not on a DAX file system we are emulating 
+ * persistent memory on DRAM; otherwise the NVDIMM regions tell ADR from 
+ * eADR. Must run after pcm_flush_init.
+ */
+void
+pcm_persist_domain_init(const char *domain, const char *dir)
+{
+	int d;
+
+	if (domain == NULL || strcmp(domain, "auto") == 0) {
+		if (!persist_domain_probe_dax(dir)) {
+			pcm_persist_domain = PCM_PERSIST_DOMAIN_EMULATED;
+		} else if (persist_domain_probe_eadr()) {
+			pcm_persist_domain = PCM_PERSIST_DOMAIN_EADR;
+		} else {
+			pcm_persist_domain = PCM_PERSIST_DOMAIN_ADR;
+		}
+	} else {
+		pcm_persist_domain = PCM_PERSIST_DOMAIN_EMULATED;
+		for (d = 0; d < PCM_PERSIST_DOMAIN_NUM; d++) {
+			if (strcmp(domain, pcm_persist_domain_names[d]) == 0) {
+				pcm_persist_domain = d;
+				break;
+			}
+		}
+	}
+	if (pcm_persist_domain == PCM_PERSIST_DOMAIN_EADR) {
+		pcm_flush_insn = PCM_FLUSH_INSN_NONE;
+	}
+}
+
+
 static inline
 cacheline_t *
 cacheline_alloc()
@@ -203,6 +436,44 @@ pcm_storeset_put(void)
 }
 
 
+/**
+ * \brief Configures crash injection.
+ *
+ * \param point the crash point to crash at; 0 never crashes.
+ * \param seed seeds which lines are evicted and how flushes tear.
+ * \param evict_likelihood likelihood out of TOTAL_OUTCOMES_NUM that an 
+ *  unflushed cacheline was evicted, and thus persisted, before the crash.
+ * \param torn_cdf "none" or "uniform"; the CDF of how much of a cacheline
+ *  being written back when the crash hits reaches memory.
+ */
+void
+pcm_crash_init(uint64_t point, unsigned int seed, int evict_likelihood, const char *torn_cdf)
+{
+	cacheline_crash_cdf_t uniform = UNIFORM_PARTIAL_CRASH;
+	cacheline_crash_cdf_t none = NO_PARTIAL_CRASH;
+
+	pcm_crash.target = point;
+	pcm_crash.seed = seed;
+	pcm_crash.count = 0;
+	pcm_likelihood_evicted_cacheline = evict_likelihood;
+	if (torn_cdf && strcmp(torn_cdf, "uniform") == 0) {
+		cacheline_crash_cdf = uniform;
+	} else {
+		cacheline_crash_cdf = none;
+	}
+}
+
+
+/**
+ * \brief Returns the number of crash points the process has passed.
+ */
+uint64_t
+pcm_crash_point_count(void)
+{
+	return pcm_crash.count;
+}
+
+
 
 void 
 pcm_check_crash(pcm_storeset_t *set)
@@ -226,6 +497,18 @@ pcm_check_crash(pcm_storeset_t *set)
 }
 
 
+/* 
+ * rand_int returns a signed value whose low bits cycle quickly; use the high
+ * bits so that outcomes fall in [0, TOTAL_OUTCOMES_NUM).
+ */
+static inline
+int
+crash_random_outcome(pcm_storeset_t *set)
+{
+	return ((unsigned int) rand_int(&set->rand_seed) >> 8) % TOTAL_OUTCOMES_NUM;
+}
+
+
 static inline
 void
 crash_save_oldvalue(pcm_storeset_t *set, volatile pcm_word_t *addr)
@@ -323,10 +606,10 @@ flush_cacheline:
 	 * that has been successfully flushed.
 	 */
 	if (pcm_storeset_list.outstanding_crash && allow_partial_crash) {
-		random_number = rand_int(&set->rand_seed) % TOTAL_OUTCOMES_NUM;
+		random_number = crash_random_outcome(set);
 		for (i=0, sum=0; i<CACHELINE_SIZE/sizeof(pcm_word_t)+1; i++) {
 			sum += cacheline_crash_cdf.word[i];
-			if (random_number <= sum) {
+			if (random_number < sum) {
 				successfully_flushed_words_num = i;
 				break;
 			}
@@ -358,6 +641,30 @@ flush_cacheline:
 }
 
 
+/*
+ * Collects the addresses of the outstanding cachelines of a store set, as 
+ * flushing a line removes it from the hash table we iterate over.
+ */
+static inline
+int
+crash_outstanding_cachelines(pcm_storeset_t *set, uintptr_t **linesp)
+{
+	int       i;
+	int       count;
+	uintptr_t *lines;
+
+	lines = (uintptr_t *) malloc(sizeof(uintptr_t) * (set->hashtbl->size + 1));
+	for(i = 0, count=0; i < set->hashtbl->size; i++) {
+		PointerHashRecord *r = PointerHashRecords_recordAt_(set->hashtbl->records, i);
+		if (r->k) {
+			lines[count++] = (uintptr_t) r->k;
+		}
+	}
+	*linesp = lines;
+	return count;
+}
+
+
 /*
  * Either flush all cachelines, or randomly flush some based on a given
  * probability distribution.
@@ -369,32 +676,21 @@ crash_flush_cachelines(pcm_storeset_t *set, int all, int likelihood_flush_cachel
 	int                 i;
 	int                 count;
 	int                 random_number;
-	int                 do_flush;
-	PointerHashRecord   *ra[1024];
+	uintptr_t           *lines;
 
 	assert(set->in_crash_emulation_code);
 
-	for(i = 0, count=0, do_flush=0; i < set->hashtbl->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(set->hashtbl->records, i);
-		if (r->k) {
-			if (!all) {
-				random_number = rand_int(&set->rand_seed) % TOTAL_OUTCOMES_NUM;
-				if (random_number < likelihood_flush_cacheline) {
-					do_flush = 1;
-				} else {
-					do_flush = 0;
-				}
+	count = crash_outstanding_cachelines(set, &lines);
+	for(i = 0; i < count; i++) {
+		if (!all) {
+			random_number = crash_random_outcome(set);
+			if (random_number >= likelihood_flush_cacheline) {
+				continue;
 			}
-			if (all || (!all && do_flush)) {
-				assert(count < 1024);
-				ra[count++] = r;
-			}	
 		}
-	}
-
-	for(i = 0; i < count; i++) {
-		crash_flush_cacheline(set, (pcm_word_t *) ra[i]->k, 0);
+		crash_flush_cacheline(set, (pcm_word_t *) lines[i], 0);
 	}	
+	free(lines);
 }
 
 
@@ -446,7 +742,7 @@ pcm_trigger_crash(pcm_storeset_t *set, int wait_storesets_halt)
 	 */
 	list_for_each_entry(set_iter, &pcm_storeset_list.list, list)		 
 	{
-		crash_flush_cachelines(set, 0, pcm_likelihood_evicted_cacheline);
+		crash_flush_cachelines(set_iter, 0, pcm_likelihood_evicted_cacheline);
 		crash_restore_unflushed_values(set_iter);
 	}
 	
@@ -467,30 +763,95 @@ nt_flush_buffers(pcm_storeset_t *set)
 {
 	int                 i;
 	int                 count;
-	PointerHashRecord   *ra[WRITE_COMBINING_BUFFERS_NUM];
+	uintptr_t           *lines;
 
 	assert(set->in_crash_emulation_code);
 
-	for(i = 0, count=0; i < set->hashtbl->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(set->hashtbl->records, i);
-		if (r->k) {
-			assert(count < WRITE_COMBINING_BUFFERS_NUM);
-			ra[count++] = r;
+	/* Write-back stores share the table, so there may be more lines than
+	 * write-combining buffers. */
+	count = crash_outstanding_cachelines(set, &lines);
+	for(i = 0; i < count; i++) {
+		crash_flush_cacheline(set, (pcm_word_t *) lines[i], 1);
+	}	
+	free(lines);
+}
+
+
+/*
+ * Crashes the process at a crash point: the write-back of flush_addr, or the
+ * drain of the write-combining buffers, that the crash interrupts reaches 
+ * memory only partially according to cacheline_crash_cdf; any other 
+ * unflushed line persists only if it was randomly evicted. The other store 
+ * sets are halted for good rather than released, and the process exits 
+ * without running any exit handlers so nothing else reaches the segments.
+ *
+ * Stores other threads issue while we restore can still slip through, so 
+ * crashes are exact only for single-threaded workloads.
+ */
+static
+void
+crash_now(pcm_storeset_t *set, volatile pcm_word_t *flush_addr, int drain_wcbufs)
+{
+	pcm_storeset_t *set_iter;
+	unsigned int   seed;
+
+	pthread_mutex_lock(&pcm_storeset_list.lock);
+	pcm_storeset_list.outstanding_crash = 1;
+	list_for_each_entry(set_iter, &pcm_storeset_list.list, list)
+	{
+		if (set_iter != set) {
+			while (set_iter->in_crash_emulation_code);
 		}
 	}
 
-	for(i = 0; i < count; i++) {
-		crash_flush_cacheline(set, (pcm_word_t *) ra[i]->k, 1);
-	}	
+	seed = pcm_crash.seed;
+	list_for_each_entry(set_iter, &pcm_storeset_list.list, list)
+	{
+		set_iter->in_crash_emulation_code = 1;
+		/* Spread nearby seeds apart */
+		set_iter->rand_seed = (seed++ + 1) * 2654435761U;
+		set_iter->rand_seed ^= set_iter->rand_seed >> 16;
+	}
+	if (flush_addr) {
+		crash_flush_cacheline(set, flush_addr, 1);
+	}
+	if (drain_wcbufs) {
+		nt_flush_buffers(set);
+	}
+	list_for_each_entry(set_iter, &pcm_storeset_list.list, list)
+	{
+		crash_flush_cachelines(set_iter, 0, pcm_likelihood_evicted_cacheline);
+		crash_restore_unflushed_values(set_iter);
+	}
+	_exit(PCM_CRASH_EXIT_STATUS);
 }
 
 
+static inline
 void
-pcm_wb_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_word_t val)
+crash_point(pcm_storeset_t *set, volatile pcm_word_t *flush_addr, int drain_wcbufs)
 {
-	if (!set) {
-		return;
+	if (__sync_add_and_fetch(&pcm_crash.count, 1) == pcm_crash.target) {
+		crash_now(set, flush_addr, drain_wcbufs);
 	}
+}
+
+
+/* Stores made outside a transaction (e.g. by the segment manager) have no
+ * store set of their own. */
+static inline
+pcm_storeset_t *
+crash_storeset(pcm_storeset_t *set)
+{
+	return set ? set : pcm_storeset_get();
+}
+
+
+void
+pcm_wb_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_word_t val)
+{
+	set = crash_storeset(set);
+	crash_point(set, NULL, 0);
 	pcm_check_crash(set);
 	set->in_crash_emulation_code = 1;
 	crash_save_oldvalue(set, addr);
@@ -501,6 +862,8 @@ pcm_wb_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_w
 void
 pcm_wb_flush_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr)
 {
+	set = crash_storeset(set);
+	crash_point(set, addr, 0);
 	set->in_crash_emulation_code = 1;
 	crash_flush_cacheline(set, addr, 1);
 	set->in_crash_emulation_code = 0;
@@ -518,6 +881,8 @@ pcm_nt_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_w
 	cacheline_t  *cacheline;
 	int          buffers_needed = 0;
 
+	set = crash_storeset(set);
+	crash_point(set, NULL, 0);
 	pcm_check_crash(set);
 	set->in_crash_emulation_code = 1;
 	byte_addr = (uintptr_t) addr;
@@ -549,8 +914,19 @@ pcm_nt_store_emulate_crash(pcm_storeset_t *set, volatile pcm_word_t *addr, pcm_w
 void
 pcm_nt_flush_emulate_crash(pcm_storeset_t *set)
 {
+	set = crash_storeset(set);
+	crash_point(set, NULL, 1);
 	pcm_check_crash(set);
 	set->in_crash_emulation_code = 1;
 	nt_flush_buffers(set);
 	set->in_crash_emulation_code = 0;
 }
+
+
+void
+pcm_wb_fence_emulate_crash(pcm_storeset_t *set)
+{
+	set = crash_storeset(set);
+	crash_point(set, NULL, 0);
+	pcm_check_crash(set);
+}
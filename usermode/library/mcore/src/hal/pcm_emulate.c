@@ -0,0 +1,211 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Runtime NVM performance emulator.
+ *
+ * Adds the latency and bandwidth of a slower persistent medium on top of
+ * the DRAM the segments actually live in. It is compiled into the PCM_*
+ * macros only with the M_PCM_EMULATE_NVM build directive, and even then 
+ * does nothing unless one of the mcore nvm_* settings is non-zero.
+ *
+ * The delay model:
+ *  - every cache-line write-back spins for nvm_flush_latency_ns, 
+ *  - every fence that has write-backs or non-temporal stores pending 
+ *    spins for nvm_fence_latency_ns, and
+ *  - the bytes drained by a fence are charged to a token bucket shared by
+ *    all threads that refills at nvm_write_bandwidth_mb; a fence waits 
+ *    until the bucket covers its bytes.
+ *
+ * Delays are measured in TSC cycles, with the TSC rate calibrated against
+ * CLOCK_MONOTONIC at startup instead of assuming a CPU frequency.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "pcm_i.h"
+
+/* Bytes the bandwidth bucket lets through before it starts throttling. */
+#define PCM_EMULATE_BURST_BYTES  (64*1024)
+
+/* How long to calibrate the TSC for. */
+#define PCM_EMULATE_CALIBRATION_NS  20000000ULL
+
+int                pcm_emulate_enabled = 0;
+double             pcm_emulate_cycles_per_ns = 0;
+__thread uint64_t  pcm_emulate_pending_bytes = 0;
+
+static struct {
+	uint64_t          flush_cycles;
+	uint64_t          fence_cycles;
+	uint64_t          cycles_per_kb;    /* bucket cost of 1024 bytes; 0 is unlimited */
+	uint64_t          burst_cycles;
+	volatile uint64_t next_free __attribute__((aligned(CACHELINE_SIZE))); /* when the medium is next idle */
+} pcm_emulate;
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static inline
+void
+spin_cycles(uint64_t cycles)
+{
+	uint64_t start = asm_rdtsc();
+
+	while (asm_rdtsc() - start < cycles) {
+		__asm__ __volatile__ ("pause");
+	}
+}
+
+
+static inline
+void
+spin_until(uint64_t tsc)
+{
+	while (asm_rdtsc() < tsc) {
+		__asm__ __volatile__ ("pause");
+	}
+}
+
+
+/**
+ * \brief Measures the TSC rate against the monotonic clock.
+ */
+static
+double
+calibrate_tsc()
+{
+	uint64_t start_ns;
+	uint64_t stop_ns;
+	uint64_t start_tsc;
+	uint64_t stop_tsc;
+
+	start_ns = monotonic_ns();
+	start_tsc = asm_rdtsc();
+	do {
+		stop_ns = monotonic_ns();
+	} while (stop_ns - start_ns < PCM_EMULATE_CALIBRATION_NS);
+	stop_tsc = asm_rdtsc();
+	return (double) (stop_tsc - start_tsc) / (double) (stop_ns - start_ns);
+}
+
+
+/**
+ * \brief Configures the emulator. A zero latency or bandwidth disables 
+ * that part of the model.
+ *
+ * Returns non-zero if emulation is enabled.
+ */
+int
+pcm_emulate_init(int flush_latency_ns, int fence_latency_ns, int write_bandwidth_mb)
+{
+	if (flush_latency_ns <= 0 && fence_latency_ns <= 0 && write_bandwidth_mb <= 0) {
+		pcm_emulate_enabled = 0;
+		return 0;
+	}
+	pcm_emulate_cycles_per_ns = calibrate_tsc();
+	pcm_emulate.flush_cycles = (uint64_t) (flush_latency_ns * pcm_emulate_cycles_per_ns);
+	pcm_emulate.fence_cycles = (uint64_t) (fence_latency_ns * pcm_emulate_cycles_per_ns);
+	if (write_bandwidth_mb > 0) {
+		/* 1 MB/s is one byte per microsecond */
+		pcm_emulate.cycles_per_kb = (uint64_t) (1024 * 1000 * pcm_emulate_cycles_per_ns / write_bandwidth_mb);
+		pcm_emulate.burst_cycles = PCM_EMULATE_BURST_BYTES * pcm_emulate.cycles_per_kb / 1024;
+	} else {
+		pcm_emulate.cycles_per_kb = 0;
+		pcm_emulate.burst_cycles = 0;
+	}
+	pcm_emulate.next_free = 0;
+	pcm_emulate_enabled = 1;
+	return 1;
+}
+
+
+/**
+ * \brief Charges bytes to the shared bandwidth bucket, waiting until the 
+ * emulated medium has room for them.
+ */
+static inline
+void
+pcm_emulate_throttle(uint64_t bytes)
+{
+	uint64_t now;
+	uint64_t old_free;
+	uint64_t new_free;
+
+	if (pcm_emulate.cycles_per_kb == 0) {
+		return;
+	}
+	now = asm_rdtsc();
+	do {
+		old_free = pcm_emulate.next_free;
+		new_free = (old_free > now ? old_free : now) + bytes * pcm_emulate.cycles_per_kb / 1024;
+	} while (!__sync_bool_compare_and_swap(&pcm_emulate.next_free, old_free, new_free));
+	if (new_free > now + pcm_emulate.burst_cycles) {
+		spin_until(new_free - pcm_emulate.burst_cycles);
+	}
+}
+
+
+void
+pcm_emulate_flush()
+{
+	pcm_emulate_pending_bytes += CACHELINE_SIZE;
+	if (pcm_emulate.flush_cycles) {
+		spin_cycles(pcm_emulate.flush_cycles);
+	}
+}
+
+
+void
+pcm_emulate_fence()
+{
+	uint64_t bytes = pcm_emulate_pending_bytes;
+
+	if (bytes == 0) {
+		return;
+	}
+	pcm_emulate_pending_bytes = 0;
+	pcm_emulate_throttle(bytes);
+	if (pcm_emulate.fence_cycles) {
+		spin_cycles(pcm_emulate.fence_cycles);
+	}
+}
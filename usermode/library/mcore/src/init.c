@@ -35,10 +35,15 @@
 #include <sys/mman.h>
 #include "reincarnation_callback.h"
 #include "segment.h"
+#include "tier.h"
 #include "log/log_i.h"
 #include "thrdesc.h"
 #include "debug.h"
 #include "config.h"
+#include "group.h"
+#ifdef _ENABLE_TRACE
+#include "pm_trace.h"
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -70,17 +75,7 @@ do_global_init(void)
 	}
 	
 	#ifdef _ENABLE_TRACE
-        gettimeofday(&glb_time, NULL);          
-        glb_tv_sec  = glb_time.tv_sec;
-        glb_tv_usec = glb_time.tv_usec;
-	glb_start_time = glb_tv_sec * 1000000 + glb_tv_usec;
-
-	pthread_spin_init(&tbuf_lock, PTHREAD_PROCESS_SHARED);
-	/* tbuf = (char*)malloc(MAX_TBUF_SZ); To avoid interaction with M's hoard */
-	tbuf = (char*)mmap(0, MAX_TBUF_SZ, PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	/* MAZ_TBUF_SZ influences how often we compress and hence the overall execution speed. */
-	if(!tbuf)
-		M_WARNING("Failed to allocate trace buffer. Abort now.");
+	/* The trace rings are set up below, once the configuration is read. */
 	#elif _ENABLE_FTRACE
         int debug_fd = -1, ret = 0;
         assert(trace_marker == -1);
@@ -131,12 +126,59 @@ fail:
 	pthread_mutex_lock(&global_init_lock);
 	if (!mnemosyne_initialized) {
 		mcore_config_init();
+		pcm_flush_init(mcore_runtime_settings.flush_insn);
+		M_WARNING("Cache-line write-back instruction: %s\n", pcm_flush_insn_name(pcm_flush_insn));
+#ifdef M_PCM_EMULATE_NVM
+		if (pcm_emulate_init(mcore_runtime_settings.nvm_flush_latency_ns,
+		                     mcore_runtime_settings.nvm_fence_latency_ns,
+		                     mcore_runtime_settings.nvm_write_bandwidth_mb))
+		{
+			M_WARNING("NVM emulation: flush %d ns, fence %d ns, bandwidth %d MB/s (TSC %.3f GHz)\n",
+			          mcore_runtime_settings.nvm_flush_latency_ns,
+			          mcore_runtime_settings.nvm_fence_latency_ns,
+			          mcore_runtime_settings.nvm_write_bandwidth_mb,
+			          pcm_emulate_cycles_per_ns);
+		}
+#else
+		/* Nothing calls the emulator; do not spend the TSC calibration on it */
+		if (mcore_runtime_settings.nvm_flush_latency_ns > 0 ||
+		    mcore_runtime_settings.nvm_fence_latency_ns > 0 ||
+		    mcore_runtime_settings.nvm_write_bandwidth_mb > 0)
+		{
+			M_WARNING("NVM emulation settings ignored; build with M_PCM_EMULATE_NVM to enable them.\n");
+		}
+#endif
+#ifdef M_PCM_EMULATE_CRASH
+		pcm_crash_init(mcore_runtime_settings.crash_point,
+		               mcore_runtime_settings.crash_seed,
+		               mcore_runtime_settings.crash_evict_likelihood,
+		               mcore_runtime_settings.crash_torn_cdf);
+#else
+		if (mcore_runtime_settings.crash_point) {
+			M_WARNING("crash_point ignored; build with M_PCM_EMULATE_CRASH to enable it.\n");
+		}
+#endif
+#ifdef _ENABLE_TRACE
+		if (pm_trace_init(mcore_runtime_settings.trace_file,
+		                  mcore_runtime_settings.trace_ring_records) < 0)
+		{
+			M_WARNING("Failed to open trace file %s\n", mcore_runtime_settings.trace_file);
+		}
+#endif
 #ifdef _M_STATS_BUILD
 		gettimeofday(&start_time, NULL);
 #endif
+		/* 
+		 * Other processes of the group wait until our segments, arena 
+		 * and log pool are in place: m_group_init returns with the group
+		 * lock held.
+		 */
+		m_group_init();
 		m_segmentmgr_init();
+		m_group_check_size();
 		mnemosyne_initialized = 1;
 		mnemosyne_reincarnation_callback_execute_all();
+		m_segmentmgr_reincarnation_finish();
 #ifdef _M_STATS_BUILD
 		gettimeofday(&stop_time, NULL);
 		op_time = 1000000 * (stop_time.tv_sec - start_time.tv_sec) +
@@ -144,6 +186,8 @@ fail:
 		fprintf(stderr, "reincarnation_latency = %llu (us)\n", op_time);
 #endif
 		m_logmgr_init(pcm_storeset);
+		m_tiermgr_init();
+		m_group_unlock();
 		M_WARNING("Initialize\n");
 	}	
 	pthread_mutex_unlock(&global_init_lock);
@@ -159,28 +203,13 @@ do_global_fini(void)
 
 	pthread_mutex_lock(&global_init_lock);
 	if (mnemosyne_initialized) {
+		m_tiermgr_fini();
 		m_logmgr_fini();
 		m_segmentmgr_fini();
 		mtm_fini_global();
+		m_group_fini();
 		#ifdef _ENABLE_TRACE
-		pthread_spin_lock(&tbuf_lock);
-		if(tbuf_sz && mtm_enable_trace)
-		{
-		        tbuf_ptr = 0; 
-        	        while(tbuf_ptr < tbuf_sz)       
-	                {
-				/* 
-				 * for some reason tbuf[tbuf] doesn't work
-				 * although i thot tbuf + tbuf is same as 
-				 * tbuf[tbuf];
-				 */
-	                        tbuf_ptr = tbuf_ptr + 1 + fprintf(m_out, "%s", tbuf + tbuf_ptr); 
-				/* tbuf_ptr += TSTR_SZ; */
-                	}
-			tbuf_sz = 0;
-		}
-		pthread_spin_unlock(&tbuf_lock);
-		pthread_spin_destroy(&tbuf_lock);
+		pm_trace_fini();
 		#elif _ENABLE_FTRACE
 		#else
 		pthread_spin_destroy(&tot_epoch_lock);
@@ -50,8 +50,11 @@
 #include "../segment.h"
 #include "../pregionlayout.h"
 #include "phlog_tornbit.h"
+#include "group.h"
 
 __attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool = 0x0;
+/* Log pools of process slots 1 and up; slot 0 uses log_pool. */
+__attribute__ ((section("PERSISTENT"))) pcm_word_t log_pools[M_MAX_PROCESS_GROUP] = { 0 };
 
 #define LOG_NUM 32
 
@@ -67,6 +70,8 @@ struct m_logtype_entry_s {
 static pthread_mutex_t      logmgr_init_lock = PTHREAD_MUTEX_INITIALIZER;
 static m_logmgr_t           *logmgr = NULL;
 static volatile char        logmgr_initialized = 0; /* reads and writes to single-byte memory locations are guaranteed to be atomic. Don't need to bother with alignment. */
+static int                  logmgr_group_held = 0;  /* group lock held until our own logs are recovered */
+static m_log_dsc_t          *slot_log_dscs[M_MAX_PROCESS_GROUP]; /* logs of other slots, see m_logmgr_recover_slot */
 
 #define NULL_LOG_OPS { NULL, NULL, NULL, NULL, NULL}
 
@@ -85,6 +90,41 @@ static m_result_t register_static_logtypes(m_logmgr_t *mgr);
 static m_result_t do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr);
 
 
+/**
+ * \brief Points the descriptors at the logs of the pool starting at pool.
+ */
+static
+void
+pool_log_dscs_init(m_log_dsc_t *log_dscs, uintptr_t pool)
+{
+	uintptr_t metadata_start_addr;
+	uintptr_t logs_start_addr;
+	int       metadata_section_size;
+	int       physical_log_size;
+	int       i;
+
+	/* 
+	 * Physical logs should be page aligned to get maximum bandwidth from the 
+	 * system. Since sizeof(metadata) much smaller than sizeof(PAGE) we 
+	 * aggregate all the metadata together.
+	 */
+	metadata_start_addr = pool; /* this is already page aligned */
+	metadata_section_size = PAGE_ALIGN(LOG_NUM * sizeof(m_log_nvmd_t));
+	logs_start_addr = metadata_start_addr + metadata_section_size;
+   	physical_log_size = PAGE_ALIGN(PHYSICAL_LOG_SIZE);
+	assert(metadata_section_size + LOG_NUM*physical_log_size <= LOG_POOL_SIZE);
+	for (i=0; i<LOG_NUM; i++) {
+		log_dscs[i].nvmd = (m_log_nvmd_t *) (metadata_start_addr + 
+		                                        sizeof(m_log_nvmd_t)*i);
+		log_dscs[i].nvphlog = (pcm_word_t *) (logs_start_addr + 
+		                                         physical_log_size*i);
+		log_dscs[i].log = NULL;
+		log_dscs[i].ops = NULL;
+		log_dscs[i].logorder = INV_LOG_ORDER;
+	}
+}
+
+
 /**
  * \brief Creates the log pool if doesn't exist and then initializes the
  * necessary volatile data structures to access the log pool. 
@@ -92,60 +132,55 @@ static m_result_t do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr);
  * A log descriptor volatile structure is created per non-volatile persistent
  * log but the actual volatile log structure is created when the log is 
  * later recovered or allocated by a client. 
+ *
+ * Each process of a group has a pool of its own, chosen by its slot, so only
+ * the logs of the last process that had the slot are recovered here; the 
+ * pools of other slots are recovered by m_logmgr_recover_slot.
  */
 static
 m_result_t
 create_log_pool(pcm_storeset_t *set, m_logmgr_t *mgr)
 {
-	uintptr_t        metadata_start_addr;
-	uintptr_t        logs_start_addr;
-	int              metadata_section_size;
-	int              physical_log_size;
 	void             *addr;
 	m_log_dsc_t      *log_dscs;
 	m_segidx_entry_t *segidx_entry;
+	pcm_word_t       *pool;
+	int              slot;
 	int              i;
 
-	if (!log_pool) {
-		/* 
-		 * Check whether the segment already exists. This is possible if
-		 * there was a crash right after segment was created but before 
-		 * log_pool was written.
-		 */
-		if (m_segment_find_using_addr((void *) LOG_POOL_START, &segidx_entry) 
-		    != M_R_SUCCESS) 
+	slot = m_process_slot();
+	pool = (slot == 0) ? &log_pool : &log_pools[slot];
+	if (!*pool) {
+		if (slot > 0) {
+			/* 
+			 * Only the first pool fits below SEGMENT_MAP_START. A crash
+			 * before the pool is recorded leaks the segment.
+			 */
+			addr = m_pmap(0, LOG_POOL_SIZE, PROT_READ|PROT_WRITE, 0);
+		} else if (m_segment_find_using_addr((void *) LOG_POOL_START, &segidx_entry) 
+		           != M_R_SUCCESS) 
 		{
 			addr = m_pmap2((void *) LOG_POOL_START, LOG_POOL_SIZE, 
 			               PROT_READ|PROT_WRITE, MAP_FIXED);
-			if (addr == MAP_FAILED) {
-				M_INTERNALERROR("Could not allocate logs pool segment.\n");
-			}
+		} else {
+			/* 
+			 * The segment already exists. This is possible if there was a 
+			 * crash right after segment was created but before log_pool 
+			 * was written.
+			 */
+			addr = (void *) LOG_POOL_START;
+		}
+		if (addr == MAP_FAILED) {
+			M_INTERNALERROR("Could not allocate logs pool segment.\n");
 		}
-		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool, (pcm_word_t) addr);
+		PCM_NT_STORE(set, (volatile pcm_word_t *) pool, (pcm_word_t) addr);
 		PCM_NT_FLUSH(set);
 	}
 	
-	/* 
-	 * Now read the non-volatile log metadata and non-volatile physical logs.
-	 * 
-	 * Physical logs should be page aligned to get maximum bandwidth from the 
-	 * system. Since sizeof(metadata) much smaller than sizeof(PAGE) we 
-	 * aggregate all the metadata together.
-	 */
-	metadata_start_addr = LOG_POOL_START; /* this is already page aligned */
-	metadata_section_size = PAGE_ALIGN(LOG_NUM * sizeof(m_log_nvmd_t));
-	logs_start_addr = metadata_start_addr + metadata_section_size;
-   	physical_log_size = PAGE_ALIGN(PHYSICAL_LOG_SIZE);
-	assert(metadata_section_size + LOG_NUM*physical_log_size <= LOG_POOL_SIZE);
+	/* Now read the non-volatile log metadata and non-volatile physical logs. */
 	log_dscs = (m_log_dsc_t *) calloc(LOG_NUM, sizeof(m_log_dsc_t));
+	pool_log_dscs_init(log_dscs, (uintptr_t) *pool);
 	for (i=0; i<LOG_NUM; i++) {
-		log_dscs[i].nvmd = (m_log_nvmd_t *) (metadata_start_addr + 
-		                                        sizeof(m_log_nvmd_t)*i);
-		log_dscs[i].nvphlog = (pcm_word_t *) (logs_start_addr + 
-		                                         physical_log_size*i);
-		log_dscs[i].log = NULL;
-		log_dscs[i].ops = NULL;
-		log_dscs[i].logorder = INV_LOG_ORDER;
 		if ((log_dscs[i].nvmd->generic_flags & LF_TYPE_MASK) == 
 		    LF_TYPE_FREE) 
 		{
@@ -188,6 +223,15 @@ logmgr_init(pcm_storeset_t *set)
 	create_log_pool(set, mgr);
 	register_static_logtypes(mgr);
 	do_recovery(set, mgr); /* will recover any known log types so far. */
+	if (!list_empty(&(mgr->pending_logs_list))) {
+		/* 
+		 * The logs left by the last process of our slot must be replayed
+		 * before any other process of the group updates the data they 
+		 * cover, so keep the group out until their type is registered.
+		 */
+		m_group_lock();
+		logmgr_group_held = 1;
+	}
 
 	/* 
 	 * Be careful, order matters. 
@@ -244,6 +288,25 @@ m_logmgr_fini(void)
 
 
 
+/**
+ * \brief Keeps the truncation thread and log allocation out until 
+ * m_logmgr_unlock.
+ */
+void
+m_logmgr_lock(void)
+{
+	pthread_mutex_lock(&(logmgr->mutex));
+}
+
+
+void
+m_logmgr_unlock(void)
+{
+	pthread_mutex_unlock(&(logmgr->mutex));
+}
+
+
+
 static
 m_result_t
 register_logtype(m_logmgr_t *mgr, int type, m_log_ops_t *ops, int lock)
@@ -312,6 +375,52 @@ m_logmgr_register_logtype(pcm_storeset_t *set, int type, m_log_ops_t *ops)
 }
 
 
+/**
+ * \brief Recovers the prepared logs of recovery_list in log order.
+ *
+ * \return the number of log fragments recovered.
+ */
+static
+unsigned int
+recover_logs(pcm_storeset_t *set, struct list_head *recovery_list)
+{
+	m_log_dsc_t  *log_dsc;
+	m_log_dsc_t  *log_dsc_to_recover;
+	unsigned int nlogfragments_recovered;
+
+	/* 
+	 * Find the next log to recover, recover it, update its recovery
+	 * order, and repeat until there are no more logs to recover.
+	 */
+	nlogfragments_recovered = 0;
+	do {
+		log_dsc_to_recover = NULL; 
+		list_for_each_entry(log_dsc, recovery_list, list) {
+			if (log_dsc->logorder == INV_LOG_ORDER) {
+				continue;
+			}
+			if (log_dsc_to_recover == NULL) {
+				log_dsc_to_recover = log_dsc;
+			} else {
+				if (log_dsc_to_recover->logorder > log_dsc->logorder) {
+					log_dsc_to_recover = log_dsc;
+				}
+			}
+		}
+		if (log_dsc_to_recover) {
+			assert(log_dsc_to_recover->ops);
+			assert(log_dsc_to_recover->ops->recovery_do);
+			assert(log_dsc_to_recover->ops->recovery_prepare_next);
+			log_dsc_to_recover->ops->recovery_do(set, log_dsc_to_recover);
+			log_dsc_to_recover->ops->recovery_prepare_next(set, log_dsc_to_recover);
+			nlogfragments_recovered++;
+		}	
+	} while(log_dsc_to_recover);
+
+	return nlogfragments_recovered;
+}
+
+
 /**
  * \brief It checks the unknown logs list and recovers any newly known 
  * log types.
@@ -322,10 +431,9 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 {
 	m_log_dsc_t        *log_dsc;
 	m_log_dsc_t        *log_dsc_tmp;
-	m_log_dsc_t        *log_dsc_to_recover;
 	struct list_head   recovery_list;
-	unsigned int       nlogfragments_recovered;
 #ifdef _M_STATS_BUILD
+	unsigned int       nlogfragments_recovered;
 	struct timeval     start_time;
 	struct timeval     stop_time;
 	unsigned long long op_time;
@@ -352,34 +460,11 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 	gettimeofday(&start_time, NULL);
 #endif
 
-	/* 
-	 * Find the next log to recover, recover it, update its recovery
-	 * order, and repeat until there are no more logs to recover.
-	 */
-	nlogfragments_recovered = 0;
-	do {
-		log_dsc_to_recover = NULL; 
-		list_for_each_entry(log_dsc, &recovery_list, list) {
-			if (log_dsc->logorder == INV_LOG_ORDER) {
-				continue;
-			}
-			if (log_dsc_to_recover == NULL) {
-				log_dsc_to_recover = log_dsc;
-			} else {
-				if (log_dsc_to_recover->logorder > log_dsc->logorder) {
-					log_dsc_to_recover = log_dsc;
-				}
-			}
-		}
-		if (log_dsc_to_recover) {
-			assert(log_dsc_to_recover->ops);
-			assert(log_dsc_to_recover->ops->recovery_do);
-			assert(log_dsc_to_recover->ops->recovery_prepare_next);
-			log_dsc_to_recover->ops->recovery_do(set, log_dsc_to_recover);
-			log_dsc_to_recover->ops->recovery_prepare_next(set, log_dsc_to_recover);
-			nlogfragments_recovered++;
-		}	
-	} while(log_dsc_to_recover);
+#ifdef _M_STATS_BUILD
+	nlogfragments_recovered = recover_logs(set, &recovery_list);
+#else
+	recover_logs(set, &recovery_list);
+#endif
 
 	/* Make the recovered logs available for reuse */
 	list_splice(&recovery_list, &(mgr->free_logs_list));
@@ -401,7 +486,89 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 m_result_t 
 m_logmgr_do_recovery(pcm_storeset_t *set)
 {
-	return do_recovery(set, logmgr);
+	m_result_t rv;
+
+	m_group_lock();
+	rv = do_recovery(set, logmgr);
+	if (logmgr_group_held && list_empty(&(logmgr->pending_logs_list))) {
+		logmgr_group_held = 0;
+		m_group_unlock();
+	}
+	m_group_unlock();
+	return rv;
+}
+
+
+static
+m_log_ops_t *
+find_logtype_ops(m_logmgr_t *mgr, int type)
+{
+	m_logtype_entry_t *logtype_entry;
+	m_log_ops_t       *ops = NULL;
+
+	pthread_mutex_lock(&(mgr->mutex));
+	list_for_each_entry(logtype_entry, &(mgr->known_logtypes_list), list) {
+		if (logtype_entry->type == type) {
+			ops = logtype_entry->ops;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(mgr->mutex));
+	return ops;
+}
+
+
+/**
+ * \brief Recovers the logs the dead process of another slot left behind.
+ *
+ * The caller holds the group lock and the lock of the slot, so the logs 
+ * are replayed before any process updates the data they cover after the
+ * crash, and nobody takes the slot meanwhile. Logs of types this process
+ * does not know are left for a later call or the next owner of the slot.
+ */
+m_result_t
+m_logmgr_recover_slot(pcm_storeset_t *set, int slot)
+{
+	pcm_word_t       pool;
+	m_log_dsc_t      *log_dscs;
+	m_log_ops_t      *ops;
+	struct list_head recovery_list;
+	int              type;
+	int              i;
+
+	if (!logmgr_initialized) {
+		return M_R_SUCCESS;
+	}
+	/* The pool may be in a segment created after we started */
+	m_segment_sync();
+	pool = (slot == 0) ? log_pool : log_pools[slot];
+	if (!pool) {
+		return M_R_SUCCESS;
+	}
+	if (!(log_dscs = slot_log_dscs[slot])) {
+		if (!(log_dscs = (m_log_dsc_t *) calloc(LOG_NUM, sizeof(m_log_dsc_t)))) {
+			return M_R_NOMEMORY;
+		}
+		pool_log_dscs_init(log_dscs, (uintptr_t) pool);
+		slot_log_dscs[slot] = log_dscs;
+	}
+	INIT_LIST_HEAD(&recovery_list);
+	for (i=0; i<LOG_NUM; i++) {
+		type = log_dscs[i].nvmd->generic_flags & LF_TYPE_MASK;
+		if (type == LF_TYPE_FREE || 
+		    !(ops = find_logtype_ops(logmgr, type)) || !ops->recovery_init) 
+		{
+			continue;
+		}
+		if (!log_dscs[i].log && ops->alloc(&log_dscs[i]) != M_R_SUCCESS) {
+			continue;
+		}
+		log_dscs[i].ops = ops;
+		ops->recovery_init(set, &log_dscs[i]);
+		list_add(&(log_dscs[i].list), &recovery_list);
+	}
+	recover_logs(set, &recovery_list);
+	return M_R_SUCCESS;
 }
 
 
@@ -234,7 +234,11 @@ m_phlog_tornbit_truncate_async(pcm_storeset_t *set, m_phlog_tornbit_t *phlog)
 
 	phlog->head = phlog->read_index;
 
-	//FIXME: do we need a flush? PCM_NT_FLUSH(set);
+	/* 
+	 * Order the write-backs of the truncated records' data (CLWB and 
+	 * CLFLUSHOPT are weakly ordered) before the new head becomes durable.
+	 */
+	PCM_NT_FLUSH(set);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, (pcm_word_t) (phlog->head | tornbit));
 	PCM_NT_FLUSH(set);
 	
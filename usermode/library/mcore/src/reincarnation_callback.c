@@ -38,8 +38,10 @@
  */
 #include "reincarnation_callback.h"
 #include "init.h"
+#include "segment.h"
 #include <list.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /*! The list of registered callbacks. */
@@ -49,16 +51,31 @@ LIST_HEAD(theRegisteredCallbacks);
 struct reincarnation_callback
 {
 	void (*routine)();      /*!< The callback to be executed. */
+	void **segments;        /*!< Addresses within the segments the callback needs; NULL for all. */
+	int  nsegments;         /*!< Number of entries in segments. */
 	struct list_head list;  /*!< Links this callback in the context of theRegisteredCallbacks. */
 };
 typedef struct reincarnation_callback reincarnation_callback_t;
 
 
 void mnemosyne_reincarnation_callback_register(void(*initializer)())
+{
+	mnemosyne_reincarnation_callback_register_segments(initializer, NULL, 0);
+}
+
+
+void mnemosyne_reincarnation_callback_register_segments(void(*initializer)(), void *segments[], int nsegments)
 {
 	if (!mnemosyne_initialized) {
 		reincarnation_callback_t* callback = (reincarnation_callback_t*) malloc(sizeof(struct reincarnation_callback));
 		callback->routine = initializer;
+		callback->segments = NULL;
+		callback->nsegments = 0;
+		if (nsegments > 0) {
+			callback->segments = (void **) malloc(nsegments * sizeof(void *));
+			memcpy(callback->segments, segments, nsegments * sizeof(void *));
+			callback->nsegments = nsegments;
+		}
 		list_add_tail(&callback->list, &theRegisteredCallbacks);
 	} else {
 		initializer();  // We're already ready already!
@@ -66,14 +83,50 @@ void mnemosyne_reincarnation_callback_register(void(*initializer)())
 }
 
 
+/*! Whether every segment the callback needs has been mapped. */
+static int callback_is_ready(reincarnation_callback_t* callback)
+{
+	int i;
+
+	if (callback->nsegments == 0) {
+		return m_segment_reincarnation_done();
+	}
+	for (i = 0; i < callback->nsegments; i++) {
+		if (!m_segment_is_reincarnated(callback->segments[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*!
+ * Callbacks run in registration order, except that one whose segments are
+ * already mapped does not wait behind one whose segments are still being 
+ * mapped in the background.
+ */
 void mnemosyne_reincarnation_callback_execute_all()
 {
 	struct list_head* callback_node;
 	struct list_head* next;
-	list_for_each_safe(callback_node, next, &theRegisteredCallbacks) {
-		list_del(callback_node);
-		reincarnation_callback_t* callback = list_entry(callback_node, reincarnation_callback_t, list);
-		callback->routine();
-		free(callback);
+	int               progress = 0;
+	int               ran;
+
+	while (!list_empty(&theRegisteredCallbacks)) {
+		ran = 0;
+		list_for_each_safe(callback_node, next, &theRegisteredCallbacks) {
+			reincarnation_callback_t* callback = list_entry(callback_node, reincarnation_callback_t, list);
+			if (!callback_is_ready(callback)) {
+				continue;
+			}
+			list_del(callback_node);
+			callback->routine();
+			free(callback->segments);
+			free(callback);
+			ran = 1;
+		}
+		if (!ran) {
+			m_segment_reincarnation_wait_progress(&progress);
+		}
 	}
 }
@@ -41,7 +41,10 @@
 #include <stdlib.h>
 #include <sysexits.h>
 #include <assert.h>
+#include <errno.h>
+#include <sched.h>
 #include <dirent.h> 
+#include <pthread.h>
 /* Mnemosyne common header files */
 #define _M_DEBUG_BUILD
 #include <debug.h>
@@ -55,6 +58,9 @@
 #include "hal/pcm_i.h"
 #include "pregionlayout.h"
 #include "config.h"
+#include "group.h"
+#include "snapshot.h"
+#include "tier.h"
 
 
 /**
@@ -62,20 +68,185 @@
  */
 #define SEGMENTS_DIR mcore_runtime_settings.segments_dir
 
+/**
+ * The hugetlbfs mount where backing stores of huge-page segments are kept.
+ * When empty, huge-page segments are ordinary backing stores in SEGMENTS_DIR
+ * mapped at huge-page aligned addresses (e.g. on a DAX file system).
+ */
+#define HUGEPAGES_DIR mcore_runtime_settings.hugepages_dir
+#define TIER_DIR      mcore_runtime_settings.tier_dir
+
+#define SIZE_4K   (4096ULL)
+#define SIZE_2M   (2ULL*1024*1024)
+#define SIZE_1G   (1024ULL*1024*1024)
+
+#define ALIGN_UP(x, align)  (((x) + (align) - 1) & ~((uintptr_t) (align) - 1))
+
+/** Number of pages a prefault toucher thread claims at a time. */
+#define PREFAULT_CHUNK_PAGES 512
+
 
 #define M_DEBUG_SEGMENT 1
 
+/* Older headers lack it; kernels before 4.17 treat it as a plain hint. */
+#ifndef MAP_FIXED_NOREPLACE
+# define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
 m_segtbl_t m_segtbl;
 
+/* Keeps segments from coming and going while a snapshot copies them */
+static pthread_mutex_t segment_change_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void * volatile m_segment_base[SEGMENT_TABLE_NUM_ENTRIES + 1];
+
 
 /* Check whether there is a hole where we can allocate memory from. */
-#undef TRY_ALLOC_IN_HOLES
+#define TRY_ALLOC_IN_HOLES
+
+
+/** Classes of persistent segments; each has its own mapping policy. */
+enum {
+	SEGMENT_CLASS_TABLE = 0,
+	SEGMENT_CLASS_PMAP,
+	SEGMENT_CLASS_LOG,
+	SEGMENT_CLASS_SECTION
+};
+
+enum {
+	SEGMENT_PREFAULT_NONE = 0,
+	SEGMENT_PREFAULT_POPULATE,
+	SEGMENT_PREFAULT_TOUCH
+};
 
+/** How a segment is backed, mapped and prefaulted. */
+typedef struct segment_policy_s {
+	size_t page_size;  /**< 4K, 2M or 1G */
+	int    hugetlbfs;  /**< backing store lives in HUGEPAGES_DIR */
+	int    prefault;   /**< one of SEGMENT_PREFAULT_* */
+	int    advice;     /**< madvise advice applied after mapping */
+} segment_policy_t;
 
-static inline void *segment_map(void *addr, size_t size, int prot, int flags, int segment_fd);
+
+static inline void *segment_map(void *addr, size_t size, int prot, int flags, int segment_fd, segment_policy_t *policy);
 static m_result_t segidx_find_entry_using_index(m_segidx_t *segidx, uint32_t index, m_segidx_entry_t **entryp);
 
 
+static inline
+int
+segment_class(uint32_t segtbl_entry_flags, uintptr_t start)
+{
+	if (segtbl_entry_flags & SGTB_TYPE_SECTION) {
+		return SEGMENT_CLASS_SECTION;
+	}
+	if (start == LOG_POOL_START) {
+		return SEGMENT_CLASS_LOG;
+	}
+	return SEGMENT_CLASS_PMAP;
+}
+
+
+/**
+ * \brief Fills in the mapping policy configured for a segment class.
+ */
+static
+void
+segment_policy(int class, segment_policy_t *policy)
+{
+	char *pagesize;
+	char *prefault;
+	char *advice;
+
+	switch (class) {
+		case SEGMENT_CLASS_PMAP:
+			pagesize = mcore_runtime_settings.pmap_pagesize;
+			prefault = mcore_runtime_settings.pmap_prefault;
+			advice = mcore_runtime_settings.pmap_advice;
+			break;
+		case SEGMENT_CLASS_LOG:
+			pagesize = mcore_runtime_settings.log_pagesize;
+			prefault = mcore_runtime_settings.log_prefault;
+			advice = mcore_runtime_settings.log_advice;
+			break;
+		case SEGMENT_CLASS_SECTION:
+			pagesize = mcore_runtime_settings.section_pagesize;
+			prefault = mcore_runtime_settings.section_prefault;
+			advice = mcore_runtime_settings.section_advice;
+			break;
+		default:
+			/* The segment table is tiny; keep the historical behavior */
+			pagesize = "4k";
+			prefault = "none";
+			advice = "random";
+	}
+
+	if (strcmp(pagesize, "1g") == 0) {
+		policy->page_size = SIZE_1G;
+	} else if (strcmp(pagesize, "2m") == 0) {
+		policy->page_size = SIZE_2M;
+	} else {
+		policy->page_size = SIZE_4K;
+	}
+	policy->hugetlbfs = (policy->page_size > SIZE_4K && HUGEPAGES_DIR[0] != '\0');
+
+	if (strcmp(prefault, "populate") == 0) {
+		policy->prefault = SEGMENT_PREFAULT_POPULATE;
+	} else if (strcmp(prefault, "touch") == 0) {
+		policy->prefault = SEGMENT_PREFAULT_TOUCH;
+	} else {
+		policy->prefault = SEGMENT_PREFAULT_NONE;
+	}
+
+	if (strcmp(advice, "normal") == 0) {
+		policy->advice = MADV_NORMAL;
+	} else if (strcmp(advice, "sequential") == 0) {
+		policy->advice = MADV_SEQUENTIAL;
+	} else if (strcmp(advice, "willneed") == 0) {
+		policy->advice = MADV_WILLNEED;
+	} else if (strcmp(advice, "hugepage") == 0) {
+		policy->advice = MADV_HUGEPAGE;
+	} else {
+		policy->advice = MADV_RANDOM;
+	}
+}
+
+
+/**
+ * \brief Overrides the configured backing of an existing segment with the 
+ * one recorded in its segment table entry.
+ *
+ * Where a segment's backing store lives is decided once, when the segment
+ * is created; changing the configuration only affects new segments.
+ */
+static inline
+void
+segment_policy_from_flags(segment_policy_t *policy, uint32_t segtbl_entry_flags)
+{
+	if (segtbl_entry_flags & SGTB_HUGETLB_1G) {
+		policy->page_size = SIZE_1G;
+		policy->hugetlbfs = 1;
+	} else if (segtbl_entry_flags & SGTB_HUGETLB_2M) {
+		policy->page_size = SIZE_2M;
+		policy->hugetlbfs = 1;
+	} else {
+		policy->hugetlbfs = 0;
+	}
+	if (segtbl_entry_flags & SGTB_TIERED) {
+		policy->page_size = SIZE_4K;
+	}
+}
+
+
+static inline
+void
+segment_backing_store_path(char *path, uint32_t segtbl_entry_flags, uint32_t index, uint64_t module_id)
+{
+	sprintf(path, "%s/%u.%lu", 
+	        (segtbl_entry_flags & SGTB_HUGETLB_MASK) ? HUGEPAGES_DIR : SEGMENTS_DIR,
+	        index, (long unsigned int) module_id);
+}
+
+
 /**
  * \brief Verify backing stores 
  *
@@ -89,7 +260,7 @@ static m_result_t segidx_find_entry_using_index(m_segidx_t *segidx, uint32_t ind
  */
 static
 void
-verify_backing_stores(m_segtbl_t *segtbl)
+verify_backing_stores_in_dir(m_segtbl_t *segtbl, char *segments_dir, int hugetlbfs)
 {
 	int              n;
 	DIR              *d;
@@ -99,20 +270,28 @@ verify_backing_stores(m_segtbl_t *segtbl)
 	uint64_t         segment_module_id; /* This is valid for the .persistent backing stores */
 	m_segidx_entry_t *ientry;
 	char             complete_path[256];
+	int              valid;
 
-	d = opendir(SEGMENTS_DIR);
+	d = opendir(segments_dir);
 	if (d) {
 		while ((dir = readdir(d)) != NULL) {
 			n = sscanf(dir->d_name, "%u.%lu\n", &segment_id, &segment_module_id);
 			if (n == 2) {
 				index = segment_id;
 				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "Verifying backing store: %u.%lu\n", segment_id, segment_module_id);
-				/* Backing store has a valid entry in the segment table? */
-				if (!(segtbl->entries[index].flags & SGTB_VALID_ENTRY)) {
+				/* 
+				 * Backing store has a valid entry in the segment table, which
+				 * expects it in this directory? 
+				 */
+				valid = index < SEGMENT_TABLE_NUM_ENTRIES &&
+				        (segtbl->entries[index].flags & SGTB_VALID_ENTRY) &&
+				        (!!(segtbl->entries[index].flags & SGTB_HUGETLB_MASK) == hugetlbfs);
+				if (!valid) {
 					/* No valid entry; erase backing store */
-					sprintf(complete_path, "%s/%s", SEGMENTS_DIR, dir->d_name);
+					sprintf(complete_path, "%s/%s", segments_dir, dir->d_name);
 					M_DEBUG_PRINT(M_DEBUG_SEGMENT, "Remove backing store: %s\n", complete_path);
 					unlink(complete_path);
+					continue;
 				}	
 				/* If this is .persistent backing store then update the index */
 				if (segment_module_id != (uint64_t) (-1LLU)) {
@@ -130,9 +309,61 @@ verify_backing_stores(m_segtbl_t *segtbl)
 }
 
 
+/**
+ * \brief Removes cold files of tiered segments that no longer exist.
+ */
+static
+void
+verify_tier_files(m_segtbl_t *segtbl)
+{
+	DIR           *d;
+	struct dirent *dir;
+	uint32_t      index;
+	char          name[32];
+	char          complete_path[256];
+
+	if (!(d = opendir(TIER_DIR))) {
+		return;
+	}
+	while ((dir = readdir(d)) != NULL) {
+		if (sscanf(dir->d_name, "%u.tier", &index) != 1) {
+			continue;
+		}
+		snprintf(name, sizeof(name), "%u.tier", index);
+		if (strcmp(name, dir->d_name) != 0) {
+			continue;
+		}
+		if (index < SEGMENT_TABLE_NUM_ENTRIES &&
+		    (segtbl->entries[index].flags & SGTB_VALID_ENTRY) &&
+		    (segtbl->entries[index].flags & SGTB_TIERED))
+		{
+			continue;
+		}
+		sprintf(complete_path, "%s/%s", TIER_DIR, dir->d_name);
+		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "Remove cold file: %s\n", complete_path);
+		unlink(complete_path);
+	}
+	closedir(d);
+}
+
+
+static
+void
+verify_backing_stores(m_segtbl_t *segtbl)
+{
+	verify_backing_stores_in_dir(segtbl, SEGMENTS_DIR, 0);
+	if (HUGEPAGES_DIR[0] != '\0') {
+		verify_backing_stores_in_dir(segtbl, HUGEPAGES_DIR, 1);
+	}
+	if (TIER_DIR[0] != '\0') {
+		verify_tier_files(segtbl);
+	}
+}
+
+
 static
 int 
-create_backing_store(char *file, unsigned long long size)
+create_backing_store(char *file, unsigned long long size, int hugetlbfs)
 {
 	int      fd;
 	unsigned long long  roundup_size;
@@ -143,6 +374,17 @@ create_backing_store(char *file, unsigned long long size)
 	if (fd < 0) {
 		return fd;
 	}
+	/* 
+	 * hugetlbfs does not support write(); its files can only be sized with
+	 * ftruncate, and size is already a multiple of the huge page size.
+	 */
+	if (hugetlbfs) {
+		if (ftruncate(fd, size) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
 	/* TRICK: We could create an empty file by seeking to the end of the file 
 	 * and writing a single zero byte there. However this would cause a page 
 	 * fault at the last page of the file and bring the page into the OS page 
@@ -183,10 +425,140 @@ m_check_backing_store(char *path, ssize_t size)
 	return rv;
 }
 
+/**
+ * \brief Enters a lock-free read-side critical section over the sorted index.
+ *
+ * Returns the epoch the reader registered with, which must be passed to
+ * segidx_read_unlock. The atomic increment is a full barrier so the 
+ * snapshot pointer is loaded only after the registration is visible.
+ */
+static inline
+unsigned int
+segidx_read_lock(m_segidx_t *segidx)
+{
+	unsigned int epoch = segidx->rcu_epoch & 1;
+
+	__sync_fetch_and_add(&segidx->rcu_readers[epoch], 1);
+	return epoch;
+}
+
+
+static inline
+void
+segidx_read_unlock(m_segidx_t *segidx, unsigned int epoch)
+{
+	__sync_fetch_and_sub(&segidx->rcu_readers[epoch], 1);
+}
+
+
+/**
+ * \brief Waits until no reader can still hold a previously published snapshot.
+ *
+ * Caller must hold the index mutex. We flip the epoch twice, each time 
+ * waiting for the readers of the old epoch to drain. One flip is not 
+ * enough: a reader may sample the epoch just before a flip and register 
+ * with the stale counter after we have already found it empty.
+ */
+static
+void
+segidx_synchronize(m_segidx_t *segidx)
+{
+	unsigned int epoch;
+	int          i;
+
+	for (i=0; i<2; i++) {
+		__sync_synchronize();
+		epoch = segidx->rcu_epoch & 1;
+		segidx->rcu_epoch = epoch ^ 1;
+		__sync_synchronize();
+		while (segidx->rcu_readers[epoch]) {
+			sched_yield();
+		}
+	}
+}
+
+
+/**
+ * \brief Rebuilds the sorted snapshot from the ordered mapped list and 
+ * publishes it.
+ *
+ * Caller must hold the index mutex (or be the only thread touching the
+ * index). The previous snapshot is reclaimed once readers have drained.
+ */
+static
+m_result_t
+segidx_publish(m_segidx_t *segidx)
+{
+	m_segidx_entry_t *ientry;
+	m_segidx_array_t *new_array;
+	m_segidx_array_t *old_array;
+	int              n;
+
+	n = 0;
+	list_for_each_entry(ientry, &(segidx->mapped_entries.list), list) {
+		n++;
+	}
+	if (!(new_array = (m_segidx_array_t *) malloc(sizeof(m_segidx_array_t) + 
+	                                              n * sizeof(m_segidx_range_t))))
+	{
+		return M_R_NOMEMORY;
+	}
+	n = 0;
+	list_for_each_entry(ientry, &(segidx->mapped_entries.list), list) {
+		new_array->ranges[n].start = ientry->segtbl_entry->start;
+		new_array->ranges[n].end = ientry->segtbl_entry->start + ientry->segtbl_entry->size;
+		new_array->ranges[n].entry = ientry;
+		n++;
+	}
+	new_array->nranges = n;
+
+	old_array = segidx->sorted;
+	__sync_synchronize();
+	segidx->sorted = new_array;
+	if (old_array) {
+		segidx_synchronize(segidx);
+		free(old_array);
+	}
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Returns the position of the last range starting at or below addr,
+ * or -1 if there is none.
+ */
+static inline
+int
+segidx_array_search(m_segidx_array_t *array, uintptr_t addr)
+{
+	int lo = 0;
+	int hi = array->nranges - 1;
+	int mid;
+	int found = -1;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (array->ranges[mid].start <= addr) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+
+/**
+ * Inserts the entry into the ordered list. When called with lock set the 
+ * sorted snapshot is republished too; the unlocked variant is used only
+ * while segidx_create builds the index, which publishes once at the end.
+ */
 static 
 m_result_t
 segidx_insert_entry_ordered(m_segidx_t *segidx, m_segidx_entry_t *new_entry, int lock)
 {
+	m_result_t       rv = M_R_SUCCESS;
 	m_segidx_entry_t *ientry;
 
 	if (lock) {
@@ -205,10 +577,33 @@ segidx_insert_entry_ordered(m_segidx_t *segidx, m_segidx_entry_t *new_entry, int
 	list_add_tail(&(new_entry->list), &(segidx->mapped_entries.list));
 
 out:
+	m_segment_base[new_entry->index + 1] = (void *) new_entry->segtbl_entry->start;
 	if (lock) {
+		rv = segidx_publish(segidx);
 		pthread_mutex_unlock(&(segidx->mutex));
 	}
-	return M_R_SUCCESS;
+	return rv;
+}
+
+
+/**
+ * Removes a mapped entry from the ordered list, republishes the sorted 
+ * snapshot and returns the entry to the free list. 
+ */
+static 
+m_result_t
+segidx_remove_entry(m_segidx_t *segidx, m_segidx_entry_t *entry)
+{
+	m_result_t rv;
+
+	pthread_mutex_lock(&(segidx->mutex));
+	list_del_init(&(entry->list));
+	rv = segidx_publish(segidx);
+	m_segment_base[entry->index + 1] = NULL;
+	entry->module_id = (uint64_t) (-1ULL);
+	list_add(&(entry->list), &(segidx->free_entries.list));
+	pthread_mutex_unlock(&(segidx->mutex));
+	return rv;
 }
 
 
@@ -234,6 +629,9 @@ segidx_create(m_segtbl_t *_segtbl, m_segidx_t **_segidxp)
 	}
 	pthread_mutex_init(&(_segidx->mutex), NULL);
 	_segidx->all_entries = entries;
+	_segidx->sorted = NULL;
+	_segidx->rcu_epoch = 0;
+	_segidx->rcu_readers[0] = _segidx->rcu_readers[1] = 0;
 	INIT_LIST_HEAD(&(_segidx->mapped_entries.list));
 	INIT_LIST_HEAD(&(_segidx->free_entries.list));
 	for (i=0; i < SEGMENT_TABLE_NUM_ENTRIES; i++) {
@@ -246,9 +644,14 @@ segidx_create(m_segtbl_t *_segtbl, m_segidx_t **_segidxp)
 			list_add_tail(&(entries[i].list), &(_segidx->free_entries.list));
 		}
 	}
+	if ((rv = segidx_publish(_segidx)) != M_R_SUCCESS) {
+		goto err_publish;
+	}
 	*_segidxp = _segidx;
 	rv = M_R_SUCCESS;
 	goto out;
+err_publish:
+	free(entries);
 err_calloc:
 	free(_segidx);
 out:
@@ -315,26 +718,29 @@ unlock:
 }
 
 
-/* Not thread safe */
+/**
+ * Lock-free; safe to call concurrently with segments being mapped and 
+ * unmapped. The returned entry is stable storage but may be recycled if
+ * the segment it describes is unmapped later.
+ */
 static
 m_result_t 
 segidx_find_entry_using_addr(m_segidx_t *segidx, void *addr, m_segidx_entry_t **entryp)
 {
-	m_segidx_entry_t *ientry;
-	m_segtbl_entry_t *tentry;
-	uintptr_t        start;
-	uint32_t         size;
+	m_result_t       rv = M_R_FAILURE;
+	m_segidx_array_t *array;
+	unsigned int     epoch;
+	int              i;
 
-	list_for_each_entry(ientry, &segidx->mapped_entries.list, list) {
-		tentry = ientry->segtbl_entry;
-		start = tentry->start;
-		size = tentry->size;
-		if ((uintptr_t) addr >= start && (uintptr_t) addr < start+size) {
-			*entryp = ientry;
-			return M_R_SUCCESS;
-		}
+	epoch = segidx_read_lock(segidx);
+	array = segidx->sorted;
+	i = segidx_array_search(array, (uintptr_t) addr);
+	if (i >= 0 && (uintptr_t) addr < array->ranges[i].end) {
+		*entryp = array->ranges[i].entry;
+		rv = M_R_SUCCESS;
 	}
-	return M_R_FAILURE;
+	segidx_read_unlock(segidx, epoch);
+	return rv;
 }
 
 
@@ -368,34 +774,67 @@ segidx_find_entry_using_module_id(m_segidx_t *segidx, uint64_t module_id, m_segi
 	return M_R_FAILURE;
 }
 
+/**
+ * \brief Returns whether [start, start+length) overlaps no mapped segment.
+ *
+ * Caller must hold the index mutex.
+ */
+static inline
+int
+segidx_region_is_free(m_segidx_array_t *array, uintptr_t start, size_t length)
+{
+	int i;
+
+	i = segidx_array_search(array, start + length - 1);
+	return (i < 0 || array->ranges[i].end <= start);
+}
+
+
+/**
+ * \brief Returns a start address, aligned to align, where a segment of the 
+ * given length does not overlap any mapped segment.
+ */
 static
 uintptr_t
-segidx_find_free_region(m_segidx_t *segidx, uintptr_t start_addr, size_t length)
+segidx_find_free_region(m_segidx_t *segidx, uintptr_t start_addr, size_t length, size_t align)
 {
-	struct list_head *tmp_list;
-	m_segidx_entry_t *max_ientry;
+	m_segidx_array_t *array;
+	uintptr_t        max_end_addr;
+	int              i;
+#ifdef TRY_ALLOC_IN_HOLES
+	uintptr_t        prev_end_addr;
+#endif
 
+	start_addr = ALIGN_UP(start_addr, align);
 	pthread_mutex_lock(&segidx->mutex); 
-	if ((tmp_list = segidx->mapped_entries.list.prev) !=  &segidx->mapped_entries.list) {
-		max_ientry = list_entry(tmp_list, m_segidx_entry_t, list);
-		if (start_addr < (max_ientry->segtbl_entry->start +	max_ientry->segtbl_entry->size)) {
-			start_addr = 0x0;
+	array = segidx->sorted;
+	if (array->nranges > 0 && !segidx_region_is_free(array, start_addr, length)) {
+		start_addr = 0x0;
+		/* Ranges are ordered and do not overlap so the last one ends highest */
+		max_end_addr = ALIGN_UP(array->ranges[array->nranges-1].end, align);
 #ifdef TRY_ALLOC_IN_HOLES
-			/* Check whether there is a hole where we can allocate memory */
-			prev_end_addr = SEGMENT_MAP_START;
-			list_for_each_entry(ientry, &(segidx->mapped_entries.list), list) {
-				if (ientry->segtbl_entry->start - prev_end_addr > length) {
-					start_addr = prev_end_addr;
-					break;
-				}
-				prev_end_addr = ientry->segtbl_entry->start + ientry->segtbl_entry->size;
+		/* 
+		 * Check whether there is a hole where we can allocate memory. First 
+		 * fit over the gaps between consecutive segments above SEGMENT_MAP_START.
+		 */
+		prev_end_addr = ALIGN_UP(SEGMENT_MAP_START, align);
+		for (i=0; i<array->nranges; i++) {
+			if (array->ranges[i].end <= prev_end_addr) {
+				continue;
 			}
-#endif			
-			/* If not found a hole then start from the maximum allocated address so far */
-			if (!start_addr) {
-				start_addr = max_ientry->segtbl_entry->start +	max_ientry->segtbl_entry->size;
-			}	
+			if (array->ranges[i].start >= prev_end_addr && 
+			    array->ranges[i].start - prev_end_addr >= length) 
+			{
+				start_addr = prev_end_addr;
+				break;
+			}
+			prev_end_addr = ALIGN_UP(array->ranges[i].end, align);
 		}
+#endif			
+		/* If not found a hole then start from the maximum allocated address so far */
+		if (!start_addr) {
+			start_addr = max_end_addr;
+		}	
 	}
 	pthread_mutex_unlock(&segidx->mutex);
 	return start_addr;
@@ -408,19 +847,22 @@ segment_table_map(m_segtbl_t *segtbl)
 {
 	char              segtbl_path[256];
 	int               segtbl_fd;
+	segment_policy_t  policy;
 
 	sprintf(segtbl_path, "%s/segment_table", SEGMENTS_DIR);
 	if (m_check_backing_store(segtbl_path, SEGMENT_TABLE_SIZE) != M_R_SUCCESS) {
 		mkdir_r(SEGMENTS_DIR, S_IRWXU);
-		segtbl_fd = create_backing_store(segtbl_path, SEGMENT_TABLE_SIZE);
+		segtbl_fd = create_backing_store(segtbl_path, SEGMENT_TABLE_SIZE, 0);
 	} else {
 		segtbl_fd = open(segtbl_path, O_RDWR);
 	}
+	segment_policy(SEGMENT_CLASS_TABLE, &policy);
 	segtbl->entries = segment_map((void *) SEGMENT_TABLE_START, 
 	                              SEGMENT_TABLE_SIZE, 
 	                              PROT_READ|PROT_WRITE,
 	                              MAP_PERSISTENT | MAP_SHARED,
-		                          segtbl_fd);
+		                          segtbl_fd,
+	                              &policy);
 	if (segtbl->entries == MAP_FAILED) {
 		assert(0 && "Going crazy...couldn't map the segment table\n");
 		return M_R_FAILURE;
@@ -505,29 +947,131 @@ out:
 }
 	
 
+typedef struct segment_prefault_arg_s {
+	volatile char *addr;
+	size_t        npages;
+	size_t        stride;
+	volatile size_t next;  /**< next page to hand out */
+} segment_prefault_arg_t;
+
+
+static
+void *
+segment_prefault_worker(void *arg)
+{
+	segment_prefault_arg_t *pa = (segment_prefault_arg_t *) arg;
+	size_t                 first;
+	size_t                 last;
+	size_t                 i;
+	char                   sum = 0;
+
+	while ((first = __sync_fetch_and_add(&pa->next, PREFAULT_CHUNK_PAGES)) < pa->npages) {
+		last = first + PREFAULT_CHUNK_PAGES;
+		if (last > pa->npages) {
+			last = pa->npages;
+		}
+		for (i=first; i<last; i++) {
+			sum += pa->addr[i * pa->stride];
+		}
+	}
+	return (void *) (uintptr_t) sum;
+}
+
+
+/**
+ * \brief Faults in every page of a mapped segment using up to 
+ * prefault_threads threads (the caller being one of them).
+ *
+ * Reads are enough: they populate the page tables without dirtying the
+ * backing store.
+ */
+static
+void
+segment_prefault(void *addr, size_t size, segment_policy_t *policy)
+{
+	segment_prefault_arg_t arg;
+	pthread_t              threads[256];
+	int                    nthreads;
+	int                    i;
+
+	/* 
+	 * Without hugetlbfs the kernel may still back the segment with 4K 
+	 * pages, so touch every 4K page. 
+	 */
+	arg.stride = policy->hugetlbfs ? policy->page_size : SIZE_4K;
+	arg.addr = (volatile char *) addr;
+	arg.npages = size / arg.stride;
+	arg.next = 0;
+	nthreads = mcore_runtime_settings.prefault_threads;
+	if (nthreads > arg.npages / PREFAULT_CHUNK_PAGES + 1) {
+		nthreads = arg.npages / PREFAULT_CHUNK_PAGES + 1;
+	}
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, segment_prefault_worker, &arg) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+	segment_prefault_worker(&arg);
+	for (i=1; i<nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+
 /**
  * Assumes segment_fd points to a valid segment backing store. 
  */
 static inline
 void *
-segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
+segment_map(void *addr, size_t size, int prot, int flags, int segment_fd, segment_policy_t *policy)
 {
-	void      *segmentp;
-	uintptr_t start;
-	uintptr_t end;
+	void       *segmentp;
+	uintptr_t  start;
+	uintptr_t  end;
+	int        share_flags;
+	static int warned_map_sync = 0;
 
 
 	if (segment_fd < 0) {
 		return ((void *) -1);
 	}
+	if (policy->prefault == SEGMENT_PREFAULT_POPULATE) {
+		flags |= MAP_POPULATE;
+	}
+	share_flags = pcm_persist_domain_map_flags();
 	segmentp = mmap(addr, size, prot, 
-	                flags | MAP_PERSISTENT| MAP_SHARED, 
+	                flags | MAP_PERSISTENT| share_flags, 
 		            segment_fd,
 		            0);
+	if (segmentp == MAP_FAILED && (share_flags & MAP_SYNC) && 
+	    (errno == EOPNOTSUPP || errno == EINVAL)) 
+	{
+		/* 
+		 * Not a DAX file: a domain forced through the configuration, or 
+		 * a hugetlbfs backing store. Flushing the caches would not make 
+		 * the data durable, so refuse the mapping rather than pretend. 
+		 * This is printed in every build since the mapping fails.
+		 */
+		if (!warned_map_sync) {
+			warned_map_sync = 1;
+			fprintf(stderr, "mnemosyne: persist_domain is %s but a segment file "
+			        "is not on a DAX file system (MAP_SYNC: %s); use the "
+			        "emulated domain.\n", 
+			        pcm_persist_domain_name(pcm_persist_domain), strerror(errno));
+		}
+		return MAP_FAILED;
+	}
 				   
 	if (segmentp == MAP_FAILED) {
 		return segmentp;
 	}
+	if ((flags & MAP_FIXED_NOREPLACE) && segmentp != addr) {
+		/* Kernels before 4.17 take MAP_FIXED_NOREPLACE as a mere hint */
+		munmap(segmentp, size);
+		errno = EEXIST;
+		return MAP_FAILED;
+	}
 	/* 
 	 * Ensure mapped segment falls into the address space region reserved 
 	 * for persistent segments.
@@ -546,9 +1090,17 @@ segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
 		return MAP_FAILED;
 	}
 
-	/* we don't want page prefetching on the persistent segment */
-	if (madvise(segmentp, size, MADV_RANDOM) < 0) {
-		return MAP_FAILED;
+	/* 
+	 * By default we don't want page prefetching on the persistent segment.
+	 * hugetlbfs mappings are huge already and reject MADV_HUGEPAGE.
+	 */
+	if (!(policy->hugetlbfs && policy->advice == MADV_HUGEPAGE)) {
+		if (madvise(segmentp, size, policy->advice) < 0) {
+			return MAP_FAILED;
+		}
+	}
+	if (policy->prefault == SEGMENT_PREFAULT_TOUCH) {
+		segment_prefault(segmentp, size, policy);
 	}
 	return segmentp;
 }
@@ -559,7 +1111,7 @@ segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
  */
 static 
 void *
-segment_map2(void *addr, size_t size, int prot, int flags, char *segment_path)
+segment_map2(void *addr, size_t size, int prot, int flags, char *segment_path, segment_policy_t *policy)
 {
 	int  segment_fd;
 	void *segmentp;
@@ -569,55 +1121,388 @@ segment_map2(void *addr, size_t size, int prot, int flags, char *segment_path)
 		return ((void *) -1);
 	}
 
-	segmentp = segment_map(addr, size, prot, flags, segment_fd);
-				   
-	if (segmentp == MAP_FAILED) {
-		close (segment_fd);
-		return segmentp;
-	}
+	segmentp = segment_map(addr, size, prot, flags, segment_fd, policy);
+	/* The mapping keeps its own reference to the backing store */
+	close (segment_fd);
 	return segmentp;
 }
 
 
+/** State of the parallel reincarnation of the previous life's segments. */
+typedef struct segment_reincarnation_s {
+	pthread_mutex_t  mutex;
+	pthread_cond_t   cond;            /**< signaled whenever a segment gets mapped */
+	m_segidx_entry_t **todo;          /**< segments to map, .persistent sections first */
+	int              ntodo;
+	int              next;            /**< next segment of todo to hand out */
+	int              nmapped;
+	int              nsections;       /**< sections among todo */
+	int              nsections_mapped;
+	char             pending[SEGMENT_TABLE_NUM_ENTRIES]; /**< segment not yet mapped, by index */
+	pthread_t        workers[64];
+	int              nworkers;
+	m_segidx_entry_t **prefault;      /**< mapped segments waiting to be prefaulted */
+	int              nprefault;
+	pthread_t        prefaulter;
+	int              prefaulter_running;
+} segment_reincarnation_t;
+
+static segment_reincarnation_t reincarnation = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER
+};
+
+
 /**
- * \brief Reincarnates valid segments
+ * \brief Maps a relocatable segment whose address range is taken at the 
+ * first free place in the reserved region and records the new address.
  *
- * Assumes segment table already has an index attached to it.
+ * Walks the gaps between indexed segments; a gap may still hold mappings
+ * we do not know about, which MAP_FIXED_NOREPLACE steps around. Only for 
+ * a single process: a group shares the segment table, so all its 
+ * processes must map a segment at the same address.
  */
-void
-segment_reincarnate_segments(m_segtbl_t *segtbl)
+static
+void *
+segment_relocate(m_segidx_entry_t *ientry, char *path, segment_policy_t *policy)
 {
-	m_segidx_entry_t *ientry;
-	m_segtbl_entry_t *tentry;
-	uintptr_t        start;
-	uintptr_t        end;
-	char             path[256];
-	void             *map_addr;
+	m_segidx_t       *segidx = m_segtbl.idx;
+	m_segtbl_entry_t *tentry = ientry->segtbl_entry;
+	m_segidx_array_t *array;
+	size_t           size = (size_t) tentry->size;
+	size_t           step;
+	uintptr_t        candidate;
+	uintptr_t        limit;
+	uintptr_t        old_start = tentry->start;
+	void             *map_addr = MAP_FAILED;
+	int              i;
 
-	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
+	step = ALIGN_UP(size > SIZE_2M ? size : SIZE_2M, policy->page_size);
+	pthread_mutex_lock(&(segidx->mutex));
+	array = segidx->sorted;
+	candidate = ALIGN_UP(SEGMENT_MAP_START, policy->page_size);
+	for (i=0; i<=array->nranges; i++) {
+		limit = (i < array->nranges) ? array->ranges[i].start : PSEGMENT_RESERVED_REGION_END;
+		while (candidate + size <= limit) {
+			map_addr = segment_map2((void *) candidate, size, PROT_READ|PROT_WRITE,
+			                        MAP_FIXED_NOREPLACE, path, policy);
+			if (map_addr != MAP_FAILED) {
+				break;
+			}
+			candidate += step;
+		}
+		if (map_addr != MAP_FAILED) {
+			break;
+		}
+		if (i < array->nranges && candidate < array->ranges[i].end) {
+			candidate = ALIGN_UP(array->ranges[i].end, policy->page_size);
+		}
+	}
+	if (map_addr != MAP_FAILED) {
+		PM_EQU(tentry->start, candidate); /* PCM STORE */
+		PCM_WB_FLUSH(NULL, &(tentry->start));
+		PCM_WB_FENCE(NULL);
+		/* Keep the index ordered by start address */
+		list_del_init(&(ientry->list));
+		segidx_insert_entry_ordered(segidx, ientry, 0);
+		segidx_publish(segidx);
+		M_WARNING("Relocated persistent segment from %p to %p\n", 
+		          (void *) old_start, map_addr);
+	}
+	pthread_mutex_unlock(&(segidx->mutex));
+	return map_addr;
+}
+
+
+/**
+ * \brief Maps a previous life segment back at its old address.
+ *
+ * Prefaulting is left to the background prefaulter; returns whether the 
+ * segment asked for it.
+ */
+static
+int
+segment_reincarnate_one(m_segidx_entry_t *ientry)
+{
+	m_segtbl_entry_t *tentry;
+	uintptr_t        start;
+	char             path[256];
+	void             *map_addr;
+	segment_policy_t policy;
+	int              prefault;
+
+	tentry = ientry->segtbl_entry;
+	if (tentry->flags & SGTB_TYPE_PMAP) {
+		segment_backing_store_path(path, tentry->flags, ientry->index, 0);
+	} else if (tentry->flags & SGTB_TYPE_SECTION) {
+		segment_backing_store_path(path, tentry->flags, ientry->index, ientry->module_id);
+	} else {
+		M_INTERNALERROR("Unknown persistent segment type.\n");
+		return 0;
+	}
+	start = (uintptr_t) tentry->start;
+	segment_policy(segment_class(tentry->flags, start), &policy);
+	segment_policy_from_flags(&policy, tentry->flags);
+	/* Touching cold extents would make them look accessed (see tier.c) */
+	prefault = (policy.prefault != SEGMENT_PREFAULT_NONE) && !(tentry->flags & SGTB_TIERED);
+	policy.prefault = SEGMENT_PREFAULT_NONE;
+	/* 
+	 * The segment must go back to its previous address space region, but
+	 * not over whatever else may have been mapped there meanwhile.
+	 */
+	/* FIXME: protection flags should be stored in the segment table */
+	map_addr = segment_map2((void *) start, (size_t) tentry->size, 
+							PROT_READ|PROT_WRITE,
+							MAP_FIXED_NOREPLACE,
+							path,
+							&policy);
+	if (map_addr == MAP_FAILED && (tentry->flags & SGTB_RELOCATABLE) &&
+	    m_process_group_size() == 1) 
+	{
+		map_addr = segment_relocate(ientry, path, &policy);
+	}
+	if (map_addr == MAP_FAILED) {
+		M_INTERNALERROR("Cannot reincarnate persistent segment at %p: address range in use.\n", 
+		                (void *) start);
+	}
+	start = (uintptr_t) map_addr;
+	if ((tentry->flags & SGTB_TIERED) &&
+	    m_tier_attach(ientry->index, start, (size_t) tentry->size, PROT_READ|PROT_WRITE, path, 0) < 0)
+	{
+		M_INTERNALERROR("Cannot reincarnate the cold extents of persistent segment at %p.\n", 
+		                (void *) start);
+	}
+	return prefault;
+}
+
+
+static
+void *
+segment_reincarnation_worker(void *arg)
+{
+	m_segidx_entry_t *ientry;
+	int              prefault;
+	int              i;
+
+	while (1) {
+		pthread_mutex_lock(&reincarnation.mutex);
+		if ((i = reincarnation.next) >= reincarnation.ntodo) {
+			pthread_mutex_unlock(&reincarnation.mutex);
+			break;
+		}
+		reincarnation.next++;
+		pthread_mutex_unlock(&reincarnation.mutex);
+
+		ientry = reincarnation.todo[i];
+		prefault = segment_reincarnate_one(ientry);
+
+		pthread_mutex_lock(&reincarnation.mutex);
+		reincarnation.pending[ientry->index] = 0;
+		reincarnation.nmapped++;
+		if (ientry->segtbl_entry->flags & SGTB_TYPE_SECTION) {
+			reincarnation.nsections_mapped++;
+		}
+		if (prefault) {
+			reincarnation.prefault[reincarnation.nprefault++] = ientry;
+		}
+		pthread_cond_broadcast(&reincarnation.cond);
+		pthread_mutex_unlock(&reincarnation.mutex);
+	}
+	return NULL;
+}
+
+
+static
+void *
+segment_prefaulter(void *arg)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	segment_policy_t policy;
+	int              i;
+
+	for (i=0; i<reincarnation.nprefault; i++) {
+		ientry = reincarnation.prefault[i];
 		tentry = ientry->segtbl_entry;
-		if (tentry->flags & SGTB_TYPE_PMAP) {
-			sprintf(path, "%s/%d.0", SEGMENTS_DIR, ientry->index);
-		} else if (tentry->flags & SGTB_TYPE_SECTION) {
-			sprintf(path, "%s/%d.%lu", SEGMENTS_DIR, ientry->index, (long unsigned int) ientry->module_id);
-		} else {
-			M_INTERNALERROR("Unknown persistent segment type.\n");
+		segment_policy(segment_class(tentry->flags, tentry->start), &policy);
+		segment_policy_from_flags(&policy, tentry->flags);
+		segment_prefault((void *) tentry->start, tentry->size, &policy);
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Starts reincarnating valid segments in the background.
+ *
+ * Segments are mapped by up to reincarnation_threads threads, .persistent 
+ * sections first since nothing can be relocated before they are in place.
+ * Use m_segment_is_reincarnated and m_segment_reincarnation_wait_progress
+ * to follow progress, and m_segmentmgr_reincarnation_finish to wait for 
+ * completion.
+ *
+ * Assumes segment table already has an index attached to it.
+ */
+static
+void
+segment_reincarnate_segments(m_segtbl_t *segtbl)
+{
+	m_segidx_entry_t *ientry;
+	int              nthreads;
+	int              n;
+	int              i;
+
+	n = 0;
+	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
+		n++;
+	}
+	reincarnation.todo = (m_segidx_entry_t **) malloc((n+1) * sizeof(m_segidx_entry_t *));
+	reincarnation.prefault = (m_segidx_entry_t **) malloc((n+1) * sizeof(m_segidx_entry_t *));
+	if (!reincarnation.todo || !reincarnation.prefault) {
+		M_INTERNALERROR("Cannot allocate the segment reincarnation list.\n");
+		return;
+	}
+	reincarnation.ntodo = 0;
+	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
+		if (ientry->segtbl_entry->flags & SGTB_TYPE_SECTION) {
+			reincarnation.todo[reincarnation.ntodo++] = ientry;
+			reincarnation.pending[ientry->index] = 1;
 		}
-		start = (uintptr_t) tentry->start;
-		end   = (uintptr_t) tentry->start + (uintptr_t) tentry->size;
-		/* 
-		 * We pass MAP_FIXED to force the segment be mapped in its previous 
-		 * address space region.
-		 */
-		/* FIXME: protection flags should be stored in the segment table */
-		map_addr = segment_map2((void *) start, (size_t) tentry->size, 
-								PROT_READ|PROT_WRITE,
-								MAP_FIXED,
-								path);
-		if (map_addr == MAP_FAILED) {
-			M_INTERNALERROR("Cannot reincarnate persistent segment.\n");
+	}
+	reincarnation.nsections = reincarnation.ntodo;
+	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
+		if (!(ientry->segtbl_entry->flags & SGTB_TYPE_SECTION)) {
+			reincarnation.todo[reincarnation.ntodo++] = ientry;
+			reincarnation.pending[ientry->index] = 1;
 		}
 	}
+
+	nthreads = mcore_runtime_settings.reincarnation_threads;
+	if (nthreads > reincarnation.ntodo) {
+		nthreads = reincarnation.ntodo;
+	}
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(&reincarnation.workers[i], NULL, 
+		                   segment_reincarnation_worker, NULL) != 0) 
+		{
+			break;
+		}
+	}
+	reincarnation.nworkers = i;
+	if (reincarnation.nworkers == 0) {
+		/* Could not get any help; do it ourselves */
+		segment_reincarnation_worker(NULL);
+	}
+}
+
+
+static
+void
+segment_wait_sections_reincarnated()
+{
+	pthread_mutex_lock(&reincarnation.mutex);
+	while (reincarnation.nsections_mapped < reincarnation.nsections) {
+		pthread_cond_wait(&reincarnation.cond, &reincarnation.mutex);
+	}
+	pthread_mutex_unlock(&reincarnation.mutex);
+}
+
+
+/**
+ * \brief Returns whether the segment containing addr is mapped.
+ *
+ * Addresses outside any previous life segment are reported as mapped 
+ * since there is nothing to wait for.
+ */
+int
+m_segment_is_reincarnated(void *addr)
+{
+	m_segidx_entry_t *ientry;
+
+	if (m_segment_find_using_addr(addr, &ientry) != M_R_SUCCESS) {
+		return 1;
+	}
+	return !((volatile char *) reincarnation.pending)[ientry->index];
+}
+
+
+/**
+ * \brief Returns whether all previous life segments are mapped.
+ */
+int
+m_segment_reincarnation_done()
+{
+	int done;
+
+	pthread_mutex_lock(&reincarnation.mutex);
+	done = (reincarnation.nmapped == reincarnation.ntodo);
+	pthread_mutex_unlock(&reincarnation.mutex);
+	return done;
+}
+
+
+/**
+ * \brief Blocks until more segments than *seen are mapped, or all are.
+ *
+ * Updates *seen to the number of segments mapped so far.
+ */
+void
+m_segment_reincarnation_wait_progress(int *seen)
+{
+	pthread_mutex_lock(&reincarnation.mutex);
+	while (reincarnation.nmapped == *seen && 
+	       reincarnation.nmapped < reincarnation.ntodo) 
+	{
+		pthread_cond_wait(&reincarnation.cond, &reincarnation.mutex);
+	}
+	*seen = reincarnation.nmapped;
+	pthread_mutex_unlock(&reincarnation.mutex);
+}
+
+
+/**
+ * \brief Waits until all previous life segments are mapped and hands the
+ * ones that asked for prefaulting to a background thread.
+ */
+void
+m_segmentmgr_reincarnation_finish()
+{
+	int i;
+
+	for (i=0; i<reincarnation.nworkers; i++) {
+		pthread_join(reincarnation.workers[i], NULL);
+	}
+	reincarnation.nworkers = 0;
+	free(reincarnation.todo);
+	reincarnation.todo = NULL;
+	if (reincarnation.nprefault > 0) {
+		if (pthread_create(&reincarnation.prefaulter, NULL, 
+		                   segment_prefaulter, NULL) == 0) 
+		{
+			reincarnation.prefaulter_running = 1;
+		}
+	}
+}
+
+
+/**
+ * \brief Waits for the background prefaulter, if any, to finish.
+ *
+ * Must be called before unmapping a segment it may be touching.
+ */
+static
+void
+segment_prefaulter_join()
+{
+	pthread_mutex_lock(&reincarnation.mutex);
+	if (reincarnation.prefaulter_running) {
+		pthread_join(reincarnation.prefaulter, NULL);
+		reincarnation.prefaulter_running = 0;
+		reincarnation.nprefault = 0;
+		free(reincarnation.prefault);
+		reincarnation.prefault = NULL;
+	}
+	pthread_mutex_unlock(&reincarnation.mutex);
 }
 
 
@@ -634,22 +1519,43 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	m_segidx_entry_t *new_ientry;
 	m_segtbl_entry_t *tentry;
 	uint32_t         flags_val;
+	segment_policy_t policy;
 	
 
 	if ((segidx_alloc_entry(m_segtbl.idx, &new_ientry)) != M_R_SUCCESS) {
 		rv = MAP_FAILED;
 		goto out;
 	}	
-	sprintf(path, "%s/%d.%lu", SEGMENTS_DIR, new_ientry->index, module_id);
+
+	segment_policy(segment_class(segtbl_entry_flags, start_addr), &policy);
+	if ((flags & MAP_FIXED) && (start_addr & (policy.page_size - 1))) {
+		/* 
+		 * A fixed address that is not huge-page aligned (e.g. the log pool)
+		 * cannot be backed by hugetlbfs; fall back to regular pages.
+		 */
+		M_WARNING("Segment at %p is not aligned to the configured page size; using 4K pages.\n", start);
+		policy.page_size = SIZE_4K;
+		policy.hugetlbfs = 0;
+	}
+	/* Extents of tiered segments are remapped one by one from regular files */
+	segment_policy_from_flags(&policy, segtbl_entry_flags);
+	if (policy.hugetlbfs) {
+		segtbl_entry_flags |= (policy.page_size == SIZE_1G) ? SGTB_HUGETLB_1G : SGTB_HUGETLB_2M;
+		mkdir_r(HUGEPAGES_DIR, S_IRWXU);
+	}
+	segment_backing_store_path(path, segtbl_entry_flags, new_ientry->index, module_id);
 
 	/* 
-	 * Round-up the size of the segment to be an integer multiple of 4K pages.
+	 * Round-up the size of the segment to be an integer multiple of pages.
 	 * This doesn't add any extra memory overhead because the kernel already 
 	 * round-ups and makes segment management simpler.
 	 */
-	length = SIZEOF_PAGES(length);
+	length = ALIGN_UP(SIZEOF_PAGES(length), policy.page_size);
+	if (segtbl_entry_flags & SGTB_TIERED) {
+		length = ALIGN_UP(length, m_tier_extent_size());
+	}
 
-	if ((fd = create_backing_store(path, length)) < 0) {
+	if ((fd = create_backing_store(path, length, policy.hugetlbfs)) < 0) {
 		rv = MAP_FAILED;
 		goto err_create_backing_store;
 	}
@@ -664,27 +1570,36 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "start_addr = %p\n", (void *) start_addr);
 
 	if ((flags & MAP_FIXED) != MAP_FIXED) {
-		start_addr = segidx_find_free_region(m_segtbl.idx, start_addr, length);
+		start_addr = segidx_find_free_region(m_segtbl.idx, start_addr, length, policy.page_size);
 	}	
-	map_addr = segment_map((void *)start_addr, length, prot, flags, fd);
+	map_addr = segment_map((void *)start_addr, length, prot, flags, fd, &policy);
+	close(fd);
 	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "new_start_addr = %p\n", (void *) start_addr);
 	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "map_addr = %p\n", map_addr);
 	if (map_addr == MAP_FAILED) {
 		rv = MAP_FAILED;
 		goto err_segment_map;
 	}
+	/* A crash before the table entry is valid leaves an orphan cold file */
+	if ((segtbl_entry_flags & SGTB_TIERED) &&
+	    m_tier_attach(new_ientry->index, (uintptr_t) map_addr, length, prot, path, 1) < 0)
+	{
+		munmap(map_addr, length);
+		rv = MAP_FAILED;
+		goto err_segment_map;
+	}
 
 	/* Now update the segment table with the necessary segment information. */
 	tentry = new_ientry->segtbl_entry;
 	PM_EQU(tentry->start, map_addr); /* PCM STORE */ 
 	PM_EQU(tentry->size, length);  /* PCM STORE */
-	PCM_WB_FENCE(NULL);
 	PCM_WB_FLUSH(NULL, &(tentry->start));
 	PCM_WB_FLUSH(NULL, &(tentry->size));
+	PCM_WB_FENCE(NULL);
 	flags_val = segtbl_entry_flags;
 	PM_EQU(tentry->flags, flags_val);  /* PCM STORE */
-	PCM_WB_FENCE(NULL);
 	PCM_WB_FLUSH(NULL, &(tentry->flags));
+	PCM_WB_FENCE(NULL);
 
 	/* Insert the entry into the ordered index */
 	segidx_insert_entry_ordered(m_segtbl.idx, new_ientry, 1);
@@ -694,6 +1609,7 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	goto out;
 
 err_segment_map:
+	unlink(path);
 err_create_backing_store:
 	segidx_free_entry(m_segtbl.idx, new_ientry);
 out:
@@ -727,6 +1643,7 @@ segment_create_sections(m_segtbl_t *segtbl)
 	size_t           length;
 	uintptr_t        persistent_section_absolute_addr;
 	uintptr_t        GOT_section_absolute_addr;
+	uintptr_t        line;
 	m_result_t       rv;
 	module_dsr_t     *module_dsr;
 	m_segtbl_entry_t *tentry;
@@ -804,12 +1721,20 @@ segment_create_sections(m_segtbl_t *segtbl)
 				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "length     = %u\n", (unsigned int) length);	
 				PM_MEMCPY(mapped_addr, elfdata->d_buf, elfdata->d_size);
 			}
+			/* The data must be durable before the flag that vouches for it */
+			for (line = (uintptr_t) BLOCK_ADDR(mapped_addr); 
+			     line < (uintptr_t) mapped_addr + module_dsr->persistent_shdr.sh_size;
+			     line += CACHELINE_SIZE)
+			{
+				PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) line);
+			}
+			PCM_WB_FENCE(NULL);
 
 			tentry = ientry->segtbl_entry;
 			flags_val = tentry->flags | SGTB_VALID_DATA; // PM_LOAD
 			PM_EQU(tentry->flags, flags_val); /* PCM STORE */
-			PCM_WB_FENCE(NULL);
 			PCM_WB_FLUSH(NULL, &(tentry->flags));
+			PCM_WB_FENCE(NULL);
 		}
 
 	} /* end of list_for_each_entry */
@@ -828,15 +1753,29 @@ m_segmentmgr_init()
 {
 	char buf[256];
 
-	/* Clear previous life segments? */
-	if (mcore_runtime_settings.reset_segments) {
+	/* Clear previous life segments? Not from under other processes. */
+	if (mcore_runtime_settings.reset_segments && !m_group_alone()) {
+		M_WARNING("reset_segments ignored: other processes are using %s\n", SEGMENTS_DIR);
+	} else if (mcore_runtime_settings.reset_segments) {
 		/* what if buffer overflow attack -- who cares, this is a prototype */
 		sprintf(buf, "rm -rf %s", SEGMENTS_DIR);
 		system(buf);
 	}
 
+	/* Where the backing stores live decides the persistence domain */
+	mkdir_r(SEGMENTS_DIR, S_IRWXU);
+	pcm_persist_domain_init(mcore_runtime_settings.persist_domain, SEGMENTS_DIR);
+	M_WARNING("Persistence domain: %s (write-back: %s)\n", 
+	          pcm_persist_domain_name(pcm_persist_domain), 
+	          pcm_flush_insn_name(pcm_flush_insn));
+
 	segment_table_incarnate();
 	segment_reincarnate_segments(&m_segtbl);
+	/* 
+	 * Other segments keep being mapped in the background while we relocate
+	 * the .persistent sections; see m_segmentmgr_reincarnation_finish.
+	 */
+	segment_wait_sections_reincarnated();
 	segment_create_sections(&m_segtbl);
 
 	segment_table_print(&m_segtbl);
@@ -851,12 +1790,99 @@ m_segmentmgr_init()
 m_result_t 
 m_segmentmgr_fini()
 {
-	/* Nothing really to do here. */
+	segment_prefaulter_join();
 	return M_R_SUCCESS;
 }
 
 
-/* Not thread safe */
+/**
+ * \brief Brings the index and our mappings in line with segments other
+ * processes of the group created or destroyed since we last looked.
+ *
+ * A table entry that is valid but not indexed was created by another 
+ * process; one that is indexed but no longer valid, or now describes a 
+ * different range, was destroyed (and perhaps reused). Other processes' 
+ * .persistent sections are only indexed, to keep their range reserved; 
+ * their module id is known just from the backing store name.
+ *
+ * Caller must hold the group lock.
+ */
+static
+void
+segment_sync(m_segtbl_t *segtbl)
+{
+	m_segidx_t       *segidx = segtbl->idx;
+	m_segidx_array_t *array;
+	m_segidx_range_t *range;
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	char             *indexed;
+	int              changed = 0;
+	int              i;
+
+	if (!(indexed = (char *) calloc(SEGMENT_TABLE_NUM_ENTRIES, 1))) {
+		return;
+	}
+	pthread_mutex_lock(&(segidx->mutex));
+	array = segidx->sorted;
+	for (i=0; i<array->nranges; i++) {
+		range = &array->ranges[i];
+		tentry = range->entry->segtbl_entry;
+		if ((tentry->flags & SGTB_VALID_ENTRY) && 
+		    tentry->start == range->start &&
+		    tentry->start + tentry->size == range->end)
+		{
+			indexed[range->entry->index] = 1;
+			continue;
+		}
+		munmap((void *) range->start, range->end - range->start);
+		m_segment_base[range->entry->index + 1] = NULL;
+		list_del_init(&(range->entry->list));
+		range->entry->module_id = (uint64_t) (-1ULL);
+		list_add(&(range->entry->list), &(segidx->free_entries.list));
+		changed = 1;
+	}
+	for (i=0; i<SEGMENT_TABLE_NUM_ENTRIES; i++) {
+		tentry = &segtbl->entries[i];
+		if (indexed[i] || !(tentry->flags & SGTB_VALID_ENTRY)) {
+			continue;
+		}
+		ientry = &segidx->all_entries[i];
+		list_del_init(&(ientry->list));
+		if (tentry->flags & SGTB_TYPE_PMAP) {
+			segment_reincarnate_one(ientry);
+		}
+		segidx_insert_entry_ordered(segidx, ientry, 0);
+		changed = 1;
+	}
+	if (changed) {
+		segidx_publish(segidx);
+	}
+	pthread_mutex_unlock(&(segidx->mutex));
+	free(indexed);
+}
+
+
+/**
+ * \brief Maps the segments other processes of the group created since and 
+ * unmaps those they destroyed.
+ *
+ * m_pmap, m_pmap2 and m_punmap do this first, so it is needed only before
+ * following a pointer into a segment another process may have just 
+ * created. Does nothing for a single process.
+ */
+void
+m_segment_sync(void)
+{
+	if (m_process_group_size() == 1) {
+		return;
+	}
+	m_group_lock();
+	segment_sync(&m_segtbl);
+	m_group_unlock();
+}
+
+
 m_result_t 
 m_segment_find_using_addr(void *addr, m_segidx_entry_t **entryp)
 {
@@ -875,8 +1901,14 @@ m_pmap(void *start, unsigned long long length, int prot, int flags)
 {
 	m_segidx_entry_t *ientry;
 	void             *rv;
+
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	m_segment_sync();
 	rv = pmap_internal(start, length, prot, flags, &ientry, 
 	                   SGTB_TYPE_PMAP | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
 	return rv;
 }
 
@@ -891,16 +1923,249 @@ m_pmap2(void *start, unsigned long long length, int prot, int flags)
 	m_segidx_entry_t *ientry;
 	void             *rv;
 
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	m_segment_sync();
 	rv = pmap_internal_abs(start, length, prot, flags, &ientry, 
 	                       SGTB_TYPE_PMAP | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
 	return rv;
 }
 
 
 
+/* Caller must hold the group lock. */
+static
 int 
-m_punmap(void *start, size_t length)
+punmap_internal(void *start, unsigned long long length)
 {
-	M_INTERNALERROR("Unimplemented functionality: m_punmap\n");
+	char             path[256];
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	m_tier_segment_t *tseg = NULL;
+	uint32_t         flags_val;
+	segment_policy_t policy;
+
+	if (m_segment_find_using_addr(start, &ientry) != M_R_SUCCESS) {
+		errno = EINVAL;
+		return -1;
+	}
+	tentry = ientry->segtbl_entry;
+	/* The segment may have been rounded up to a huge page or extent multiple */
+	segment_policy(SEGMENT_CLASS_PMAP, &policy);
+	segment_policy_from_flags(&policy, tentry->flags);
+	if (tentry->flags & SGTB_TIERED) {
+		tseg = m_tier_find((uintptr_t) start);
+	}
+	if (tentry->start != (uintptr_t) start || 
+	    (SIZEOF_PAGES(length) != tentry->size && 
+	     ALIGN_UP(SIZEOF_PAGES(length), policy.page_size) != tentry->size &&
+	     !(tseg && ALIGN_UP(SIZEOF_PAGES(length), tseg->extent_size) == tentry->size)) ||
+	    !(tentry->flags & SGTB_TYPE_PMAP)) 
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	segment_backing_store_path(path, tentry->flags, ientry->index, 0);
+	segment_prefaulter_join();
+
+	flags_val = 0;
+	PM_EQU(tentry->flags, flags_val);  /* PCM STORE */
+	PCM_WB_FLUSH(NULL, &(tentry->flags));
+	PCM_WB_FENCE(NULL);
+
+	/* 
+	 * Tear down the mapping and backing store before releasing the index 
+	 * entry: once released, the entry (and its backing store name) may be 
+	 * handed out to a concurrent m_pmap.
+	 */
+	if (tseg) {
+		m_tier_detach(ientry->index);
+	}
+	munmap(start, tentry->size);
+	unlink(path);
+	segidx_remove_entry(m_segtbl.idx, ientry);
 	return 0;
 }
+
+
+/**
+ * \brief Maps a persistent segment that may move on reincarnation.
+ *
+ * Start address is offset by SEGMENT_MAP_START.
+ */
+void *
+m_pmap_relocatable(void *start, unsigned long long length, int prot, int flags)
+{
+	m_segidx_entry_t *ientry;
+	void             *rv;
+
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	m_segment_sync();
+	rv = pmap_internal(start, length, prot, flags, &ientry, 
+	                   SGTB_TYPE_PMAP | SGTB_RELOCATABLE | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
+	return rv;
+}
+
+
+/**
+ * \brief Maps a persistent segment whose cold extents may be moved to 
+ * tier_dir (see tier.h).
+ *
+ * Start address is offset by SEGMENT_MAP_START. Fails with ENOTSUP if 
+ * tier_dir is not set or the heap is shared by a group of processes.
+ */
+void *
+m_pmap_tiered(void *start, unsigned long long length, int prot, int flags)
+{
+	m_segidx_entry_t *ientry;
+	void             *rv;
+
+	if (TIER_DIR[0] == '\0' || m_process_group_size() > 1) {
+		errno = ENOTSUP;
+		return MAP_FAILED;
+	}
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	rv = pmap_internal(start, length, prot, flags, &ientry, 
+	                   SGTB_TYPE_PMAP | SGTB_TIERED | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
+	return rv;
+}
+
+
+m_pptr_t
+m_pptr_make(void *addr)
+{
+	m_segidx_entry_t *ientry;
+
+	if (!addr || m_segment_find_using_addr(addr, &ientry) != M_R_SUCCESS) {
+		return M_PPTR_NULL;
+	}
+	return ((m_pptr_t) (ientry->index + 1) << M_PPTR_OFFSET_BITS) | 
+	       (m_pptr_t) ((uintptr_t) addr - ientry->segtbl_entry->start);
+}
+
+
+/**
+ * \brief Unmaps a persistent segment previously mapped with m_pmap/m_pmap2 
+ * and destroys its backing store.
+ *
+ * Only whole segments can be unmapped: start must be the start of the 
+ * segment and length must cover it. Returns 0 on success or -1 with errno
+ * set to EINVAL, like munmap.
+ *
+ * The segment table entry is invalidated before the backing store is 
+ * removed, so a crash in between leaves an orphan backing store that 
+ * verify_backing_stores cleans up on the next incarnation.
+ */
+int 
+m_punmap(void *start, unsigned long long length)
+{
+	int rv;
+
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	m_segment_sync();
+	rv = punmap_internal(start, length);
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
+	return rv;
+}
+
+
+/**
+ * \brief Copies the segment table and the backing store of every segment
+ * into the new directory dir and records sqn there.
+ *
+ * Backing stores on hugetlbfs go to dir/hugepages, and cold files of 
+ * tiered segments to dir/tier. Caller makes sure persistent data does 
+ * not change meanwhile (see m_snapshot_freeze).
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+m_segment_snapshot(const char *dir, uint64_t sqn)
+{
+	char             src[256];
+	char             dst[256];
+	char             *name;
+	m_segtbl_entry_t *tentry;
+	m_segidx_entry_t *ientry;
+	uint64_t         module_id;
+	int              nsegments = 0;
+	int              hugepages = 0;
+	int              tiered = 0;
+	int              i;
+	int              rv = -1;
+	FILE             *info;
+
+	if (mkdir(dir, S_IRWXU) < 0) {
+		return -1;
+	}
+	pthread_mutex_lock(&segment_change_mutex);
+	m_group_lock();
+	sprintf(src, "%s/segment_table", SEGMENTS_DIR);
+	snprintf(dst, sizeof(dst), "%s/segment_table", dir);
+	if (file_clone(src, dst) < 0) {
+		goto out;
+	}
+	for (i=0; i<SEGMENT_TABLE_NUM_ENTRIES; i++) {
+		tentry = &m_segtbl.entries[i];
+		if (!(tentry->flags & SGTB_VALID_ENTRY)) {
+			continue;
+		}
+		module_id = 0;
+		if (tentry->flags & SGTB_TYPE_SECTION) {
+			segidx_find_entry_using_index(m_segtbl.idx, i, &ientry);
+			module_id = ientry->module_id;
+		}
+		segment_backing_store_path(src, tentry->flags, i, module_id);
+		path2file(src, &name);
+		if (tentry->flags & SGTB_HUGETLB_MASK) {
+			snprintf(dst, sizeof(dst), "%s/hugepages", dir);
+			if (!hugepages++ && mkdir(dst, S_IRWXU) < 0) {
+				goto out;
+			}
+			snprintf(dst, sizeof(dst), "%s/hugepages/%s", dir, name);
+		} else {
+			snprintf(dst, sizeof(dst), "%s/%s", dir, name);
+		}
+		if (file_clone(src, dst) < 0) {
+			goto out;
+		}
+		if (tentry->flags & SGTB_TIERED) {
+			snprintf(dst, sizeof(dst), "%s/tier", dir);
+			if (!tiered++ && mkdir(dst, S_IRWXU) < 0) {
+				goto out;
+			}
+			m_tier_cold_path(src, i);
+			path2file(src, &name);
+			snprintf(dst, sizeof(dst), "%s/tier/%s", dir, name);
+			if (file_clone(src, dst) < 0) {
+				goto out;
+			}
+		}
+		nsegments++;
+	}
+	/* Written last: a snapshot without it is incomplete */
+	snprintf(dst, sizeof(dst), "%s/snapshot.info", dir);
+	if (!(info = fopen(dst, "w"))) {
+		goto out;
+	}
+	fprintf(info, "sqn %llu\nsegments %d\n", (unsigned long long) sqn, nsegments);
+	if (fflush(info) != 0 || fsync(fileno(info)) < 0) {
+		fclose(info);
+		goto out;
+	}
+	fclose(info);
+	rv = 0;
+out:
+	m_group_unlock();
+	pthread_mutex_unlock(&segment_change_mutex);
+	return rv;
+}
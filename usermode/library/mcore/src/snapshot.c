@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ * 
+ * \brief Snapshot gate: quiesces commits while a snapshot is taken.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "snapshot.h"
+#include "log/log_i.h"
+
+m_snapshot_gate_slot_t m_snapshot_gate[M_SNAPSHOT_GATE_SLOTS];
+volatile uint32_t      m_snapshot_closed = 0;
+__thread int           m_snapshot_slot = 0;
+
+static uint32_t        snapshot_next_slot = 0;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t snapshot_gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  snapshot_gate_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * \brief Gives the calling thread a slot; threads share slots round-robin
+ * once there are more threads than slots.
+ */
+int
+m_snapshot_slot_assign(void)
+{
+	m_snapshot_slot = (int) (__sync_fetch_and_add(&snapshot_next_slot, 1) % M_SNAPSHOT_GATE_SLOTS) + 1;
+	return m_snapshot_slot;
+}
+
+
+void
+m_snapshot_gate_wait(void)
+{
+	pthread_mutex_lock(&snapshot_gate_mutex);
+	while (m_snapshot_closed) {
+		pthread_cond_wait(&snapshot_gate_cond, &snapshot_gate_mutex);
+	}
+	pthread_mutex_unlock(&snapshot_gate_mutex);
+}
+
+
+/**
+ * \brief Closes the gate and waits until every commit in progress is done.
+ *
+ * Also keeps the truncation thread out so that the logs do not change 
+ * under the copy. Snapshots are taken one at a time.
+ */
+void
+m_snapshot_freeze(void)
+{
+	int i;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	pthread_mutex_lock(&snapshot_gate_mutex);
+	m_snapshot_closed = 1;
+	pthread_mutex_unlock(&snapshot_gate_mutex);
+	__sync_synchronize();
+	for (i=0; i<M_SNAPSHOT_GATE_SLOTS; i++) {
+		while (m_snapshot_gate[i].writers) {
+			sched_yield();
+		}
+	}
+	m_logmgr_lock();
+}
+
+
+void
+m_snapshot_thaw(void)
+{
+	m_logmgr_unlock();
+	pthread_mutex_lock(&snapshot_gate_mutex);
+	m_snapshot_closed = 0;
+	pthread_cond_broadcast(&snapshot_gate_cond);
+	pthread_mutex_unlock(&snapshot_gate_mutex);
+	pthread_mutex_unlock(&snapshot_mutex);
+}
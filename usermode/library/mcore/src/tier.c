@@ -0,0 +1,762 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ * 
+ * \brief Tiered segments: moves extents between persistent memory and 
+ * tier_dir (see tier.h).
+ *
+ * A background thread wakes up every tier_scan_interval_ms. Hot extents
+ * that no transaction wrote for tier_cold_after_s are demoted; cold 
+ * extents that have pages in the page cache again, that is that were
+ * accessed since they were demoted, are promoted. Writes to hot extents
+ * are seen when they are written back; reads are not, so an extent that
+ * is only read is demoted, faulted back on the next access and promoted
+ * again; pin it (m_ptier_pin) to keep it in persistent memory.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <debug.h>
+#include "mnemosyne.h"
+#include "files.h"
+#include "config.h"
+#include "snapshot.h"
+#include "hal/pcm_i.h"
+#include "tier.h"
+
+#define TIER_DIR mcore_runtime_settings.tier_dir
+
+/* Cold file: the extents, then the extent size, then a state byte each */
+#define TIER_HEADER_OFFSET(seg_size)         (seg_size)
+#define TIER_STATE_OFFSET(seg_size, extent)  ((seg_size) + sizeof(uint64_t) + (extent))
+
+m_tier_segment_t  *m_tier_segments[M_TIER_MAX_SEGMENTS];
+volatile int      m_tier_nsegments = 0;
+volatile uint32_t m_tier_scan = 0;
+
+/* Order: m_snapshot_freeze, then tier_mutex */
+static pthread_mutex_t tier_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tier_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  tier_thread_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       tier_thread;
+static int             tier_thread_running = 0;
+static int             tier_thread_stop = 0;
+static struct sigaction tier_old_segv;
+
+
+size_t
+m_tier_extent_size(void)
+{
+	size_t size = 4096;
+
+	while (size * 2 <= (size_t) mcore_runtime_settings.tier_extent_kb * 1024) {
+		size *= 2;
+	}
+	return size;
+}
+
+
+void
+m_tier_cold_path(char *path, uint32_t index)
+{
+	sprintf(path, "%s/%u.tier", TIER_DIR, index);
+}
+
+
+static
+int
+pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = pwrite(fd, buf, len, off)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf = (const char *) buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+
+static
+void
+tier_free(m_tier_segment_t *seg)
+{
+	if (seg->pm_fd >= 0) {
+		close(seg->pm_fd);
+	}
+	if (seg->cold_fd >= 0) {
+		close(seg->cold_fd);
+	}
+	free((void *) seg->state);
+	free((void *) seg->last_write);
+	free(seg);
+}
+
+
+/**
+ * \brief Starts tracking the tiered segment at [start, start+size) and 
+ * maps its cold extents over it.
+ *
+ * \param create if non-zero, the segment is new and its cold file is 
+ *  created with every extent hot.
+ * \return 0 on success, or -1 with errno set.
+ */
+int
+m_tier_attach(uint32_t index, uintptr_t start, size_t size, int prot, 
+              const char *pm_path, int create)
+{
+	m_tier_segment_t *seg;
+	char             path[256];
+	uint64_t         extent_size;
+	int              saved_errno;
+	int              e;
+	int              i;
+
+	if (!(seg = (m_tier_segment_t *) calloc(1, sizeof(m_tier_segment_t)))) {
+		return -1;
+	}
+	seg->pm_fd = seg->cold_fd = -1;
+	seg->start = start;
+	seg->end = start + size;
+	seg->prot = prot;
+	seg->index = index;
+	m_tier_cold_path(path, index);
+	if ((seg->pm_fd = open(pm_path, O_RDWR)) < 0) {
+		goto err;
+	}
+	if (create) {
+		mkdir_r(TIER_DIR, S_IRWXU);
+		if ((seg->cold_fd = open(path, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0) {
+			goto err;
+		}
+		extent_size = m_tier_extent_size();
+		if (ftruncate(seg->cold_fd, TIER_STATE_OFFSET(size, size / extent_size)) < 0 ||
+		    pwrite_all(seg->cold_fd, &extent_size, sizeof(extent_size), TIER_HEADER_OFFSET(size)) < 0 ||
+		    fdatasync(seg->cold_fd) < 0)
+		{
+			goto err;
+		}
+	} else {
+		if ((seg->cold_fd = open(path, O_RDWR)) < 0 ||
+		    pread(seg->cold_fd, &extent_size, sizeof(extent_size), TIER_HEADER_OFFSET(size)) != sizeof(extent_size))
+		{
+			goto err;
+		}
+	}
+	if (extent_size < 4096 || (extent_size & (extent_size - 1)) || size % extent_size) {
+		errno = EINVAL;
+		goto err;
+	}
+	seg->extent_size = (size_t) extent_size;
+	for (seg->extent_shift = 0; (1ULL << seg->extent_shift) < extent_size; seg->extent_shift++);
+	seg->nextents = (int) (size / extent_size);
+	seg->state = (volatile uint8_t *) calloc(seg->nextents, sizeof(uint8_t));
+	seg->last_write = (volatile uint32_t *) malloc(seg->nextents * sizeof(uint32_t));
+	if (!seg->state || !seg->last_write) {
+		goto err;
+	}
+	if (!create && 
+	    pread(seg->cold_fd, (void *) seg->state, seg->nextents, TIER_STATE_OFFSET(size, 0)) != seg->nextents)
+	{
+		goto err;
+	}
+	for (e = 0; e < seg->nextents; e++) {
+		seg->last_write[e] = m_tier_scan;
+		if (seg->state[e] != M_TIER_COLD) {
+			seg->state[e] = M_TIER_HOT;
+			continue;
+		}
+		if (mmap((void *) (start + ((uintptr_t) e << seg->extent_shift)), seg->extent_size, prot,
+		         MAP_SHARED|MAP_FIXED, seg->cold_fd, (off_t) e << seg->extent_shift) == MAP_FAILED)
+		{
+			goto err;
+		}
+		madvise((void *) (start + ((uintptr_t) e << seg->extent_shift)), seg->extent_size, MADV_RANDOM);
+	}
+
+	pthread_mutex_lock(&tier_mutex);
+	for (i = 0; i < M_TIER_MAX_SEGMENTS && m_tier_segments[i]; i++);
+	if (i == M_TIER_MAX_SEGMENTS) {
+		pthread_mutex_unlock(&tier_mutex);
+		errno = ENOSPC;
+		goto err;
+	}
+	m_tier_segments[i] = seg;
+	m_tier_nsegments++;
+	pthread_mutex_unlock(&tier_mutex);
+	return 0;
+
+err:
+	saved_errno = errno;
+	if (create) {
+		unlink(path);
+	}
+	tier_free(seg);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * \brief Stops tracking the tiered segment and removes its cold file.
+ *
+ * Nobody may be writing to the segment anymore.
+ */
+void
+m_tier_detach(uint32_t index)
+{
+	m_tier_segment_t *seg = NULL;
+	char             path[256];
+	int              i;
+
+	pthread_mutex_lock(&tier_mutex);
+	for (i = 0; i < M_TIER_MAX_SEGMENTS; i++) {
+		if (m_tier_segments[i] && m_tier_segments[i]->index == index) {
+			seg = m_tier_segments[i];
+			m_tier_segments[i] = NULL;
+			m_tier_nsegments--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tier_mutex);
+	if (seg) {
+		m_tier_cold_path(path, index);
+		unlink(path);
+		tier_free(seg);
+	}
+}
+
+
+/**
+ * \brief Writes back the pages of cold extents among lines, which are 
+ * sorted, and drops those lines. Records writes to hot extents.
+ *
+ * \return the number of lines left, for the caller to write back.
+ */
+int
+m_tier_flush_lines(uintptr_t *lines, int n)
+{
+	m_tier_segment_t *seg = NULL;
+	uintptr_t        run_start = 0;
+	uintptr_t        run_end = 0;
+	uintptr_t        page;
+	int              e;
+	int              i;
+	int              j;
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (!seg || lines[i] < seg->start || lines[i] >= seg->end) {
+			if (!(seg = m_tier_find(lines[i]))) {
+				lines[j++] = lines[i];
+				continue;
+			}
+		}
+		e = (int) ((lines[i] - seg->start) >> seg->extent_shift);
+		if (!(seg->state[e] & M_TIER_COLD)) {
+			seg->last_write[e] = m_tier_scan;
+			lines[j++] = lines[i];
+			continue;
+		}
+		page = lines[i] & ~((uintptr_t) PAGE_SIZE - 1);
+		if (page >= run_start && page < run_end) {
+			continue;
+		}
+		if (page != run_end) {
+			if (run_end > run_start) {
+				msync((void *) run_start, run_end - run_start, MS_SYNC);
+			}
+			run_start = page;
+		}
+		run_end = page + PAGE_SIZE;
+	}
+	if (run_end > run_start) {
+		msync((void *) run_start, run_end - run_start, MS_SYNC);
+	}
+	return j;
+}
+
+
+/**
+ * \brief Writes back the page holding addr if it is in a cold extent, or
+ * records a write to it if it is in a hot one.
+ *
+ * \return non-zero if the page was written back.
+ */
+int
+m_tier_writeback(uintptr_t addr)
+{
+	m_tier_segment_t *seg;
+	uintptr_t        page;
+	int              e;
+
+	if (!(seg = m_tier_find(addr))) {
+		return 0;
+	}
+	e = (int) ((addr - seg->start) >> seg->extent_shift);
+	if (!(seg->state[e] & M_TIER_COLD)) {
+		seg->last_write[e] = m_tier_scan;
+		return 0;
+	}
+	page = addr & ~((uintptr_t) PAGE_SIZE - 1);
+	msync((void *) page, PAGE_SIZE, MS_SYNC);
+	return 1;
+}
+
+
+/*
+ * Stores to an extent being moved fault while it is copied (see 
+ * tier_move). They wait for the move and are retried, on the mapping of
+ * the new tier; anything else goes to the previous handler.
+ */
+static
+void
+tier_segv(int sig, siginfo_t *info, void *ctx)
+{
+	uintptr_t        addr = (uintptr_t) info->si_addr;
+	m_tier_segment_t *seg = m_tier_find(addr);
+	int              e;
+
+	if (seg && (seg->prot & PROT_WRITE)) {
+		/* The move may be over already: the retry then succeeds */
+		e = (int) ((addr - seg->start) >> seg->extent_shift);
+		while (seg->state[e] & M_TIER_MOVING) {
+			sched_yield();
+		}
+		return;
+	}
+	if (tier_old_segv.sa_flags & SA_SIGINFO) {
+		tier_old_segv.sa_sigaction(sig, info, ctx);
+	} else if (tier_old_segv.sa_handler == SIG_DFL || tier_old_segv.sa_handler == SIG_IGN) {
+		/* The store faults again and gets the old disposition */
+		sigaction(SIGSEGV, &tier_old_segv, NULL);
+	} else {
+		tier_old_segv.sa_handler(sig);
+	}
+}
+
+
+/* Makes the extents writable again after a failed move */
+static
+void
+tier_unprotect(m_tier_segment_t *seg, int *extents, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		mprotect((void *) (seg->start + ((uintptr_t) extents[i] << seg->extent_shift)), 
+		         seg->extent_size, seg->prot);
+		seg->state[extents[i]] &= ~M_TIER_MOVING;
+	}
+}
+
+
+/**
+ * \brief Moves extents of seg to the cold tier (cold != 0) or back.
+ *
+ * Caller has frozen commits and holds tier_mutex; stores outside 
+ * transactions are held off by making the extents read-only. The 
+ * contents are copied and synced first, then the state bytes, and only
+ * then the mappings change; the copy left behind is released last.
+ */
+static
+int
+tier_move(m_tier_segment_t *seg, int *extents, int n, int cold)
+{
+	int     dst_fd = cold ? seg->cold_fd : seg->pm_fd;
+	int     src_fd = cold ? seg->pm_fd : seg->cold_fd;
+	size_t  size = seg->end - seg->start;
+	uint8_t state = cold ? M_TIER_COLD : M_TIER_HOT;
+	off_t   off;
+	void    *addr;
+	int     i;
+
+	if (n == 0) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		off = (off_t) extents[i] << seg->extent_shift;
+		seg->state[extents[i]] |= M_TIER_MOVING;
+		if (mprotect((void *) (seg->start + off), seg->extent_size, seg->prot & ~PROT_WRITE) < 0) {
+			tier_unprotect(seg, extents, i + 1);
+			return -1;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		off = (off_t) extents[i] << seg->extent_shift;
+		if (pwrite_all(dst_fd, (void *) (seg->start + off), seg->extent_size, off) < 0) {
+			goto err;
+		}
+	}
+	if (fdatasync(dst_fd) < 0) {
+		goto err;
+	}
+	for (i = 0; i < n; i++) {
+		if (pwrite_all(seg->cold_fd, &state, 1, TIER_STATE_OFFSET(size, extents[i])) < 0) {
+			goto err;
+		}
+	}
+	if (fdatasync(seg->cold_fd) < 0) {
+		M_INTERNALERROR("Cannot sync the state of tiered segment %u.\n", seg->index);
+	}
+	for (i = 0; i < n; i++) {
+		off = (off_t) extents[i] << seg->extent_shift;
+		addr = (void *) (seg->start + off);
+		if (mmap(addr, seg->extent_size, seg->prot, MAP_SHARED|MAP_FIXED, dst_fd, off) == MAP_FAILED) {
+			M_INTERNALERROR("Cannot remap extent %p of tiered segment %u.\n", addr, seg->index);
+		}
+		if (cold) {
+			/* Keep readahead from making neighbouring pages look accessed */
+			madvise(addr, seg->extent_size, MADV_RANDOM);
+			posix_fadvise(dst_fd, off, seg->extent_size, POSIX_FADV_DONTNEED);
+		}
+		fallocate(src_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, off, seg->extent_size);
+		seg->last_write[extents[i]] = m_tier_scan;
+		/* Writable again, through the new mapping: lets faulted stores go */
+		seg->state[extents[i]] = (seg->state[extents[i]] & M_TIER_PINNED) | state;
+	}
+	return 0;
+
+err:
+	tier_unprotect(seg, extents, n);
+	return -1;
+}
+
+
+/* Returns non-zero if a page of the cold extent e was accessed since it was demoted */
+static
+int
+tier_accessed(m_tier_segment_t *seg, int e)
+{
+	unsigned char vec[256];
+	uintptr_t     addr = seg->start + ((uintptr_t) e << seg->extent_shift);
+	uintptr_t     end = addr + seg->extent_size;
+	size_t        len;
+	size_t        i;
+
+	for (; addr < end; addr += len) {
+		len = end - addr;
+		if (len > sizeof(vec) * PAGE_SIZE) {
+			len = sizeof(vec) * PAGE_SIZE;
+		}
+		if (mincore((void *) addr, len, vec) < 0) {
+			return 0;
+		}
+		for (i = 0; i < len / PAGE_SIZE; i++) {
+			if (vec[i] & 1) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/* Candidates of a scan: extents to demote, then extents to promote */
+typedef struct tier_plan_s {
+	int *demote;
+	int ndemote;
+	int *promote;
+	int npromote;
+} tier_plan_t;
+
+
+/* Caller holds tier_mutex */
+static
+int
+tier_plan(m_tier_segment_t *seg, tier_plan_t *plan, int budget, uint32_t cold_after)
+{
+	uint32_t scan = m_tier_scan;
+	uint8_t  state;
+	int      e;
+
+	plan->ndemote = plan->npromote = 0;
+	for (e = 0; e < seg->nextents && plan->ndemote + plan->npromote < budget; e++) {
+		state = seg->state[e];
+		if (state & M_TIER_COLD) {
+			if (tier_accessed(seg, e)) {
+				plan->promote[plan->npromote++] = e;
+			}
+		} else if (!(state & M_TIER_PINNED) && cold_after && scan - seg->last_write[e] >= cold_after) {
+			plan->demote[plan->ndemote++] = e;
+		}
+	}
+	return plan->ndemote + plan->npromote;
+}
+
+
+/**
+ * \brief One pass of the tiering policy over every tiered segment.
+ */
+static
+void
+tier_scan_once(tier_plan_t *plan)
+{
+	m_tier_segment_t *seg;
+	uint32_t         cold_after = 0;
+	int              budget = mcore_runtime_settings.tier_migrate_per_scan;
+	int              i;
+
+	if (mcore_runtime_settings.tier_cold_after_s) {
+		cold_after = (uint32_t) ((uint64_t) mcore_runtime_settings.tier_cold_after_s * 1000 / 
+		                         mcore_runtime_settings.tier_scan_interval_ms);
+		if (cold_after == 0) {
+			cold_after = 1;
+		}
+	}
+	__sync_fetch_and_add(&m_tier_scan, 1);
+	for (i = 0; i < M_TIER_MAX_SEGMENTS && budget > 0; i++) {
+		/* Look without stopping commits first; most passes move nothing */
+		pthread_mutex_lock(&tier_mutex);
+		seg = m_tier_segments[i];
+		if (!seg || tier_plan(seg, plan, budget, cold_after) == 0) {
+			pthread_mutex_unlock(&tier_mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&tier_mutex);
+
+		m_snapshot_freeze();
+		pthread_mutex_lock(&tier_mutex);
+		if (m_tier_segments[i] == seg && tier_plan(seg, plan, budget, cold_after) > 0) {
+			if (tier_move(seg, plan->demote, plan->ndemote, 1) < 0 ||
+			    tier_move(seg, plan->promote, plan->npromote, 0) < 0) 
+			{
+				M_WARNING("Cannot move extents of tiered segment %u: %s\n", seg->index, strerror(errno));
+			}
+			budget -= plan->ndemote + plan->npromote;
+		}
+		pthread_mutex_unlock(&tier_mutex);
+		m_snapshot_thaw();
+	}
+}
+
+
+static
+void *
+tier_thread_main(void *arg)
+{
+	tier_plan_t     plan;
+	struct timespec ts;
+	int             budget = mcore_runtime_settings.tier_migrate_per_scan;
+
+	plan.demote = (int *) malloc(budget * sizeof(int));
+	plan.promote = (int *) malloc(budget * sizeof(int));
+	if (!plan.demote || !plan.promote) {
+		M_INTERNALERROR("Cannot allocate the tiering plan.\n");
+	}
+	pthread_mutex_lock(&tier_thread_mutex);
+	while (!tier_thread_stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long) (mcore_runtime_settings.tier_scan_interval_ms % 1000) * 1000000;
+		ts.tv_sec += mcore_runtime_settings.tier_scan_interval_ms / 1000 + ts.tv_nsec / 1000000000;
+		ts.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&tier_thread_cond, &tier_thread_mutex, &ts);
+		if (tier_thread_stop) {
+			break;
+		}
+		pthread_mutex_unlock(&tier_thread_mutex);
+		if (m_tier_nsegments) {
+			tier_scan_once(&plan);
+		}
+		pthread_mutex_lock(&tier_thread_mutex);
+	}
+	pthread_mutex_unlock(&tier_thread_mutex);
+	free(plan.demote);
+	free(plan.promote);
+	return NULL;
+}
+
+
+/**
+ * \brief Starts the tiering thread if tier_dir is set.
+ *
+ * Runs once the log manager is up: moving extents stops commits.
+ */
+m_result_t
+m_tiermgr_init(void)
+{
+	struct sigaction act;
+
+	if (TIER_DIR[0] == '\0' || tier_thread_running) {
+		return M_R_SUCCESS;
+	}
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = tier_segv;
+	act.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&act.sa_mask);
+	if (sigaction(SIGSEGV, &act, &tier_old_segv) < 0) {
+		return M_R_FAILURE;
+	}
+	if (pthread_create(&tier_thread, NULL, tier_thread_main, NULL) != 0) {
+		sigaction(SIGSEGV, &tier_old_segv, NULL);
+		return M_R_FAILURE;
+	}
+	tier_thread_running = 1;
+	return M_R_SUCCESS;
+}
+
+
+m_result_t
+m_tiermgr_fini(void)
+{
+	if (!tier_thread_running) {
+		return M_R_SUCCESS;
+	}
+	pthread_mutex_lock(&tier_thread_mutex);
+	tier_thread_stop = 1;
+	pthread_cond_signal(&tier_thread_cond);
+	pthread_mutex_unlock(&tier_thread_mutex);
+	pthread_join(tier_thread, NULL);
+	sigaction(SIGSEGV, &tier_old_segv, NULL);
+	tier_thread_running = 0;
+	return M_R_SUCCESS;
+}
+
+
+/* 
+ * Moves the extents of the tiered segment around [addr, addr+length) to 
+ * one tier and sets or clears their pin.
+ */
+static
+int
+tier_range(void *addr, size_t length, int cold, int pin)
+{
+	m_tier_segment_t *seg;
+	uintptr_t        start = (uintptr_t) addr;
+	int              *extents;
+	int              first;
+	int              last;
+	int              n = 0;
+	int              rv = 0;
+	int              e;
+
+	if (length == 0) {
+		return 0;
+	}
+	m_snapshot_freeze();
+	pthread_mutex_lock(&tier_mutex);
+	if (!(seg = m_tier_find(start)) || start + length > seg->end) {
+		errno = EINVAL;
+		rv = -1;
+		goto out;
+	}
+	first = (int) ((start - seg->start) >> seg->extent_shift);
+	last = (int) ((start + length - 1 - seg->start) >> seg->extent_shift);
+	if (!(extents = (int *) malloc((last - first + 1) * sizeof(int)))) {
+		rv = -1;
+		goto out;
+	}
+	for (e = first; e <= last; e++) {
+		if (pin > 0) {
+			seg->state[e] |= M_TIER_PINNED;
+		} else if (pin < 0) {
+			seg->state[e] &= ~M_TIER_PINNED;
+			seg->last_write[e] = m_tier_scan;
+			continue;
+		}
+		if (cold && (seg->state[e] & M_TIER_PINNED)) {
+			continue;
+		}
+		if (!!(seg->state[e] & M_TIER_COLD) != cold) {
+			extents[n++] = e;
+		}
+	}
+	rv = tier_move(seg, extents, n, cold);
+	free(extents);
+out:
+	pthread_mutex_unlock(&tier_mutex);
+	m_snapshot_thaw();
+	return rv;
+}
+
+
+int
+m_ptier_pin(void *addr, size_t length)
+{
+	return tier_range(addr, length, 0, 1);
+}
+
+
+int
+m_ptier_unpin(void *addr, size_t length)
+{
+	return tier_range(addr, length, 0, -1);
+}
+
+
+int
+m_ptier_demote(void *addr, size_t length)
+{
+	return tier_range(addr, length, 1, 0);
+}
+
+
+size_t
+m_ptier_cold_bytes(void)
+{
+	m_tier_segment_t *seg;
+	size_t           bytes = 0;
+	int              i;
+	int              e;
+
+	pthread_mutex_lock(&tier_mutex);
+	for (i = 0; i < M_TIER_MAX_SEGMENTS; i++) {
+		if ((seg = m_tier_segments[i])) {
+			for (e = 0; e < seg->nextents; e++) {
+				if (seg->state[e] & M_TIER_COLD) {
+					bytes += seg->extent_size;
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&tier_mutex);
+	return bytes;
+}
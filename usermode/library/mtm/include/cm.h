@@ -54,10 +54,121 @@
 #ifndef _CM_H
 #define _CM_H
 
+#include <sched.h>
+#include "cmsite.h"
+#include "config.h"
+
 #define CM_RESTART          1
 #define CM_RESTART_NO_LOAD  2
 #define CM_RESTART_LOCKED   3
 
+
+/* 
+ * Rank a transaction publishes in its write-set entries so that the karma
+ * and timestamp policies can compare themselves against a lock owner 
+ * without a pointer to the owner's descriptor.
+ */
+static inline
+uint32_t
+cm_rank(mtm_tx_t *tx)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
+
+	switch (mtm_cm_policy) {
+		case CM_POLICY_KARMA:
+			return (uint32_t) (tx->cm_karma + modedata->r_set.nb_entries + modedata->w_set.nb_entries);
+		case CM_POLICY_TIMESTAMP:
+			return tx->cm_birth;
+		default:
+			return 0;
+	}
+}
+
+
+/* 
+ * Returns non-zero if the transaction has priority over the owner of the
+ * lock. Equal ranks never win so that two transactions cannot wait on each
+ * other. Ranks published by the owner may be stale; waiting is bounded 
+ * anyway.
+ */
+static inline
+int
+cm_rank_wins(mtm_tx_t *tx, mtm_word_t l)
+{
+	w_entry_t *owner = (w_entry_t *) LOCK_GET_ADDR(l);
+	uint32_t  orank = owner->cm_rank;
+	uint32_t  rank = cm_rank(tx);
+
+	switch (mtm_cm_policy) {
+		case CM_POLICY_KARMA:
+			return rank > orank;
+		case CM_POLICY_TIMESTAMP:
+			/* Older transactions (smaller stamp) win; tolerates wrap-around */
+			return (int32_t) (orank - rank) > 0;
+		default:
+			return 0;
+	}
+}
+
+
+static inline
+void
+cm_backoff(mtm_tx_t *tx)
+{
+	unsigned long wait;
+	volatile int  j;
+
+	/* Simple RNG (good enough for backoff) */
+	tx->cm_seed ^= (tx->cm_seed << 17);
+	tx->cm_seed ^= (tx->cm_seed >> 13);
+	tx->cm_seed ^= (tx->cm_seed << 5);
+	wait = tx->cm_seed % tx->cm_backoff;
+	for (j = 0; j < wait; j++) {
+		/* Do nothing */
+	}
+	if (tx->cm_backoff < mtm_runtime_settings.cm_backoff_max) {
+		tx->cm_backoff <<= 1;
+	}
+}
+
+
+/*
+ * Called once per top-level transaction (not on retries, which restart 
+ * past _ITM_beginTransaction).
+ */
+static inline
+void
+cm_begin(mtm_tx_t *tx, _ITM_srcLocation *srcloc)
+{
+	uintptr_t key = srcloc ? (uintptr_t) srcloc : tx->cm_site_pc;
+
+	if (tx->cm_site == NULL || tx->cm_site->key != key) {
+		tx->cm_site = mtm_cm_site_get(key);
+	}
+	if (mtm_cm_policy == CM_POLICY_TIMESTAMP) {
+		tx->cm_birth = (uint32_t) __sync_add_and_fetch(&mtm_cm_birth_clock, 1);
+	}
+	if (mtm_cm_policy == CM_POLICY_ADAPTIVE && tx->cm_site->serialize) {
+		mtm_cm_site_acquire_token(tx->cm_site);
+		tx->cm_token = 1;
+	}
+}
+
+
+/*
+ * Called when the transaction leaves for good, either committed or aborted
+ * by the user.
+ */
+static inline
+void
+cm_end(mtm_tx_t *tx)
+{
+	if (tx->cm_token) {
+		mtm_cm_site_release_token(tx->cm_site);
+		tx->cm_token = 0;
+	}
+}
+
 static inline
 int 
 cm_conflict(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t *l)
@@ -65,6 +176,15 @@ cm_conflict(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t *l)
 	mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
 	w_entry_t   *w;
 
+	/*
+	 * A lazily committed owner only waits for the flusher, never for us:
+	 * have the flusher hurry up and wait for it instead of aborting.
+	 */
+	if (mtm_durable_pending && mtm_durable_owns((w_entry_t *) LOCK_GET_ADDR(*l))) {
+		*l = mtm_durable_wait(lock, *l);
+		return CM_RESTART_NO_LOAD;
+	}
+
 #if CM == CM_PRIORITY
 	if (tx->retries >= cm_threshold) {
 		if (LOCK_GET_PRIORITY(*l) < tx->priority ||
@@ -109,6 +229,23 @@ give_up:
 #elif CM == CM_DELAY
 	tx->c_lock = lock;
 #endif /* CM == CM_DELAY */
+
+	if (mtm_cm_policy == CM_POLICY_KARMA || mtm_cm_policy == CM_POLICY_TIMESTAMP) {
+		if (cm_rank_wins(tx, *l)) {
+			/* We have priority: wait (bounded) for the owner to commit or abort */
+			mtm_word_t lw;
+			int        spins;
+
+			for (spins = mtm_runtime_settings.cm_wait_spins; spins > 0; spins--) {
+				lw = ATOMIC_LOAD(lock);
+				if (lw != *l) {
+					*l = lw;
+					return CM_RESTART_NO_LOAD;
+				}
+				cpu_relax();
+			}
+		}
+	}
 	return CM_RESTART_LOCKED;
 }
 
@@ -161,6 +298,34 @@ cm_delay(mtm_tx_t *tx)
 		tx->c_lock = NULL;
 	}
 #endif /* CM == CM_DELAY || CM == CM_PRIORITY */
+
+	mtm_cm_site_record_abort(tx->cm_site, tx->retries);
+
+	switch (mtm_cm_policy) {
+		case CM_POLICY_BACKOFF:
+			cm_backoff(tx);
+			break;
+		case CM_POLICY_KARMA:
+			{
+				/* Work done by the aborted attempt carries over to the next one */
+				mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
+				tx->cm_karma += modedata->r_set.nb_entries + modedata->w_set.nb_entries;
+			}	
+			break;
+		case CM_POLICY_ADAPTIVE:
+			if (tx->cm_site->serialize) {
+				/* Hot site: retry while holding the site token rather than spinning */
+				if (!tx->cm_token) {
+					mtm_cm_site_acquire_token(tx->cm_site);
+					tx->cm_token = 1;
+				}
+			} else {
+				cm_backoff(tx);
+			}
+			break;
+		default:
+			break;
+	}
 }
 
 
@@ -178,9 +343,13 @@ static inline
 void
 cm_reset(mtm_tx_t *tx)
 {
-#if CM == CM_PRIORITY || defined(INTERNAL_STATS)
+	if (((++tx->cm_commits) & ((1 << CM_SITE_COMMIT_SAMPLE_LOG) - 1)) == 0) {
+		mtm_cm_site_record_commits(tx->cm_site, 1 << CM_SITE_COMMIT_SAMPLE_LOG, tx->retries);
+	}
+	cm_end(tx);
 	tx->retries = 0;
-#endif /* CM == CM_PRIORITY || defined(INTERNAL_STATS) */
+	tx->cm_karma = 0;
+	tx->cm_backoff = mtm_runtime_settings.cm_backoff_min;
 
 #if CM == CM_BACKOFF
 	/* Reset backoff */
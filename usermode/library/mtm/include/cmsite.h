@@ -0,0 +1,100 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file cmsite.h
+ *
+ * \brief Runtime contention manager selection and the per atomic-block
+ * (transaction site) abort profile the history-based managers rely on.
+ *
+ * A transaction site is identified by its _ITM_srcLocation when the compiler
+ * passes one, or else by the return address of _ITM_beginTransaction, which
+ * is unique per atomic block. Profiles live in a fixed-size open-addressing
+ * table that is never resized or freed, so a pointer to a site stays valid
+ * for the lifetime of the process and can be cached in the transaction 
+ * descriptor.
+ *
+ * Counters are updated without atomic operations on the commit path (they
+ * are heuristics, not statistics we report as exact), and commits are 
+ * sampled to keep the shared cache line cold for contention-free sites.
+ */
+
+#ifndef _MTM_CMSITE_H
+#define _MTM_CMSITE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CM_SITE_TABLE_SIZE          1024     /* Must be power of two */
+#define CM_SITE_COMMIT_SAMPLE_LOG   4        /* Record every 16th commit */
+
+/* 
+ * Contention management policies selectable at runtime through the 
+ * mtm.cm_policy setting. These compose with the compile-time CM; the 
+ * default (suicide) adds nothing on top of it.
+ */
+typedef enum mtm_cm_policy {
+	CM_POLICY_SUICIDE = 0,    /* Restart immediately */
+	CM_POLICY_BACKOFF,        /* Randomized exponential backoff before restart */
+	CM_POLICY_KARMA,          /* Transaction with more accumulated work waits, the other restarts */
+	CM_POLICY_TIMESTAMP,      /* Older transaction waits, the younger restarts */
+	CM_POLICY_ADAPTIVE        /* Per-site: backoff normally, serialize sites with high abort rate */
+} mtm_cm_policy_t;
+
+typedef struct mtm_cm_site_s mtm_cm_site_t;
+
+struct mtm_cm_site_s {
+	volatile uintptr_t     key;              /* Source location or PC of the atomic block; 0 if free */
+	volatile unsigned long win_commits;      /* Commits seen in current window (sampled) */
+	volatile unsigned long win_aborts;       /* Aborts seen in current window */
+	volatile unsigned long commits;          /* Total commits (sampled) */
+	volatile unsigned long aborts;           /* Total aborts */
+	volatile unsigned long max_retries;      /* Largest number of consecutive aborts seen */
+	volatile unsigned long serialized;       /* Number of times this site switched to serialized execution */
+	volatile int           serialize;        /* Adaptive policy decision: run instances one at a time */
+	volatile int           token;            /* Serialization token (test-and-test-and-set lock) */
+	char                   padding[0] __attribute__((aligned(64)));
+};
+
+
+extern mtm_cm_policy_t mtm_cm_policy;
+extern unsigned long    mtm_cm_birth_clock;
+
+void mtm_cm_init(void);
+mtm_cm_site_t *mtm_cm_site_get(uintptr_t key);
+void mtm_cm_site_record_abort(mtm_cm_site_t *site, unsigned long retries);
+void mtm_cm_site_record_commits(mtm_cm_site_t *site, unsigned long commits, unsigned long retries);
+void mtm_cm_site_acquire_token(mtm_cm_site_t *site);
+void mtm_cm_site_release_token(mtm_cm_site_t *site);
+void mtm_cm_site_report(FILE *stream);
+
+#endif /* _MTM_CMSITE_H */
@@ -39,7 +39,23 @@
 #define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)                        \
   ACTION(config, values, group, stats, bool, int, 0, CONFIG_NO_CHECK, 0)                     \
   ACTION(config, values, group, force_mode, string, char *, "pwbetl", CONFIG_NO_CHECK, 0)     \
-  ACTION(config, values, group, stats_file, string, char *, "mtm.stats", CONFIG_NO_CHECK, 0)
+  ACTION(config, values, group, stats_file, string, char *, "mtm.stats", CONFIG_NO_CHECK, 0)   \
+  ACTION(config, values, group, cm_policy, string, char *, "suicide", CONFIG_LIST_CHECK, 5,   \
+         "suicide", "backoff", "karma", "timestamp", "adaptive")                               \
+  ACTION(config, values, group, cm_backoff_min, int, int, 4, CONFIG_RANGE_CHECK, 1, 1 << 20)  \
+  ACTION(config, values, group, cm_backoff_max, int, int, 1 << 16, CONFIG_RANGE_CHECK, 1, 1 << 24) \
+  ACTION(config, values, group, cm_wait_spins, int, int, 1 << 12, CONFIG_RANGE_CHECK, 0, 1 << 24) \
+  ACTION(config, values, group, cm_adapt_window, int, int, 256, CONFIG_RANGE_CHECK, 16, 1 << 20) \
+  ACTION(config, values, group, cm_serialize_threshold, int, int, 50, CONFIG_RANGE_CHECK, 1, 100) \
+  ACTION(config, values, group, htm_fastpath, bool, int, 0, CONFIG_NO_CHECK, 0)              \
+  ACTION(config, values, group, htm_retries, int, int, 4, CONFIG_RANGE_CHECK, 1, 64)          \
+  ACTION(config, values, group, htm_max_writes, int, int, 64, CONFIG_RANGE_CHECK, 1, 4096)   \
+  ACTION(config, values, group, metrics, bool, int, 1, CONFIG_NO_CHECK, 0)                   \
+  ACTION(config, values, group, metrics_max_threads, int, int, 64, CONFIG_RANGE_CHECK, 1, 4096) \
+  ACTION(config, values, group, durable_window_us, int, int, 1000, CONFIG_RANGE_CHECK, 1, 1000000) \
+  ACTION(config, values, group, txlock_elide, bool, int, 0, CONFIG_NO_CHECK, 0)              \
+  ACTION(config, values, group, txlock_elide_retries, int, int, 2, CONFIG_RANGE_CHECK, 1, 1024) \
+  ACTION(config, values, group, txlock_spins, int, int, 1 << 12, CONFIG_RANGE_CHECK, 1, 1 << 24)
 
 
 typedef CONFIG_GROUP_STRUCT(mtm) mtm_config_t;
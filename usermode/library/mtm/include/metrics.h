@@ -0,0 +1,172 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file metrics.h
+ *
+ * \brief Always-on transaction latency histograms exported through shared
+ * memory.
+ *
+ * Every thread owns a slot of per-metric histograms in a POSIX shared
+ * memory object named /mnemosyne.<pid>, created at initialization. The
+ * owner is the only writer of its slot and updates it with plain stores;
+ * an external reader (tool/mnemostat) maps the object read-only and sums
+ * the slots while the process runs. Nothing is allocated after a thread
+ * acquires its slot.
+ *
+ * Histograms are log-linear (HDR style): values below 2^SUB_BITS get a
+ * bucket each, and every following power of two is split into 2^SUB_BITS
+ * equal buckets, bounding the relative error to 2^-SUB_BITS. Latencies
+ * are recorded in TSC cycles; the header stores a (tsc, CLOCK_MONOTONIC)
+ * pair so that a reader on the same machine can convert them to time.
+ */
+
+#ifndef _MTM_METRICS_H
+#define _MTM_METRICS_H
+
+#include <stdint.h>
+
+#define MTM_METRICS_MAGIC        0x5343495254454d4dULL  /* "MMETRICS" */
+#define MTM_METRICS_VERSION      1
+#define MTM_METRICS_SHM_FMT      "/mnemosyne.%d"
+
+#define MTM_METRICS_SUB_BITS     4
+#define MTM_METRICS_SUB_COUNT    (1 << MTM_METRICS_SUB_BITS)
+#define MTM_METRICS_NUM_BUCKETS  ((64 - MTM_METRICS_SUB_BITS + 1) * MTM_METRICS_SUB_COUNT)
+
+#define MTM_METRICS_SLOT_FREE    0
+#define MTM_METRICS_SLOT_ACTIVE  1
+#define MTM_METRICS_SLOT_EXITED  2
+
+/** The histograms kept per thread: name and unit of the recorded values. */
+#define FOREACH_METRICS_HIST(ACTION)                                        \
+  ACTION(xact_latency, cycles)      /* begin to commit, including retries */\
+  ACTION(log_flush, cycles)         /* making the redo log durable */       \
+  ACTION(trunc_wait, cycles)        /* waiting for log truncation */        \
+  ACTION(wset_size, entries)        /* write-set entries at commit */
+
+typedef enum {
+#define METRICSENTRY(name, unit) mtm_metrics_##name##_hist,
+	FOREACH_METRICS_HIST (METRICSENTRY)
+#undef METRICSENTRY	
+	mtm_metrics_numofhists
+} mtm_metrics_histentry_t; 
+
+
+typedef struct mtm_metrics_hist_s {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[MTM_METRICS_NUM_BUCKETS];
+} mtm_metrics_hist_t;
+
+
+typedef struct mtm_metrics_slot_s {
+	volatile uint32_t  state;    /* MTM_METRICS_SLOT_* */
+	uint32_t           tid;      /* Kernel thread id of the (last) owner */
+	uint64_t           commits;
+	uint64_t           aborts;
+	uint64_t           pad[5];
+	mtm_metrics_hist_t hist[mtm_metrics_numofhists];
+} __attribute__((aligned(64))) mtm_metrics_slot_t;
+
+
+typedef struct mtm_metrics_shm_s {
+	uint64_t           magic;
+	uint32_t           version;
+	uint32_t           nb_slots;
+	uint32_t           nb_hists;
+	uint32_t           nb_buckets;
+	uint32_t           sub_bits;
+	int32_t            pid;
+	uint64_t           start_tsc;
+	uint64_t           start_ns;  /* CLOCK_MONOTONIC at start_tsc */
+	uint64_t           pad[3];
+	mtm_metrics_slot_t slots[];
+} mtm_metrics_shm_t;
+
+
+static inline
+unsigned int
+mtm_metrics_bucket(uint64_t val)
+{
+	unsigned int msb;
+	unsigned int shift;
+
+	if (val < MTM_METRICS_SUB_COUNT) {
+		return (unsigned int) val;
+	}
+	msb = 63 - __builtin_clzll(val);
+	shift = msb - MTM_METRICS_SUB_BITS;
+	return ((shift + 1) << MTM_METRICS_SUB_BITS) + 
+	       (unsigned int) ((val >> shift) - MTM_METRICS_SUB_COUNT);
+}
+
+
+/** \brief Smallest value that falls in bucket idx. */
+static inline
+uint64_t
+mtm_metrics_bucket_low(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < MTM_METRICS_SUB_COUNT) {
+		return idx;
+	}
+	shift = (idx >> MTM_METRICS_SUB_BITS) - 1;
+	return ((uint64_t) ((idx & (MTM_METRICS_SUB_COUNT - 1)) + MTM_METRICS_SUB_COUNT)) << shift;
+}
+
+
+static inline
+void
+mtm_metrics_record(mtm_metrics_slot_t *slot, 
+                   mtm_metrics_histentry_t entry, 
+                   uint64_t val)
+{
+	mtm_metrics_hist_t *hist = &slot->hist[entry];
+
+	hist->buckets[mtm_metrics_bucket(val)]++;
+	hist->count++;
+	hist->sum += val;
+	if (val > hist->max) {
+		hist->max = val;
+	}
+}
+
+
+void mtm_metrics_init(void);
+void mtm_metrics_fini(void);
+mtm_metrics_slot_t *mtm_metrics_slot_acquire(uint32_t tid);
+void mtm_metrics_slot_release(mtm_metrics_slot_t *slot);
+
+#endif /* _MTM_METRICS_H */
@@ -189,9 +189,22 @@ void insert_write_set_entry_after(w_entry_t* new_entry,
 	mode_data_t* modedata = (mode_data_t *) transaction->modedata[transaction->mode];
 	modedata->w_set.nb_entries++;
 
+	/* Publish our rank for transactions that conflict on this entry's lock. */
+	new_entry->cm_rank = cm_rank(transaction);
+
 	/* Write the new entry to the persistent TM log as well? */
 	if (new_entry->is_nonvolatile) {
-		M_TMLOG_WRITE(transaction->pcm_storeset, modedata->ptmlog, (uintptr_t) new_entry->addr, new_entry->value, new_entry->mask);
+		/* First write to this cache line: remember it for write-back at commit. */
+		if (cache_neighbor == NULL) {
+			mtm_dirtyset_add(&modedata->dirty_lines, (uintptr_t) new_entry->addr);
+		}
+		/*
+		 * Inside an RTM region the log is written after xend (see pwb_htm_end);
+		 * the flusher writes it for lazy-durable transactions (see durable.c).
+		 */
+		if (!transaction->htm_active && !transaction->lazy_active) {
+			M_TMLOG_WRITE(transaction->pcm_storeset, modedata->ptmlog, (uintptr_t) new_entry->addr, new_entry->value, new_entry->mask);
+		}
 	}
 }
 
@@ -243,6 +256,271 @@ matching_write_set_entry(w_entry_t* const list_head,
 }
 
 
+/**
+ * \brief Write barrier used inside an RTM region.
+ *
+ * Same bookkeeping as pwb_write_internal but without atomic operations,
+ * contention management or timestamps: the hardware makes the lock
+ * acquisition atomic with the rest of the region and aborts it if a
+ * software transaction touches one of the locks. Anything that would make
+ * the software path wait or restart aborts the region instead. The
+ * persistent log is not written here (see insert_write_set_entry_after).
+ */
+static inline
+w_entry_t *
+pwb_htm_write(mtm_tx_t *tx,
+              mode_data_t *modedata,
+              volatile mtm_word_t *addr,
+              mtm_word_t value,
+              mtm_word_t mask)
+{
+	volatile mtm_word_t *lock;
+	mtm_word_t          l;
+	w_entry_t           *w;
+	w_entry_t           *write_set_head;
+	w_entry_t           *write_set_tail = NULL;
+	w_entry_t           *last_entry_in_same_cache_block = NULL;
+	int                 access_is_nonvolatile;
+
+	if (((uintptr_t) addr >= PSEGMENT_RESERVED_REGION_START &&
+	     (uintptr_t) addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
+	{
+		access_is_nonvolatile = 1;
+	} else {
+		access_is_nonvolatile = 0;
+		/* Stack: the hardware undoes it on abort. */
+		if ((uintptr_t) addr <= tx->stack_base && 
+			(uintptr_t) addr > tx->stack_base - tx->stack_size)
+		{
+			if (mask == 0) {
+				return NULL;
+			}
+			if (mask != ~(mtm_word_t)0) {
+				value = (*addr & ~mask) | (value & mask);
+			}	
+			*addr = value;
+			return NULL;
+		}
+	}
+
+	lock = GET_LOCK(addr);
+	l = *lock;
+	if (LOCK_GET_OWNED(l)) {
+		write_set_head = (w_entry_t *) LOCK_GET_ADDR(l);
+		if (!(modedata->w_set.entries <= write_set_head &&
+		      write_set_head < modedata->w_set.entries + modedata->w_set.nb_entries))
+		{
+			mtm_rtm_abort(MTM_HTM_ABORT_LOCKED);
+		}
+		w = matching_write_set_entry(write_set_head, addr, &write_set_tail, &last_entry_in_same_cache_block);
+		if (w != NULL) {
+			if (mask != 0) {
+				mask_new_value(w, addr, value, mask);
+			}
+			return w;
+		}
+		if (modedata->w_set.nb_entries >= mtm_htm_max_writes) {
+			mtm_rtm_abort(MTM_HTM_ABORT_WSET_FULL);
+		}
+		w = &modedata->w_set.entries[modedata->w_set.nb_entries];
+		initialize_write_set_entry(w, addr, value, mask, write_set_tail->version, lock, access_is_nonvolatile);
+		insert_write_set_entry_after(w, write_set_tail, tx, last_entry_in_same_cache_block);
+		return w;
+	}
+
+	if (modedata->w_set.nb_entries >= mtm_htm_max_writes) {
+		mtm_rtm_abort(MTM_HTM_ABORT_WSET_FULL);
+	}
+	w = &modedata->w_set.entries[modedata->w_set.nb_entries];
+	initialize_write_set_entry(w, addr, value, mask, LOCK_GET_TIMESTAMP(l), lock, access_is_nonvolatile);
+# if CM == CM_PRIORITY
+	*lock = LOCK_SET_ADDR((mtm_word_t)w, tx->priority);
+# else
+	*lock = LOCK_SET_ADDR((mtm_word_t)w);
+# endif
+	insert_write_set_entry_after(w, NULL, tx, NULL);
+	return w;
+}
+
+
+/**
+ * \brief Read barrier used inside an RTM region.
+ *
+ * Reading the lock word puts it in the hardware read set, so a software
+ * writer that later acquires it aborts the region. No read set and no
+ * timestamp checks are needed.
+ */
+static inline
+mtm_word_t
+pwb_htm_load(mtm_tx_t *tx, mode_data_t *modedata, volatile mtm_word_t *addr)
+{
+	mtm_word_t l;
+	w_entry_t  *w;
+
+	if (!((uintptr_t) addr >= PSEGMENT_RESERVED_REGION_START &&
+	      (uintptr_t) addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
+	{
+		if ((uintptr_t) addr <= tx->stack_base && 
+			(uintptr_t) addr > tx->stack_base - tx->stack_size)
+		{
+			return *addr;
+		}
+	}
+
+	l = *GET_LOCK(addr);
+	if (LOCK_GET_OWNED(l)) {
+		w = (w_entry_t *) LOCK_GET_ADDR(l);
+		if (!(modedata->w_set.entries <= w && 
+		      w < modedata->w_set.entries + modedata->w_set.nb_entries))
+		{
+			mtm_rtm_abort(MTM_HTM_ABORT_LOCKED);
+		}
+		for (; w != NULL; w = w->next) {
+			if (addr == w->addr) {
+				return (w->mask == 0 ? *addr : w->value);
+			}
+		}
+	}
+	return *addr;
+}
+
+
+/*
+ * Extend the snapshot of a read-only transaction. Only possible while all
+ * its reads fit in the inline read set; otherwise the transaction is
+ * bound to its start timestamp.
+ */
+static inline
+int
+pwb_ro_extend(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	r_entry_t  *r;
+	mtm_word_t now;
+	mtm_word_t l;
+	int        i;
+
+	if (modedata->ro_nb_entries > PWB_RO_RSET_SIZE) {
+		return 0;
+	}
+	now = GET_CLOCK;
+#ifdef ROLLOVER_CLOCK
+	if (now >= VERSION_MAX) {
+		return 0;
+	}
+#endif /* ROLLOVER_CLOCK */
+	r = modedata->ro_entries;
+	for (i = modedata->ro_nb_entries; i > 0; i--, r++) {
+		l = ATOMIC_LOAD(r->lock);
+		if (LOCK_GET_OWNED(l) || LOCK_GET_TIMESTAMP(l) != r->version) {
+			return 0;
+		}
+	}
+	modedata->end = now;
+	return 1;
+}
+
+
+/**
+ * \brief Read barrier of a read-only snapshot transaction.
+ *
+ * Reads are checked against the snapshot [start, end] only. The first
+ * PWB_RO_RSET_SIZE reads are remembered in an inline buffer so that the
+ * snapshot can be extended and the transaction upgraded if it writes;
+ * nothing is ever added to the r_set.
+ */
+static inline
+mtm_word_t
+pwb_ro_load(mtm_tx_t *tx, mode_data_t *modedata, volatile mtm_word_t *addr)
+{
+	volatile mtm_word_t *lock;
+	mtm_word_t          l;
+	mtm_word_t          l2;
+	mtm_word_t          value;
+	mtm_word_t          version;
+	r_entry_t           *r;
+
+	if (!((uintptr_t) addr >= PSEGMENT_RESERVED_REGION_START &&
+	      (uintptr_t) addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
+	{
+		if ((uintptr_t) addr <= tx->stack_base && 
+			(uintptr_t) addr > tx->stack_base - tx->stack_size)
+		{
+			return ATOMIC_LOAD(addr);
+		}
+	}
+
+	lock = GET_LOCK(addr);
+restart:
+	l = ATOMIC_LOAD_ACQ(lock);
+restart_no_load:
+	if (LOCK_GET_OWNED(l)) {
+		/* A writer is committing (or may commit) a newer version; we own no locks. */
+		switch (cm_conflict(tx, lock, &l)) {
+			case CM_RESTART:
+				goto restart;
+			case CM_RESTART_NO_LOAD:
+				goto restart_no_load;
+			case CM_RESTART_LOCKED:
+#ifdef _M_STATS_BUILD
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+#endif					
+				mtm_pwb_restart_transaction(tx, RESTART_LOCKED_READ);
+		}
+		assert(0);
+	}
+	value = ATOMIC_LOAD_ACQ(addr);
+	l2 = ATOMIC_LOAD_ACQ(lock);
+	if (l != l2) {
+		l = l2;
+		goto restart_no_load;
+	}
+	version = LOCK_GET_TIMESTAMP(l);
+	if (version > modedata->end) {
+		if (!pwb_ro_extend(tx, modedata)) {
+#ifdef _M_STATS_BUILD
+			m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+#endif					
+			mtm_pwb_restart_transaction(tx, RESTART_VALIDATE_READ);
+		}
+		l = ATOMIC_LOAD_ACQ(lock);
+		if (l != l2) {
+			goto restart_no_load;
+		}
+	}
+	if (modedata->ro_nb_entries < PWB_RO_RSET_SIZE) {
+		r = &modedata->ro_entries[modedata->ro_nb_entries];
+		r->version = version;
+		r->lock = lock;
+	}
+	modedata->ro_nb_entries++;
+	return value;
+}
+
+
+/*
+ * A read-only transaction is about to write. If all its reads were
+ * recorded, they move to the r_set and the transaction carries on as an
+ * ordinary update transaction; otherwise it restarts as one.
+ */
+static inline
+void
+pwb_ro_upgrade(mtm_tx_t *tx, mode_data_t *modedata)
+{
+#ifdef _M_STATS_BUILD
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, ro_upgrades, 1);
+#endif					
+	if (modedata->ro_nb_entries > PWB_RO_RSET_SIZE) {
+		tx->ro = 0;
+		mtm_pwb_restart_transaction(tx, RESTART_NOT_READONLY);
+	}
+	assert(modedata->r_set.size >= PWB_RO_RSET_SIZE);
+	memcpy(modedata->r_set.entries, modedata->ro_entries, modedata->ro_nb_entries * sizeof(r_entry_t));
+	modedata->r_set.nb_entries = modedata->ro_nb_entries;
+	tx->ro_active = 0;
+	M_TMLOG_BEGIN(modedata->ptmlog);
+}
+
+
 /**
  * \brief Store a masked value of size less than or equal to a word, creating or
  * updating a write-set entry as necessary.
@@ -300,6 +578,10 @@ pwb_write_internal(mtm_tx_t *tx,
 		assert(0);
 	}
 
+	if (tx->htm_active) {
+		return pwb_htm_write(tx, modedata, addr, value, mask);
+	}
+
 #if 0
 /* ENABLES NULL BARRIERS */
 	{
@@ -382,6 +664,11 @@ pwb_write_internal(mtm_tx_t *tx,
 		}
 	}
 
+
+	/* Writes that need isolation end the read-only phase. */
+	if (tx->ro_active) {
+		pwb_ro_upgrade(tx, modedata);
+	}
 	
 #ifdef _M_STATS_BUILD
 	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes, 1);
@@ -429,7 +716,7 @@ restart_no_load:
 				if (matching_entry->mask != 0) {
 					mask_new_value(matching_entry, addr, value, mask);
 					/* Write out the entry to the persistent TM log? */
-					if (access_is_nonvolatile) {
+					if (access_is_nonvolatile && !tx->lazy_active) {
 						M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) matching_entry->addr, matching_entry->value, matching_entry->mask);
 					}	
 				}
@@ -595,6 +882,13 @@ pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 	}
 	assert(tx->status == TX_ACTIVE);
 
+	if (tx->htm_active) {
+		return pwb_htm_load(tx, modedata, addr);
+	}
+	if (tx->ro_active) {
+		return pwb_ro_load(tx, modedata, addr);
+	}
+
 #if 0
 /* ENABLES NULL BARRIERS */
 
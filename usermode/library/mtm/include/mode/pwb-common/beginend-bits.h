@@ -58,10 +58,87 @@
 #include <pwb_i.h>
 #include <rwset.h>
 #include <cm.h>
+#include <snapshot.h>
 
 //#define PRINT_DEBUG printf
 //#define MTM_DEBUG_PRINT printf
 
+/*
+ * Writes the persistent log records of the write set that the barriers
+ * deferred (see pwb_htm_end and the lazy-durable commit).
+ */
+static inline
+void
+pwb_log_wset(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	w_entry_t *w;
+	int       i;
+
+	w = modedata->w_set.entries;
+	for (i = modedata->w_set.nb_entries; i > 0; i--, w++) {
+		if (w->is_nonvolatile && w->mask != 0) {
+			M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, w->value, w->mask);
+		}
+	}
+}
+
+
+/*
+ * Leaves the RTM region of a hardware transaction. From here on the
+ * transaction is an ordinary pwbetl transaction that owns all its write
+ * locks and has an empty read set (xend validated the reads), so it only
+ * needs the persistent log records the barriers deferred. A location
+ * written several times is logged once, with its final value.
+ */
+static inline
+void
+pwb_htm_end(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	mtm_rtm_end();
+	tx->htm_active = 0;
+	tx->ro_active = 0;
+	tx->htm_commits++;
+
+	pwb_log_wset(tx, modedata);
+}
+
+
+/*
+ * Truncation waits are accumulated by the physical log while the
+ * transaction writes and flushes (asynchronous truncation) or measured
+ * around the synchronous truncation at commit; either way the total since
+ * begin is what the transaction waited.
+ */
+static inline
+void
+pwb_metrics_begin(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	tx->metrics_begin = hrtime_cycles();
+	tx->metrics_trunc_wait = 0;
+	tx->metrics_trunc_base = M_TMLOG_PHLOG(modedata->ptmlog)->stat_wait_time_for_trunc;
+}
+
+
+static inline
+void
+pwb_metrics_commit(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	mtm_metrics_slot_t *slot = tx->metrics;
+	uint64_t           wait;
+
+	wait = tx->metrics_trunc_wait + 
+	       HRTIME_NS2CYCLE(M_TMLOG_PHLOG(modedata->ptmlog)->stat_wait_time_for_trunc - 
+	                       tx->metrics_trunc_base);
+	mtm_metrics_record(slot, mtm_metrics_xact_latency_hist, 
+	                   hrtime_cycles() - tx->metrics_begin);
+	mtm_metrics_record(slot, mtm_metrics_wset_size_hist, modedata->w_set.nb_entries);
+	if (wait) {
+		mtm_metrics_record(slot, mtm_metrics_trunc_wait_hist, wait);
+	}
+	slot->commits++;
+}
+
+
 static inline 
 bool
 pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
@@ -73,6 +150,7 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 	w_entry_t   *w;
 	mtm_word_t  t;
 	int         i;
+	uint64_t    now;
 #ifdef READ_LOCKED_DATA
 	mtm_word_t  id;
 #endif /* READ_LOCKED_DATA */
@@ -88,9 +166,19 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 		return true;
 	}	
 
+	if (tx->htm_active) {
+		pwb_htm_end(tx, modedata);
+	}
+
 	if (modedata->w_set.nb_entries > 0) {
 		/* Update transaction */
 
+		/* 
+		 * From taking the commit timestamp until the data is durable a
+		 * snapshot must wait for us (see snapshot.h).
+		 */
+		m_snapshot_gate_enter();
+
 		/* Get commit timestamp */
 		t = FETCH_INC_CLOCK + 1;
 		if (t >= VERSION_MAX) {
@@ -102,6 +190,7 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 # ifdef INTERNAL_STATS
 			tx->aborts_rollover++;
 # endif /* INTERNAL_STATS */
+			m_snapshot_gate_exit();
 			return false;
 #else /* ! ROLLOVER_CLOCK */
 			fprintf(stderr, "Exceeded maximum version number: 0x%lx\n", (unsigned long)t);
@@ -121,10 +210,37 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 #ifdef INTERNAL_STATS
 				tx->aborts_validate_commit++;
 #endif /* INTERNAL_STATS */
+				m_snapshot_gate_exit();
 				return false;
 			}
 		}
 
+		if (tx->lazy_active && !mtm_useraction_list_empty(tx->commit_action_list)) {
+			/*
+			 * Commit actions run on this thread right after commit, and 
+			 * some must not before the data is durable: a pfree'd block
+			 * could be reused and durably overwritten while a crash can 
+			 * still undo the free. Commit eagerly instead.
+			 */
+			pwb_log_wset(tx, modedata);
+			tx->lazy_active = 0;
+		}
+		if (tx->lazy_active) {
+			/*
+			 * Keep the locks and leave logging and write-back to the
+			 * flusher. Volatile data need not wait for it.
+			 */
+			w = modedata->w_set.entries;
+			for (i = modedata->w_set.nb_entries; i > 0; i--, w++) {
+				if (!w->is_nonvolatile && w->mask != 0) {
+					PCM_WB_STORE_ALIGNED_MASKED(tx->pcm_storeset, w->addr, w->value, w->mask);
+				}
+			}
+			mtm_durable_enqueue(tx, modedata, t);
+			m_snapshot_gate_exit();
+			goto committed;
+		}
+
 # ifdef READ_LOCKED_DATA
 		/* Update instance number (becomes odd) */
 		id = tx->id;
@@ -133,7 +249,14 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 # endif /* READ_LOCKED_DATA */
 
 		/* Make sure the persistent tm log is made stable */
-		M_TMLOG_COMMIT(tx->pcm_storeset, modedata->ptmlog, t);
+		if (tx->metrics) {
+			now = hrtime_cycles();
+			M_TMLOG_COMMIT(tx->pcm_storeset, modedata->ptmlog, t);
+			mtm_metrics_record(tx->metrics, mtm_metrics_log_flush_hist, 
+			                   hrtime_cycles() - now);
+		} else {
+			M_TMLOG_COMMIT(tx->pcm_storeset, modedata->ptmlog, t);
+		}
 
 		/* Make sure previous stores are not reordered with the cl-flushes below  freud : unnecessary fence */
 		/* PCM_WB_FENCE(tx->pcm_storeset);  moved this info M_TMLOG_COMMIT. It replaces PCM_NT_FLUSH in m_tmlog_base_? */
@@ -151,34 +274,23 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 			if (w->mask != 0) {
 				PCM_WB_STORE_ALIGNED_MASKED(tx->pcm_storeset, w->addr, w->value, w->mask);
 			}	
-# ifdef	SYNC_TRUNCATION
-			/* Flush the cacheline to persistent memory if this is the last entry in this cache line. */
-			if (w->next_cache_neighbor == NULL) {
-				/* If isolation is enabled, then the write set may contain non-persistent 
-				 * writes as well. Need to filter those out as we don't need to flush them 
-				 * out of the cache.
-				 * FIXME: Would it be better if we had marked them as non-persistent and
-				 *        avoid the bounds checking?
-				 */
-				if (enable_isolation) {
-					if (((uintptr_t) w->addr >= PSEGMENT_RESERVED_REGION_START &&
-						 (uintptr_t) w->addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
-					{
-						/* access is persistent -- flush, freud : why flush individual entries ? */
-						PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
-						wbflush_cnt++;
-					}
-				} else {
-					PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
-					wbflush_cnt++;
-				}
-			}	
-# endif
 			/* Only drop lock for last covered address in write set */
 			if (w->next == NULL) {
 				ATOMIC_STORE_REL(w->lock, LOCK_SET_TIMESTAMP(t));
 			}	
 		}
+# ifdef	SYNC_TRUNCATION
+		/* 
+		 * Write back the dirty cachelines in a separate pass so that the
+		 * write-backs issue back-to-back. With CLWB/CLFLUSHOPT they overlap
+		 * in the memory system and the single fence below waits for all of
+		 * them. The log is already durable, so releasing the locks above
+		 * before the data is written back is safe. Only the persistent
+		 * lines recorded by the write barrier are visited, once each and
+		 * in address order.
+		 */
+		wbflush_cnt = mtm_dirtyset_flush(tx->pcm_storeset, &modedata->dirty_lines);
+# endif
 		PCM_WB_FENCE(tx->pcm_storeset);
 #ifdef _M_STATS_BUILD
 		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, wbflush, wbflush_cnt);
@@ -191,13 +303,24 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 # endif /* READ_LOCKED_DATA */
 
 # ifdef	SYNC_TRUNCATION
+		if (tx->metrics) {
+			now = hrtime_cycles();
 			M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
+			tx->metrics_trunc_wait += hrtime_cycles() - now;
+		} else {
+			M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
+		}
 # endif
+		m_snapshot_gate_exit();
+	}
+
+committed:
+	if (tx->metrics) {
+		pwb_metrics_commit(tx, modedata);
 	}
 
 #ifdef _M_STATS_BUILD	
 	m_stats_threadstat_aggregate(tx->threadstat, tx->statset);
-	assert(m_stats_statset_destroy(&tx->statset) == M_R_SUCCESS);
 #endif	
 
 	cm_reset(tx);
@@ -227,11 +350,14 @@ pwb_rollback(mtm_tx_t *tx)
 	/* Check status */
 	assert(tx->status == TX_ACTIVE);
 
-	/* Mark the transaction in the persistent log as aborted. */
-	M_TMLOG_ABORT(tx->pcm_storeset, modedata->ptmlog, 0);
+	/* Mark the transaction in the persistent log as aborted. A read-only
+	 * transaction never wrote to the log. */
+	if (!tx->ro_active) {
+		M_TMLOG_ABORT(tx->pcm_storeset, modedata->ptmlog, 0);
 # ifdef	SYNC_TRUNCATION
-	M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
+		M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
 # endif
+	}
 
 	/* Drop locks */
 	i = modedata->w_set.nb_entries;
@@ -265,6 +391,9 @@ pwb_rollback(mtm_tx_t *tx)
 	}
 
 	tx->retries++;
+	if (tx->metrics) {
+		tx->metrics->aborts++;
+	}
 #ifdef INTERNAL_STATS
 	tx->aborts++;
 	if (tx->max_retries < tx->retries) {
@@ -350,10 +479,16 @@ start:
 	
 	modedata->w_set.nb_entries = 0;
 	modedata->r_set.nb_entries = 0;
+	mtm_dirtyset_clear(&modedata->dirty_lines);
+	modedata->ro_nb_entries = 0;
+	tx->ro_active = tx->ro;
 	mtm_useraction_clear (tx->commit_action_list);
 	mtm_useraction_clear (tx->undo_action_list);
 
-	M_TMLOG_BEGIN(modedata->ptmlog);
+	/* Read-only transactions begin the log only if they upgrade. */
+	if (!tx->ro_active) {
+		M_TMLOG_BEGIN(modedata->ptmlog);
+	}
 
 #ifdef EPOCH_GC
 	gc_set_epoch(modedata->start);
@@ -387,13 +522,28 @@ beginTransaction_internal (mtm_tx_t *tx,
 	memcpy(&tx->jb, &tx->tmp_jb, sizeof(jmp_buf));
 	*__env = &(tx->jb);
 	tx->prop = prop;
+	/* Declared (or compiler-detected) read-only transactions run as snapshots. */
+	tx->ro = enable_isolation && (tx->ro_next || (prop & pr_readOnly));
+	tx->ro_next = 0;
+#ifdef READ_LOCKED_DATA
+	/* Readers peek into the owner's write set, which the flusher takes over */
+	tx->lazy_active = 0;
+#else
+	tx->lazy_active = enable_isolation && (tx->lazy_next || tx->lazy);
+#endif
+	tx->lazy_next = 0;
 
 	/* Initialize transaction descriptor */
 	pwb_prepare_transaction(tx);
+	cm_begin(tx, srcloc);
+	if (tx->metrics) {
+		pwb_metrics_begin(tx, (mode_data_t *) tx->modedata[tx->mode]);
+	}
 
 #ifdef _M_STATS_BUILD	
-	assert(m_stats_statset_create(&tx->statset) == M_R_SUCCESS);
-	assert(m_stats_statset_init(tx->statset, NULL /*srcloc->psource*/) == M_R_SUCCESS);
+	/* The statset is embedded in the descriptor: no allocation per transaction */
+	tx->statset = &tx->statset_inst;
+	m_stats_statset_init(tx->statset, NULL /*srcloc->psource*/);
 #endif	
 
 	if ((prop & pr_doesGoIrrevocable) || !(prop & pr_instrumentedCode))
@@ -0,0 +1,204 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file dirtyset.h
+ *
+ * \brief Compact set of dirty persistent cache lines.
+ *
+ * Holds the block addresses of the persistent cache lines a transaction
+ * (or a log truncation pass) has dirtied so that write-back can touch each
+ * line exactly once, in address order, without walking the write set or a
+ * hash table. The set is a plain growable array; it is sorted and
+ * deduplicated lazily right before it is drained.
+ *
+ */
+
+#ifndef _PWB_DIRTYSET_H
+#define _PWB_DIRTYSET_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pcm.h>
+#include <tier.h>
+
+/* Initial size of sets that are not sized after a write set. */
+#define MTM_DIRTYSET_DEFAULT_SIZE    1024
+
+/* Below this size an insertion sort beats qsort. */
+#define MTM_DIRTYSET_ISORT_THRESHOLD 32
+
+typedef struct mtm_dirtyset_s mtm_dirtyset_t;
+
+struct mtm_dirtyset_s {
+	uintptr_t *lines;             /* Array of cache-line (block) addresses */
+	int       nb_entries;         /* Number of entries */
+	int       size;               /* Size of array */
+};
+
+
+static inline
+int
+mtm_dirtyset_cmp(const void *a, const void *b)
+{
+	uintptr_t x = *(const uintptr_t *) a;
+	uintptr_t y = *(const uintptr_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+static inline
+void
+mtm_dirtyset_init(mtm_dirtyset_t *set, int size)
+{
+	set->nb_entries = 0;
+	set->size = size;
+	if ((set->lines = (uintptr_t *) malloc(size * sizeof(uintptr_t))) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+}
+
+
+static inline
+void
+mtm_dirtyset_fini(mtm_dirtyset_t *set)
+{
+	free(set->lines);
+	set->lines = NULL;
+	set->nb_entries = set->size = 0;
+}
+
+
+static inline
+void
+mtm_dirtyset_clear(mtm_dirtyset_t *set)
+{
+	set->nb_entries = 0;
+}
+
+
+/**
+ * Sorts the set in address order and drops duplicate lines.
+ */
+static inline
+void
+mtm_dirtyset_sort(mtm_dirtyset_t *set)
+{
+	uintptr_t *lines = set->lines;
+	uintptr_t line;
+	int       n = set->nb_entries;
+	int       i;
+	int       j;
+
+	if (n < 2) {
+		return;
+	}
+	if (n <= MTM_DIRTYSET_ISORT_THRESHOLD) {
+		for (i = 1; i < n; i++) {
+			line = lines[i];
+			for (j = i; j > 0 && lines[j-1] > line; j--) {
+				lines[j] = lines[j-1];
+			}
+			lines[j] = line;
+		}
+	} else {
+		qsort(lines, n, sizeof(uintptr_t), mtm_dirtyset_cmp);
+	}
+	for (i = 1, j = 1; i < n; i++) {
+		if (lines[i] != lines[j-1]) {
+			lines[j++] = lines[i];
+		}
+	}
+	set->nb_entries = j;
+}
+
+
+/**
+ * Adds the cache line covering addr to the set. The caller may add the
+ * same line more than once; duplicates are folded when the set is sorted
+ * or when it fills up.
+ */
+static inline
+void
+mtm_dirtyset_add(mtm_dirtyset_t *set, uintptr_t addr)
+{
+	/* 
+	 * Nothing will be written back on eADR; don't bother tracking, unless
+	 * lines of cold extents are to be synced (see tier.h).
+	 */
+	if (pcm_flush_insn == PCM_FLUSH_INSN_NONE && !m_tier_nsegments) {
+		return;
+	}
+	if (set->nb_entries == set->size) {
+		mtm_dirtyset_sort(set);
+		/* Grow only if compaction did not free at least half the array. */
+		if (set->nb_entries > set->size / 2) {
+			set->size *= 2;
+			if ((set->lines = (uintptr_t *) realloc(set->lines, set->size * sizeof(uintptr_t))) == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+	}
+	set->lines[set->nb_entries++] = (uintptr_t) BLOCK_ADDR(addr);
+}
+
+
+/**
+ * Writes back every line in the set in address order and empties it.
+ * Returns the number of lines written back. The caller issues the fence.
+ */
+static inline
+int
+mtm_dirtyset_flush(pcm_storeset_t *pcm_storeset, mtm_dirtyset_t *set)
+{
+	int i;
+	int n;
+
+	mtm_dirtyset_sort(set);
+	n = set->nb_entries;
+	if (m_tier_nsegments) {
+		/* Pages of cold extents go to their file; leaves the other lines */
+		n = m_tier_flush_lines(set->lines, n);
+	}
+	for (i = 0; i < n; i++) {
+		PCM_WB_FLUSH(pcm_storeset, (volatile pcm_word_t *) set->lines[i]);
+	}
+	set->nb_entries = 0;
+
+	return n;
+}
+
+#endif /* _PWB_DIRTYSET_H */
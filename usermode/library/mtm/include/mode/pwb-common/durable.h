@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file durable.h
+ *
+ * \brief Lazy-durable commit: write sets the flusher makes durable.
+ *
+ * A lazy-durable transaction commits without writing its log. Its write
+ * set, and with it every lock the transaction holds, goes to the flusher
+ * (see durable.c), which logs a whole batch of such write sets with one
+ * fence, writes them back and only then releases their locks. Nobody can
+ * therefore see data that could still be lost, except the committing 
+ * thread through plain loads of volatile data.
+ *
+ */
+
+#ifndef _PWB_DURABLE_H
+#define _PWB_DURABLE_H
+
+/* Write sets handed over and not yet durable; read without the lock */
+extern volatile int mtm_durable_pending;
+
+void mtm_durable_enqueue(mtm_tx_t *tx, mode_data_t *modedata, mtm_word_t t);
+int mtm_durable_owns(w_entry_t *owner);
+mtm_word_t mtm_durable_wait(volatile mtm_word_t *lock, mtm_word_t l);
+
+#endif /* _PWB_DURABLE_H */
@@ -48,6 +48,7 @@
 #include "local.h"
 #include "locks.h"
 #include "tmlog.h"
+#include "dirtyset.h"
 
 
 //#undef MTM_DEBUG_PRINT
@@ -93,6 +94,7 @@ struct mtm_pwb_w_entry_s {
 			mtm_word_t                  mask;                /* Write mask */
 			mtm_word_t                  version;             /* Version overwritten */
 			int                         is_nonvolatile;      /* Write access is to non-volatile memory */
+			uint32_t                    cm_rank;             /* Rank of the owner as seen by the runtime CM (fits in the padding after is_nonvolatile) */
 			volatile mtm_word_t         *lock;               /* Pointer to lock (for fast access) */
 #if defined(CONFLICT_TRACKING)
 			struct mtm_tx_s             *tx;                 /* Transaction owning the write set */
@@ -116,6 +118,10 @@ struct mtm_pwb_w_set_s {
 };
 
 
+/* Reads a read-only transaction records for snapshot extension and upgrade */
+#define PWB_RO_RSET_SIZE 32
+
+
 /*!
  * A descriptor associated with each transaction, holding that transaction's read/write
  * set and other statistics about the transaction specific to this mode.
@@ -127,9 +133,15 @@ struct mtm_pwb_mode_data_s
 
 	mtm_pwb_r_set_t r_set;
 	mtm_pwb_w_set_t w_set;
+	mtm_dirtyset_t  dirty_lines; /**< Persistent cache lines dirtied by the write set; one entry per line */
+
+	mtm_pwb_r_entry_t ro_entries[PWB_RO_RSET_SIZE]; /**< Inline read set of a read-only transaction */
+	int               ro_nb_entries;                /**< Reads of a read-only transaction; only the first PWB_RO_RSET_SIZE are recorded */
 	
 	m_log_dsc_t     *ptmlog_dsc; /**< The persistent tm log descriptor */
 	M_TMLOG_T       *ptmlog;     /**< The persistent tm log; this is to avoid dereferencing ptmlog_dsc in the fast path */
 };
 
+#include "durable.h"
+
 #endif /* _PWB_COMMON_INTERNAL_IOK811_H */
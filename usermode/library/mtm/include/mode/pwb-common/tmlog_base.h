@@ -38,6 +38,7 @@
 #include <log.h>
 #include <debug.h>
 #include "mtm_i.h"
+#include "dirtyset.h"
 
 #define XACT_COMMIT_MARKER 0x0010000000000000
 #define XACT_ABORT_MARKER  0x0100000000000000
@@ -50,13 +51,11 @@ extern m_log_ops_t tmlog_base_ops;
 
 typedef struct m_tmlog_base_s m_tmlog_base_t;
 
-typedef void set_t;
-
 
 /* Must ensure that phlog_base is word aligned. */
 struct m_tmlog_base_s {
 	m_phlog_base_t   phlog_base;
-	set_t            *flush_set;
+	mtm_dirtyset_t   flush_set;
 };
 
 
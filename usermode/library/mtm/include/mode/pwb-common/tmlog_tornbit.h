@@ -38,6 +38,7 @@
 #include <log.h>
 #include <debug.h>
 #include "mtm_i.h"
+#include "dirtyset.h"
 
 #define XACT_COMMIT_MARKER 0x0010000000000000
 #define XACT_ABORT_MARKER  0x0100000000000000
@@ -50,12 +51,10 @@ extern m_log_ops_t tmlog_tornbit_ops;
 
 typedef struct m_tmlog_tornbit_s m_tmlog_tornbit_t;
 
-typedef void tornbit_flush_set_t;
-
 /* Must ensure that phlog_tornbit is word aligned. */
 struct m_tmlog_tornbit_s {
 	m_phlog_tornbit_t   phlog_tornbit;
-	tornbit_flush_set_t *flush_set;
+	mtm_dirtyset_t      flush_set;
 };
 
 static inline
@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file htm.h
+ *
+ * \brief Hardware (RTM) fast path for pwbetl transactions.
+ *
+ * A top-level transaction first runs its body inside an RTM region. The
+ * barriers still acquire the pwbetl write locks and buffer the new values
+ * in the write set, but do so with plain loads and stores that the
+ * hardware tracks, and they defer the persistent log. At xend the
+ * transaction owns its write locks and its reads are consistent, so the
+ * log records, the commit marker, write-back and lock release are done by
+ * the ordinary pwbetl commit. Hardware and software transactions
+ * synchronize through the same lock array; there is no global fallback
+ * lock. Hardware aborts retry a few times and then fall back to pwbetl.
+ */
+
+#ifndef _PWBETL_HTM_KL019A_H
+#define _PWBETL_HTM_KL019A_H
+
+#include <stdio.h>
+#include "rtm.h"
+
+/* Explicit abort codes (passed to xabort) */
+#define MTM_HTM_ABORT_LOCKED      0x01 /* Location is locked by a software transaction */
+#define MTM_HTM_ABORT_WSET_FULL   0x02 /* Write set exceeds htm_max_writes */
+#define MTM_HTM_ABORT_RESTART     0x03 /* Runtime asked for a restart */
+#define MTM_HTM_ABORT_USER        0x04 /* User abort or retry */
+#define MTM_HTM_ABORT_IRREVOCABLE 0x05 /* Transaction must become irrevocable */
+#define MTM_HTM_NUM_ABORT_CODES   (MTM_HTM_ABORT_IRREVOCABLE+1)
+
+extern int mtm_htm_enabled;
+extern int mtm_htm_max_writes;
+
+void     mtm_pwbetl_htm_init(void);
+uint32_t mtm_pwbetl_htm_begin(mtm_tx_t *tx, uint32_t actions);
+void     mtm_pwbetl_htm_fini_thread(mtm_tx_t *tx);
+void     mtm_pwbetl_htm_report(FILE *stream);
+
+#endif /* _PWBETL_HTM_KL019A_H */
@@ -41,6 +41,9 @@
 #ifndef MTM_H_CFA9SVDY
 #define MTM_H_CFA9SVDY
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*!
  * Opens a durability transaction. This should be used as
  *   MNEMOSYNE_ATOMIC {
@@ -53,13 +56,108 @@
 
 #define MNEMOSYNE_ATOMIC __transaction_relaxed
 
+/*!
+ * Opens a durability transaction that is expected to only read. It runs
+ * against a snapshot without keeping a read set or touching the log; if
+ * it does write, it turns into a normal transaction (possibly after a
+ * restart). Nested uses behave like MNEMOSYNE_ATOMIC, and so does a break
+ * inside the block: it leaves the enclosing loop or switch.
+ */
+#define MNEMOSYNE_ATOMIC_READONLY if (mtm_declare_readonly()) {} else MNEMOSYNE_ATOMIC
+
+/*!
+ * Opens a durability transaction that commits without waiting for its
+ * writes to become durable. Its effects are visible to other transactions
+ * right away, but a crash may lose it: a background flusher makes the
+ * transactions committed this way durable, in commit order and as one
+ * batch, within durable_window_us (see m_durable_barrier). Until then the
+ * persistent data it wrote is only seen through transactions, which wait
+ * for the flusher if they touch it. A transaction with commit actions,
+ * such as one that frees persistent memory, commits durably anyway.
+ * Nested uses behave like MNEMOSYNE_ATOMIC, and so does a break inside the
+ * block.
+ */
+#define MNEMOSYNE_ATOMIC_LAZY if (mtm_declare_lazy_durable()) {} else MNEMOSYNE_ATOMIC
+
 # ifdef __cplusplus
 extern "C" {
 # endif
 
 void mtm_fini_global();
+__attribute__((transaction_pure)) int mtm_declare_readonly(void);
+__attribute__((transaction_pure)) int mtm_declare_lazy_durable(void);
+
+/*!
+ * Makes every top-level durability transaction of the calling thread
+ * lazy-durable, as if opened with MNEMOSYNE_ATOMIC_LAZY (on != 0), or 
+ * turns this back off (on == 0).
+ */
+void mtm_set_lazy_durable(int on);
+
+/*!
+ * Waits until every transaction that committed lazily before the call,
+ * in any thread, is durable.
+ */
+void m_durable_barrier(void);
 extern int mtm_enable_trace;
 
+/*!
+ * Looks up a root in the persistent root directory, a table of named
+ * pointers into persistent memory kept by the runtime. Any library in the
+ * process can find its roots through it without persistent globals of its
+ * own.
+ *
+ * Inside a durability transaction the lookup is part of the transaction.
+ *
+ * \param name at most 47 characters.
+ * \return the root's value, or NULL if the root was never set.
+ */
+__attribute__((transaction_pure)) void *m_root_get(const char *name);
+
+/*!
+ * Creates or updates a root in the persistent root directory. Inside a
+ * durability transaction the update commits or aborts with it; outside,
+ * it is durable when the call returns. Roots cannot be removed, only
+ * set to NULL.
+ *
+ * \param name at most 47 characters.
+ * \return 0 on success; -1 with errno set to EINVAL for a bad name, or
+ *  ENOMEM/ENOSPC if the directory cannot be created or is full.
+ */
+__attribute__((transaction_pure)) int m_root_set(const char *name, void *value);
+
+/*!
+ * Writes back [addr, addr+size) to persistent memory and waits for it, 
+ * outside the log. For memory no transaction can reach, such as allocator
+ * or handle metadata kept private to a library, that was updated with 
+ * plain stores and must be durable before what follows.
+ *
+ * Not a way to skip logging the contents of new data-structure nodes:
+ * a block may be freed and allocated again while a concurrent or 
+ * read-only transaction still reaches it, and plain stores to it are not
+ * seen by that transaction's validation. Fill such nodes with 
+ * transactional stores.
+ */
+__attribute__((transaction_pure)) void m_persist_new(const void *addr, size_t size);
+
+/*!
+ * Takes a crash-consistent snapshot of all persistent data into the new
+ * directory dir, while transactions keep running: commits only wait while
+ * the segments are copied, which is cheap where the file system can share
+ * blocks (reflink). The snapshot holds the transactions that committed 
+ * before the call; restore it with the mnemorestore tool.
+ *
+ * Call outside a transaction. Lazy-durable transactions that commit 
+ * during the call may be left out. Persistent memory written outside 
+ * transactions is copied as it is at that moment.
+ *
+ * \param sqn if not NULL, set to the commit timestamp of the last 
+ *  transaction in the snapshot.
+ * \return 0 on success, or -1 with errno set; ENOTSUP if the heap is 
+ *  shared by a group of processes.
+ */
+int m_snapshot(const char *dir, uint64_t *sqn);
+
 /* GCC specific. For function pointers */
 struct clone_entry
 {
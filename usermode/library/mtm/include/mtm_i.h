@@ -100,6 +100,7 @@ ACTION (name,__m256,M256)
 # define M_TMLOG_T              m_tmlog_base_t
 # define M_TMLOG_LF_TYPE        LF_TYPE_TM_BASE
 # define M_TMLOG_OPS            tmlog_base_ops
+# define M_TMLOG_PHLOG(tmlog)   (&(tmlog)->phlog_base)
 #elif TMLOG_TYPE == TMLOG_TYPE_TORNBIT
 # define M_TMLOG_WRITE          m_tmlog_tornbit_write
 # define M_TMLOG_TRUNCATE_SYNC  m_tmlog_tornbit_truncate_sync
@@ -109,6 +110,7 @@ ACTION (name,__m256,M256)
 # define M_TMLOG_T              m_tmlog_tornbit_t
 # define M_TMLOG_LF_TYPE        LF_TYPE_TM_TORNBIT
 # define M_TMLOG_OPS            tmlog_tornbit_ops
+# define M_TMLOG_PHLOG(tmlog)   (&(tmlog)->phlog_tornbit)
 #else
 # error "Unknown persistent log type."
 #endif
@@ -228,6 +230,9 @@ extern int cm_threshold;
 #include "locks.h"
 #include "local.h"
 #include "stats.h"
+#include "cmsite.h"
+#include "mode/pwbetl/htm.h"
+#include "metrics.h"
 
 /**
  * Size of a word (accessible atomically) on the target architecture.
@@ -301,6 +306,25 @@ struct mtm_tx_s {
 	int                    visible_reads;    /* Should we use visible reads? */
 #endif /* CM == CM_PRIORITY */
 	unsigned long          retries;          /* Number of consecutive aborts (retries) */
+	mtm_cm_site_t          *cm_site;         /* Abort profile of the atomic block being executed */
+	uintptr_t              cm_site_pc;       /* Return address of _ITM_beginTransaction; identifies the site when there is no srcloc */
+	unsigned long          cm_backoff;       /* Runtime CM: maximum backoff duration */
+	unsigned long          cm_seed;          /* Runtime CM: RNG seed */
+	unsigned long          cm_commits;       /* Runtime CM: commits, used to sample the site profile */
+	unsigned long          cm_karma;         /* Runtime CM: work (accesses) performed by aborted attempts */
+	uint32_t               cm_birth;         /* Runtime CM: start stamp of the first attempt, kept across retries */
+	int                    cm_token;         /* Runtime CM: holds the serialization token of cm_site */
+	int                    ro_next;          /* The next top-level transaction was declared read-only */
+	int                    ro;               /* The top-level transaction runs as a read-only snapshot transaction */
+	int                    ro_active;        /* Still read-only (has not written); cleared on upgrade */
+	int                    lazy_next;        /* The next top-level transaction was declared lazy-durable */
+	int                    lazy;             /* Top-level transactions of this thread are lazy-durable (mtm_set_lazy_durable) */
+	int                    lazy_active;      /* The top-level transaction commits without waiting for durability (see durable.c) */
+	int                    htm_active;       /* Executing inside an RTM region (see mode/pwbetl/htm.h) */
+	unsigned long          htm_commits;      /* HTM fast path: transactions committed in hardware */
+	unsigned long          htm_aborts;       /* HTM fast path: hardware aborts */
+	unsigned long          htm_fallbacks;    /* HTM fast path: transactions that fell back to pwbetl */
+	unsigned long          htm_aborts_by_code[MTM_HTM_NUM_ABORT_CODES]; /* HTM fast path: explicit aborts by code */
 
 	uintptr_t              stack_base;       /* Stack base address */
 	uintptr_t              stack_size;       /* Stack size */
@@ -309,6 +333,11 @@ struct mtm_tx_s {
 	pcm_storeset_t         *pcm_storeset;    /* PCM emulation bookkeeping structure */
 	m_stats_threadstat_t   *threadstat;      /* Thread statistics */
 	m_stats_statset_t      *statset;         /* Per transaction instance statistics */
+	m_stats_statset_t      statset_inst;     /* Storage statset points to */
+	mtm_metrics_slot_t     *metrics;         /* Latency histograms of this thread; NULL if disabled */
+	uint64_t               metrics_begin;    /* TSC at top-level begin, kept across retries */
+	uint64_t               metrics_trunc_base; /* Log truncation wait time (ns) at begin */
+	uint64_t               metrics_trunc_wait; /* Synchronous truncation cycles since begin */
 	mtm_user_action_list_t *commit_action_list;
 	mtm_user_action_list_t *undo_action_list;
 };
@@ -460,6 +489,8 @@ static inline unsigned int lock_idx_swap(unsigned int idx) {
 }
 #endif /* LOCK_IDX_SWAP */
 
+void m_durable_barrier(void);
+
 #ifdef ROLLOVER_CLOCK
 /*
  * We use a simple approach for clock roll-over:
@@ -537,6 +568,8 @@ static inline void mtm_overflow(mtm_tx_t *tx)
 {
   PRINT_DEBUG("==> mtm_overflow(%p[%lu-%lu])\n", tx, (unsigned long)tx->start, (unsigned long)tx->end);
 
+  /* Lazily committed write sets still hold locks the reset would clear */
+  m_durable_barrier();
   pthread_mutex_lock(&tx_count_mutex);
   /* Set overflow flag (might already be set) */
   tx_overflow = 1;
@@ -64,7 +64,8 @@
   ACTION(nvwrites_distinct)                                                 \
   ACTION(vwrites)                                                           \
   ACTION(vwrites_distinct)                                                  \
-  ACTION(wbflush)                                                            
+  ACTION(wbflush)                                                           \
+  ACTION(ro_upgrades)                                                            
 
 
 #ifdef _M_STATS_BUILD
@@ -100,7 +101,7 @@ typedef enum {
 	m_stats_numofstats
 } m_stats_statentry_t; 
 
-typedef unsigned int m_stats_statcounter_t;
+typedef unsigned long long m_stats_statcounter_t;
 typedef struct m_stats_threadstat_s m_stats_threadstat_t;
 typedef struct m_statsmgr_s m_statsmgr_t;
 typedef struct m_stats_statset_s m_stats_statset_t;
@@ -39,8 +39,10 @@
 #ifndef MTM_RWLOCK_H_AGH190
 #define MTM_RWLOCK_H_AGH190
 
+#include <pthread.h>
+
 typedef struct {
-	//TODO: fields
+	pthread_rwlock_t rwlock;
 } mtm_rwlock_t;
 
 extern int mtm_rwlock_init (mtm_rwlock_t *);
@@ -0,0 +1,107 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ * Restricted Transactional Memory (RTM) primitives.
+ *
+ * The instructions are hand-encoded so that the runtime builds with
+ * assemblers and compiler flags that know nothing about TSX; whether they
+ * may be executed is decided at runtime with mtm_rtm_supported().
+ */
+
+#ifndef _RTM_H_AX19LM
+#define _RTM_H_AX19LM
+
+#include <stddef.h>
+#include <cpuid.h>
+
+#define MTM_RTM_STARTED        (~0u)
+
+/* Abort status bits as reported in EAX. */
+#define MTM_RTM_ABORT_EXPLICIT (1 << 0)
+#define MTM_RTM_ABORT_RETRY    (1 << 1)
+#define MTM_RTM_ABORT_CONFLICT (1 << 2)
+#define MTM_RTM_ABORT_CAPACITY (1 << 3)
+#define MTM_RTM_ABORT_DEBUG    (1 << 4)
+#define MTM_RTM_ABORT_NESTED   (1 << 5)
+#define MTM_RTM_ABORT_CODE(x)  (((x) >> 24) & 0xff)
+
+static inline
+int
+mtm_rtm_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx >> 11) & 1;
+}
+
+/* Returns MTM_RTM_STARTED or, after an abort, the abort status. */
+static inline
+unsigned int
+mtm_rtm_begin(void)
+{
+	unsigned int status = MTM_RTM_STARTED;
+
+	/* xbegin with the fallback at the next instruction */
+	__asm__ __volatile__(".byte 0xc7,0xf8 ; .long 0" : "+a" (status) :: "memory");
+	return status;
+}
+
+static inline
+void
+mtm_rtm_end(void)
+{
+	/* xend */
+	__asm__ __volatile__(".byte 0x0f,0x01,0xd5" ::: "memory");
+}
+
+/* code must be a compile-time constant */
+#define mtm_rtm_abort(code)                                                   \
+	__asm__ __volatile__(".byte 0xc6,0xf8,%P0" :: "i" (code) : "memory")
+
+static inline
+int
+mtm_rtm_test(void)
+{
+	unsigned char active;
+
+	/* xtest */
+	__asm__ __volatile__(".byte 0x0f,0x01,0xd6 ; setnz %0" : "=r" (active) :: "memory");
+	return active;
+}
+
+#endif /* _RTM_H_AX19LM */
@@ -10,9 +10,19 @@
 #define TM_ATOMIC       		__transaction_atomic
 #define TM_RELAXED      		__transaction_relaxed
 #define PTx				TM_RELAXED
+#define PTx_RO				if (mtm_declare_readonly()) {} else PTx	/* read-only snapshot; upgrades on write */
+#define PTx_LAZY			if (mtm_declare_lazy_durable()) {} else PTx	/* durable within durable_window_us */
 #define __persist__			__attribute__ ((section("PERSISTENT")))
 
 
+#ifdef __cplusplus
+extern "C" __attribute__((transaction_pure)) int mtm_declare_readonly(void);
+extern "C" __attribute__((transaction_pure)) int mtm_declare_lazy_durable(void);
+#else
+__attribute__((transaction_pure)) int mtm_declare_readonly(void);
+__attribute__((transaction_pure)) int mtm_declare_lazy_durable(void);
+#endif
+
 /* To prevent GCC from barfing on libc calls */
 TM_PURE 
 void __assert_fail (const char *__assertion, const char *__file,
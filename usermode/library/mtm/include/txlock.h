@@ -47,177 +47,63 @@
 #undef pthread_rwlock_unlock
 
 
-//FIXME: These locks are not deadlock safe -- need to 
-//drop locks if can't get a lock to avoid deadlock
-//See Volos Transact 08
-
-#include <itm.h>
+/**
+ * \file txlock.h
+ *
+ * \brief Locks that may be taken both inside and outside transactions.
+ *
+ * A lock taken inside a transaction is held until the transaction commits
+ * or aborts (an unlock inside the transaction only takes effect at commit),
+ * and a thread may take again a lock it holds. A transaction that cannot
+ * get a lock within txlock_spins attempts restarts, dropping the locks it
+ * took, so that transactions waiting on locks and locks held around 
+ * transactions cannot deadlock (see Volos et al., TRANSACT 2008).
+ *
+ * With txlock_elide set, a transaction does not take the lock on its first
+ * txlock_elide_retries attempts: it only announces itself as an eliding 
+ * holder and leaves conflicts with other eliding holders to the STM, so 
+ * sections guarded by the same lock run in parallel. Whoever takes the 
+ * lock for real -- code outside transactions, or a transaction that kept 
+ * aborting -- waits for the eliding holders it conflicts with to leave, and
+ * a transaction that finds the lock taken waits for it or restarts. 
+ * Eliding readers and real readers of a reader-writer lock do not conflict.
+ */
+
+#include <stdint.h>
 #include <pthread.h>
 
-#define DEBUG_PRINTF(format, ...)
-//#define DEBUG_PRINTF(format, a, b) printf(format, a, b)
-
-/* MUTEX TXSAFE LOCKS */
-
-typedef pthread_mutex_t m_txmutex_t;
-
-void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action(void *arg);
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txmutex_init(m_txmutex_t *txmutex)
-{
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-	pthread_mutexattr_t attr;
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-
-	return pthread_mutex_init(mutex, &attr);
-}
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txmutex_destroy(m_txmutex_t *txmutex)
-{
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-
-	return pthread_mutex_destroy(mutex);
-}
-
-__attribute__((noinline))
-static
-void breakme() { }
-
-__attribute__((transaction_pure))
-static inline 
-int m_txmutex_lock(m_txmutex_t *txmutex)
-{
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-	int ret;
-
-	DEBUG_PRINTF("[%d] NOW  : MUTEX  LOCK   %p\n", pthread_self(), mutex);
-	ret = pthread_mutex_lock(mutex);
-	DEBUG_PRINTF("[%d] NOW  : MUTEX  LOCK   %p DONE\n", pthread_self(), mutex);
-
-	return ret;
-}
-
-
-void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action_local(void *arg)
-{
-	m_txmutex_t *txmutex = (m_txmutex_t *) arg;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-
-	//printf("[%d] COMMIT: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-	pthread_mutex_unlock(mutex);
+typedef struct m_txlock_s m_txlock_t;
 
-	return;
-}
+struct m_txlock_s {
+	volatile uintptr_t state;          /* Real holders: writer bit and 2 per reader */
+	volatile uintptr_t elided_readers; /* Transactions in a read section without the lock */
+	volatile uintptr_t elided_writers; /* Transactions in a write section without the lock */
+};
 
+#define M_TXLOCK_INITIALIZER { 0, 0, 0 }
 
+/* MUTEX TXSAFE LOCKS */
 
-__attribute__((transaction_pure))
-static inline 
-int m_txmutex_unlock(m_txmutex_t *txmutex)
-{
-	int             ret;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-
-	_ITM_transaction * td;
-	td = _ITM_getTransaction();
+typedef m_txlock_t m_txmutex_t;
 
-	if (_ITM_inTransaction() > 0) {
-		DEBUG_PRINTF("[%d] DEFER: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-		_ITM_addUserCommitAction (m_txmutex_unlock_commit_action_local, 2, txmutex);
-		//_ITM_addUserCommitAction (td, m_txmutex_unlock_commit_action_local, 2, txmutex);
-		ret = 0;
-	} else {
-		DEBUG_PRINTF("[%d] NOW  : MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-		ret = pthread_mutex_unlock (mutex);
-	}
+#define M_TXMUTEX_INITIALIZER M_TXLOCK_INITIALIZER
 
-	return ret;
-}
+__attribute__((transaction_pure)) int m_txmutex_init(m_txmutex_t *txmutex);
+__attribute__((transaction_pure)) int m_txmutex_destroy(m_txmutex_t *txmutex);
+__attribute__((transaction_pure)) int m_txmutex_lock(m_txmutex_t *txmutex);
+__attribute__((transaction_pure)) int m_txmutex_unlock(m_txmutex_t *txmutex);
 
 /* READER/WRITER TXSAFE LOCKS */
 
-typedef pthread_rwlock_t m_txrwlock_t;
-
-void _ITM_CALL_CONVENTION m_txrwlock_unlock_commit_action(void *arg);
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txrwlock_init(m_txrwlock_t *txrwlock)
-{
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	return pthread_rwlock_init(rwlock, NULL);
-}
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txrwlock_destroy(m_txrwlock_t *txrwlock)
-{
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	return pthread_rwlock_destroy(rwlock);
-}
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txrwlock_rdlock(m_txrwlock_t *txrwlock)
-{
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	/* 
-	 * TODO: Support a thread re-locking a lock it owns as 
-	 * locks are not released till commit
-	 */
-	DEBUG_PRINTF("[%d] NOW  : RWLOCK RDLOCK %p\n", pthread_self(), rwlock);
-	return pthread_rwlock_rdlock(rwlock);
-}
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txrwlock_wrlock(m_txrwlock_t *txrwlock)
-{
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	/* 
-	 * TODO: Support a thread re-locking a lock it owns as 
-	 * locks are not released till commit
-	 */
-	DEBUG_PRINTF("[%d] NOW  : RWLOCK WRLOCK %p\n", pthread_self(), rwlock);
-	return pthread_rwlock_wrlock(rwlock);
-}
-
-
-__attribute__((transaction_pure))
-static inline 
-int m_txrwlock_unlock(m_txrwlock_t *txrwlock)
-{
-	int             ret;
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	_ITM_transaction * td;
-	td = _ITM_getTransaction();
+typedef m_txlock_t m_txrwlock_t;
 
-	if (_ITM_inTransaction() > 0) {
-		DEBUG_PRINTF("[%d] DEFER: RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
-		_ITM_addUserCommitAction (m_txrwlock_unlock_commit_action, 2, txrwlock);
-		ret = 0;
-	} else {
-		DEBUG_PRINTF("[%d] NOW  : RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
-		ret = pthread_rwlock_unlock (rwlock);
-	}
+#define M_TXRWLOCK_INITIALIZER M_TXLOCK_INITIALIZER
 
-	return ret;
-}
+__attribute__((transaction_pure)) int m_txrwlock_init(m_txrwlock_t *txrwlock);
+__attribute__((transaction_pure)) int m_txrwlock_destroy(m_txrwlock_t *txrwlock);
+__attribute__((transaction_pure)) int m_txrwlock_rdlock(m_txrwlock_t *txrwlock);
+__attribute__((transaction_pure)) int m_txrwlock_wrlock(m_txrwlock_t *txrwlock);
+__attribute__((transaction_pure)) int m_txrwlock_unlock(m_txrwlock_t *txrwlock);
 
 
 #endif
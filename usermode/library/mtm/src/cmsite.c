@@ -0,0 +1,233 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file cmsite.c
+ *
+ * \brief Implements the runtime contention manager state and the per-site
+ * abort profile.
+ *
+ */
+
+#include <sched.h>
+#include "mtm_i.h"
+#include "config.h"
+#include "cmsite.h"
+
+#define CM_SITE_HASH(key)   ((((key) >> 4) ^ ((key) >> 13)) & (CM_SITE_TABLE_SIZE - 1))
+
+mtm_cm_policy_t mtm_cm_policy = CM_POLICY_SUICIDE;
+unsigned long   mtm_cm_birth_clock = 0;
+
+/* 
+ * Shared by all sites whose key does not fit in the table. Aborts from 
+ * such sites are still accounted but they all share one profile.
+ */
+static mtm_cm_site_t cm_site_overflow;
+static mtm_cm_site_t cm_site_table[CM_SITE_TABLE_SIZE];
+
+static const char *cm_policy_names[] = {
+	"suicide",
+	"backoff",
+	"karma",
+	"timestamp",
+	"adaptive"
+};
+
+
+void
+mtm_cm_init(void)
+{
+	int i;
+
+	for (i=0; i<sizeof(cm_policy_names)/sizeof(cm_policy_names[0]); i++) {
+		if (strcmp(mtm_runtime_settings.cm_policy, cm_policy_names[i]) == 0) {
+			mtm_cm_policy = (mtm_cm_policy_t) i;
+			break;
+		}
+	}
+	if (mtm_runtime_settings.cm_backoff_max < mtm_runtime_settings.cm_backoff_min) {
+		mtm_runtime_settings.cm_backoff_max = mtm_runtime_settings.cm_backoff_min;
+	}
+	PRINT_DEBUG("\tCM_POLICY=%s\n", cm_policy_names[mtm_cm_policy]);
+}
+
+
+/**
+ * \brief Returns the profile of the site identified by key, creating it on
+ * first use. Never returns NULL.
+ */
+mtm_cm_site_t *
+mtm_cm_site_get(uintptr_t key)
+{
+	mtm_cm_site_t *site;
+	uintptr_t     k;
+	int           i;
+	int           probe;
+
+	if (key == 0) {
+		return &cm_site_overflow;
+	}
+	i = CM_SITE_HASH(key);
+	for (probe = 0; probe < CM_SITE_TABLE_SIZE; probe++) {
+		site = &cm_site_table[i];
+		k = site->key;
+		if (k == key) {
+			return site;
+		}
+		if (k == 0) {
+			k = __sync_val_compare_and_swap(&site->key, 0, key);
+			if (k == 0 || k == key) {
+				return site;
+			}
+		}
+		i = (i + 1) & (CM_SITE_TABLE_SIZE - 1);
+	}
+	return &cm_site_overflow;
+}
+
+
+/* 
+ * Re-evaluates the adaptive decision at the end of an observation window.
+ * Only the thread that closes the window makes the decision; counters are 
+ * halved rather than cleared so that the rate decays instead of flapping. 
+ */
+static inline
+void
+cm_site_adapt(mtm_cm_site_t *site)
+{
+	unsigned long aborts = site->win_aborts;
+	unsigned long total = aborts + site->win_commits;
+	unsigned long rate;
+	int           threshold = mtm_runtime_settings.cm_serialize_threshold;
+
+	if (total < mtm_runtime_settings.cm_adapt_window) {
+		return;
+	}
+	rate = (aborts * 100) / total;
+	if (!site->serialize && rate >= threshold) {
+		site->serialize = 1;
+		site->serialized++;
+	} else if (site->serialize && rate < threshold / 2) {
+		site->serialize = 0;
+	}
+	site->win_aborts = aborts >> 1;
+	site->win_commits = site->win_commits >> 1;
+}
+
+
+void
+mtm_cm_site_record_abort(mtm_cm_site_t *site, unsigned long retries)
+{
+	__sync_add_and_fetch(&site->aborts, 1);
+	__sync_add_and_fetch(&site->win_aborts, 1);
+	if (retries > site->max_retries) {
+		site->max_retries = retries;
+	}
+	if (mtm_cm_policy == CM_POLICY_ADAPTIVE) {
+		cm_site_adapt(site);
+	}
+}
+
+
+void
+mtm_cm_site_record_commits(mtm_cm_site_t *site, unsigned long commits, unsigned long retries)
+{
+	site->commits += commits;
+	site->win_commits += commits;
+	if (retries > site->max_retries) {
+		site->max_retries = retries;
+	}
+	if (mtm_cm_policy == CM_POLICY_ADAPTIVE) {
+		cm_site_adapt(site);
+	}
+}
+
+
+void
+mtm_cm_site_acquire_token(mtm_cm_site_t *site)
+{
+	while (1) {
+		if (site->token == 0 && __sync_lock_test_and_set(&site->token, 1) == 0) {
+			return;
+		}
+		while (site->token) {
+			sched_yield();
+		}
+	}
+}
+
+
+void
+mtm_cm_site_release_token(mtm_cm_site_t *site)
+{
+	__sync_lock_release(&site->token);
+}
+
+
+static inline
+void
+cm_site_print(FILE *stream, mtm_cm_site_t *site)
+{
+	fprintf(stream, "%#18lx %12lu %12lu %12lu %10lu %s\n",
+	        (unsigned long) site->key,
+	        site->commits,
+	        site->aborts,
+	        site->max_retries,
+	        site->serialized,
+	        site->serialize ? "serial" : "");
+}
+
+
+/**
+ * \brief Prints the abort profile of every site that has aborted at least 
+ * once.
+ *
+ * Commit counts are sampled and therefore approximate. 
+ */
+void
+mtm_cm_site_report(FILE *stream)
+{
+	int i;
+
+	fprintf(stream, "CONTENTION MANAGER: %s\n", cm_policy_names[mtm_cm_policy]);
+	fprintf(stream, "%18s %12s %12s %12s %10s\n", 
+	        "SITE", "~COMMITS", "ABORTS", "MAX_RETRIES", "SERIALIZED");
+	for (i=0; i<CM_SITE_TABLE_SIZE; i++) {
+		if (cm_site_table[i].key != 0 && cm_site_table[i].aborts > 0) {
+			cm_site_print(stream, &cm_site_table[i]);
+		}
+	}
+	if (cm_site_overflow.aborts > 0) {
+		cm_site_print(stream, &cm_site_overflow);
+	}
+}
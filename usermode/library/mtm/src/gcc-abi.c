@@ -41,6 +41,7 @@
 #include "init.h"
 #include "useraction.h"
 #include <setjmp.h>
+#include <tier.h>
 
 extern void* mtm_pmalloc(size_t);
 extern void* mtm_pmalloc_undo(size_t);
@@ -116,6 +117,9 @@ _ITM_getTMCloneOrIrrevocable (void *ptr)
   //  if (stm_current_tx() != NULL && stm_is_active(tx))
   //  GCC always use implicit transaction descriptor 
 	mtm_tx_t *tx = mtm_get_tx();
+	if (tx->htm_active) {
+		mtm_rtm_abort(MTM_HTM_ABORT_IRREVOCABLE);
+	}
 	tx->status = TX_IRREVOCABLE;
 	return ptr;
 }
@@ -202,11 +206,19 @@ uint32_t _ITM_CALL_CONVENTION MTM_begin_transaction(uint32_t attr, jmp_buf * buf
 		tx = mtm_init_thread();
 	}
 	assert(tx != NULL);
+	/* GCC passes no source location; the return address of 
+	 * _ITM_beginTransaction identifies the atomic block instead. */
+	tx->cm_site_pc = ((mtm_jmpbuf_t *) buf)->abendPC;
 	ret = mtm_pwbetl_beginTransaction_internal(tx, attr, NULL, &env);
 
   /* Save thread context only when outermost transaction */
   	if (likely(env != NULL))
 		memcpy(env, buf, sizeof(jmp_buf)); /* TODO limit size to real size */
+	/* Top-level transactions first try the hardware fast path, unless 
+	 * they commit lazily: the flusher writes their log from the write set. */
+	if (likely(env != NULL) && mtm_htm_enabled && !tx->lazy_active) {
+		ret = mtm_pwbetl_htm_begin(tx, ret);
+	}
   // freud : This is where you intialized the jump buffer. 
   // And then use a code like _ITM_siglongjmp to parse the buffer 
   // and jump to the appropriate routine.
@@ -299,6 +311,62 @@ _ITM_getTransaction(void)
 }
 
 
+/*
+ * Declares the next top-level transaction of the calling thread read-only.
+ * Returns 0 so that it can be used as the condition of an if whose else
+ * branch is the transaction (see MNEMOSYNE_ATOMIC_READONLY); unlike a 
+ * switch, an if does not capture break. Pure so that it can be called 
+ * from code that may already be inside a transaction.
+ */
+_ITM_TRANSACTION_PURE
+int
+mtm_declare_readonly(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	if (tx->nesting == 0) {
+		tx->ro_next = 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Declares the next top-level transaction of the calling thread 
+ * lazy-durable (see MNEMOSYNE_ATOMIC_LAZY and durable.c). Same contract
+ * as mtm_declare_readonly.
+ */
+_ITM_TRANSACTION_PURE
+int
+mtm_declare_lazy_durable(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	if (tx->nesting == 0) {
+		tx->lazy_next = 1;
+	}
+	return 0;
+}
+
+
+void
+mtm_set_lazy_durable(int on)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	tx->lazy = on ? 1 : 0;
+}
+
+
 int _ITM_CALL_CONVENTION
 _ITM_getThreadnum (void)
 {
@@ -534,3 +602,29 @@ void * _ITM_prealloc (void * ptr, size_t sz)
 	return buf;
 }
 
+
+/*
+ * Writes back memory that was updated with plain stores and that no 
+ * transaction can reach (see mtm.h). Freshly allocated blocks do not 
+ * qualify: a transaction that read the block before it was freed may 
+ * still be running.
+ */
+_ITM_TRANSACTION_PURE
+void m_persist_new(const void *addr, size_t size)
+{
+	mtm_tx_t       *tx = mtm_get_tx();
+	pcm_storeset_t *set = tx ? tx->pcm_storeset : pcm_storeset_get();
+	uintptr_t      line = (uintptr_t) BLOCK_ADDR(addr);
+	uintptr_t      end = (uintptr_t) addr + size;
+
+	for (; line < end; line += CACHELINE_SIZE) {
+		if (m_tier_nsegments && m_tier_writeback(line)) {
+			/* The whole page of a cold extent was synced */
+			line = (line | (PAGE_SIZE - 1)) + 1 - CACHELINE_SIZE;
+			continue;
+		}
+		PCM_WB_FLUSH(set, (volatile pcm_word_t *) line);
+	}
+	PCM_WB_FENCE(set);
+}
+
@@ -55,6 +55,8 @@
 #include <execinfo.h>
 #include <signal.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "mtm_i.h"
 #include "config.h"
 #include "locks.h"
@@ -116,6 +118,9 @@ init_global()
 	COMPILE_TIME_ASSERT(sizeof(mtm_word_t) == sizeof(atomic_t));
 
 	mtm_config_init();
+	mtm_cm_init();
+	mtm_pwbetl_htm_init();
+	mtm_metrics_init();
 
 #ifdef EPOCH_GC
 	gc_init(mtm_get_clock);
@@ -229,6 +234,14 @@ fini_global()
 #ifdef _M_STATS_BUILD	
 	m_stats_print(mtm_statsmgr);
 #endif  
+	if (mtm_runtime_settings.stats) {
+		mtm_cm_site_report(stderr);
+		if (mtm_get_tx()) {
+			mtm_pwbetl_htm_fini_thread(mtm_get_tx());
+		}
+		mtm_pwbetl_htm_report(stderr);
+	}
+	mtm_metrics_fini();
 }
 
 
@@ -344,9 +357,36 @@ mtm_init_thread(void)
 	tx->priority = 0;
 	tx->visible_reads = 0;
 #endif /* CM == CM_PRIORITY */
-#if CM == CM_PRIORITY || defined(INTERNAL_STATS)
 	tx->retries = 0;
-#endif /* CM == CM_PRIORITY || defined(INTERNAL_STATS) */
+	/* Runtime contention manager */
+	tx->cm_site = NULL;
+	tx->cm_site_pc = 0;
+	tx->cm_backoff = mtm_runtime_settings.cm_backoff_min;
+	/*
+	 * Per thread, so that threads that conflict do not back off in
+	 * lockstep and collide again; xorshift needs a non-zero seed.
+	 */
+	tx->cm_seed = ((unsigned long) syscall(SYS_gettid) * 0x9e3779b97f4a7c15UL) ^
+	              (unsigned long) (uintptr_t) tx;
+	if (tx->cm_seed == 0) {
+		tx->cm_seed = 123456789UL;
+	}
+	tx->cm_commits = 0;
+	tx->cm_karma = 0;
+	tx->cm_birth = 0;
+	tx->cm_token = 0;
+	tx->ro_next = 0;
+	tx->ro = 0;
+	tx->ro_active = 0;
+	tx->lazy_next = 0;
+	tx->lazy = 0;
+	tx->lazy_active = 0;
+	/* HTM fast path */
+	tx->htm_active = 0;
+	tx->htm_commits = 0;
+	tx->htm_aborts = 0;
+	tx->htm_fallbacks = 0;
+	memset(tx->htm_aborts_by_code, 0, sizeof(tx->htm_aborts_by_code));
 #ifdef INTERNAL_STATS
 	/* Statistics */
 	tx->aborts = 0;
@@ -395,6 +435,10 @@ mtm_init_thread(void)
 	mtm_useraction_list_alloc(&tx->undo_action_list);
 
 	tx->thread_num = __sync_add_and_fetch (&global_num, 1);
+	tx->metrics = mtm_metrics_slot_acquire((uint32_t) syscall(SYS_gettid));
+	tx->metrics_begin = 0;
+	tx->metrics_trunc_base = 0;
+	tx->metrics_trunc_wait = 0;
 #ifdef _M_STATS_BUILD	
 	m_stats_threadstat_create(mtm_statsmgr, tx->thread_num, &tx->threadstat);
 #endif
@@ -430,6 +474,9 @@ mtm_fini_thread(void)
 	mtm_rollover_exit(tx);
 #endif /* ROLLOVER_CLOCK */
 
+	mtm_pwbetl_htm_fini_thread(tx);
+	mtm_metrics_slot_release(tx->metrics);
+
 	/* Create mode specific descriptors */
 #undef ACTION
 #define ACTION(mode) \
@@ -0,0 +1,154 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file metrics.c
+ *
+ * \brief Creates the shared-memory metrics snapshot and hands out 
+ * per-thread slots.
+ *
+ */
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <hrtime.h>
+#include "mtm_i.h"
+#include "config.h"
+#include "metrics.h"
+
+static mtm_metrics_shm_t *metrics_shm = NULL;
+static size_t            metrics_shm_size = 0;
+static char              metrics_shm_name[64];
+
+
+void
+mtm_metrics_init(void)
+{
+	struct timespec ts;
+	int             fd;
+	uint32_t        nb_slots;
+
+	if (!mtm_runtime_settings.metrics) {
+		return;
+	}
+	nb_slots = mtm_runtime_settings.metrics_max_threads;
+	metrics_shm_size = sizeof(mtm_metrics_shm_t) + nb_slots * sizeof(mtm_metrics_slot_t);
+	snprintf(metrics_shm_name, sizeof(metrics_shm_name), MTM_METRICS_SHM_FMT, (int) getpid());
+
+	fd = shm_open(metrics_shm_name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "mtm: cannot create metrics snapshot %s; metrics disabled\n", metrics_shm_name);
+		return;
+	}
+	if (ftruncate(fd, metrics_shm_size) != 0) {
+		close(fd);
+		shm_unlink(metrics_shm_name);
+		return;
+	}
+	metrics_shm = (mtm_metrics_shm_t *) mmap(NULL, metrics_shm_size, 
+	                                         PROT_READ | PROT_WRITE, 
+	                                         MAP_SHARED, fd, 0);
+	close(fd);
+	if (metrics_shm == MAP_FAILED) {
+		metrics_shm = NULL;
+		shm_unlink(metrics_shm_name);
+		return;
+	}
+
+	/* ftruncate zero-fills, so all slots start out free and empty */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	metrics_shm->start_tsc = hrtime_cycles();
+	metrics_shm->start_ns = 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+	metrics_shm->version = MTM_METRICS_VERSION;
+	metrics_shm->nb_slots = nb_slots;
+	metrics_shm->nb_hists = mtm_metrics_numofhists;
+	metrics_shm->nb_buckets = MTM_METRICS_NUM_BUCKETS;
+	metrics_shm->sub_bits = MTM_METRICS_SUB_BITS;
+	metrics_shm->pid = (int32_t) getpid();
+	/* Publish last: readers check the magic before trusting the layout */
+	__sync_synchronize();
+	metrics_shm->magic = MTM_METRICS_MAGIC;
+}
+
+
+void
+mtm_metrics_fini(void)
+{
+	if (metrics_shm == NULL) {
+		return;
+	}
+	munmap(metrics_shm, metrics_shm_size);
+	shm_unlink(metrics_shm_name);
+	metrics_shm = NULL;
+}
+
+
+/*
+ * Prefers a slot that was never used; once all are taken, a new thread
+ * continues the counts of a thread that has exited. Returns NULL when 
+ * metrics are disabled or every slot belongs to a live thread.
+ */
+mtm_metrics_slot_t *
+mtm_metrics_slot_acquire(uint32_t tid)
+{
+	mtm_metrics_slot_t *slot;
+	uint32_t           i;
+	uint32_t           state;
+
+	if (metrics_shm == NULL) {
+		return NULL;
+	}
+	for (state = MTM_METRICS_SLOT_FREE; state <= MTM_METRICS_SLOT_EXITED; state += 2) {
+		for (i = 0; i < metrics_shm->nb_slots; i++) {
+			slot = &metrics_shm->slots[i];
+			if (slot->state == state &&
+			    __sync_bool_compare_and_swap(&slot->state, state, MTM_METRICS_SLOT_ACTIVE))
+			{
+				slot->tid = tid;
+				return slot;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+void
+mtm_metrics_slot_release(mtm_metrics_slot_t *slot)
+{
+	if (slot) {
+		__sync_lock_test_and_set(&slot->state, MTM_METRICS_SLOT_EXITED);
+	}
+}
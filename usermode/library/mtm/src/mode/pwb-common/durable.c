@@ -0,0 +1,403 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file durable.c
+ *
+ * \brief Lazy-durable commit.
+ *
+ * A lazy-durable transaction validates and takes its commit timestamp as
+ * usual but then hands its write set over to the flusher thread instead
+ * of logging it, and returns. It keeps its locks: another transaction 
+ * that runs into one of them waits for the flusher (see cm_conflict), so
+ * no one ever sees persistent data that a crash could still take away.
+ *
+ * Every durable_window_us (or earlier, when someone waits) the flusher 
+ * takes all the pending write sets, sorts them by commit timestamp and
+ * writes them to its own log as one log transaction, ordered after every
+ * transaction they may depend on by the newest timestamp in it. One fence
+ * makes the whole batch durable. It then writes the batch back and drops
+ * its locks with the timestamps the transactions committed with.
+ *
+ * The log records cannot be written by the committing threads: the log 
+ * is written with streaming stores, and only the thread that issued them
+ * can fence them.
+ *
+ * Write-set arrays are never freed while handed over: the lock words point
+ * into them. A transaction that hands one over gets back one the flusher
+ * is done with.
+ *
+ * Commit actions run on the committing thread as soon as it returns, so a
+ * transaction that has any (pfree registers one) commits eagerly.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <mnemosyne.h>
+#include <log.h>
+#include <mtm_i.h>
+#include <pwb_i.h>
+#include <rwset.h>
+#include <snapshot.h>
+#include "config.h"
+
+/* Log words one log transaction of the flusher may take (the log is a ring) */
+#define DURABLE_LOG_WORDS (PHYSICAL_LOG_NUM_ENTRIES / 2)
+
+typedef struct durable_wset_s durable_wset_t;
+
+struct durable_wset_s {
+	w_entry_t      *entries;    /* Write set; locks point into it while pending */
+	int            nb_entries;  /* Number of entries */
+	int            size;        /* Size of array */
+	mtm_word_t     t;           /* Commit timestamp */
+	durable_wset_t *next;
+};
+
+volatile int mtm_durable_pending = 0;
+
+static pthread_mutex_t durable_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  durable_cond = PTHREAD_COND_INITIALIZER;       /* Wakes up the flusher */
+static pthread_cond_t  durable_done_cond = PTHREAD_COND_INITIALIZER;  /* A batch became durable */
+static pthread_once_t  durable_once = PTHREAD_ONCE_INIT;
+static pthread_t       durable_thread;
+static int             durable_stop = 0;
+static int             durable_hurry = 0;     /* Someone waits: don't wait for the deadline */
+static durable_wset_t  *durable_queue = NULL; /* Pending write sets */
+static durable_wset_t  *durable_batch = NULL; /* Write sets being flushed; they still hold their locks */
+static durable_wset_t  *durable_free = NULL;  /* Flushed write sets, for reuse */
+static uint64_t        durable_enqueued = 0;  /* Write sets handed over so far */
+static uint64_t        durable_done = 0;      /* Write sets made durable so far */
+static struct timespec durable_deadline;      /* When the oldest pending write set is due */
+
+static void durable_stop_flusher(void);
+static void *durable_flusher(void *arg);
+
+
+static void
+durable_start(void)
+{
+	if (pthread_create(&durable_thread, NULL, durable_flusher, NULL) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+	/* Runs before the runtime shuts down the log manager */
+	atexit(durable_stop_flusher);
+}
+
+
+static void
+durable_stop_flusher(void)
+{
+	pthread_mutex_lock(&durable_lock);
+	durable_stop = 1;
+	pthread_cond_signal(&durable_cond);
+	pthread_mutex_unlock(&durable_lock);
+	pthread_join(durable_thread, NULL);
+}
+
+
+static int
+durable_cmp(const void *a, const void *b)
+{
+	mtm_word_t x = (*(durable_wset_t * const *) a)->t;
+	mtm_word_t y = (*(durable_wset_t * const *) b)->t;
+
+	return (x > y) - (x < y);
+}
+
+
+/*
+ * Hands the committed write set of tx over to the flusher. The thread
+ * continues with a write set the flusher no longer needs.
+ */
+void
+mtm_durable_enqueue(mtm_tx_t *tx, mode_data_t *modedata, mtm_word_t t)
+{
+	durable_wset_t *ws;
+	w_entry_t      *entries;
+	int            size;
+
+	pthread_once(&durable_once, durable_start);
+
+	pthread_mutex_lock(&durable_lock);
+	if ((ws = durable_free) != NULL) {
+		durable_free = ws->next;
+	}
+	pthread_mutex_unlock(&durable_lock);
+	if (ws == NULL) {
+		if ((ws = (durable_wset_t *) malloc(sizeof(durable_wset_t))) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		ws->entries = NULL;
+		ws->size = 0;
+	}
+
+	entries = ws->entries;
+	size = ws->size;
+	ws->entries = modedata->w_set.entries;
+	ws->size = modedata->w_set.size;
+	ws->nb_entries = modedata->w_set.nb_entries;
+	ws->t = t;
+	if (size >= modedata->w_set.size) {
+		modedata->w_set.entries = entries;
+		modedata->w_set.size = size;
+	} else {
+		free(entries);
+		mtm_allocate_ws_entries(tx, modedata, 0);
+	}
+
+	pthread_mutex_lock(&durable_lock);
+	if (durable_queue == NULL) {
+		clock_gettime(CLOCK_REALTIME, &durable_deadline);
+		durable_deadline.tv_nsec += (long) mtm_runtime_settings.durable_window_us * 1000;
+		durable_deadline.tv_sec += durable_deadline.tv_nsec / 1000000000;
+		durable_deadline.tv_nsec %= 1000000000;
+		pthread_cond_signal(&durable_cond);
+	}
+	ws->next = durable_queue;
+	durable_queue = ws;
+	durable_enqueued++;
+	mtm_durable_pending++;
+	pthread_mutex_unlock(&durable_lock);
+}
+
+
+/*
+ * Returns non-zero if owner, the write-set entry a lock points to, belongs
+ * to a write set handed over to the flusher.
+ */
+int
+mtm_durable_owns(w_entry_t *owner)
+{
+	durable_wset_t *lists[2];
+	durable_wset_t *ws;
+	int            owns = 0;
+	int            i;
+
+	pthread_mutex_lock(&durable_lock);
+	lists[0] = durable_queue;
+	lists[1] = durable_batch;
+	for (i = 0; i < 2 && !owns; i++) {
+		for (ws = lists[i]; ws != NULL; ws = ws->next) {
+			if (ws->entries <= owner && owner < ws->entries + ws->nb_entries) {
+				owns = 1;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&durable_lock);
+	return owns;
+}
+
+
+/*
+ * Waits until the lock no longer holds l, which a lazily committed write
+ * set owns, and returns its new value.
+ */
+mtm_word_t
+mtm_durable_wait(volatile mtm_word_t *lock, mtm_word_t l)
+{
+	mtm_word_t lw;
+
+	pthread_mutex_lock(&durable_lock);
+	durable_hurry = 1;
+	pthread_cond_signal(&durable_cond);
+	pthread_mutex_unlock(&durable_lock);
+	while ((lw = ATOMIC_LOAD_ACQ(lock)) == l) {
+		sched_yield();
+	}
+	return lw;
+}
+
+
+void
+m_durable_barrier(void)
+{
+	uint64_t target;
+
+	pthread_mutex_lock(&durable_lock);
+	target = durable_enqueued;
+	if (durable_done < target) {
+		durable_hurry = 1;
+		pthread_cond_signal(&durable_cond);
+		while (durable_done < target) {
+			pthread_cond_wait(&durable_done_cond, &durable_lock);
+		}
+	}
+	pthread_mutex_unlock(&durable_lock);
+}
+
+
+/*
+ * Makes order[0..n) durable, oldest first, and releases their locks. As
+ * many write sets go into one log transaction as fit; one that does not
+ * fit alone gets one of its own, like in the log of a thread.
+ */
+static void
+durable_flush(pcm_storeset_t *set, M_TMLOG_T *log, mtm_dirtyset_t *dirty,
+              durable_wset_t **order, int n)
+{
+	durable_wset_t *ws;
+	w_entry_t      *w;
+	int            words;
+	int            first;
+	int            j;
+	int            k;
+	int            i;
+
+	qsort(order, n, sizeof(durable_wset_t *), durable_cmp);
+
+	for (first = 0; first < n; first = j) {
+		m_snapshot_gate_enter();
+		words = 0;
+		for (j = first; j < n; j++) {
+			ws = order[j];
+			for (k = 0, i = 0, w = ws->entries; i < ws->nb_entries; i++, w++) {
+				if (w->is_nonvolatile && w->mask != 0) {
+					k += 3;
+				}
+			}
+			if (j > first && words + k > DURABLE_LOG_WORDS) {
+				break;
+			}
+			words += k;
+			for (i = 0, w = ws->entries; i < ws->nb_entries; i++, w++) {
+				if (w->is_nonvolatile && w->mask != 0) {
+					M_TMLOG_WRITE(set, log, (uintptr_t) w->addr, w->value, w->mask);
+				}
+			}
+		}
+		M_TMLOG_COMMIT(set, log, order[j-1]->t);
+
+		for (k = first; k < j; k++) {
+			ws = order[k];
+			for (i = 0, w = ws->entries; i < ws->nb_entries; i++, w++) {
+				if (w->mask != 0) {
+					PCM_WB_STORE_ALIGNED_MASKED(set, w->addr, w->value, w->mask);
+					if (w->is_nonvolatile) {
+						mtm_dirtyset_add(dirty, (uintptr_t) w->addr);
+					}
+				}
+				if (w->next == NULL) {
+					ATOMIC_STORE_REL(w->lock, LOCK_SET_TIMESTAMP(ws->t));
+				}
+			}
+		}
+# ifdef	SYNC_TRUNCATION
+		mtm_dirtyset_flush(set, dirty);
+# endif
+		PCM_WB_FENCE(set);
+# ifdef	SYNC_TRUNCATION
+		M_TMLOG_TRUNCATE_SYNC(set, log);
+# endif
+		mtm_dirtyset_clear(dirty);
+		m_snapshot_gate_exit();
+	}
+}
+
+
+static void *
+durable_flusher(void *arg)
+{
+	pcm_storeset_t *set = pcm_storeset_get();
+	m_log_dsc_t    *log_dsc;
+	M_TMLOG_T      *log;
+	mtm_dirtyset_t dirty;
+	durable_wset_t **order = NULL;
+	durable_wset_t *batch;
+	durable_wset_t *ws;
+	int            order_size = 0;
+	int            n;
+	uint64_t       enqueued;
+
+#ifdef SYNC_TRUNCATION	
+	m_logmgr_alloc_log(set, M_TMLOG_LF_TYPE, 0, &log_dsc);
+#else
+	m_logmgr_alloc_log(set, M_TMLOG_LF_TYPE, LF_ASYNC_TRUNCATION, &log_dsc);
+#endif	
+	log = (M_TMLOG_T *) log_dsc->log;
+	mtm_dirtyset_init(&dirty, MTM_DIRTYSET_DEFAULT_SIZE);
+
+	pthread_mutex_lock(&durable_lock);
+	while (1) {
+		while (durable_queue == NULL && !durable_stop) {
+			pthread_cond_wait(&durable_cond, &durable_lock);
+		}
+		if (durable_queue == NULL) {
+			break;
+		}
+		while (!durable_hurry && !durable_stop &&
+		       pthread_cond_timedwait(&durable_cond, &durable_lock, &durable_deadline) != ETIMEDOUT)
+		{
+			/* Woken up before the deadline */
+		}
+		batch = durable_queue;
+		enqueued = durable_enqueued;
+		durable_queue = NULL;
+		durable_batch = batch;
+		durable_hurry = 0;
+		pthread_mutex_unlock(&durable_lock);
+
+		for (n = 0, ws = batch; ws != NULL; ws = ws->next) {
+			if (n == order_size) {
+				order_size = order_size ? order_size * 2 : 1024;
+				if ((order = (durable_wset_t **) realloc(order, order_size * sizeof(durable_wset_t *))) == NULL) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			order[n++] = ws;
+		}
+		durable_flush(set, log, &dirty, order, n);
+
+		pthread_mutex_lock(&durable_lock);
+		durable_batch = NULL;
+		for (ws = batch; ws->next != NULL; ws = ws->next);
+		ws->next = durable_free;
+		durable_free = batch;
+		durable_done = enqueued;
+		mtm_durable_pending -= n;
+		pthread_cond_broadcast(&durable_done_cond);
+	}
+	pthread_mutex_unlock(&durable_lock);
+
+	free(order);
+	mtm_dirtyset_fini(&dirty);
+	m_logmgr_free_log(log_dsc);
+	pcm_storeset_put();
+	return NULL;
+}
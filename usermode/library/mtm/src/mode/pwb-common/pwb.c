@@ -44,6 +44,10 @@ mtm_pwb_restart_transaction (mtm_tx_t *tx, mtm_restart_reason r)
 	}	
 #endif
 
+	if (tx->htm_active) {
+		mtm_rtm_abort(MTM_HTM_ABORT_RESTART);
+	}
+
 	if (r == RESTART_REALLOCATE) {
 		assert(0 && "Currently we don't support extending the read/write set size");
 	}
@@ -42,7 +42,6 @@
 #include <assert.h>
 #include <mnemosyne.h>
 #include <pcm.h>
-#include <cuckoo_hash/PointerHashInline.h>
 #include <debug.h>
 #include "tmlog_base.h"
 
@@ -83,7 +82,7 @@ m_tmlog_base_alloc(m_log_dsc_t *log_dsc)
 	 * word aligned.
 	 */
 	assert((( (uintptr_t) &tmlog_base->phlog_base) & (sizeof(uint64_t)-1)) == 0);
-	tmlog_base->flush_set = (set_t *) PointerHash_new();
+	mtm_dirtyset_init(&tmlog_base->flush_set, MTM_DIRTYSET_DEFAULT_SIZE);
 	log_dsc->log = (m_log_t *) tmlog_base;
 
 	return M_R_SUCCESS;
@@ -119,7 +118,6 @@ truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	pcm_word_t        mask;
 	uintptr_t         block_addr;
 	int               val;
-	int               i;
 
 #ifdef _DEBUG_THIS
 	printf("truncation_prepare: log_dsc = %p\n", log_dsc);
@@ -147,14 +145,12 @@ retry:
 					 */
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &sqn) == M_R_SUCCESS);
 					m_phlog_base_next_chunk(&tmlog->phlog_base);
-#ifdef FLUSH_CACHELINE_ONCE
-					for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-						PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-						if (block_addr = (uintptr_t) r->k) {
-							PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-						}
-					}
-#endif					
+					/* 
+					 * Lines of committed fragments read before this one are
+					 * in the set too and must be durable before the log
+					 * space holding their records is given back.
+					 */
+					mtm_dirtyset_flush(set, &tmlog->flush_set);
 					m_phlog_base_truncate_async(set, &tmlog->phlog_base);
 					sqn = INV_LOG_ORDER;
 					goto retry;
@@ -164,13 +160,14 @@ retry:
 					block_addr = (uintptr_t) BLOCK_ADDR(addr);
 
 #ifdef FLUSH_CACHELINE_ONCE
-					if (!PointerHash_at_((PointerHash *) tmlog->flush_set, (void *) block_addr)) {
-						PointerHash_at_put_((PointerHash *) tmlog->flush_set, 
-						                    (void *) block_addr, 
-						                    (void *) 1);
-					}
+					mtm_dirtyset_add(&tmlog->flush_set, block_addr);
 #else 					
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
+					if (m_tier_nsegments) {
+						/* Cold extents are synced by page (see tier.h) */
+						mtm_dirtyset_add(&tmlog->flush_set, block_addr);
+					} else {
+						PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
+					}
 #endif					
 				}
 			} else {
@@ -203,9 +200,7 @@ m_tmlog_base_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 m_result_t 
 m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
-	int            i;
 	m_tmlog_base_t *tmlog = (m_tmlog_base_t *) log_dsc->log;
-	uintptr_t      block_addr;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_base_truncation_do: START: log_dsc = %p\n", log_dsc);
@@ -213,15 +208,8 @@ m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 #endif
 
 
-#ifdef FLUSH_CACHELINE_ONCE
-	for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-		if (block_addr = (uintptr_t) r->k) {
-			PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-		}
-	}
-#endif	
+	/* Lines truncation_prepare collected, if any, once each in address order */
+	mtm_dirtyset_flush(set, &tmlog->flush_set);
 	m_phlog_base_truncate_async(set, &tmlog->phlog_base);
 
 #ifdef _DEBUG_THIS
@@ -362,7 +350,9 @@ m_tmlog_base_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 				assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
 				if (mask!=0) {
 					PCM_WB_STORE_ALIGNED_MASKED(set, (volatile pcm_word_t *) addr, value, mask);
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
+					if (!m_tier_nsegments || !m_tier_writeback(addr)) {
+						PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
+					}
 				}	
 			}	
 		} else {
@@ -42,7 +42,6 @@
 #include <assert.h>
 #include <mnemosyne.h>
 #include <pcm.h>
-#include <cuckoo_hash/PointerHashInline.h>
 #include <debug.h>
 #include "tmlog_tornbit.h"
 
@@ -73,30 +72,6 @@ m_log_ops_t tmlog_tornbit_ops = {
   printf("head       : %lu\n", tmlog->phlog_tornbit.head);        \
   printf("read_index : %lu\n", tmlog->phlog_tornbit.read_index);
 
-void PointerHash_removeKey_noshrink(PointerHash *self, void *k)
-{
-	PointerHashRecord *r;
-	
-	r = PointerHash_record1_(self, k);	
-	if(r->k == k)
-	{
-		r->k = 0x0;
-		r->v = 0x0;
-		self->keyCount --;
-		return;
-	}
-	
-	r = PointerHash_record2_(self, k);
-	if(r->k == k)
-	{
-		r->k = 0x0;
-		r->v = 0x0;
-		self->keyCount --;
-		return;
-	}
-}
-
-
 m_result_t 
 m_tmlog_tornbit_alloc(m_log_dsc_t *log_dsc)
 {
@@ -111,7 +86,7 @@ m_tmlog_tornbit_alloc(m_log_dsc_t *log_dsc)
 	 * word aligned.
 	 */
 	assert((( (uintptr_t) &tmlog_tornbit->phlog_tornbit) & (sizeof(uint64_t)-1)) == 0);
-	tmlog_tornbit->flush_set = (tornbit_flush_set_t *) PointerHash_new();
+	mtm_dirtyset_init(&tmlog_tornbit->flush_set, MTM_DIRTYSET_DEFAULT_SIZE);
 	log_dsc->log = (m_log_t *) tmlog_tornbit;
 
 	return M_R_SUCCESS;
@@ -184,11 +159,7 @@ retry:
 					block_addr = (uintptr_t) BLOCK_ADDR(addr);
 
 #ifdef FLUSH_CACHELINE_ONCE
-					if (!PointerHash_at_((PointerHash *) tmlog->flush_set, (void *) block_addr)) {
-						PointerHash_at_put_((PointerHash *) tmlog->flush_set, 
-						                    (void *) block_addr, 
-						                    (void *) 1);
-					}
+					mtm_dirtyset_add(&tmlog->flush_set, block_addr);
 #else 					
 					PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
 #endif					
@@ -223,9 +194,7 @@ m_tmlog_tornbit_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_ds
 m_result_t 
 m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
-	int               i;
 	m_tmlog_tornbit_t *tmlog = (m_tmlog_tornbit_t *) log_dsc->log;
-	uintptr_t         block_addr;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_tornbit_truncation_do: START\n");
@@ -233,14 +202,8 @@ m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 #endif
 
 #ifdef FLUSH_CACHELINE_ONCE
-	for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-		if (block_addr = (uintptr_t) r->k) {
-			//PointerHash_removeKey_noshrink((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-		}
-	}
+	/* Each dirty line once, in address order. */
+	mtm_dirtyset_flush(set, &tmlog->flush_set);
 #endif	
 	m_phlog_tornbit_truncate_async(set, &tmlog->phlog_tornbit);
 
@@ -386,7 +349,9 @@ m_tmlog_tornbit_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
 				if (mask!=0) {
 					PCM_WB_STORE_ALIGNED_MASKED(set, (volatile pcm_word_t *) addr, value, mask);
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
+					if (!m_tier_nsegments || !m_tier_writeback(addr)) {
+						PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
+					}
 				}	
 			}	
 		} else {
@@ -66,12 +66,18 @@ mtm_pwbetl_abortTransaction (mtm_tx_t *tx,
 	        (reason == userRetry && 1));
 	//assert ((tx->state & STATE_ABORTING) == 0);
 
+	if (tx->htm_active) {
+		/* Let the software path perform the abort or retry. */
+		mtm_rtm_abort(MTM_HTM_ABORT_USER);
+	}
+
 	if (tx->status & TX_IRREVOCABLE) {
 		abort ();
 	}	
 
 	if (reason == userAbort) {
 		rollback_transaction (tx);
+		cm_end (tx);
 		//pwb_fini (td);
 
 		/* TODO: Implement serial mode to support irrevocable actions such as I/O
@@ -0,0 +1,153 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file htm.c
+ *
+ * \brief Implements the RTM fast path entry for pwbetl transactions.
+ *
+ */
+
+#include "mtm_i.h"
+#include "config.h"
+#include "mode/pwbetl/htm.h"
+
+int mtm_htm_enabled = 0;
+int mtm_htm_max_writes = 0;
+
+static int           htm_retries;
+static unsigned long htm_total_commits = 0;
+static unsigned long htm_total_aborts = 0;
+static unsigned long htm_total_fallbacks = 0;
+static unsigned long htm_total_aborts_by_code[MTM_HTM_NUM_ABORT_CODES];
+
+
+void
+mtm_pwbetl_htm_init(void)
+{
+	if (!mtm_runtime_settings.htm_fastpath) {
+		return;
+	}
+	if (!mtm_rtm_supported()) {
+		fprintf(stderr, "mtm: htm_fastpath requested but the CPU does not support RTM; using pwbetl only\n");
+		return;
+	}
+	htm_retries = mtm_runtime_settings.htm_retries;
+	mtm_htm_max_writes = mtm_runtime_settings.htm_max_writes;
+	mtm_htm_enabled = 1;
+}
+
+
+/**
+ * \brief Tries to run the top-level transaction of tx in hardware.
+ *
+ * Must be called after the software begin so that an abort of the RTM
+ * region falls back to a fully initialized pwbetl transaction: the
+ * hardware discards every store made inside the region, including the
+ * ones to tx and to its write set. The actions returned to the caller
+ * are the same either way since the barriers pick the path.
+ */
+uint32_t
+mtm_pwbetl_htm_begin(mtm_tx_t *tx, uint32_t actions)
+{
+	unsigned int status;
+	unsigned int code;
+	int          attempt;
+	int          i;
+
+	for (attempt = 0; attempt < htm_retries; attempt++) {
+		status = mtm_rtm_begin();
+		if (status == MTM_RTM_STARTED) {
+			tx->htm_active = 1;
+			return actions;
+		}
+		tx->htm_aborts++;
+		if (status & MTM_RTM_ABORT_EXPLICIT) {
+			code = MTM_RTM_ABORT_CODE(status);
+			if (code < MTM_HTM_NUM_ABORT_CODES) {
+				tx->htm_aborts_by_code[code]++;
+			}
+			/* Only conflicts with software transactions are worth retrying. */
+			if (code != MTM_HTM_ABORT_LOCKED && code != MTM_HTM_ABORT_RESTART) {
+				break;
+			}
+		} else if (!(status & MTM_RTM_ABORT_RETRY)) {
+			/* Capacity, system calls, faults, ...: will abort again. */
+			break;
+		}
+		for (i = 0; i < (16 << attempt); i++) {
+			cpu_relax();
+		}
+	}
+	tx->htm_fallbacks++;
+	return actions;
+}
+
+
+void
+mtm_pwbetl_htm_fini_thread(mtm_tx_t *tx)
+{
+	int i;
+
+	__sync_fetch_and_add(&htm_total_commits, tx->htm_commits);
+	__sync_fetch_and_add(&htm_total_aborts, tx->htm_aborts);
+	__sync_fetch_and_add(&htm_total_fallbacks, tx->htm_fallbacks);
+	for (i = 0; i < MTM_HTM_NUM_ABORT_CODES; i++) {
+		__sync_fetch_and_add(&htm_total_aborts_by_code[i], tx->htm_aborts_by_code[i]);
+	}
+	tx->htm_commits = tx->htm_aborts = tx->htm_fallbacks = 0;
+	for (i = 0; i < MTM_HTM_NUM_ABORT_CODES; i++) {
+		tx->htm_aborts_by_code[i] = 0;
+	}
+}
+
+
+/**
+ * \brief Prints the fast-path counters of the threads that have finished.
+ */
+void
+mtm_pwbetl_htm_report(FILE *stream)
+{
+	if (!mtm_htm_enabled) {
+		return;
+	}
+	fprintf(stream, "HTM FAST PATH: max_writes=%d retries=%d\n", mtm_htm_max_writes, htm_retries);
+	fprintf(stream, "%12s %12s %12s %12s %12s %12s\n", 
+	        "COMMITS", "ABORTS", "FALLBACKS", "LOCKED", "WSET_FULL", "USER");
+	fprintf(stream, "%12lu %12lu %12lu %12lu %12lu %12lu\n",
+	        htm_total_commits,
+	        htm_total_aborts,
+	        htm_total_fallbacks,
+	        htm_total_aborts_by_code[MTM_HTM_ABORT_LOCKED],
+	        htm_total_aborts_by_code[MTM_HTM_ABORT_WSET_FULL],
+	        htm_total_aborts_by_code[MTM_HTM_ABORT_USER]);
+}
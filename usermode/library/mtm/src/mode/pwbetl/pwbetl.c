@@ -85,6 +85,9 @@ mtm_pwbetl_create(mtm_tx_t *tx, mtm_mode_data_t **datap)
 	data->w_set.reallocate = 0;
 	mtm_allocate_ws_entries(tx, data, 0);
 
+	/* Dirty persistent cache lines (at most one per write set entry) */
+	mtm_dirtyset_init(&data->dirty_lines, RW_SET_SIZE);
+
 	/* Non-volatile log */
 #ifdef SYNC_TRUNCATION	
 	m_logmgr_alloc_log(tx->pcm_storeset, M_TMLOG_LF_TYPE, 0, &data->ptmlog_dsc);
@@ -117,4 +120,5 @@ mtm_pwbetl_destroy(mtm_mode_data_t *_data)
 	free(data->r_set.entries);
 	free(data->w_set.entries);
 #endif /* ! EPOCH_GC */
+	mtm_dirtyset_fini(&data->dirty_lines);
 }
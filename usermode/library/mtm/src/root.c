@@ -0,0 +1,293 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file root.c
+ *
+ * \brief Implements the persistent root directory (see m_root_get and
+ * m_root_set in mtm.h).
+ *
+ * The directory is an open-addressing hash table in its own persistent 
+ * segment, found through a persistent pointer in this library's PERSISTENT
+ * section. Each entry is one cacheline holding the name's hash, the value,
+ * and the name itself. Entries are never removed, so a probe sequence ends
+ * at the first free entry and a name, once published, never moves or 
+ * changes.
+ *
+ * Inside a transaction every access goes through the transactional 
+ * barriers, so creating or updating a root commits or aborts with the 
+ * enclosing transaction. Outside a transaction an update is made durable 
+ * on its own: the name and value are written before the hash that 
+ * publishes the entry. Such stores bypass the STM, so updates of both 
+ * kinds take root_txlock, which a transaction holds until it commits or 
+ * aborts (see txlock.h): a transaction never has an update of the other
+ * kind made under it.
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <mnemosyne.h>
+#include "mtm_i.h"
+#include "txlock.h"
+
+#define ROOT_MAGIC        0x746f6f52736f6d6eLLU   /* "nmosRoot" */
+#define ROOT_NUM_ENTRIES  4096                   /* must be a power of two */
+#define ROOT_NAME_WORDS   6
+#define ROOT_NAME_MAX     (ROOT_NAME_WORDS * sizeof(uint64_t) - 1)
+
+typedef struct root_entry_s root_entry_t;
+typedef struct root_directory_s root_directory_t;
+
+struct root_entry_s {
+	uint64_t hash;                          /**< 0 if the entry is free */
+	uint64_t value;
+	uint64_t name[ROOT_NAME_WORDS];         /**< NUL padded */
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
+struct root_directory_s {
+	uint64_t     magic;
+	uint64_t     nentries;
+	root_entry_t entries[] __attribute__ ((aligned (CACHELINE_SIZE)));
+};
+
+__attribute__ ((section("PERSISTENT"))) root_directory_t *root_directory = NULL;
+
+/* Serializes creating the directory */
+static pthread_mutex_t root_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes updates, inside transactions and out */
+static m_txmutex_t     root_txlock = M_TXMUTEX_INITIALIZER;
+
+
+static inline
+int
+in_transaction(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	return tx && tx->status != TX_IDLE;
+}
+
+
+static inline
+uint64_t
+root_load(int intx, uint64_t *addr)
+{
+	if (intx) {
+		return _ITM_RU8(addr);
+	}
+	return *((volatile uint64_t *) addr);
+}
+
+
+/* FNV-1a; 0 marks free entries so it is never a hash. */
+static
+uint64_t
+root_hash(const uint64_t *key)
+{
+	const uint8_t *p = (const uint8_t *) key;
+	uint64_t      hash = 0xcbf29ce484222325LLU;
+	int           i;
+
+	for (i=0; i<ROOT_NAME_WORDS*sizeof(uint64_t) && p[i]; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3LLU;
+	}
+	return hash ? hash : 1;
+}
+
+
+static
+int
+root_key(const char *name, uint64_t *key)
+{
+	size_t len;
+
+	if (name == NULL || (len = strlen(name)) == 0 || len > ROOT_NAME_MAX) {
+		return -1;
+	}
+	memset(key, 0, ROOT_NAME_WORDS * sizeof(uint64_t));
+	memcpy(key, name, len);
+	return 0;
+}
+
+
+static
+root_directory_t *
+root_directory_create(void)
+{
+	pcm_storeset_t   *set;
+	root_directory_t *dir;
+	size_t           size;
+
+	pthread_mutex_lock(&root_lock);
+	if ((dir = root_directory) != NULL) {
+		goto out;
+	}
+	/* 
+	 * A crash before root_directory is written leaks the segment, which 
+	 * costs address space but nothing else: the next run makes a new one.
+	 */
+	size = sizeof(root_directory_t) + ROOT_NUM_ENTRIES * sizeof(root_entry_t);
+	dir = (root_directory_t *) m_pmap(NULL, size, PROT_READ|PROT_WRITE, 0);
+	if (dir == MAP_FAILED) {
+		dir = NULL;
+		goto out;
+	}
+	set = pcm_storeset_get();
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &dir->magic, (pcm_word_t) ROOT_MAGIC);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &dir->nentries, (pcm_word_t) ROOT_NUM_ENTRIES);
+	PCM_NT_FLUSH(set);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &root_directory, (pcm_word_t) dir);
+	PCM_NT_FLUSH(set);
+out:
+	pthread_mutex_unlock(&root_lock);
+	return dir;
+}
+
+
+/**
+ * \brief Finds the entry for key, or the free entry where it would go.
+ *
+ * Returns NULL if key is absent and the directory is full.
+ */
+static
+root_entry_t *
+root_lookup(int intx, root_directory_t *dir, const uint64_t *key, uint64_t hash)
+{
+	root_entry_t *entry;
+	uint64_t     mask = dir->nentries - 1;
+	uint64_t     h;
+	uint64_t     i;
+	int          w;
+
+	for (i=0; i<dir->nentries; i++) {
+		entry = &dir->entries[(hash + i) & mask];
+		if ((h = root_load(intx, &entry->hash)) == 0) {
+			return entry;
+		}
+		if (h != hash) {
+			continue;
+		}
+		for (w=0; w<ROOT_NAME_WORDS; w++) {
+			if (root_load(intx, &entry->name[w]) != key[w]) {
+				break;
+			}
+		}
+		if (w == ROOT_NAME_WORDS) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+
+void *
+m_root_get(const char *name)
+{
+	root_directory_t *dir = root_directory;
+	root_entry_t     *entry;
+	uint64_t         key[ROOT_NAME_WORDS];
+	uint64_t         hash;
+	int              intx;
+
+	if (dir == NULL || root_key(name, key) != 0) {
+		return NULL;
+	}
+	intx = in_transaction();
+	hash = root_hash(key);
+	entry = root_lookup(intx, dir, key, hash);
+	if (entry == NULL || root_load(intx, &entry->hash) == 0) {
+		return NULL;
+	}
+	return (void *) root_load(intx, &entry->value);
+}
+
+
+int
+m_root_set(const char *name, void *value)
+{
+	root_directory_t *dir = root_directory;
+	root_entry_t     *entry;
+	pcm_storeset_t   *set;
+	uint64_t         key[ROOT_NAME_WORDS];
+	uint64_t         hash;
+	int              w;
+
+	if (root_key(name, key) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dir == NULL && (dir = root_directory_create()) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	hash = root_hash(key);
+
+	if (in_transaction()) {
+		/* Held until the transaction ends; the unlock only drops a count */
+		m_txmutex_lock(&root_txlock);
+		if ((entry = root_lookup(1, dir, key, hash)) == NULL) {
+			m_txmutex_unlock(&root_txlock);
+			errno = ENOSPC;
+			return -1;
+		}
+		if (_ITM_RU8(&entry->hash) == 0) {
+			for (w=0; w<ROOT_NAME_WORDS; w++) {
+				_ITM_WU8(&entry->name[w], key[w]);
+			}
+			_ITM_WU8(&entry->hash, hash);
+		}
+		_ITM_WU8(&entry->value, (uint64_t) value);
+		m_txmutex_unlock(&root_txlock);
+		return 0;
+	}
+
+	m_txmutex_lock(&root_txlock);
+	if ((entry = root_lookup(0, dir, key, hash)) == NULL) {
+		m_txmutex_unlock(&root_txlock);
+		errno = ENOSPC;
+		return -1;
+	}
+	set = pcm_storeset_get();
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &entry->value, (pcm_word_t) value);
+	if (entry->hash == 0) {
+		for (w=0; w<ROOT_NAME_WORDS; w++) {
+			PCM_NT_STORE(set, (volatile pcm_word_t *) &entry->name[w], (pcm_word_t) key[w]);
+		}
+		PCM_NT_FLUSH(set);
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &entry->hash, (pcm_word_t) hash);
+	}
+	PCM_NT_FLUSH(set);
+	m_txmutex_unlock(&root_txlock);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file snapshot.c
+ *
+ * \brief Implements m_snapshot (see mtm.h).
+ *
+ * Commits wait at the snapshot gate of mcore (see snapshot.h) while the 
+ * segments are copied, so the copy holds every transaction with a commit
+ * timestamp up to the clock value read while the gate was closed, and no
+ * other. Logs are copied along with the segments; recovery replays the 
+ * transactions still in them, as after a crash.
+ */
+
+#include <errno.h>
+#include <mnemosyne.h>
+#include <snapshot.h>
+#include "mtm_i.h"
+
+
+int
+m_snapshot(const char *dir, uint64_t *sqn)
+{
+	mtm_word_t stamp;
+	int        rv;
+
+	/* Other processes of the group commit through gates of their own */
+	if (m_process_group_size() > 1) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	/* Lazy-durable commits are only in the flusher's memory */
+	m_durable_barrier();
+	m_snapshot_freeze();
+	stamp = GET_CLOCK;
+	rv = m_segment_snapshot(dir, (uint64_t) stamp);
+	m_snapshot_thaw();
+	if (rv == 0 && sqn) {
+		*sqn = (uint64_t) stamp;
+	}
+	return rv;
+}
@@ -184,7 +184,7 @@ stats_statset_reset(m_stats_statset_t *statset)
 {
 #define RESETSTAT(name)                                                      \
   statset->stats[m_stats_##name##_stat].total = 0;                    \
-  statset->stats[m_stats_##name##_stat].min = 0xFFFFFFFF;             \
+  statset->stats[m_stats_##name##_stat].min = ~0ULL;                  \
   statset->stats[m_stats_##name##_stat].max = 0;
 
 	FOREACH_STAT (RESETSTAT)
@@ -298,7 +298,7 @@ m_stats_statset_print(FILE *fout,
 
 	count = statset->count;
 
-	fprintf(fout, "%s%s%s:%13s%13s%13s%13u\n", 
+	fprintf(fout, "%s%s%s:%13s%13s%13s%13llu\n", 
 	        WHITESPACE(shiftlen+2),
 	        "Transactions",
 			WHITESPACE(25 - strlen("Transactions")),
@@ -312,7 +312,7 @@ m_stats_statset_print(FILE *fout,
 		min = statset->stats[i].min;
 		max = statset->stats[i].max;
 		mean = (double) total / (double) count;
-		fprintf(fout, "%s%s%s:%13u%13.2f%13u%13u\n", 
+		fprintf(fout, "%s%s%s:%13llu%13.2f%13llu%13llu\n", 
 		        WHITESPACE(shiftlen+2),
 		        stats_strings[i],
 				WHITESPACE(25 - strlen(stats_strings[i])),
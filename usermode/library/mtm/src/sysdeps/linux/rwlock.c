@@ -34,45 +34,44 @@
  * \file rwlock.c
  * \brief Reader-writer lock implementation 
  *
- * \todo Implement rw-lock if need to support serial mode for irrevocable 
- * actions
- *
- * Note: Linux implementation could use pthreads rwlock
- *
+ * The runtime's own reader-writer lock, for the serial mode of irrevocable
+ * actions; it is not meant to be taken inside transactions (see txlock.h 
+ * for that). The Linux implementation uses the pthreads rwlock.
  */
 
+#include <pthread.h>
 #include "rwlock.h"
 
 int
 mtm_rwlock_init (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	return pthread_rwlock_init(&lock->rwlock, NULL);
 }
 
 
 int
 mtm_rwlock_rdlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	return pthread_rwlock_rdlock(&lock->rwlock);
 }
 
 
 int
 mtm_rwlock_wrlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	return pthread_rwlock_wrlock(&lock->rwlock);
 }
 
 
 int
 mtm_rwlock_trywrlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	return pthread_rwlock_trywrlock(&lock->rwlock);
 }
 
 
 int
 mtm_rwlock_unlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	return pthread_rwlock_unlock(&lock->rwlock);
 }
@@ -30,31 +30,502 @@
 ### END HEADER ###
 */
 
+/**
+ * \file txlock.c
+ *
+ * \brief Transaction-safe mutexes and reader-writer locks (see txlock.h).
+ *
+ * Each thread keeps the locks it holds in a small table. A lock entered
+ * by the running transaction is released by a commit or undo action of
+ * that transaction; its count only tells whether the thread still holds
+ * it after commit.
+ */
+
+#include <errno.h>
+#include <sched.h>
 #include <pthread.h>
 #include "mtm_i.h"
+#include "config.h"
+#include "txlock.h"
+
+#define TXLOCK_MAX_HELD  32
+
+#define TXLOCK_WRITER    ((uintptr_t) 1)  /* state: held by a writer */
+#define TXLOCK_READER    ((uintptr_t) 2)  /* state: one more reader */
+
+/* Modes of a held lock */
+#define TXLOCK_READ      0x1
+#define TXLOCK_WRITE     0x2
+#define TXLOCK_ELIDED    0x4
+
+typedef struct txlock_held_s txlock_held_t;
+
+struct txlock_held_s {
+	m_txlock_t *lock;
+	int         mode;
+	int         count;   /* Lock calls not matched by an unlock call yet */
+	int         intx;    /* Taken by the running transaction */
+};
+
+static __thread txlock_held_t txlock_held[TXLOCK_MAX_HELD];
+static __thread int           txlock_nheld = 0;
+
+
+static
+txlock_held_t *
+held_find(m_txlock_t *lock)
+{
+	int i;
+
+	for (i = 0; i < txlock_nheld; i++) {
+		if (txlock_held[i].lock == lock) {
+			return &txlock_held[i];
+		}
+	}
+	return NULL;
+}
+
+
+static
+txlock_held_t *
+held_add(m_txlock_t *lock, int mode, int intx)
+{
+	txlock_held_t *held;
+
+	if (txlock_nheld == TXLOCK_MAX_HELD) {
+		return NULL;
+	}
+	held = &txlock_held[txlock_nheld++];
+	held->lock = lock;
+	held->mode = mode;
+	held->count = 1;
+	held->intx = intx;
+	return held;
+}
+
+
+static
+void
+held_drop(txlock_held_t *held)
+{
+	*held = txlock_held[--txlock_nheld];
+}
+
+
+static inline
+int
+state_tryacquire(m_txlock_t *lock, int mode)
+{
+	uintptr_t s = lock->state;
+
+	if (mode & TXLOCK_WRITE) {
+		return s == 0 && __sync_bool_compare_and_swap(&lock->state, 0, TXLOCK_WRITER);
+	}
+	return !(s & TXLOCK_WRITER) && __sync_bool_compare_and_swap(&lock->state, s, s + TXLOCK_READER);
+}
+
+
+static inline
+void
+state_release(m_txlock_t *lock, int mode)
+{
+	__sync_fetch_and_sub(&lock->state, (mode & TXLOCK_WRITE) ? TXLOCK_WRITER : TXLOCK_READER);
+}
+
+
+static inline
+int
+elide_compatible(uintptr_t state, int mode)
+{
+	return state == 0 || (!(mode & TXLOCK_WRITE) && !(state & TXLOCK_WRITER));
+}
+
+
+/* 
+ * Returns whether the section may run without the lock. The counter is
+ * raised before the state is looked at and real holders do the reverse,
+ * so one of the two always sees the other.
+ */
+static inline
+int
+elide_tryenter(m_txlock_t *lock, int mode)
+{
+	volatile uintptr_t *elided = (mode & TXLOCK_WRITE) ? &lock->elided_writers : &lock->elided_readers;
+
+	if (!elide_compatible(lock->state, mode)) {
+		return 0;
+	}
+	__sync_fetch_and_add(elided, 1);
+	if (elide_compatible(lock->state, mode)) {
+		return 1;
+	}
+	__sync_fetch_and_sub(elided, 1);
+	return 0;
+}
+
+
+static inline
+void
+elide_leave(m_txlock_t *lock, int mode)
+{
+	__sync_fetch_and_sub((mode & TXLOCK_WRITE) ? &lock->elided_writers : &lock->elided_readers, 1);
+}
+
+
+/*
+ * Eliding holders never wait for a real holder without bound, so a real
+ * holder can wait for them to commit or abort.
+ */
+static inline
+void
+elide_drain(m_txlock_t *lock, int mode)
+{
+	while (lock->elided_writers || ((mode & TXLOCK_WRITE) && lock->elided_readers)) {
+		cpu_relax();
+	}
+}
+
+
+static
+void
+held_release(txlock_held_t *held)
+{
+	if (held->mode & TXLOCK_ELIDED) {
+		elide_leave(held->lock, held->mode);
+	} else {
+		state_release(held->lock, held->mode);
+	}
+}
+
+
+/*
+ * Tries op up to txlock_spins times, or forever when bounded is zero.
+ * Outside a transaction nothing can wait for us while we spin, but a 
+ * transaction could hold a lock that the holder of this one waits for.
+ */
+static
+int
+spin_until(int (*op)(m_txlock_t *, int), m_txlock_t *lock, int mode, int bounded)
+{
+	int spins = 0;
+
+	while (!op(lock, mode)) {
+		if (++spins >= mtm_runtime_settings.txlock_spins && bounded) {
+			return 0;
+		}
+		if ((spins & 1023) == 0) {
+			sched_yield();
+		} else {
+			cpu_relax();
+		}
+	}
+	return 1;
+}
+
+
+static
+int
+state_tryupgrade(m_txlock_t *lock, int mode)
+{
+	return __sync_bool_compare_and_swap(&lock->state, TXLOCK_READER, TXLOCK_WRITER);
+}
+
+
+static
+void
+txlock_restart(void)
+{
+	_ITM_abortTransaction(userRetry, NULL);
+}
+
+
+/* Undo action of a lock entered by the transaction */
+static
+void _ITM_CALL_CONVENTION
+txlock_undo_enter(void *arg)
+{
+	txlock_held_t *held = held_find((m_txlock_t *) arg);
+
+	held_release(held);
+	held_drop(held);
+}
+
+
+/* 
+ * Commit action of a lock entered by the transaction. A lock the thread 
+ * still holds must be held for real from now on. An elided one is left 
+ * before it is taken, as a real holder may be waiting for us to leave:
+ * a section that outlives its transaction is thus atomic only up to the
+ * commit and from then on.
+ */
+static
+void _ITM_CALL_CONVENTION
+txlock_commit_enter(void *arg)
+{
+	m_txlock_t    *lock = (m_txlock_t *) arg;
+	txlock_held_t *held = held_find(lock);
+
+	if (held->count == 0) {
+		held_release(held);
+		held_drop(held);
+		return;
+	}
+	if (held->mode & TXLOCK_ELIDED) {
+		held->mode &= ~TXLOCK_ELIDED;
+		elide_leave(lock, held->mode);
+		spin_until(state_tryacquire, lock, held->mode, 0);
+		elide_drain(lock, held->mode);
+	}
+	held->intx = 0;
+}
+
+
+/* Undo action of a lock call on a lock held from before the transaction */
+static
+void _ITM_CALL_CONVENTION
+txlock_undo_lock(void *arg)
+{
+	held_find((m_txlock_t *) arg)->count--;
+}
 
-typedef pthread_mutex_t m_txmutex_t;
 
-void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action(void *arg)
+/* Undo action of an unlock call on a lock held from before the transaction */
+static
+void _ITM_CALL_CONVENTION
+txlock_undo_unlock(void *arg)
 {
-	m_txmutex_t *txmutex = (m_txmutex_t *) arg;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
+	held_find((m_txlock_t *) arg)->count++;
+}
 
-	//printf("[%d] COMMIT: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-	pthread_mutex_unlock(mutex);
 
-	return;
+/* Commit action of an unlock call on a lock held from before the transaction */
+static
+void _ITM_CALL_CONVENTION
+txlock_commit_unlock(void *arg)
+{
+	txlock_held_t *held = held_find((m_txlock_t *) arg);
+
+	if (held && held->count == 0) {
+		held_release(held);
+		held_drop(held);
+	}
 }
 
-typedef pthread_rwlock_t m_txrwlock_t;
 
-void _ITM_CALL_CONVENTION m_txrwlock_unlock_commit_action(void *arg)
+/* 
+ * A transaction first waits a bit for the lock to be free and then 
+ * restarts; after txlock_elide_retries attempts it takes the lock.
+ */
+static
+int
+txlock_enter(mtm_tx_t *tx, m_txlock_t *lock, int mode)
 {
-	m_txrwlock_t *txrwlock = (m_txrwlock_t *) arg;
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
+	int restartable = !(tx->status & TX_IRREVOCABLE);
 
-	//printf("[%d] COMMIT: RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
-	pthread_rwlock_unlock(rwlock);
+	if (restartable && 
+	    mtm_runtime_settings.txlock_elide && 
+	    tx->retries < mtm_runtime_settings.txlock_elide_retries)
+	{
+		if (!spin_until(elide_tryenter, lock, mode, 1)) {
+			txlock_restart();
+		}
+		return mode | TXLOCK_ELIDED;
+	}
+	if (!spin_until(state_tryacquire, lock, mode, restartable)) {
+		txlock_restart();
+	}
+	elide_drain(lock, mode);
+	return mode;
+}
+
+
+static
+int
+txlock_upgrade(mtm_tx_t *tx, txlock_held_t *held)
+{
+	m_txlock_t *lock = held->lock;
+
+	if (tx == NULL || !held->intx) {
+		/* Can neither wait for the other readers nor make them go away */
+		if (!state_tryupgrade(lock, TXLOCK_WRITE)) {
+			return EDEADLK;
+		}
+	} else if (held->mode & TXLOCK_ELIDED) {
+		if (!spin_until(elide_tryenter, lock, TXLOCK_WRITE, 1)) {
+			txlock_restart();
+		}
+		elide_leave(lock, TXLOCK_READ);
+		held->mode = TXLOCK_WRITE | TXLOCK_ELIDED;
+		return 0;
+	} else if (!spin_until(state_tryupgrade, lock, TXLOCK_WRITE, !(tx->status & TX_IRREVOCABLE))) {
+		txlock_restart();
+	}
+	elide_drain(lock, TXLOCK_WRITE);
+	held->mode = TXLOCK_WRITE;
+	return 0;
+}
+
+
+/* The transaction of the thread, if it runs one */
+static inline
+mtm_tx_t *
+txlock_tx(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
 
-	return;
+	if (tx && (tx->status == TX_ACTIVE || (tx->status & TX_IRREVOCABLE))) {
+		return tx;
+	}
+	return NULL;
+}
+
+
+static
+int
+txlock_lock(m_txlock_t *lock, int mode)
+{
+	mtm_tx_t      *tx = txlock_tx();
+	txlock_held_t *held;
+	int           ret;
+
+	if (tx && tx->htm_active) {
+		/* Sections guarded by a lock run in software transactions */
+		mtm_rtm_abort(MTM_HTM_ABORT_IRREVOCABLE);
+	}
+	if ((held = held_find(lock)) != NULL) {
+		if ((mode & TXLOCK_WRITE) && !(held->mode & TXLOCK_WRITE)) {
+			if ((ret = txlock_upgrade(tx, held)) != 0) {
+				return ret;
+			}
+		}
+		held->count++;
+		if (tx && !held->intx) {
+			mtm_useraction_addUserUndoAction(tx, txlock_undo_lock, lock);
+		}
+		return 0;
+	}
+	if (txlock_nheld == TXLOCK_MAX_HELD) {
+		return EAGAIN;
+	}
+	if (tx) {
+		held_add(lock, txlock_enter(tx, lock, mode), 1);
+		mtm_useraction_addUserCommitAction(tx, txlock_commit_enter, _ITM_noTransactionId, lock);
+		mtm_useraction_addUserUndoAction(tx, txlock_undo_enter, lock);
+	} else {
+		spin_until(state_tryacquire, lock, mode, 0);
+		elide_drain(lock, mode);
+		held_add(lock, mode, 0);
+	}
+	return 0;
+}
+
+
+static
+int
+txlock_unlock(m_txlock_t *lock)
+{
+	mtm_tx_t      *tx = txlock_tx();
+	txlock_held_t *held;
+
+	if ((held = held_find(lock)) == NULL || held->count == 0) {
+		return EPERM;
+	}
+	held->count--;
+	if (tx) {
+		if (!held->intx) {
+			mtm_useraction_addUserCommitAction(tx, txlock_commit_unlock, _ITM_noTransactionId, lock);
+			mtm_useraction_addUserUndoAction(tx, txlock_undo_unlock, lock);
+		}
+		return 0;
+	}
+	if (held->count == 0) {
+		held_release(held);
+		held_drop(held);
+	}
+	return 0;
+}
+
+
+static
+int
+txlock_init(m_txlock_t *lock)
+{
+	lock->state = 0;
+	lock->elided_readers = 0;
+	lock->elided_writers = 0;
+	return 0;
+}
+
+
+static
+int
+txlock_destroy(m_txlock_t *lock)
+{
+	if (lock->state || lock->elided_readers || lock->elided_writers) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+
+int
+m_txmutex_init(m_txmutex_t *txmutex)
+{
+	return txlock_init(txmutex);
+}
+
+
+int
+m_txmutex_destroy(m_txmutex_t *txmutex)
+{
+	return txlock_destroy(txmutex);
+}
+
+
+int
+m_txmutex_lock(m_txmutex_t *txmutex)
+{
+	return txlock_lock(txmutex, TXLOCK_WRITE);
+}
+
+
+int
+m_txmutex_unlock(m_txmutex_t *txmutex)
+{
+	return txlock_unlock(txmutex);
+}
+
+
+int
+m_txrwlock_init(m_txrwlock_t *txrwlock)
+{
+	return txlock_init(txrwlock);
+}
+
+
+int
+m_txrwlock_destroy(m_txrwlock_t *txrwlock)
+{
+	return txlock_destroy(txrwlock);
+}
+
+
+int
+m_txrwlock_rdlock(m_txrwlock_t *txrwlock)
+{
+	return txlock_lock(txrwlock, TXLOCK_READ);
+}
+
+
+int
+m_txrwlock_wrlock(m_txrwlock_t *txrwlock)
+{
+	return txlock_lock(txrwlock, TXLOCK_WRITE);
+}
+
+
+int
+m_txrwlock_unlock(m_txrwlock_t *txrwlock)
+{
+	return txlock_unlock(txrwlock);
 }
@@ -117,6 +117,13 @@ mtm_useraction_list_run (mtm_user_action_list_t *list, int reverse)
 }
 
 
+int
+mtm_useraction_list_empty(mtm_user_action_list_t *list)
+{
+	return list->nb_entries == 0;
+}
+
+
 void
 mtm_useraction_addUserCommitAction(mtm_tx_t * tx,
                                    _ITM_userCommitFunction fn,
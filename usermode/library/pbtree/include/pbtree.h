@@ -0,0 +1,128 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Defines the public interface to the persistent B+-tree, an ordered map 
+ * from 64-bit keys to pointer-sized values kept in persistent memory.
+ *
+ * The tree is laid out for the transactional memory rather than for a CPU
+ * alone. Inner nodes hold sorted keys, so a lookup reads a few contiguous
+ * cache lines per level instead of chasing one pointer per level as a 
+ * binary tree does. Leaves are unsorted: an insert fills a free slot and 
+ * sets its bit in the leaf's bitmap, and a remove clears the bit, so 
+ * neither logs more than a few words. A one-byte fingerprint per slot, 
+ * packed in one cache line, keeps point lookups from reading the keys of
+ * the whole leaf. A split logs the new nodes' used slots, which is about 
+ * what shifting the keys of a sorted node in place would log.
+ *
+ * Except for pbtree_scan, the functions must be called inside a durability
+ * transaction. Empty leaves are not merged back into the tree.
+ */
+#ifndef _PBTREE_H_RT61XP
+#define _PBTREE_H_RT61XP
+
+#include <stddef.h>
+#include <stdint.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+typedef struct pbtree_s pbtree_t;
+
+/*!
+ * Allocates an empty tree. Keep the pointer in persistent memory, for 
+ * example as a root (see m_root_set), to find the tree after a restart.
+ *
+ * \return the tree, or NULL if it cannot be allocated.
+ */
+__attribute__((transaction_safe)) 
+pbtree_t *pbtree_alloc(void);
+
+/*! Frees a tree and all its nodes; the values are not freed. */
+__attribute__((transaction_safe)) 
+void pbtree_free(pbtree_t *tree);
+
+/*!
+ * Looks up a key.
+ *
+ * \return 1 and the value in *valuep (if valuep is not NULL) if the key is
+ *  present, 0 otherwise.
+ */
+__attribute__((transaction_safe)) 
+int pbtree_get(pbtree_t *tree, uint64_t key, void **valuep);
+
+/*!
+ * Inserts a key that is not in the tree yet.
+ *
+ * \return 1 if inserted, 0 if the key was already present (its value is
+ *  left alone), -1 if a node cannot be allocated.
+ */
+__attribute__((transaction_safe)) 
+int pbtree_insert(pbtree_t *tree, uint64_t key, void *value);
+
+/*!
+ * Replaces the value of a key that is in the tree.
+ *
+ * \return 1 if replaced, 0 if the key is not present.
+ */
+__attribute__((transaction_safe)) 
+int pbtree_update(pbtree_t *tree, uint64_t key, void *value);
+
+/*!
+ * Removes a key.
+ *
+ * \return 1 if removed, 0 if the key was not present.
+ */
+__attribute__((transaction_safe)) 
+int pbtree_remove(pbtree_t *tree, uint64_t key);
+
+/*!
+ * Copies, in key order, up to max keys in [lo, hi] and their values into 
+ * keys[] and values[] (either may be NULL). Outside a transaction the scan
+ * runs as a read-only transaction against a snapshot of the tree, so it 
+ * neither logs nor conflicts with updates to what it has already read; 
+ * inside one it is part of it. To go on past max keys, scan again from 
+ * the last key returned plus one.
+ *
+ * \return the number of keys copied.
+ */
+__attribute__((transaction_callable)) 
+size_t pbtree_scan(pbtree_t *tree, uint64_t lo, uint64_t hi, 
+                   uint64_t *keys, void **values, size_t max);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* _PBTREE_H_RT61XP */
@@ -0,0 +1,583 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file pbtree.c
+ *
+ * \brief Persistent B+-tree (see pbtree.h).
+ *
+ * A tree of height h has h levels of inner nodes above its leaves; a tree
+ * of height 0 is a single leaf. Inner node children[i] holds the keys 
+ * below keys[i], and children[nkeys] the rest. Leaves are chained in key
+ * order through their next pointers, which is what scans follow.
+ *
+ * Inner nodes are copy-on-write: adding a separator to one builds a new 
+ * node and swaps the pointer to it in its parent, so concurrent lookups 
+ * never see a node half shifted. New nodes are written through the 
+ * transaction like any other update: a node freed by one transaction may 
+ * be allocated again by another while a third still reads it, and only 
+ * transactional writes make that reader notice. Every node an insert may
+ * need is allocated before the tree is touched, so running out of memory
+ * leaves the tree as it was.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ptx.h>
+#include "pbtree.h"
+
+#define LEAF_SLOTS      32
+#define LEAF_FULL       ((1LLU << LEAF_SLOTS) - 1)
+#define INNER_KEYS      31
+#define MAX_HEIGHT      16            /* never reached: 32^16 keys */
+#define MAX_NEW_NODES   (2 * MAX_HEIGHT + 1)
+
+/* For matching a fingerprint against eight slots at once */
+#define BYTES_ONES      0x0101010101010101LLU
+#define BYTES_HIGHS     0x8080808080808080LLU
+
+typedef struct pbtree_leaf_s pbtree_leaf_t;
+
+/* 
+ * The header fits in the first cache line, so a lookup that misses on
+ * the fingerprints reads only that line.
+ */
+struct pbtree_leaf_s {
+	uint64_t      bitmap;                 /* bit i set if slot i is used */
+	pbtree_leaf_t *next;
+	union {
+		uint8_t   bytes[LEAF_SLOTS];
+		uint64_t  words[LEAF_SLOTS / 8];
+	} fp;
+	uint64_t      pad[2];
+	uint64_t      keys[LEAF_SLOTS];
+	void          *values[LEAF_SLOTS];
+};
+
+typedef struct pbtree_inner_s {
+	uint64_t nkeys;
+	uint64_t keys[INNER_KEYS];
+	void     *children[INNER_KEYS + 1];
+} pbtree_inner_t;
+
+struct pbtree_s {
+	uint64_t height;
+	void     *root;
+	uint64_t pad[6];
+};
+
+
+TM_SAFE static inline
+uint8_t
+fingerprint(uint64_t key)
+{
+	return (uint8_t) ((key * 0x9e3779b97f4a7c15LLU) >> 56);
+}
+
+
+/*
+ * Node builders. They fill a node the running transaction has just 
+ * allocated. Slots past the bitmap are never read, so a leaf is written 
+ * only as far as it is used.
+ */
+
+TM_SAFE static void
+leaf_build(pbtree_leaf_t *leaf, const uint64_t *keys, void * const *values, 
+           int n, pbtree_leaf_t *next)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		leaf->keys[i] = keys[i];
+		leaf->values[i] = values[i];
+		leaf->fp.bytes[i] = fingerprint(keys[i]);
+	}
+	leaf->bitmap = (n == LEAF_SLOTS) ? LEAF_FULL : (1LLU << n) - 1;
+	leaf->next = next;
+}
+
+
+TM_SAFE static void
+inner_build(pbtree_inner_t *node, const uint64_t *keys, void * const *children, int nkeys)
+{
+	int i;
+
+	node->nkeys = nkeys;
+	for (i = 0; i < nkeys; i++) {
+		node->keys[i] = keys[i];
+		node->children[i] = children[i];
+	}
+	node->children[nkeys] = children[nkeys];
+}
+
+
+/*
+ * Copies a leaf's keys in [lo, hi], sorted, to the caller's buffers. Those
+ * are usually private to the caller, so they are written outside the 
+ * transaction: logging them would also turn a read-only scan into an 
+ * update.
+ */
+TM_PURE static void
+scan_emit(uint64_t *keys, void **values, const uint64_t *leaf_keys, 
+          void * const *leaf_values, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (keys) {
+			keys[i] = leaf_keys[i];
+		}
+		if (values) {
+			values[i] = leaf_values[i];
+		}
+	}
+}
+
+
+/*
+ * Transactional helpers; they run inside the caller's durability 
+ * transaction.
+ */
+
+TM_SAFE static int
+inner_search(pbtree_inner_t *node, uint64_t key)
+{
+	int lo = 0;
+	int hi = (int) node->nkeys;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (key < node->keys[mid]) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+
+/* Descends to the leaf for key, recording the inner nodes on the way. */
+TM_SAFE static pbtree_leaf_t *
+find_leaf(pbtree_t *tree, uint64_t key, pbtree_inner_t **path, int *slots)
+{
+	void           *node = tree->root;
+	int            height = (int) tree->height;
+	pbtree_inner_t *inner;
+	int            level;
+	int            s;
+
+	for (level = 0; level < height; level++) {
+		inner = (pbtree_inner_t *) node;
+		s = inner_search(inner, key);
+		if (path) {
+			path[level] = inner;
+			slots[level] = s;
+		}
+		node = inner->children[s];
+	}
+	return (pbtree_leaf_t *) node;
+}
+
+
+/* Returns the slot holding key, or -1. */
+TM_SAFE static int
+leaf_find(pbtree_leaf_t *leaf, uint64_t key)
+{
+	uint64_t pattern = BYTES_ONES * fingerprint(key);
+	uint64_t bitmap = leaf->bitmap;
+	uint64_t x;
+	uint64_t match;
+	int      w;
+	int      slot;
+
+	for (w = 0; w < LEAF_SLOTS / 8; w++) {
+		if (((bitmap >> (w * 8)) & 0xff) == 0) {
+			continue;
+		}
+		/* Flags the bytes equal to the fingerprint (plus some false hits) */
+		x = leaf->fp.words[w] ^ pattern;
+		match = (x - BYTES_ONES) & ~x & BYTES_HIGHS;
+		while (match) {
+			slot = w * 8 + __builtin_ctzll(match) / 8;
+			match &= match - 1;
+			if ((bitmap & (1LLU << slot)) && leaf->keys[slot] == key) {
+				return slot;
+			}
+		}
+	}
+	return -1;
+}
+
+
+TM_SAFE static void
+leaf_put(pbtree_leaf_t *leaf, uint64_t key, void *value)
+{
+	uint64_t bitmap = leaf->bitmap;
+	int      slot = __builtin_ctzll(~bitmap);
+
+	leaf->keys[slot] = key;
+	leaf->values[slot] = value;
+	leaf->fp.bytes[slot] = fingerprint(key);
+	leaf->bitmap = bitmap | (1LLU << slot);
+}
+
+
+/* Sorts a leaf's used slots by key; returns how many there are. */
+TM_SAFE static int
+leaf_sort(pbtree_leaf_t *leaf, uint64_t *keys, void **values, int *slots)
+{
+	uint64_t bitmap = leaf->bitmap;
+	uint64_t key;
+	void     *value;
+	int      n = 0;
+	int      s;
+	int      i;
+
+	while (bitmap) {
+		s = __builtin_ctzll(bitmap);
+		bitmap &= bitmap - 1;
+		key = leaf->keys[s];
+		value = leaf->values[s];
+		for (i = n; i > 0 && keys[i - 1] > key; i--) {
+			keys[i] = keys[i - 1];
+			values[i] = values[i - 1];
+			if (slots) {
+				slots[i] = slots[i - 1];
+			}
+		}
+		keys[i] = key;
+		values[i] = value;
+		if (slots) {
+			slots[i] = s;
+		}
+		n++;
+	}
+	return n;
+}
+
+
+/*
+ * Moves the upper half of a full leaf to the new leaf right. Only the 
+ * leaf's link and bitmap are logged; the moved slots are just let go.
+ */
+TM_SAFE static uint64_t
+leaf_split(pbtree_leaf_t *leaf, pbtree_leaf_t *right)
+{
+	uint64_t keys[LEAF_SLOTS];
+	void     *values[LEAF_SLOTS];
+	int      slots[LEAF_SLOTS];
+	uint64_t moved = 0;
+	int      i;
+
+	leaf_sort(leaf, keys, values, slots);
+	for (i = LEAF_SLOTS / 2; i < LEAF_SLOTS; i++) {
+		moved |= 1LLU << slots[i];
+	}
+	leaf_build(right, &keys[LEAF_SLOTS / 2], &values[LEAF_SLOTS / 2], 
+	           LEAF_SLOTS / 2, leaf->next);
+	leaf->next = right;
+	leaf->bitmap &= ~moved;
+	return keys[LEAF_SLOTS / 2];
+}
+
+
+/* 
+ * Allocates the nodes splitting leaf would take: the new leaf, then for 
+ * each inner level up from it a new copy, or two if the level splits too,
+ * and a new root if the root splits. 
+ */
+TM_SAFE static int
+split_prealloc(pbtree_t *tree, pbtree_inner_t **path, void **pool)
+{
+	int n = 0;
+	int level;
+	int i;
+
+	for (level = (int) tree->height - 1; level >= 0; level--) {
+		if (path[level]->nkeys < INNER_KEYS) {
+			n += 1;
+			break;
+		}
+		n += 2;
+	}
+	if (level < 0) {
+		n += 1;
+	}
+	if ((pool[0] = pmalloc(sizeof(pbtree_leaf_t))) == NULL) {
+		return -1;
+	}
+	for (i = 1; i <= n; i++) {
+		if ((pool[i] = pmalloc(sizeof(pbtree_inner_t))) == NULL) {
+			while (i-- > 0) {
+				pfree(pool[i]);
+			}
+			return -1;
+		}
+	}
+	return n;
+}
+
+
+/* Splits the full leaf on path and inserts key into the right half. */
+TM_SAFE static int
+split_insert(pbtree_t *tree, pbtree_inner_t **path, int *slots, 
+             pbtree_leaf_t *leaf, uint64_t key, void *value)
+{
+	void           *pool[MAX_NEW_NODES + 1];
+	uint64_t       keys[INNER_KEYS + 1];
+	void           *children[INNER_KEYS + 2];
+	pbtree_inner_t *node;
+	pbtree_inner_t *left;
+	pbtree_inner_t *right;
+	pbtree_leaf_t  *new_leaf;
+	void           *left_child;
+	void           *right_child;
+	uint64_t       sep;
+	int            next = 1;
+	int            level;
+	int            n;
+	int            s;
+	int            i;
+
+	if (split_prealloc(tree, path, pool) < 0) {
+		return -1;
+	}
+	new_leaf = (pbtree_leaf_t *) pool[0];
+	sep = leaf_split(leaf, new_leaf);
+	leaf_put(key < sep ? leaf : new_leaf, key, value);
+
+	/* Push (sep, right_child) up, replacing the path's child with left_child */
+	left_child = leaf;
+	right_child = new_leaf;
+	for (level = (int) tree->height - 1; level >= 0; level--) {
+		node = path[level];
+		s = slots[level];
+		n = (int) node->nkeys;
+		for (i = 0; i < s; i++) {
+			keys[i] = node->keys[i];
+			children[i] = node->children[i];
+		}
+		keys[s] = sep;
+		children[s] = left_child;
+		children[s + 1] = right_child;
+		for (i = s; i < n; i++) {
+			keys[i + 1] = node->keys[i];
+			children[i + 2] = node->children[i + 1];
+		}
+		n++;
+		if (n <= INNER_KEYS) {
+			left = (pbtree_inner_t *) pool[next++];
+			inner_build(left, keys, children, n);
+			if (level > 0) {
+				path[level - 1]->children[slots[level - 1]] = left;
+			} else {
+				tree->root = left;
+			}
+			pfree(node);
+			return 1;
+		}
+		left = (pbtree_inner_t *) pool[next++];
+		right = (pbtree_inner_t *) pool[next++];
+		inner_build(left, keys, children, n / 2);
+		inner_build(right, &keys[n / 2 + 1], &children[n / 2 + 1], n - n / 2 - 1);
+		pfree(node);
+		sep = keys[n / 2];
+		left_child = left;
+		right_child = right;
+	}
+
+	/* The root split */
+	left = (pbtree_inner_t *) pool[next++];
+	keys[0] = sep;
+	children[0] = left_child;
+	children[1] = right_child;
+	inner_build(left, keys, children, 1);
+	tree->root = left;
+	tree->height++;
+	return 1;
+}
+
+
+TM_SAFE static void
+node_free(void *node, int level)
+{
+	pbtree_inner_t *inner;
+	int            i;
+
+	if (level > 0) {
+		inner = (pbtree_inner_t *) node;
+		for (i = 0; i <= (int) inner->nkeys; i++) {
+			node_free(inner->children[i], level - 1);
+		}
+	}
+	pfree(node);
+}
+
+
+TM_SAFE static size_t
+scan_tx(pbtree_t *tree, uint64_t lo, uint64_t hi, 
+        uint64_t *keys, void **values, size_t max)
+{
+	uint64_t      leaf_keys[LEAF_SLOTS];
+	void          *leaf_values[LEAF_SLOTS];
+	pbtree_leaf_t *leaf;
+	size_t        count = 0;
+	int           first;
+	int           last;
+	int           n;
+
+	if (lo > hi) {
+		return 0;
+	}
+	for (leaf = find_leaf(tree, lo, NULL, NULL); leaf != NULL && count < max; leaf = leaf->next) {
+		n = leaf_sort(leaf, leaf_keys, leaf_values, NULL);
+		for (first = 0; first < n && leaf_keys[first] < lo; first++);
+		for (last = first; last < n && leaf_keys[last] <= hi; last++);
+		if ((size_t) (last - first) > max - count) {
+			last = first + (int) (max - count);
+		}
+		scan_emit(keys ? &keys[count] : NULL, values ? &values[count] : NULL, 
+		          &leaf_keys[first], &leaf_values[first], last - first);
+		count += last - first;
+		if (last < n) {
+			/* Hit a key past hi, or max */
+			break;
+		}
+	}
+	return count;
+}
+
+
+TM_SAFE pbtree_t *
+pbtree_alloc(void)
+{
+	pbtree_t      *tree;
+	pbtree_leaf_t *leaf;
+
+	if ((tree = (pbtree_t *) pmalloc(sizeof(pbtree_t))) == NULL) {
+		return NULL;
+	}
+	if ((leaf = (pbtree_leaf_t *) pmalloc(sizeof(pbtree_leaf_t))) == NULL) {
+		pfree(tree);
+		return NULL;
+	}
+	leaf_build(leaf, NULL, NULL, 0, NULL);
+	tree->height = 0;
+	tree->root = leaf;
+	return tree;
+}
+
+
+TM_SAFE void
+pbtree_free(pbtree_t *tree)
+{
+	node_free(tree->root, (int) tree->height);
+	pfree(tree);
+}
+
+
+TM_SAFE int
+pbtree_get(pbtree_t *tree, uint64_t key, void **valuep)
+{
+	pbtree_leaf_t *leaf = find_leaf(tree, key, NULL, NULL);
+	int           slot = leaf_find(leaf, key);
+
+	if (slot < 0) {
+		return 0;
+	}
+	if (valuep) {
+		*valuep = leaf->values[slot];
+	}
+	return 1;
+}
+
+
+TM_SAFE int
+pbtree_insert(pbtree_t *tree, uint64_t key, void *value)
+{
+	pbtree_inner_t *path[MAX_HEIGHT];
+	int            slots[MAX_HEIGHT];
+	pbtree_leaf_t  *leaf = find_leaf(tree, key, path, slots);
+
+	if (leaf_find(leaf, key) >= 0) {
+		return 0;
+	}
+	if (leaf->bitmap != LEAF_FULL) {
+		leaf_put(leaf, key, value);
+		return 1;
+	}
+	return split_insert(tree, path, slots, leaf, key, value);
+}
+
+
+TM_SAFE int
+pbtree_update(pbtree_t *tree, uint64_t key, void *value)
+{
+	pbtree_leaf_t *leaf = find_leaf(tree, key, NULL, NULL);
+	int           slot = leaf_find(leaf, key);
+
+	if (slot < 0) {
+		return 0;
+	}
+	leaf->values[slot] = value;
+	return 1;
+}
+
+
+TM_SAFE int
+pbtree_remove(pbtree_t *tree, uint64_t key)
+{
+	pbtree_leaf_t *leaf = find_leaf(tree, key, NULL, NULL);
+	int           slot = leaf_find(leaf, key);
+
+	if (slot < 0) {
+		return 0;
+	}
+	leaf->bitmap &= ~(1LLU << slot);
+	return 1;
+}
+
+
+size_t
+pbtree_scan(pbtree_t *tree, uint64_t lo, uint64_t hi, 
+            uint64_t *keys, void **values, size_t max)
+{
+	size_t count;
+
+	PTx_RO {
+		count = scan_tx(tree, lo, hi, keys, values, max);
+	}
+	return count;
+}
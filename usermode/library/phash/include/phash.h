@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Defines the public interface to the persistent hash map. A map lives in
+ * persistent memory under a name in the root directory (see m_root_get), 
+ * maps byte-string keys to pointer-sized values, and may be used from 
+ * many threads.
+ *
+ * Updates are durability transactions. Called inside a transaction they 
+ * become part of it; called outside, each is a transaction of its own.
+ * Lookups outside a transaction do not go through the transactional 
+ * memory at all: they read the map directly and validate what they read
+ * against a sequence number per lock stripe, retrying if an update to the 
+ * same stripe raced with them. Lookups inside a transaction are 
+ * transactional, so they see the transaction's own updates.
+ *
+ * The table grows by doubling. The move to the larger table is spread
+ * over later updates, a few buckets at a time, so no transaction ever 
+ * writes the whole table.
+ */
+#ifndef _PHASH_H_AK38QZ
+#define _PHASH_H_AK38QZ
+
+#include <stddef.h>
+#include <stdint.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+typedef struct phash_s phash_t;
+
+/*!
+ * Opens the map with the given name, creating an empty one if none exists.
+ * Opening the same name again returns the same handle.
+ *
+ * \return the map, or NULL if it cannot be created.
+ */
+phash_t *phash_open(const char *name);
+
+/*!
+ * Drops a handle returned by phash_open. The map itself stays in
+ * persistent memory.
+ */
+void phash_close(phash_t *map);
+
+/*!
+ * Looks up a key.
+ *
+ * \return 1 and the value in *valuep if the key is present, 0 otherwise.
+ */
+__attribute__((transaction_callable))
+int phash_get(phash_t *map, const void *key, size_t keylen, void **valuep);
+
+/*!
+ * Maps key to value, replacing any previous value.
+ *
+ * \return 1 if the key is new, 0 if its value was replaced, -1 if memory
+ *  for it cannot be allocated.
+ */
+__attribute__((transaction_callable))
+int phash_put(phash_t *map, const void *key, size_t keylen, void *value);
+
+/*!
+ * Removes a key.
+ *
+ * \return 1 if the key was removed, 0 if it was not present.
+ */
+__attribute__((transaction_callable))
+int phash_remove(phash_t *map, const void *key, size_t keylen);
+
+/*!
+ * \return the number of keys in the map. Not atomic with respect to 
+ * concurrent updates.
+ */
+uint64_t phash_count(phash_t *map);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* _PHASH_H_AK38QZ */
@@ -0,0 +1,136 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * A typed C++ front end to the persistent hash map in phash.h.
+ *
+ * Keys of trivially copyable types are hashed by their bytes; std::string
+ * keys by their characters. Values are stored in the map's pointer-sized
+ * slot, so they must be trivially copyable and no larger than a pointer;
+ * anything bigger should be pmalloc'ed and stored by pointer.
+ */
+#ifndef _PHASH_HPP_AK38QZ
+#define _PHASH_HPP_AK38QZ
+
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include "phash.h"
+
+namespace phash {
+
+template <typename K>
+struct key_traits {
+    static_assert(std::is_trivially_copyable<K>::value, 
+                  "phash keys must be trivially copyable or std::string");
+
+    __attribute__((transaction_pure))
+    static const void *data(const K &key) { return &key; }
+
+    __attribute__((transaction_pure))
+    static size_t size(const K &) { return sizeof(K); }
+};
+
+template <>
+struct key_traits<std::string> {
+    __attribute__((transaction_pure))
+    static const void *data(const std::string &key) { return key.data(); }
+
+    __attribute__((transaction_pure))
+    static size_t size(const std::string &key) { return key.size(); }
+};
+
+
+template <typename K, typename V>
+class map {
+    static_assert(std::is_trivially_copyable<V>::value && sizeof(V) <= sizeof(void *),
+                  "phash values must be trivially copyable and fit in a pointer");
+
+    typedef key_traits<K> traits;
+
+public:
+    /*!
+     * Opens (or creates) the map with the given name; valid() tells 
+     * whether that worked.
+     */
+    explicit map(const char *name) : map_(phash_open(name)) { }
+
+    ~map() {
+        if (map_) {
+            phash_close(map_);
+        }
+    }
+
+    bool valid() const { return map_ != NULL; }
+
+    /*! \return true and the value in *value if the key is present. */
+    __attribute__((transaction_callable))
+    bool get(const K &key, V *value) {
+        void *slot;
+
+        if (!phash_get(map_, traits::data(key), traits::size(key), &slot)) {
+            return false;
+        }
+        if (value) {
+            memcpy(value, &slot, sizeof(V));
+        }
+        return true;
+    }
+
+    /*! \return 1 if the key is new, 0 if replaced, -1 if out of memory. */
+    __attribute__((transaction_callable))
+    int put(const K &key, const V &value) {
+        void *slot = NULL;
+
+        memcpy(&slot, &value, sizeof(V));
+        return phash_put(map_, traits::data(key), traits::size(key), slot);
+    }
+
+    /*! \return true if the key was removed. */
+    __attribute__((transaction_callable))
+    bool remove(const K &key) {
+        return phash_remove(map_, traits::data(key), traits::size(key)) == 1;
+    }
+
+    uint64_t size() { return phash_count(map_); }
+
+private:
+    map(const map &);
+    map &operator=(const map &);
+
+    phash_t *map_;
+};
+
+} // namespace phash
+
+#endif /* _PHASH_HPP_AK38QZ */
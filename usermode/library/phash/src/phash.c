@@ -0,0 +1,690 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file phash.c
+ *
+ * \brief Persistent concurrent hash map (see phash.h).
+ *
+ * Keys are spread over PHASH_NUM_STRIPES stripes by the low bits of their
+ * hash. Since the number of buckets is a multiple of the number of 
+ * stripes, every bucket belongs to exactly one stripe, in the old table as 
+ * well as in the new one while the map grows. An update holds its stripe 
+ * until its transaction commits or aborts; the stripe's sequence number is
+ * odd while it is held, which is what optimistic lookups validate against.
+ *
+ * Growing swaps in a table twice the size under all stripes. From then on
+ * every update to a stripe first moves a few of that stripe's buckets from 
+ * the old table, splitting each chain in two; a lookup goes to the old 
+ * table for buckets its stripe has not moved yet. The old table is freed 
+ * when the last stripe is done.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ptx.h>
+
+/* The transaction descriptor is opaque to us; we only pass it around. */
+typedef struct mtm_tx_s mtm_tx_t;
+#include <itm.h>
+#include "phash.h"
+
+#define PHASH_MAGIC          0x3168736168506d4dLLU   /* "MmPhash1" */
+#define PHASH_NUM_STRIPES    64                      /* power of two */
+#define PHASH_MIN_BUCKETS    (PHASH_NUM_STRIPES * 16)
+#define PHASH_LOAD_FACTOR    2                       /* keys per bucket before growing */
+#define PHASH_MIGRATE_BATCH  4                       /* old buckets moved per update */
+#define PHASH_SPIN_LIMIT     1024                    /* spins on a held stripe before restarting */
+
+#define STRIPE_OF(hash)      ((hash) & (PHASH_NUM_STRIPES - 1))
+
+#define COMPILER_BARRIER()   __asm__ __volatile__ ("" ::: "memory")
+#define CPU_RELAX()          __asm__ __volatile__ ("pause" ::: "memory")
+
+typedef struct phash_node_s phash_node_t;
+
+struct phash_node_s {
+	phash_node_t *next;
+	uint64_t     hash;
+	void         *value;
+	uint64_t     keylen;
+	uint8_t      key[];
+};
+
+typedef struct phash_table_s {
+	uint64_t     nbuckets;
+	uint64_t     pad[7];
+	phash_node_t *buckets[];
+} phash_table_t;
+
+/* Persistent per-stripe state, written only by the stripe's holder. */
+typedef struct phash_pm_stripe_s {
+	uint64_t count;        /* keys in the stripe */
+	uint64_t migrated;     /* old buckets of the stripe moved so far */
+	uint64_t pad[6];
+} phash_pm_stripe_t;
+
+typedef struct phash_pm_s {
+	uint64_t          magic;
+	uint64_t          nstripes;
+	phash_table_t     *table;
+	phash_table_t     *old_table;     /* non-NULL while growing */
+	uint64_t          stripes_done;   /* stripes done moving to table */
+	uint64_t          pad[3];
+	phash_pm_stripe_t stripes[PHASH_NUM_STRIPES];
+} phash_pm_t;
+
+/* Volatile per-stripe lock. */
+typedef struct phash_stripe_s {
+	volatile uint64_t seq;      /* odd while held */
+	void * volatile   owner;    /* transaction holding the stripe */
+	uint64_t          depth;
+} __attribute__((aligned(64))) phash_stripe_t;
+
+struct phash_s {
+	phash_stripe_t stripes[PHASH_NUM_STRIPES];
+	phash_pm_t     *pm;
+	char           *name;
+	int            refcount;
+	phash_t        *next;
+};
+
+static pthread_mutex_t phash_open_lock = PTHREAD_MUTEX_INITIALIZER;
+static phash_t         *phash_open_list = NULL;
+
+
+static inline
+uint64_t
+phash_hash(const void *key, size_t keylen)
+{
+	const uint8_t *p = (const uint8_t *) key;
+	uint64_t      h = 0xcbf29ce484222325LLU;
+	size_t        i;
+
+	for (i = 0; i < keylen; i++) {
+		h = (h ^ p[i]) * 0x100000001b3LLU;
+	}
+	/* FNV-1a is weak in the low bits, which pick the stripe and bucket */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdLLU;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53LLU;
+	h ^= h >> 33;
+	return h;
+}
+
+
+/*
+ * Stripe locks. They are volatile, so they are taken and released outside
+ * the transactional memory; the release is registered both as a commit 
+ * and as an undo action, so the stripe is held until the outermost 
+ * transaction is done either way.
+ */
+
+TM_PURE static void
+stripe_release(void *arg)
+{
+	phash_stripe_t *stripe = (phash_stripe_t *) arg;
+
+	if (--stripe->depth == 0) {
+		stripe->owner = NULL;
+		__sync_fetch_and_add(&stripe->seq, 1);
+	}
+}
+
+
+TM_PURE static int
+stripe_try_acquire(phash_stripe_t *stripe, void *tx)
+{
+	uint64_t seq;
+
+	if (stripe->owner == tx) {
+		stripe->depth++;
+	} else {
+		seq = stripe->seq;
+		if ((seq & 1) || !__sync_bool_compare_and_swap(&stripe->seq, seq, seq + 1)) {
+			return 0;
+		}
+		stripe->owner = tx;
+		stripe->depth = 1;
+	}
+	_ITM_addUserCommitAction(stripe_release, _ITM_noTransactionId, stripe);
+	_ITM_addUserUndoAction(stripe_release, stripe);
+	return 1;
+}
+
+
+TM_PURE static void
+stripe_acquire(phash_stripe_t *stripe)
+{
+	void *tx = _ITM_getTransaction();
+	int  spins;
+
+	for (spins = 0; !stripe_try_acquire(stripe, tx); spins++) {
+		if (spins == PHASH_SPIN_LIMIT) {
+			/* 
+			 * The holder may be waiting for a stripe we hold; restarting
+			 * lets go of ours.
+			 */
+			_ITM_abortTransaction(userRetry, NULL);
+		}
+		CPU_RELAX();
+	}
+}
+
+
+TM_PURE static int
+stripe_try_acquire_all(phash_t *map)
+{
+	void *tx = _ITM_getTransaction();
+	int  i;
+
+	/* Stripes already taken are let go when the transaction ends */
+	for (i = 0; i < PHASH_NUM_STRIPES; i++) {
+		if (!stripe_try_acquire(&map->stripes[i], tx)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+static inline
+uint64_t
+stripe_read_begin(phash_stripe_t *stripe)
+{
+	uint64_t seq;
+
+	while ((seq = stripe->seq) & 1) {
+		CPU_RELAX();
+	}
+	COMPILER_BARRIER();
+	return seq;
+}
+
+
+static inline
+int
+stripe_read_valid(phash_stripe_t *stripe, uint64_t seq)
+{
+	COMPILER_BARRIER();
+	return stripe->seq == seq;
+}
+
+
+/*
+ * Transactional helpers; they run inside the durability transactions of 
+ * the update functions below, with the key's stripe held.
+ */
+
+TM_SAFE static phash_node_t **
+bucket_tx(phash_pm_t *pm, uint64_t hash)
+{
+	phash_table_t *table = pm->table;
+	uint64_t      nold;
+	uint64_t      b;
+
+	if (pm->old_table) {
+		nold = table->nbuckets / 2;
+		b = hash & (nold - 1);
+		if (b / PHASH_NUM_STRIPES >= pm->stripes[STRIPE_OF(hash)].migrated) {
+			return &pm->old_table->buckets[b];
+		}
+	}
+	return &table->buckets[hash & (table->nbuckets - 1)];
+}
+
+
+TM_SAFE static int
+key_equal_tx(phash_node_t *node, const uint8_t *key, size_t keylen)
+{
+	size_t i;
+
+	if (node->keylen != keylen) {
+		return 0;
+	}
+	for (i = 0; i < keylen; i++) {
+		if (node->key[i] != key[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Returns the link that points, or would point, to the key's node. */
+TM_SAFE static phash_node_t **
+find_tx(phash_pm_t *pm, uint64_t hash, const void *key, size_t keylen)
+{
+	phash_node_t **pos = bucket_tx(pm, hash);
+	phash_node_t *node;
+
+	while ((node = *pos) != NULL) {
+		if (node->hash == hash && key_equal_tx(node, (const uint8_t *) key, keylen)) {
+			break;
+		}
+		pos = &node->next;
+	}
+	return pos;
+}
+
+
+/* Moves the next few old buckets of stripe s; s must be held. */
+TM_SAFE static void
+migrate_tx(phash_pm_t *pm, int s)
+{
+	phash_table_t *old = pm->old_table;
+	phash_table_t *table;
+	phash_node_t  *node;
+	phash_node_t  *next;
+	phash_node_t  *low;
+	phash_node_t  *high;
+	uint64_t      nold;
+	uint64_t      per_stripe;
+	uint64_t      k;
+	uint64_t      b;
+	int           n;
+
+	if (old == NULL) {
+		return;
+	}
+	table = pm->table;
+	nold = table->nbuckets / 2;
+	per_stripe = nold / PHASH_NUM_STRIPES;
+	k = pm->stripes[s].migrated;
+	if (k == per_stripe) {
+		return;
+	}
+	for (n = 0; n < PHASH_MIGRATE_BATCH && k < per_stripe; n++, k++) {
+		b = s + k * PHASH_NUM_STRIPES;
+		low = high = NULL;
+		for (node = old->buckets[b]; node != NULL; node = next) {
+			next = node->next;
+			if (node->hash & nold) {
+				node->next = high;
+				high = node;
+			} else {
+				node->next = low;
+				low = node;
+			}
+		}
+		table->buckets[b] = low;
+		table->buckets[b + nold] = high;
+	}
+	pm->stripes[s].migrated = k;
+	if (k == per_stripe && ++pm->stripes_done == PHASH_NUM_STRIPES) {
+		pm->old_table = NULL;
+		pfree(old);
+	}
+}
+
+
+/* 
+ * Stripes nobody updates would keep the old table alive forever, so a 
+ * stripe that is done takes a batch from the next one that is not, if 
+ * that one is free.
+ */
+TM_SAFE static void
+migrate_help_tx(phash_t *map, int s)
+{
+	phash_pm_t *pm = map->pm;
+	uint64_t   per_stripe;
+	int        i;
+	int        t;
+
+	if (pm->old_table == NULL) {
+		return;
+	}
+	per_stripe = pm->table->nbuckets / 2 / PHASH_NUM_STRIPES;
+	for (i = 1; i < PHASH_NUM_STRIPES; i++) {
+		t = (s + i) & (PHASH_NUM_STRIPES - 1);
+		if (pm->stripes[t].migrated < per_stripe) {
+			if (stripe_try_acquire(&map->stripes[t], _ITM_getTransaction())) {
+				migrate_tx(pm, t);
+			}
+			return;
+		}
+	}
+}
+
+
+/* Starts doubling the table; the buckets are filled in by migrate_tx. */
+TM_SAFE static void
+grow_tx(phash_t *map)
+{
+	phash_pm_t    *pm = map->pm;
+	phash_table_t *bigger;
+	uint64_t      nbuckets = pm->table->nbuckets * 2;
+	int           i;
+
+	if (!stripe_try_acquire_all(map) || pm->old_table != NULL) {
+		return;
+	}
+	bigger = (phash_table_t *) pmalloc(sizeof(phash_table_t) + nbuckets * sizeof(phash_node_t *));
+	if (bigger == NULL) {
+		return;
+	}
+	bigger->nbuckets = nbuckets;
+	for (i = 0; i < PHASH_NUM_STRIPES; i++) {
+		pm->stripes[i].migrated = 0;
+	}
+	pm->stripes_done = 0;
+	pm->old_table = pm->table;
+	pm->table = bigger;
+}
+
+
+TM_SAFE static phash_pm_t *
+pm_create(const char *name)
+{
+	phash_pm_t    *pm;
+	phash_table_t *table;
+	uint64_t      b;
+	int           i;
+
+	if ((pm = (phash_pm_t *) pmalloc(sizeof(phash_pm_t))) == NULL) {
+		return NULL;
+	}
+	table = (phash_table_t *) pmalloc(sizeof(phash_table_t) + 
+	                                  PHASH_MIN_BUCKETS * sizeof(phash_node_t *));
+	if (table == NULL) {
+		pfree(pm);
+		return NULL;
+	}
+	table->nbuckets = PHASH_MIN_BUCKETS;
+	for (b = 0; b < PHASH_MIN_BUCKETS; b++) {
+		table->buckets[b] = NULL;
+	}
+	pm->magic = PHASH_MAGIC;
+	pm->nstripes = PHASH_NUM_STRIPES;
+	pm->table = table;
+	pm->old_table = NULL;
+	pm->stripes_done = 0;
+	for (i = 0; i < PHASH_NUM_STRIPES; i++) {
+		pm->stripes[i].count = 0;
+		pm->stripes[i].migrated = 0;
+	}
+	if (m_root_set(name, pm) != 0) {
+		pfree(table);
+		pfree(pm);
+		return NULL;
+	}
+	return pm;
+}
+
+
+TM_SAFE static int
+lookup_tx(phash_pm_t *pm, uint64_t hash, const void *key, size_t keylen, void **valuep)
+{
+	phash_node_t *node = *find_tx(pm, hash, key, keylen);
+
+	if (node == NULL) {
+		return 0;
+	}
+	if (valuep) {
+		*valuep = node->value;
+	}
+	return 1;
+}
+
+
+TM_SAFE static int
+put_tx(phash_t *map, uint64_t hash, const void *key, size_t keylen, void *value)
+{
+	phash_pm_t   *pm = map->pm;
+	int          s = STRIPE_OF(hash);
+	phash_node_t **pos;
+	phash_node_t *node;
+
+	stripe_acquire(&map->stripes[s]);
+	migrate_tx(pm, s);
+	pos = find_tx(pm, hash, key, keylen);
+	if ((node = *pos) != NULL) {
+		node->value = value;
+		return 0;
+	}
+	if ((node = (phash_node_t *) pmalloc(sizeof(phash_node_t) + keylen)) == NULL) {
+		return -1;
+	}
+	node->next = NULL;
+	node->hash = hash;
+	node->value = value;
+	node->keylen = keylen;
+	memcpy(node->key, key, keylen);
+	*pos = node;
+	if (++pm->stripes[s].count > pm->table->nbuckets / PHASH_NUM_STRIPES * PHASH_LOAD_FACTOR && 
+	    pm->old_table == NULL)
+	{
+		grow_tx(map);
+	} else {
+		migrate_help_tx(map, s);
+	}
+	return 1;
+}
+
+
+TM_SAFE static int
+remove_tx(phash_t *map, uint64_t hash, const void *key, size_t keylen)
+{
+	phash_pm_t   *pm = map->pm;
+	int          s = STRIPE_OF(hash);
+	phash_node_t **pos;
+	phash_node_t *node;
+
+	stripe_acquire(&map->stripes[s]);
+	migrate_tx(pm, s);
+	pos = find_tx(pm, hash, key, keylen);
+	if ((node = *pos) == NULL) {
+		return 0;
+	}
+	*pos = node->next;
+	pm->stripes[s].count--;
+	pfree(node);
+	return 1;
+}
+
+
+/*
+ * Lookup outside any transaction. Every pointer is validated against the
+ * stripe's sequence number before it is followed, so a racing update is 
+ * noticed before the lookup can wander into memory it freed; freed 
+ * persistent memory stays mapped, so the reads themselves are harmless.
+ */
+TM_PURE static int
+lookup_optimistic(phash_t *map, uint64_t hash, const void *key, size_t keylen, void **valuep)
+{
+	phash_pm_t     *pm = map->pm;
+	phash_stripe_t *stripe = &map->stripes[STRIPE_OF(hash)];
+	phash_table_t  *table;
+	phash_table_t  *old;
+	phash_node_t   *node;
+	phash_node_t   *next;
+	uint64_t       seq;
+	uint64_t       nold;
+	uint64_t       b;
+	uint64_t       node_hash;
+	uint64_t       node_keylen;
+	void           *value;
+
+retry:
+	seq = stripe_read_begin(stripe);
+	table = pm->table;
+	old = pm->old_table;
+	if (old) {
+		nold = table->nbuckets / 2;
+		b = hash & (nold - 1);
+		if (b / PHASH_NUM_STRIPES >= pm->stripes[STRIPE_OF(hash)].migrated) {
+			table = old;
+		}
+	}
+	node = table->buckets[hash & (table->nbuckets - 1)];
+	if (!stripe_read_valid(stripe, seq)) {
+		goto retry;
+	}
+	while (node != NULL) {
+		next = node->next;
+		node_hash = node->hash;
+		node_keylen = node->keylen;
+		value = node->value;
+		if (!stripe_read_valid(stripe, seq)) {
+			goto retry;
+		}
+		if (node_hash == hash && node_keylen == keylen &&
+		    memcmp(node->key, key, keylen) == 0)
+		{
+			if (!stripe_read_valid(stripe, seq)) {
+				goto retry;
+			}
+			if (valuep) {
+				*valuep = value;
+			}
+			return 1;
+		}
+		node = next;
+	}
+	if (!stripe_read_valid(stripe, seq)) {
+		goto retry;
+	}
+	return 0;
+}
+
+
+phash_t *
+phash_open(const char *name)
+{
+	phash_t    *map;
+	phash_pm_t *pm = NULL;
+
+	pthread_mutex_lock(&phash_open_lock);
+	for (map = phash_open_list; map != NULL; map = map->next) {
+		if (strcmp(map->name, name) == 0) {
+			map->refcount++;
+			goto out;
+		}
+	}
+	PTx {
+		pm = (phash_pm_t *) m_root_get(name);
+		if (pm == NULL) {
+			pm = pm_create(name);
+		}
+	}
+	if (pm == NULL || pm->magic != PHASH_MAGIC || pm->nstripes != PHASH_NUM_STRIPES) {
+		goto out;
+	}
+	if (posix_memalign((void **) &map, sizeof(phash_stripe_t), sizeof(phash_t)) != 0) {
+		map = NULL;
+		goto out;
+	}
+	memset(map, 0, sizeof(phash_t));
+	map->pm = pm;
+	map->name = strdup(name);
+	map->refcount = 1;
+	map->next = phash_open_list;
+	phash_open_list = map;
+out:
+	pthread_mutex_unlock(&phash_open_lock);
+	return map;
+}
+
+
+void
+phash_close(phash_t *map)
+{
+	phash_t **pos;
+
+	pthread_mutex_lock(&phash_open_lock);
+	if (--map->refcount == 0) {
+		for (pos = &phash_open_list; *pos != map; pos = &(*pos)->next);
+		*pos = map->next;
+		free(map->name);
+		free(map);
+	}
+	pthread_mutex_unlock(&phash_open_lock);
+}
+
+
+int
+phash_get(phash_t *map, const void *key, size_t keylen, void **valuep)
+{
+	uint64_t hash = phash_hash(key, keylen);
+	int      ret;
+
+	if (_ITM_inTransaction() == outsideTransaction) {
+		return lookup_optimistic(map, hash, key, keylen, valuep);
+	}
+	PTx {
+		ret = lookup_tx(map->pm, hash, key, keylen, valuep);
+	}
+	return ret;
+}
+
+
+int
+phash_put(phash_t *map, const void *key, size_t keylen, void *value)
+{
+	uint64_t hash = phash_hash(key, keylen);
+	int      ret;
+
+	PTx {
+		ret = put_tx(map, hash, key, keylen, value);
+	}
+	return ret;
+}
+
+
+int
+phash_remove(phash_t *map, const void *key, size_t keylen)
+{
+	uint64_t hash = phash_hash(key, keylen);
+	int      ret;
+
+	PTx {
+		ret = remove_tx(map, hash, key, keylen);
+	}
+	return ret;
+}
+
+
+uint64_t
+phash_count(phash_t *map)
+{
+	uint64_t count = 0;
+	int      i;
+
+	for (i = 0; i < PHASH_NUM_STRIPES; i++) {
+		count += map->pm->stripes[i].count;
+	}
+	return count;
+}
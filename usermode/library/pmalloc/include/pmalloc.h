@@ -34,6 +34,7 @@
 #define _MNEMOSYNE_PMALLOC_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #if __cplusplus
 extern "C" {
@@ -48,6 +49,62 @@ __attribute__((transaction_pure)) void *_ITM_pcalloc(size_t, size_t);
 __attribute__((transaction_pure)) void *_ITM_prealloc(void *, size_t);
 #define prealloc _ITM_prealloc
 
+/*
+ * Handles: movable persistent objects. The compactor (see pmalloc_compact) 
+ * may move the object of a handle to another address at any time, so the 
+ * address phandle_get returns is valid only until the end of the durability
+ * transaction that called it. Keep the handle, not the address, in 
+ * persistent data structures. Objects allocated with pmalloc never move.
+ * Like pmalloc and pfree, phandle_alloc and phandle_free belong in 
+ * durability transactions. Handles are not available in a process group 
+ * (see m_process_group_size).
+ */
+typedef uint64_t phandle_t;
+
+#define PHANDLE_NULL 0
+
+/* Allocates an object of size bytes and a handle for it; PHANDLE_NULL if out of memory. */
+__attribute__((transaction_safe)) phandle_t phandle_alloc(size_t size);
+/* Frees the object of h and h itself. */
+__attribute__((transaction_safe)) void phandle_free(phandle_t h);
+/* Current address of the object of h. */
+__attribute__((transaction_safe)) void *phandle_get(phandle_t h);
+
+typedef struct pmalloc_stats_s {
+	size_t heap_bytes;          /* size of the arena */
+	size_t free_bytes;          /* bytes in free extents */
+	size_t free_extents;        /* number of free extents */
+	size_t largest_free_bytes;  /* largest free extent, i.e. largest possible allocation */
+	size_t slabs;               /* slabs held by thread heaps, empty ones included */
+	size_t empty_slabs;         /* slabs without live blocks */
+	size_t sparse_slabs;        /* slabs less than half full */
+	size_t slab_used_bytes;     /* bytes of live slab blocks */
+	size_t handles;             /* live handles */
+	size_t compact_passes;
+	size_t migrated_objects;    /* objects the compactor moved */
+	size_t migrated_bytes;
+	size_t released_slabs;      /* empty slabs given back to the extent heap */
+} pmalloc_stats_t;
+
+/* 
+ * Fills stats with fragmentation metrics of this process's arena. The 
+ * free extent figures are read without stopping allocation, so they are 
+ * approximate while other threads allocate.
+ */
+void pmalloc_stats(pmalloc_stats_t *stats);
+
+/*
+ * Runs one compaction pass in the calling thread: objects of handles 
+ * that live in sparse slabs move, one durability transaction each, to 
+ * fuller slabs until max_bytes have been copied, and empty slabs go back to 
+ * the extent heap, where they merge with their free neighbours into extents 
+ * large allocations can use. With pmalloc.compact set, a background thread 
+ * does this under the pmalloc.compact_bandwidth_kb budget.
+ *
+ * \return the number of bytes copied.
+ */
+size_t pmalloc_compact(size_t max_bytes);
+
 #if __cplusplus
 }
 #endif
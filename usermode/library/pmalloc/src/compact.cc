@@ -0,0 +1,327 @@
+#include "heap.hh"
+#include "config.hh"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include <mnemosyne.h>
+
+
+/*
+ * Handle table: entry h-1 holds the address of the object of handle h, or
+ * NULL if the handle is free. It is a pmap segment of its own, made on first
+ * use; entries from PHANDLE_TOP on have never been used.
+ */
+enum { kMaxHandles = 1 << 22 };
+
+__attribute__ ((section("PERSISTENT"))) void** PHANDLE_TABLE = 0;
+__attribute__ ((section("PERSISTENT"))) uint64_t PHANDLE_TOP = 0;
+
+static const uint64_t kNoHandle = ~0ULL;
+
+static std::mutex handles_mutex;
+static bool handles_loaded = false;
+static std::vector<uint64_t> handles_free;
+static size_t handles_live = 0;
+
+/* Caller holds handles_mutex */
+static bool handles_load()
+{
+    if (handles_loaded) {
+        return true;
+    }
+    /* Handles need a heap of our own, see pmalloc.h */
+    if (m_process_group_size() > 1) {
+        return false;
+    }
+    if (PHANDLE_TABLE == 0) {
+        PHANDLE_TABLE = (void**) m_pmap(0, kMaxHandles * sizeof(void*), PROT_READ|PROT_WRITE, 0);
+        if (PHANDLE_TABLE == (void**) -1) {
+            PHANDLE_TABLE = 0;
+            return false;
+        }
+        m_persist_new(&PHANDLE_TABLE, sizeof(PHANDLE_TABLE));
+    }
+    for (uint64_t i = PHANDLE_TOP; i > 0; i--) {
+        if (PHANDLE_TABLE[i-1] == NULL) {
+            handles_free.push_back(i-1);
+        } else {
+            handles_live++;
+        }
+    }
+    handles_loaded = true;
+    return true;
+}
+
+__attribute__((transaction_pure))
+static uint64_t handle_take()
+{
+    uint64_t idx = kNoHandle;
+
+    handles_mutex.lock();
+    if (handles_load()) {
+        if (!handles_free.empty()) {
+            idx = handles_free.back();
+            handles_free.pop_back();
+        } else if (PHANDLE_TOP < kMaxHandles) {
+            idx = PHANDLE_TOP;
+            PHANDLE_TOP++;
+            m_persist_new(&PHANDLE_TOP, sizeof(PHANDLE_TOP));
+        }
+    }
+    if (idx != kNoHandle) {
+        handles_live++;
+    }
+    handles_mutex.unlock();
+    return idx;
+}
+
+static void handle_put(void* arg)
+{
+    handles_mutex.lock();
+    handles_free.push_back((uint64_t) arg);
+    handles_live--;
+    handles_mutex.unlock();
+}
+
+__attribute__((transaction_pure))
+static void handle_give_back(uint64_t idx)
+{
+    handle_put((void*) idx);
+}
+
+__attribute__((transaction_pure))
+static void handle_put_on_abort(uint64_t idx)
+{
+    if (_ITM_inTransaction()) {
+        _ITM_addUserUndoAction(handle_put, (void*) idx);
+    }
+}
+
+__attribute__((transaction_pure))
+static void handle_put_on_commit(uint64_t idx)
+{
+    if (!_ITM_inTransaction()) {
+        handle_put((void*) idx);
+        return;
+    }
+    _ITM_addUserCommitAction(handle_put, _ITM_getTransactionId(), (void*) idx);
+}
+
+__attribute__((transaction_pure))
+static void** handle_entry(uint64_t idx)
+{
+    return &PHANDLE_TABLE[idx];
+}
+
+/* Outside a transaction a store to an entry is made durable right away */
+__attribute__((transaction_pure))
+static void handle_persist(void** entry)
+{
+    if (!_ITM_inTransaction()) {
+        m_persist_new(entry, sizeof(*entry));
+    }
+}
+
+extern "C"
+phandle_t phandle_alloc(size_t size)
+{
+    uint64_t idx;
+    void* ptr;
+
+    if ((idx = handle_take()) == kNoHandle) {
+        return PHANDLE_NULL;
+    }
+    if ((ptr = pmalloc(size)) == NULL) {
+        handle_give_back(idx);
+        return PHANDLE_NULL;
+    }
+    handle_put_on_abort(idx);
+    void** entry = handle_entry(idx);
+    *entry = ptr;
+    handle_persist(entry);
+    return idx + 1;
+}
+
+extern "C"
+void phandle_free(phandle_t h)
+{
+    if (h == PHANDLE_NULL) {
+        return;
+    }
+    void** entry = handle_entry(h - 1);
+    void* ptr = *entry;
+    *entry = NULL;
+    handle_persist(entry);
+    pfree(ptr);
+    handle_put_on_commit(h - 1);
+}
+
+extern "C"
+void* phandle_get(phandle_t h)
+{
+    if (h == PHANDLE_NULL) {
+        return NULL;
+    }
+    return *handle_entry(h - 1);
+}
+
+
+/*
+ * Moves the object of entry from ptr to a new block of the calling thread,
+ * unless the entry changed since the caller looked at it or the new block
+ * is in the slab [slab, slab+slabsize) the object is leaving. The
+ * transaction conflicts with any other that uses the handle, so those see
+ * either the old or the new address, never a half-copied object.
+ */
+static bool migrate(void** entry, void* ptr, size_t size, uintptr_t slab, size_t slabsize)
+{
+    bool moved = false;
+
+    MNEMOSYNE_ATOMIC {
+        void* old = *entry;
+        if (old == ptr) {
+            void* ptr_new = pmalloc(size);
+            if (ptr_new && ((uintptr_t) ptr_new < slab || (uintptr_t) ptr_new >= slab + slabsize)) {
+                memcpy(ptr_new, old, size);
+                *entry = ptr_new;
+                pfree(old);
+                moved = true;
+            } else if (ptr_new) {
+                pfree(ptr_new);
+            }
+        }
+    }
+    return moved;
+}
+
+/*
+ * Only objects of handles move: nothing else tells us where the pointers
+ * to an object are. A slab emptied this way goes back to the extent heap
+ * along with any other empty slab.
+ */
+size_t Heap::compact(ThreadHeap* thp, size_t max_bytes)
+{
+    std::map<uintptr_t, size_t> sparse;
+    size_t moved = 0;
+
+    compact_mutex_.lock();
+    slheaps_mutex_.lock();
+    for (std::list<ReclaimingSlabHeap*>::iterator it = slheaps_.begin(); it != slheaps_.end(); ++it) {
+        (*it)->sparse_slabs(&sparse, *it == thp->slabheap());
+    }
+    slheaps_mutex_.unlock();
+
+    handles_mutex.lock();
+    uint64_t top = handles_load() ? PHANDLE_TOP : 0;
+    handles_mutex.unlock();
+
+    for (uint64_t idx = 0; idx < top && moved < max_bytes && !sparse.empty(); idx++) {
+        void** entry = handle_entry(idx);
+        void* ptr = *entry;
+        if (ptr == NULL) {
+            continue;
+        }
+        /* The slab is the last one starting at or below ptr, and ptr is not its header */
+        std::map<uintptr_t, size_t>::iterator it = sparse.upper_bound((uintptr_t) ptr);
+        if (it == sparse.begin()) {
+            continue;
+        }
+        --it;
+        if ((uintptr_t) ptr == it->first || (uintptr_t) ptr >= it->first + slabsize_) {
+            continue;
+        }
+        if (migrate(entry, ptr, it->second, it->first, slabsize_)) {
+            moved += it->second;
+            migrated_objects_++;
+            migrated_bytes_ += it->second;
+        }
+    }
+    release_empty_slabs();
+    compact_passes_++;
+    compact_mutex_.unlock();
+    return moved;
+}
+
+void Heap::stats(pmalloc_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = region_size_;
+    for (ExtentHeap_t::Iterator it = exheap_->begin(); it != exheap_->end(); ++it) {
+        if ((*it).nvheader()->is_free()) {
+            size_t bytes = (*it).len() * exheap_->blocksize();
+            stats->free_bytes += bytes;
+            stats->free_extents++;
+            if (bytes > stats->largest_free_bytes) {
+                stats->largest_free_bytes = bytes;
+            }
+        }
+    }
+
+    slheaps_mutex_.lock();
+    for (std::list<ReclaimingSlabHeap*>::iterator it = slheaps_.begin(); it != slheaps_.end(); ++it) {
+        (*it)->count(stats);
+    }
+    slheaps_mutex_.unlock();
+
+    handles_mutex.lock();
+    stats->handles = handles_live;
+    handles_mutex.unlock();
+
+    stats->compact_passes = compact_passes_;
+    stats->migrated_objects = migrated_objects_;
+    stats->migrated_bytes = migrated_bytes_;
+    stats->released_slabs = released_slabs_;
+}
+
+
+static std::thread compactor;
+static std::mutex compactor_mutex;
+static std::condition_variable compactor_cond;
+static bool compactor_stop = false;
+
+/*
+ * Each pass copies at most what the bandwidth budget allows for an
+ * interval, so the compactor never takes more than its share of NVM write
+ * bandwidth, however long a pass itself takes.
+ */
+static void compactor_main()
+{
+    std::chrono::milliseconds interval(pmalloc_runtime_settings.compact_interval_ms);
+    size_t budget = (size_t) pmalloc_runtime_settings.compact_bandwidth_kb * 1024 *
+                    pmalloc_runtime_settings.compact_interval_ms / 1000;
+    std::unique_lock<std::mutex> lock(compactor_mutex);
+
+    while (!compactor_cond.wait_for(lock, interval, [] { return compactor_stop; })) {
+        lock.unlock();
+        pmalloc_compact(budget);
+        lock.lock();
+    }
+}
+
+/* Runs at exit, before the runtime unmaps the heap */
+static void compactor_exit()
+{
+    compactor_mutex.lock();
+    compactor_stop = true;
+    compactor_mutex.unlock();
+    compactor_cond.notify_one();
+    compactor.join();
+}
+
+void Heap::start_compactor()
+{
+    pmalloc_config_init();
+    if (!pmalloc_runtime_settings.compact || nslots_ > 1) {
+        return;
+    }
+    compactor = std::thread(compactor_main);
+    atexit(compactor_exit);
+}
@@ -0,0 +1,27 @@
+#ifndef _MNEMOSYNE_HEAP_CONFIG_HH
+#define _MNEMOSYNE_HEAP_CONFIG_HH
+
+extern "C" {
+#include "config_generic.h"
+}
+
+/* 
+ * Background compaction (see pmalloc_compact in pmalloc.h): every 
+ * compact_interval_ms the compactor migrates up to compact_bandwidth_kb 
+ * per second worth of objects out of sparse slabs.
+ */
+#define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)          \
+  ACTION(config, values, group, compact, bool, int, 0, CONFIG_NO_CHECK, 0)     \
+  ACTION(config, values, group, compact_bandwidth_kb, int, int, 1024,          \
+         CONFIG_RANGE_CHECK, 1, 1 << 22)                                       \
+  ACTION(config, values, group, compact_interval_ms, int, int, 1000,           \
+         CONFIG_RANGE_CHECK, 10, 3600000)
+
+
+typedef CONFIG_GROUP_STRUCT(pmalloc) pmalloc_config_t;
+
+extern pmalloc_config_t pmalloc_runtime_settings;
+
+void pmalloc_config_init();
+
+#endif // _MNEMOSYNE_HEAP_CONFIG_HH
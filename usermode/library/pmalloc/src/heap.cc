@@ -14,6 +14,18 @@
 //MNEMOSYNE_PERSISTENT void* PREGION_BASE = 0;
 __attribute__ ((section("PERSISTENT"))) void* PREGION_BASE = 0;
 
+/* Process groups: arenas of slots 1 and up (slot 0 uses PREGION_BASE) */
+__attribute__ ((section("PERSISTENT"))) void* PREGION_BASES[M_MAX_PROCESS_GROUP] = { 0 };
+/* Whether the owner has formatted the arena of a slot */
+__attribute__ ((section("PERSISTENT"))) uint64_t PREGION_MADE[M_MAX_PROCESS_GROUP] = { 0 };
+/* Blocks other processes freed in the arena of a slot, linked through their first word */
+__attribute__ ((section("PERSISTENT"))) void* PREGION_REMOTE_FREE[M_MAX_PROCESS_GROUP] = { 0 };
+
+void** Heap::arena_base(int slot)
+{
+    return slot == 0 ? &PREGION_BASE : &PREGION_BASES[slot];
+}
+
 int Heap::init()
 {
     alps::DebugOptions dbgopt;
@@ -42,7 +54,34 @@ int Heap::init()
      * to ensure slab data and metadata fit within the slab extent */
     bigsize_ = slabsize_/2;
 
-    if (PREGION_BASE == 0) {
+    region_size_ = region_size;
+    slot_ = m_process_slot();
+    nslots_ = m_process_group_size();
+
+    if (nslots_ > 1) {
+        /* 
+         * Whoever comes first creates the arenas of all slots, so that a 
+         * process started later maps them all while it reincarnates.
+         */
+        m_group_lock();
+        m_segment_sync();
+        for (int i = 0; i < nslots_; i++) {
+            void** base = arena_base(i);
+            if (*base == 0) {
+                *base = (void*) m_pmap(0, region_size, PROT_READ|PROT_WRITE, 0);
+                m_persist_new(base, sizeof(*base));
+            }
+        }
+        m_group_unlock();
+        void* region = *arena_base(slot_);
+        if (!PREGION_MADE[slot_]) {
+            exheap_ = ExtentHeap_t::make(region, region_size, block_log2size);
+            PREGION_MADE[slot_] = 1;
+            m_persist_new(&PREGION_MADE[slot_], sizeof(PREGION_MADE[slot_]));
+        } else {
+            exheap_ = ExtentHeap_t::load(region);
+        }
+    } else if (PREGION_BASE == 0) {
         PREGION_BASE = (void*) m_pmap((void *) PREGION_BASE, region_size, PROT_READ|PROT_WRITE, 0);
         void* region = PREGION_BASE;
         exheap_ = ExtentHeap_t::make(region, region_size, block_log2size);
@@ -51,26 +90,239 @@ int Heap::init()
         exheap_ = ExtentHeap_t::load(region);
     }
 
-    slheap_ = new SlabHeap_t(slabsize_, NULL, exheap_);
+    slheap_ = new ReclaimingSlabHeap(slabsize_, NULL, exheap_);
     slheap_->init(ctx);
+    slheaps_.push_back(slheap_);
+
+    compact_passes_ = 0;
+    migrated_objects_ = 0;
+    migrated_bytes_ = 0;
+    released_slabs_ = 0;
 }
 
 ThreadHeap* Heap::threadheap()
 {
-    Context ctx;
+    ReclaimingSlabHeap* slheap;
 
-    SlabHeap_t* slheap = new SlabHeap_t(slabsize_, NULL, exheap_);
-    slheap_->init(ctx);
+    slheaps_mutex_.lock();
+    if (!retired_slheaps_.empty()) {
+        slheap = retired_slheaps_.front();
+        retired_slheaps_.pop_front();
+    } else {
+        slheap = new ReclaimingSlabHeap(slabsize_, slheap_, exheap_);
+    }
+    slheaps_.push_back(slheap);
+    slheaps_mutex_.unlock();
 
     HybridHeap_t* hheap = new HybridHeap_t(bigsize_, slheap, exheap_);
-    ThreadHeap* thp = new ThreadHeap(hheap);
+    ThreadHeap* thp = new ThreadHeap(hheap, slheap, this);
     return thp;
 }
 
+void Heap::retire(ThreadHeap* thp)
+{
+    Context ctx;
+    ReclaimingSlabHeap* slheap = thp->slabheap();
+
+    compact_mutex_.lock();
+    released_slabs_ += slheap->release_empty_slabs(ctx, 0);
+    slheap->hand_over(ctx);
+    compact_mutex_.unlock();
+
+    slheaps_mutex_.lock();
+    slheaps_.remove(slheap);
+    retired_slheaps_.push_back(slheap);
+    slheaps_mutex_.unlock();
+
+    delete thp->hybridheap();
+    delete thp;
+}
+
+/* Caller holds compact_mutex_ */
+size_t Heap::release_empty_slabs()
+{
+    Context ctx;
+    size_t n = 0;
+
+    slheaps_mutex_.lock();
+    for (std::list<ReclaimingSlabHeap*>::iterator it = slheaps_.begin(); it != slheaps_.end(); ++it) {
+        /* Threads keep one empty slab around so they do not churn */
+        n += (*it)->release_empty_slabs(ctx, *it == slheap_ ? 0 : 1);
+    }
+    slheaps_mutex_.unlock();
+    released_slabs_ += n;
+    return n;
+}
+
+size_t ReclaimingSlabHeap::release_empty_slabs(Context& ctx, size_t keep)
+{
+    typedef alps::nvExtentHeader<Context, alps::TPtr> nvExtentHeader_t;
+    size_t n = 0;
+
+    lock();
+    while (empty_slabs_.size() > keep) {
+        SlabT* slab = empty_slabs_.front();
+        alps::TPtr<void> region = slab->nvslab_;
+        alps::Extent<Context, alps::TPtr, alps::PPtr> ex;
+
+        remove_slab(slab);
+        extentheap_->extent(region, &ex);
+        extentheap_->free(ctx, region);
+        m_persist_new(ex.nvheader().get(), ex.len() * sizeof(nvExtentHeader_t));
+        delete slab;
+        n++;
+    }
+    unlock();
+    return n;
+}
+
+/*
+ * A free of a block in a slab we move may be waiting for our lock; it 
+ * finds the slab's new owner once it gets it. Lock order is child, parent,
+ * as in SlabHeap::malloc.
+ */
+void ReclaimingSlabHeap::hand_over(Context& ctx)
+{
+    lock();
+    for (int c = 0; c < alps::kSizeClasses; c++) {
+        for (int f = 0; f < alps::kSlabFullnessBins; f++) {
+            typename SlabT::SlabList& sl = full_slabs_[c][f];
+            while (!sl.empty()) {
+                SlabT* slab = sl.front();
+                slab->remove();
+                parentslabheap_->lock();
+                parentslabheap_->insert_slab(slab, c);
+                parentslabheap_->unlock();
+            }
+        }
+    }
+    unlock();
+}
+
+void ReclaimingSlabHeap::sparse_slabs(std::map<uintptr_t, size_t>* slabs, bool skip_next)
+{
+    lock();
+    for (int c = 0; c < alps::kSizeClasses; c++) {
+        typename SlabT::SlabList& sl = full_slabs_[c][0];
+        SlabT* next = skip_next ? find_slab(c) : NULL;
+        for (typename SlabT::SlabList::iterator it = sl.begin(); it != sl.end(); ++it) {
+            if (*it != next) {
+                (*slabs)[(uintptr_t) (*it)->nvslab_.get()] = (*it)->block_size();
+            }
+        }
+    }
+    unlock();
+}
+
+void ReclaimingSlabHeap::count(pmalloc_stats_t* stats)
+{
+    lock();
+    for (int c = 0; c < alps::kSizeClasses; c++) {
+        for (int f = 0; f < alps::kSlabFullnessBins; f++) {
+            typename SlabT::SlabList& sl = full_slabs_[c][f];
+            for (typename SlabT::SlabList::iterator it = sl.begin(); it != sl.end(); ++it) {
+                stats->slabs++;
+                stats->sparse_slabs += f == 0 ? 1 : 0;
+                stats->slab_used_bytes += ((*it)->nblocks() - (*it)->nblocks_free()) * (*it)->block_size();
+            }
+        }
+    }
+    stats->slabs += empty_slabs_.size();
+    stats->empty_slabs += empty_slabs_.size();
+    unlock();
+}
+
+int Heap::foreign_slot(void* ptr)
+{
+    if (nslots_ == 1) {
+        return -1;
+    }
+    for (int i = 0; i < nslots_; i++) {
+        char* base = (char*) *arena_base(i);
+        if ((char*) ptr >= base && (char*) ptr < base + region_size_) {
+            return i == slot_ ? -1 : i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Pushes a block on the remote free stack of its owner. The link is 
+ * durable before the block is published, so a crash at worst leaks it.
+ */
+void Heap::remote_free(int slot, void* ptr)
+{
+    void* volatile* head = &PREGION_REMOTE_FREE[slot];
+    void* old;
+
+    do {
+        old = *head;
+        *(void**) ptr = old;
+        m_persist_new(ptr, sizeof(void*));
+    } while (!__sync_bool_compare_and_swap(head, old, ptr));
+    m_persist_new((void*) head, sizeof(void*));
+}
+
+bool Heap::has_remote_frees()
+{
+    return nslots_ > 1 && PREGION_REMOTE_FREE[slot_] != NULL;
+}
+
+/*
+ * Detaches our remote free stack. The empty head is durable before any 
+ * block on it is freed: a crash while freeing them leaks the rest rather 
+ * than freeing them twice.
+ */
+void* Heap::take_remote_frees()
+{
+    void* list = __sync_lock_test_and_set(&PREGION_REMOTE_FREE[slot_], (void*) NULL);
+    m_persist_new(&PREGION_REMOTE_FREE[slot_], sizeof(void*));
+    return list;
+}
+
+/*
+ * Like HybridHeap::getsize, but reads only the persistent metadata: the 
+ * volatile descriptors of another process's arena live in its memory.
+ */
+size_t Heap::foreign_getsize(int slot, void* ptr)
+{
+    typedef alps::nvExtentHeap<Context, alps::TPtr, alps::PPtr> nvExtentHeap_t;
+    typedef alps::nvSlab<Context, alps::TPtr> nvSlab_t;
+
+    nvExtentHeap_t* nvexheap = reinterpret_cast<nvExtentHeap_t*>(*arena_base(slot));
+    char* block0 = (char*) nvexheap->block(0).get();
+    size_t log2size = nvexheap->header_.block_log2size_;
+
+    if ((char*) ptr < block0) {
+        return 0;
+    }
+    size_t idx = ((char*) ptr - block0) >> log2size;
+    size_t exsz = nvexheap->extent_header(idx)->size() << log2size;
+    char* extent = block0 + (idx << log2size);
+    if (exsz == slabsize_ && (char*) ptr != extent) {
+        return reinterpret_cast<nvSlab_t*>(extent)->block_size();
+    }
+    return exsz;
+}
+
+void ThreadHeap::drain_remote_frees(Context& ctx)
+{
+    void* ptr = heap_->take_remote_frees();
+
+    while (ptr) {
+        void* next = *(void**) ptr;
+        hheap_->free(ctx, ptr);
+        ptr = next;
+    }
+}
+
 void* ThreadHeap::pmalloc(size_t sz)
 {
     Context ctx(true, true);
     
+    if (heap_->has_remote_frees()) {
+        drain_remote_frees(ctx);
+    }
     alps::TPtr<void> ptr;
     alps::ErrorCode rc = hheap_->malloc(ctx, sz, &ptr);
     if (rc != alps::kErrorCodeOk) {
@@ -86,17 +338,29 @@ void ThreadHeap::pmalloc_undo(void* ptr)
     hheap_->free(ctx, ptr);
 }
 
+/* 
+ * Memory of another process's arena is returned to it only once the freeing
+ * transaction commits; until then there is nothing to prepare.
+ */
 void ThreadHeap::pfree_prepare(void* ptr) 
 {
     Context ctx(false, true);
     
+    if (heap_->foreign_slot(ptr) >= 0) {
+        return;
+    }
     hheap_->free(ctx, ptr);
 }
 
 void ThreadHeap::pfree_commit(void* ptr) 
 {
     Context ctx(true, false);
+    int slot;
     
+    if ((slot = heap_->foreign_slot(ptr)) >= 0) {
+        heap_->remote_free(slot, ptr);
+        return;
+    }
     hheap_->free(ctx, ptr);
 }
 
@@ -104,6 +368,10 @@ void ThreadHeap::pfree_commit(void* ptr)
 size_t ThreadHeap::getsize(void* ptr)
 {
     Context ctx(true, true);
+    int slot;
 
+    if ((slot = heap_->foreign_slot(ptr)) >= 0) {
+        return heap_->foreign_getsize(slot, ptr);
+    }
     return hheap_->getsize(ptr);
 }
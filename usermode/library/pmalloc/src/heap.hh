@@ -6,6 +6,12 @@
 #include <alps/layers/extentheap.hh>
 #include <alps/layers/hybridheap.hh>
 
+#include <list>
+#include <map>
+#include <mutex>
+
+#include <pmalloc.h>
+
 #include <mnemosyne.h>
 #include <mtm.h>
 #include <mtm_i.h>
@@ -55,11 +61,40 @@ typedef alps::SlabHeap<Context, alps::TPtr, alps::PPtr> SlabHeap_t;
 typedef alps::ExtentHeap<Context, alps::TPtr, alps::PPtr> ExtentHeap_t;
 typedef alps::HybridHeap<Context, alps::TPtr, alps::PPtr, SlabHeap_t, ExtentHeap_t> HybridHeap_t;
 
+class Heap;
+
+/*
+ * SlabHeap that gives memory back. ALPS keeps an empty slab for reuse by 
+ * the same heap forever; this one returns it to the extent heap, where it 
+ * merges with its free neighbours into an extent large allocations can 
+ * use. A thread's heap hands its remaining slabs to the shared parent heap 
+ * when the thread exits, so that other threads fill them up again.
+ */
+class ReclaimingSlabHeap: public SlabHeap_t {
+public:
+    ReclaimingSlabHeap(size_t slabsize, SlabHeap_t* parent, ExtentHeap_t* exheap)
+        : SlabHeap_t(slabsize, parent, exheap)
+    { }
+
+    /* Returns all but keep empty slabs to the extent heap; returns their number */
+    size_t release_empty_slabs(Context& ctx, size_t keep);
+    /* Moves every slab with live blocks to the parent heap */
+    void hand_over(Context& ctx);
+    /* 
+     * Adds start and block size of every slab less than half full, except
+     * with skip_next those that the next allocations will use.
+     */
+    void sparse_slabs(std::map<uintptr_t, size_t>* slabs, bool skip_next);
+    void count(pmalloc_stats_t* stats);
+};
+
 class ThreadHeap
 {
 public:
-    ThreadHeap(HybridHeap_t* hheap)
-        : hheap_(hheap)
+    ThreadHeap(HybridHeap_t* hheap, ReclaimingSlabHeap* slheap, Heap* heap)
+        : hheap_(hheap),
+          slheap_(slheap),
+          heap_(heap)
     { }
 
     void* pmalloc(size_t sz);
@@ -68,21 +103,71 @@ public:
     void pfree_commit(void* ptr);
     size_t getsize(void* ptr);
 
+    ReclaimingSlabHeap* slabheap() { return slheap_; }
+    HybridHeap_t* hybridheap() { return hheap_; }
+
 private:
+    void drain_remote_frees(Context& ctx);
+
     HybridHeap_t* hheap_;
+    ReclaimingSlabHeap* slheap_;
+    Heap* heap_;
 };
 
+/* 
+ * In a process group (see mnemosyne.h) every process allocates from an 
+ * arena of its own, selected by its slot, and all processes map all arenas.
+ * Memory of another process's arena is handed back to it through a 
+ * persistent lock-free stack that the owner drains when it next allocates.
+ */
 class Heap {
 public:
 
     int init();
     ThreadHeap* threadheap();
+    /* Gives the slabs of an exiting thread to the other threads */
+    void retire(ThreadHeap* thp);
+
+    /* Compaction and fragmentation metrics, see pmalloc.h and compact.cc */
+    size_t compact(ThreadHeap* thp, size_t max_bytes);
+    void stats(pmalloc_stats_t* stats);
+    void start_compactor();
+
+    /* Slot of the arena holding ptr if that is not ours, otherwise -1 */
+    int foreign_slot(void* ptr);
+    void remote_free(int slot, void* ptr);
+    void* take_remote_frees();
+    bool has_remote_frees();
+    size_t foreign_getsize(int slot, void* ptr);
 
 private:
+    void** arena_base(int slot);
+    size_t release_empty_slabs();
+
     ExtentHeap_t* exheap_;
-    SlabHeap_t* slheap_;
+    ReclaimingSlabHeap* slheap_;
+    /* 
+     * Slab heaps of live threads and slheap_, and those of exited threads 
+     * for new threads to reuse: one may still be locked by a thread freeing 
+     * a block of a slab that has just moved, so none is ever deleted.
+     */
+    std::list<ReclaimingSlabHeap*> slheaps_;
+    std::list<ReclaimingSlabHeap*> retired_slheaps_;
+    std::mutex slheaps_mutex_;
+    /* 
+     * Serializes compaction passes and thread exits, the only ones to 
+     * delete slab descriptors, so a pass can hold on to them.
+     */
+    std::mutex compact_mutex_;
+    size_t compact_passes_;
+    size_t migrated_objects_;
+    size_t migrated_bytes_;
+    size_t released_slabs_;
     size_t bigsize_;
     size_t slabsize_;
+    size_t region_size_;
+    int slot_;
+    int nslots_;
 };
 
 #endif // _MNEMOSYNE_HEAP_HEAP_HH
@@ -8,7 +8,6 @@
 #include <mtm_i.h>
 #include <itm.h>
 
-thread_local ThreadHeap* threadheap = NULL;
 static Heap* heap;
 std::mutex heapmtx;
 
@@ -22,17 +21,51 @@ inline static Heap * getHeap (void)
     heap = new Heap();
     heap->init();
     heapmtx.unlock();
+    heap->start_compactor();
     return heap;
 }
 
+/* Hands the thread's slabs over to the other threads when it exits */
+struct ThreadHeapHolder {
+    ThreadHeap* thp;
+
+    ~ThreadHeapHolder()
+    {
+        if (thp) {
+            getHeap()->retire(thp);
+            thp = NULL;
+        }
+    }
+};
+
+thread_local ThreadHeapHolder threadheap;
+
 inline static ThreadHeap* getThreadHeap (void)
 {
-    if (threadheap) {
-        return threadheap;
+    if (threadheap.thp) {
+        return threadheap.thp;
     }
     Heap* heap = getHeap();
-    threadheap = heap->threadheap();
-    return threadheap;
+    threadheap.thp = heap->threadheap();
+    return threadheap.thp;
+}
+
+/*
+ * A process of a group must have mapped every arena before another process
+ * can hand it a pointer into one, so the first process sets up the heap
+ * while it reincarnates instead of on its first allocation.
+ */
+static void heap_reincarnate(void)
+{
+    if (m_process_group_size() > 1) {
+        getHeap();
+    }
+}
+
+__attribute__((constructor))
+static void heap_register_reincarnation(void)
+{
+    mnemosyne_reincarnation_callback_register(heap_reincarnate);
 }
 
 extern "C"
@@ -94,6 +127,18 @@ size_t mtm_get_obj_size(void *ptr)
     return heap->getsize(ptr);
 }
 
+extern "C"
+void pmalloc_stats(pmalloc_stats_t *stats)
+{
+    getHeap()->stats(stats);
+}
+
+extern "C"
+size_t pmalloc_compact(size_t max_bytes)
+{
+    return getHeap()->compact(getThreadHeap(), max_bytes);
+}
+
 extern "C" void * mtm_prealloc (void * ptr, size_t sz)
 {
     //TODO
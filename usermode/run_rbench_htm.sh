@@ -0,0 +1,25 @@
+#!/bin/bash
+# Compares the pwbetl software path with the RTM fast path on the rbench
+# queue and array throughput tests.
+# meant to be run from mnemosyne-gcc/usermode/ after
+#   scons --build-example=rbench
+PWD=`pwd`
+export LD_LIBRARY_PATH=$PWD/library/:$LD_LIBRARY_PATH
+bin=./build/examples/rbench/rbench
+
+if [[ $1 == '-h' ]]
+then
+	echo "usage: $0 [-h]"
+	echo "Runs rbench twice: MTM_HTM_FASTPATH=0 (pwbetl) and MTM_HTM_FASTPATH=1 (RTM fast path)."
+	echo "The fast-path commit/abort/fallback counters are printed at exit (MTM_STATS=1)."
+	exit
+fi
+
+grep -q -w rtm /proc/cpuinfo || echo "warning: this CPU does not report RTM; the second run will use pwbetl too"
+
+for htm in 0 1
+do
+	echo "===== MTM_HTM_FASTPATH=$htm ====="
+	rm -rf /dev/shm/psegments
+	MTM_STATS=1 MTM_HTM_FASTPATH=$htm $bin
+done
@@ -0,0 +1,136 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+extern "C" {
+#include <cmsite.h>
+}
+#include "../common/unittest.h"
+
+#define NUM_THREADS 4
+#define NUM_INCS    10000
+#define HOT_WORDS   8
+
+static uint64_t counter;
+static uint64_t hot[HOT_WORDS];
+
+
+/* Every thread runs the same atomic block over the same words */
+static void *incrementThread(void *arg)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < NUM_INCS; i++) {
+		__tm_atomic {
+			for (j = 0; j < HOT_WORDS; j++) {
+				hot[j]++;
+			}
+			counter++;
+		}
+	}
+	return NULL;
+}
+
+
+/* 
+ * Reads back the per-site abort profile through the report and returns 
+ * the number of aborts of the site that aborted most, along with the 
+ * name of the policy the runtime picked.
+ */
+static unsigned long hotSiteAborts(char *policy)
+{
+	char          *buf = NULL;
+	size_t        size = 0;
+	FILE          *stream;
+	char          *line;
+	unsigned long key;
+	unsigned long commits;
+	unsigned long aborts;
+	unsigned long retries;
+	unsigned long max = 0;
+
+	stream = open_memstream(&buf, &size);
+	mtm_cm_site_report(stream);
+	fclose(stream);
+
+	line = strtok(buf, "\n");
+	sscanf(line, "CONTENTION MANAGER: %63s", policy);
+	strtok(NULL, "\n");  /* column header */
+	while ((line = strtok(NULL, "\n"))) {
+		if (sscanf(line, "%lx %lu %lu %lu", &key, &commits, &aborts, &retries) == 4) {
+			if (key != 0 && aborts > max) {
+				max = aborts;
+			}
+		}
+	}
+	free(buf);
+	return max;
+}
+
+
+SUITE(SuiteCM)
+{
+	/* 
+	 * Run once per mtm.cm_policy value: the counter must be exact and the
+	 * contended block must show up in the abort profile.
+	 */
+	TEST(Counter)
+	{
+		pthread_t     threads[NUM_THREADS];
+		char          policy[64];
+		const char    *expected = getenv("MTM_CM_POLICY");
+		unsigned long aborts;
+		int           i;
+
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&threads[i], NULL, incrementThread, NULL);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		CHECK_EQUAL((uint64_t) NUM_THREADS * NUM_INCS, counter);
+		for (i = 0; i < HOT_WORDS; i++) {
+			CHECK_EQUAL(counter, hot[i]);
+		}
+
+		aborts = hotSiteAborts(policy);
+		CHECK_EQUAL(expected ? expected : "suicide", policy);
+		CHECK(aborts > 0);
+	}
+}
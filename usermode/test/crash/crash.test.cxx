@@ -0,0 +1,402 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file crash.test.cxx
+ *
+ * \brief Crash-consistency fuzzer.
+ *
+ * Runs the workload (workload.cxx) in a child process that crashes at a 
+ * chosen crash point of the PCM crash emulation (see pcm_crash_init), then 
+ * runs recovery in a fresh process and checks the workload's invariants and
+ * that no committed transaction was lost. Needs a library built with 
+ * M_PCM_EMULATE_CRASH.
+ *
+ * Every iteration starts from the same image: the segments left by the 
+ * setup run are kept as a snapshot and copied back, extent by extent, into
+ * the working segments directory before the child starts. 
+ *
+ * Environment:
+ *   CRASH_FUZZ_DIR     where to keep the segments (default under /dev/shm)
+ *   CRASH_FUZZ_POINTS  how many crash points to try (default 200; 0 is all)
+ *   CRASH_FUZZ_OPS     operations per run (default 32)
+ *   CRASH_FUZZ_SEED    seed for the workload and the crash outcomes 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../common/unittest.h"
+
+#define CRASH_EXIT_STATUS  86    /* PCM_CRASH_EXIT_STATUS */
+#define PROGRESS_FD        3
+#define SETUP_OPS          64
+#define COPY_BUF_SIZE      (1024*1024)
+
+struct outcome_s {
+	int      status;          /* exit status, or -1 if killed */
+	int      committed;       /* last "commit" reported */
+	uint64_t points;          /* "points" reported by a completed run */
+	int64_t  ops;             /* "ops" reported by a check; -1 if none */
+	char     error[256];      /* "error" reported by a check */
+};
+
+static char  baseDir[PATH_MAX];
+static char  snapshotDir[PATH_MAX];
+static char  workDir[PATH_MAX];
+static char  workloadPath[PATH_MAX];
+
+
+static int envInt(const char *name, int defval)
+{
+	char *val = getenv(name);
+
+	return val ? atoi(val) : defval;
+}
+
+
+static void initPaths()
+{
+	char    *dir;
+	char    *slash;
+	ssize_t len;
+
+	if ((dir = getenv("CRASH_FUZZ_DIR"))) {
+		snprintf(baseDir, PATH_MAX, "%s", dir);
+	} else {
+		snprintf(baseDir, PATH_MAX, "/dev/shm/mnemosyne-crashfuzz.%d", (int) getpid());
+	}
+	snprintf(snapshotDir, PATH_MAX, "%s/snapshot", baseDir);
+	snprintf(workDir, PATH_MAX, "%s/work", baseDir);
+	mkdir(baseDir, 0755);
+	mkdir(snapshotDir, 0755);
+	mkdir(workDir, 0755);
+
+	/* The workload is built next to us; try the current directory if unsure */
+	if ((len = readlink("/proc/self/exe", workloadPath, PATH_MAX - 32)) < 0) {
+		len = 0;
+	}
+	workloadPath[len] = '\0';
+	slash = strrchr(workloadPath, '/');
+	strcpy(slash ? slash + 1 : workloadPath, "workload");
+}
+
+
+static void removeFiles(const char *dir)
+{
+	DIR           *d;
+	struct dirent *de;
+	char          path[PATH_MAX];
+
+	if (!(d = opendir(dir))) {
+		return;
+	}
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(path, PATH_MAX, "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	closedir(d);
+}
+
+
+/* 
+ * Copies a file keeping its holes: the segments are mostly sparse (the 
+ * pmalloc heap alone is 8GB of address space), so only the data extents
+ * are copied.
+ */
+static bool copySparseFile(const char *src, const char *dst, char *buf)
+{
+	int         sfd;
+	int         dfd;
+	struct stat st;
+	off_t       data;
+	off_t       hole;
+	ssize_t     n;
+	bool        ok = false;
+
+	if ((sfd = open(src, O_RDONLY)) < 0) {
+		return false;
+	}
+	if ((dfd = open(dst, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0) {
+		close(sfd);
+		return false;
+	}
+	if (fstat(sfd, &st) != 0 || ftruncate(dfd, st.st_size) != 0) {
+		goto out;
+	}
+	for (data = 0; data < st.st_size; data = hole) {
+		if ((data = lseek(sfd, data, SEEK_DATA)) < 0) {
+			break;  /* ENXIO: no more data */
+		}
+		hole = lseek(sfd, data, SEEK_HOLE);
+		while (data < hole) {
+			n = pread(sfd, buf, hole - data < COPY_BUF_SIZE ? hole - data : COPY_BUF_SIZE, data);
+			if (n <= 0 || pwrite(dfd, buf, n, data) != n) {
+				goto out;
+			}
+			data += n;
+		}
+	}
+	ok = true;
+out:
+	close(sfd);
+	close(dfd);
+	return ok;
+}
+
+
+static bool copyDir(const char *src, const char *dst)
+{
+	static char   *buf = NULL;
+	DIR           *d;
+	struct dirent *de;
+	char          spath[PATH_MAX];
+	char          dpath[PATH_MAX];
+	bool          ok = true;
+
+	if (!buf) {
+		buf = (char *) malloc(COPY_BUF_SIZE);
+	}
+	removeFiles(dst);
+	if (!(d = opendir(src))) {
+		return false;
+	}
+	while (ok && (de = readdir(d))) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(spath, PATH_MAX, "%s/%s", src, de->d_name);
+		snprintf(dpath, PATH_MAX, "%s/%s", dst, de->d_name);
+		ok = copySparseFile(spath, dpath, buf);
+	}
+	closedir(d);
+	return ok;
+}
+
+
+static void parseProgress(char *line, struct outcome_s *outcome)
+{
+	unsigned long long val;
+
+	if (sscanf(line, "commit %llu", &val) == 1) {
+		outcome->committed = (int) val;
+	} else if (sscanf(line, "points %llu", &val) == 1) {
+		outcome->points = val;
+	} else if (sscanf(line, "ops %llu", &val) == 1) {
+		outcome->ops = (int64_t) val;
+	} else if (strncmp(line, "error ", 6) == 0) {
+		snprintf(outcome->error, sizeof(outcome->error), "%s", line + 6);
+	}
+}
+
+
+/*
+ * Runs the workload on segmentsDir in a child process and collects what it 
+ * reports. crashPoint 0 lets it run to completion.
+ */
+static void runWorkload(const char *segmentsDir, int reset, int crashPoint, int seed, 
+                        const char *tornCdf, const char *mode, int nops, 
+                        struct outcome_s *outcome)
+{
+	int   pfd[2];
+	int   logfd;
+	int   status;
+	pid_t pid;
+	char  logPath[PATH_MAX];
+	char  buf[4096];
+	char  line[512];
+	int   len = 0;
+	int   i;
+	int   n;
+	char  nopsStr[16];
+	char  seedStr[16];
+
+	memset(outcome, 0, sizeof(*outcome));
+	outcome->committed = -1;
+	outcome->ops = -1;
+	if (pipe(pfd) != 0) {
+		outcome->status = -1;
+		return;
+	}
+	snprintf(logPath, PATH_MAX, "%s/workload.log", baseDir);
+	snprintf(nopsStr, sizeof(nopsStr), "%d", nops);
+	snprintf(seedStr, sizeof(seedStr), "%d", seed);
+
+	if ((pid = fork()) == 0) {
+		char val[32];
+
+		setenv("MCORE_SEGMENTS_DIR", segmentsDir, 1);
+		setenv("MCORE_RESET_SEGMENTS", reset ? "1" : "0", 1);
+		snprintf(val, sizeof(val), "%d", crashPoint);
+		setenv("MCORE_CRASH_POINT", val, 1);
+		snprintf(val, sizeof(val), "%d", seed + crashPoint);
+		setenv("MCORE_CRASH_SEED", val, 1);
+		setenv("MCORE_CRASH_TORN_CDF", tornCdf, 1);
+		/* Keep the library's chatter out of the test report on stderr */
+		if ((logfd = open(logPath, O_WRONLY|O_CREAT|O_APPEND, 0644)) >= 0) {
+			dup2(logfd, 1);
+			dup2(logfd, 2);
+			close(logfd);
+		}
+		close(pfd[0]);
+		dup2(pfd[1], PROGRESS_FD);
+		if (pfd[1] != PROGRESS_FD) {
+			close(pfd[1]);
+		}
+		if (strcmp(mode, "check") == 0) {
+			execl(workloadPath, "workload", mode, (char *) NULL);
+		} else {
+			execl(workloadPath, "workload", mode, nopsStr, seedStr, (char *) NULL);
+		}
+		_exit(127);
+	}
+	close(pfd[1]);
+	while ((n = read(pfd[0], buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] == '\n' || len == sizeof(line) - 1) {
+				line[len] = '\0';
+				parseProgress(line, outcome);
+				len = 0;
+			} else {
+				line[len++] = buf[i];
+			}
+		}
+	}
+	close(pfd[0]);
+	waitpid(pid, &status, 0);
+	outcome->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+SUITE(SuiteCrashFuzz)
+{
+	TEST(Fuzz)
+	{
+		struct outcome_s run;
+		struct outcome_s check;
+		int              npoints = envInt("CRASH_FUZZ_POINTS", 200);
+		int              nops = envInt("CRASH_FUZZ_OPS", 32);
+		int              seed = envInt("CRASH_FUZZ_SEED", 1);
+		int              setupOps;
+		uint64_t         totalPoints;
+		int              crashPoint;
+		int              i;
+		int              failures = 0;
+		unsigned int     rseed = seed;
+		const char       *tornCdf;
+		struct timespec  start;
+		struct timespec  stop;
+		double           secs;
+
+		initPaths();
+
+		/* Build the image every iteration starts from */
+		removeFiles(snapshotDir);
+		runWorkload(snapshotDir, 1, 0, seed, "none", "setup", SETUP_OPS, &run);
+		CHECK_EQUAL(0, run.status);
+		setupOps = run.committed;
+
+		/* A run without a crash tells how many crash points there are */
+		CHECK(copyDir(snapshotDir, workDir));
+		runWorkload(workDir, 0, 0, seed, "none", "run", nops, &run);
+		CHECK_EQUAL(0, run.status);
+		totalPoints = run.points;
+		CHECK(totalPoints > 0);
+		if (run.status != 0 || totalPoints == 0) {
+			return;
+		}
+		if (npoints <= 0 || npoints > totalPoints) {
+			npoints = totalPoints;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < npoints; i++) {
+			/* Either sweep every point or sample them */
+			if (npoints == totalPoints) {
+				crashPoint = i + 1;
+			} else {
+				crashPoint = 1 + rand_r(&rseed) % totalPoints;
+			}
+			tornCdf = (i % 2) ? "uniform" : "none";
+
+			CHECK(copyDir(snapshotDir, workDir));
+			runWorkload(workDir, 0, crashPoint, seed, tornCdf, "run", nops, &run);
+			if (run.status != CRASH_EXIT_STATUS && run.status != 0) {
+				printf("crash point %d (%s): workload exited with %d\n", crashPoint, tornCdf, run.status);
+				failures++;
+				continue;
+			}
+			runWorkload(workDir, 0, 0, seed, "none", "check", 0, &check);
+
+			/* Recovery keeps every committed operation, plus maybe the 
+			 * one in flight when the crash hit */
+			if (run.committed < 0) {
+				run.committed = setupOps;
+			}
+			if (check.status != 0 || 
+			    check.ops < run.committed || check.ops > run.committed + 1) 
+			{
+				printf("crash point %d (%s, seed %d): recovered %lld ops after %d committed: %s\n", 
+				       crashPoint, tornCdf, seed + crashPoint, (long long) check.ops, 
+				       run.committed, check.error);
+				failures++;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+		printf("crash fuzz: %d of %llu crash points, %d failures, %.0f points/min\n",
+		       npoints, (unsigned long long) totalPoints, failures, secs > 0 ? npoints * 60 / secs : 0);
+		CHECK_EQUAL(0, failures);
+
+		if (failures == 0 && !getenv("CRASH_FUZZ_DIR")) {
+			removeFiles(snapshotDir);
+			removeFiles(workDir);
+			removeFiles(baseDir);
+			rmdir(snapshotDir);
+			rmdir(workDir);
+			rmdir(baseDir);
+		}
+	}
+}
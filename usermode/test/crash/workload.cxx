@@ -0,0 +1,173 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file workload.cxx
+ *
+ * \brief Workload the crash fuzzer (crash.test.cxx) runs in a child process.
+ *
+ * Keeps a table of persistent nodes allocated with pmalloc and updates it
+ * with transactions whose outcome is derived from a seed and the number of
+ * operations done so far, so every run from the same image is identical.
+ *
+ *   workload setup NOPS SEED   run NOPS operations on a fresh image
+ *   workload run NOPS SEED     run NOPS operations, reporting each commit
+ *   workload check             recover and verify the table invariants
+ *
+ * Progress is reported on descriptor 3 when the fuzzer provides it:
+ * "commit N" after the Nth operation commits, "points N" with the number of 
+ * crash points passed at the end of a run, and "ops N" or "error ..." from 
+ * a check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <mnemosyne.h>
+#include <pmalloc.h>
+
+#define NUM_SLOTS    64
+#define NODE_MAGIC   0x6d6e656d6f73796eULL
+#define PROGRESS_FD  3
+
+/* From pcm_i.h, which cannot be included without the library's directives */
+extern "C" uint64_t pcm_crash_point_count(void);
+
+struct node_s {
+	uint64_t key;
+	uint64_t value;
+	uint64_t check;
+};
+
+MNEMOSYNE_PERSISTENT struct node_s *slots[NUM_SLOTS];
+MNEMOSYNE_PERSISTENT uint64_t      nnodes;
+MNEMOSYNE_PERSISTENT uint64_t      total;
+MNEMOSYNE_PERSISTENT uint64_t      ops;
+
+
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+
+/* Inserts, updates or deletes the node of one slot. */
+static void doOperation(unsigned int seed)
+{
+	uint64_t      r = mix(((uint64_t) seed << 32) + ops);
+	int           i = r % NUM_SLOTS;
+	uint64_t      value = (r >> 16) % 1000 + 1;
+	struct node_s *node;
+
+	__tm_atomic {
+		node = slots[i];
+		if (node == NULL) {
+			node = (struct node_s *) pmalloc(sizeof(struct node_s));
+			node->key = i;
+			node->value = value;
+			node->check = i ^ value ^ NODE_MAGIC;
+			slots[i] = node;
+			nnodes++;
+			total += value;
+		} else if (r & (1ULL << 48)) {
+			total = total - node->value + value;
+			node->value = value;
+			node->check = i ^ value ^ NODE_MAGIC;
+		} else {
+			slots[i] = NULL;
+			nnodes--;
+			total -= node->value;
+			pfree(node);
+		}
+		ops++;
+	}
+}
+
+
+static int check()
+{
+	uint64_t      n = 0;
+	uint64_t      sum = 0;
+	struct node_s *node;
+	int           i;
+
+	for (i = 0; i < NUM_SLOTS; i++) {
+		if ((node = slots[i]) == NULL) {
+			continue;
+		}
+		if (node->key != i || node->check != (node->key ^ node->value ^ NODE_MAGIC)) {
+			dprintf(PROGRESS_FD, "error slot %d holds a torn node\n", i);
+			return 1;
+		}
+		n++;
+		sum += node->value;
+	}
+	if (n != nnodes || sum != total) {
+		dprintf(PROGRESS_FD, "error %llu nodes summing to %llu, expected %llu summing to %llu\n",
+		        (unsigned long long) n, (unsigned long long) sum,
+		        (unsigned long long) nnodes, (unsigned long long) total);
+		return 1;
+	}
+	dprintf(PROGRESS_FD, "ops %llu\n", (unsigned long long) ops);
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	int          nops;
+	unsigned int seed;
+	int          i;
+
+	if (argc == 2 && strcmp(argv[1], "check") == 0) {
+		return check();
+	}
+	if (argc != 4 || (strcmp(argv[1], "setup") != 0 && strcmp(argv[1], "run") != 0)) {
+		fprintf(stderr, "usage: %s setup|run NOPS SEED | check\n", argv[0]);
+		return 2;
+	}
+	nops = atoi(argv[2]);
+	seed = (unsigned int) atoi(argv[3]);
+	for (i = 0; i < nops; i++) {
+		doOperation(seed);
+		dprintf(PROGRESS_FD, "commit %llu\n", (unsigned long long) ops);
+	}
+	dprintf(PROGRESS_FD, "points %llu\n", (unsigned long long) pcm_crash_point_count());
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdint.h>
+#include <pthread.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+#include "../common/unittest.h"
+
+#define NUM_THREADS 4
+#define NUM_INCS    10000
+
+MNEMOSYNE_PERSISTENT uint64_t counter;
+MNEMOSYNE_PERSISTENT uint64_t slots[NUM_THREADS];
+MNEMOSYNE_PERSISTENT void     *block;
+
+static uint64_t volatile_copy;
+
+
+static void *incrementThread(void *arg)
+{
+	uint64_t id = (uint64_t) (uintptr_t) arg;
+	int      i;
+
+	mtm_set_lazy_durable(1);
+	for (i = 0; i < NUM_INCS; i++) {
+		__tm_atomic {
+			counter++;
+			slots[id]++;
+		}
+	}
+	return NULL;
+}
+
+
+SUITE(SuiteLazyDurable)
+{
+	/* A lazy transaction is seen by the next one, durable or not */
+	TEST(Commit)
+	{
+		uint64_t value;
+		int      ok = 1;
+		int      i;
+
+		for (i = 0; i < NUM_INCS; i++) {
+			MNEMOSYNE_ATOMIC_LAZY {
+				counter++;
+				volatile_copy = counter;
+			}
+			/* Volatile data is written back at commit */
+			if (volatile_copy != i + 1) {
+				ok = 0;
+			}
+		}
+		__tm_atomic {
+			value = counter;
+		}
+		CHECK(ok);
+		CHECK_EQUAL(NUM_INCS, value);
+	}
+
+	/* Threads touching the same data wait for the flusher, not abort forever */
+	TEST(Threads)
+	{
+		pthread_t threads[NUM_THREADS];
+		uint64_t  value;
+		uint64_t  sum = 0;
+		int       i;
+
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&threads[i], NULL, incrementThread, (void *) (uintptr_t) i);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		__tm_atomic {
+			value = counter;
+			for (i = 0; i < NUM_THREADS; i++) {
+				sum += slots[i];
+			}
+		}
+		CHECK_EQUAL((NUM_THREADS + 1) * NUM_INCS, value);
+		CHECK_EQUAL(NUM_THREADS * NUM_INCS, sum);
+	}
+
+	/* A break inside the block leaves the loop around it */
+	TEST(Break)
+	{
+		int i;
+
+		for (i = 0; i < NUM_INCS; i++) {
+			MNEMOSYNE_ATOMIC_LAZY {
+				if (i == 1) {
+					break;
+				}
+				counter++;
+			}
+		}
+		CHECK_EQUAL(1, i);
+	}
+
+	/* After the barrier plain loads see it all */
+	TEST(Barrier)
+	{
+		MNEMOSYNE_ATOMIC_LAZY {
+			counter++;
+		}
+		m_durable_barrier();
+		CHECK_EQUAL((NUM_THREADS + 1) * NUM_INCS + 2, counter);
+	}
+
+	/* 
+	 * A transaction that frees memory commits durably: the block must not
+	 * be reused while a crash could still undo the free.
+	 */
+	TEST(Free)
+	{
+		MNEMOSYNE_ATOMIC {
+			block = pmalloc(64);
+		}
+		CHECK(block != NULL);
+		MNEMOSYNE_ATOMIC_LAZY {
+			pfree(block);
+			block = NULL;
+		}
+		/* No barrier: written back at commit */
+		CHECK(block == NULL);
+	}
+
+	TEST(Recover)
+	{
+		uint64_t sum = 0;
+		int      i;
+
+		CHECK(block == NULL);
+		CHECK_EQUAL((NUM_THREADS + 1) * NUM_INCS + 2, counter);
+		for (i = 0; i < NUM_THREADS; i++) {
+			sum += slots[i];
+		}
+		CHECK_EQUAL(NUM_THREADS * NUM_INCS, sum);
+	}
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdint.h>
+#include <pmalloc.h>
+#include <mnemosyne.h>
+#include "../common/unittest.h"
+
+#define NHANDLES 2000
+#define KEEP     10
+
+static phandle_t handles[NHANDLES];
+
+SUITE(SuiteCompact)
+{
+	TEST(Test1)
+	{
+		pmalloc_stats_t before;
+		pmalloc_stats_t after;
+		int             i;
+		int             ok = 1;
+
+		for (i = 0; i < NHANDLES; i++) {
+			__tm_atomic {
+				handles[i] = phandle_alloc(64);
+				((uint64_t *) phandle_get(handles[i]))[0] = i;
+			}
+			CHECK(handles[i] != PHANDLE_NULL);
+		}
+		/* Leave every slab of the size class sparse */
+		for (i = 0; i < NHANDLES; i++) {
+			if (i % KEEP) {
+				__tm_atomic {
+					phandle_free(handles[i]);
+				}
+			}
+		}
+		pmalloc_stats(&before);
+		CHECK(before.sparse_slabs > 1);
+		CHECK(before.handles >= NHANDLES / KEEP);
+
+		CHECK(pmalloc_compact(SIZE_MAX) > 0);
+
+		for (i = 0; i < NHANDLES; i += KEEP) {
+			__tm_atomic {
+				if (((uint64_t *) phandle_get(handles[i]))[0] != i) {
+					ok = 0;
+				}
+			}
+		}
+		CHECK(ok);
+		pmalloc_stats(&after);
+		CHECK(after.migrated_objects > 0);
+		CHECK(after.released_slabs > before.released_slabs);
+		CHECK(after.slabs < before.slabs);
+		CHECK(after.free_bytes > before.free_bytes);
+	}
+}
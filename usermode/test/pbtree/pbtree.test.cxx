@@ -0,0 +1,201 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <mtm.h>
+#include <pbtree.h>
+#include "../common/unittest.h"
+
+#define NUM_KEYS     20000      /* enough for a tree of height 3 */
+
+static void *valueOf(uint64_t i)
+{
+	return (void *) (uintptr_t) (3 * i + 1);
+}
+
+static pbtree_t *openTree(const char *name)
+{
+	pbtree_t *tree;
+
+	__tm_atomic {
+		tree = (pbtree_t *) m_root_get(name);
+		if (tree == NULL) {
+			tree = pbtree_alloc();
+			m_root_set(name, tree);
+		}
+	}
+	return tree;
+}
+
+
+SUITE(SuitePersistentBTree)
+{
+	TEST(InsertGetRemove)
+	{
+		pbtree_t *tree = openTree("test.pbtree.small");
+		void     *value;
+		int      ret;
+		uint64_t i;
+
+		CHECK(tree != NULL);
+		for (i = 0; i < 10; i++) {
+			__tm_atomic {
+				ret = pbtree_insert(tree, i, valueOf(i));
+			}
+			CHECK_EQUAL(1, ret);
+		}
+		__tm_atomic {
+			ret = pbtree_insert(tree, 5, (void *) 5);
+		}
+		CHECK_EQUAL(0, ret);
+		__tm_atomic {
+			ret = pbtree_update(tree, 5, (void *) 5) + pbtree_get(tree, 5, &value);
+		}
+		CHECK_EQUAL(2, ret);
+		CHECK(value == (void *) 5);
+		__tm_atomic {
+			ret = pbtree_remove(tree, 5) + pbtree_remove(tree, 5) + pbtree_get(tree, 5, NULL);
+		}
+		CHECK_EQUAL(1, ret);
+		__tm_atomic {
+			ret = pbtree_update(tree, 5, (void *) 5);
+		}
+		CHECK_EQUAL(0, ret);
+		for (i = 0; i < 10; i++) {
+			value = NULL;
+			__tm_atomic {
+				ret = pbtree_get(tree, i, &value);
+			}
+			CHECK_EQUAL(i != 5, ret);
+			CHECK(i == 5 || value == valueOf(i));
+		}
+	}
+
+	TEST(Splits)
+	{
+		pbtree_t *tree = openTree("test.pbtree");
+		void     *value;
+		int      ret;
+		uint64_t i;
+		uint64_t key;
+
+		CHECK(tree != NULL);
+		/* Out of order, so that splits happen all over the tree */
+		for (i = 0; i < NUM_KEYS; i++) {
+			key = (i * 7919) % NUM_KEYS;
+			__tm_atomic {
+				ret = pbtree_insert(tree, key, valueOf(key));
+			}
+			CHECK_EQUAL(1, ret);
+		}
+		for (i = 1; i < NUM_KEYS; i += 2) {
+			__tm_atomic {
+				ret = pbtree_remove(tree, i);
+			}
+			CHECK_EQUAL(1, ret);
+		}
+		for (i = 0; i < NUM_KEYS; i++) {
+			value = NULL;
+			__tm_atomic {
+				ret = pbtree_get(tree, i, &value);
+			}
+			CHECK_EQUAL((int) (i % 2 == 0), ret);
+			CHECK(i % 2 || value == valueOf(i));
+		}
+	}
+
+	TEST(Scan)
+	{
+		pbtree_t *tree = openTree("test.pbtree");
+		uint64_t keys[NUM_KEYS];
+		void     *values[NUM_KEYS];
+		size_t   n;
+		size_t   i;
+
+		CHECK(tree != NULL);
+		n = pbtree_scan(tree, 100, 199, keys, values, NUM_KEYS);
+		CHECK_EQUAL(50, n);
+		for (i = 0; i < n; i++) {
+			CHECK_EQUAL(100 + 2 * i, keys[i]);
+			CHECK(values[i] == valueOf(keys[i]));
+		}
+		/* Resume where a bounded scan stopped */
+		n = pbtree_scan(tree, 1001, UINT64_MAX, keys, NULL, 10);
+		CHECK_EQUAL(10, n);
+		CHECK_EQUAL(1002, keys[0]);
+		n = pbtree_scan(tree, keys[9] + 1, UINT64_MAX, keys, NULL, 10);
+		CHECK_EQUAL(10, n);
+		CHECK_EQUAL(1022, keys[0]);
+		CHECK_EQUAL(NUM_KEYS / 2, pbtree_scan(tree, 0, UINT64_MAX, NULL, NULL, NUM_KEYS));
+		CHECK_EQUAL(0, pbtree_scan(tree, NUM_KEYS, UINT64_MAX, keys, values, NUM_KEYS));
+		CHECK_EQUAL(0, pbtree_scan(tree, 10, 9, keys, values, NUM_KEYS));
+	}
+
+	TEST(ScanInTransaction)
+	{
+		pbtree_t *tree = openTree("test.pbtree.small");
+		uint64_t keys[16];
+		size_t   n;
+
+		CHECK(tree != NULL);
+		/* The scan sees the transaction's own updates */
+		__tm_atomic {
+			pbtree_insert(tree, 5, valueOf(5));
+			pbtree_remove(tree, 6);
+			n = pbtree_scan(tree, 4, 7, keys, NULL, 16);
+		}
+		CHECK_EQUAL(3, n);
+		CHECK_EQUAL(4, keys[0]);
+		CHECK_EQUAL(5, keys[1]);
+		CHECK_EQUAL(7, keys[2]);
+	}
+
+	TEST(GetAfterRestart)
+	{
+		pbtree_t *tree = openTree("test.pbtree");
+		void     *value;
+		int      ret;
+		uint64_t i;
+
+		CHECK(tree != NULL);
+		for (i = 0; i < NUM_KEYS; i++) {
+			value = NULL;
+			__tm_atomic {
+				ret = pbtree_get(tree, i, &value);
+			}
+			CHECK_EQUAL((int) (i % 2 == 0), ret);
+			CHECK(i % 2 || value == valueOf(i));
+		}
+		CHECK_EQUAL(NUM_KEYS / 2, pbtree_scan(tree, 0, UINT64_MAX, NULL, NULL, NUM_KEYS));
+	}
+}
@@ -0,0 +1,228 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <mtm.h>
+#include <phash.h>
+#include <phash.hpp>
+#include "../common/unittest.h"
+
+#define NUM_KEYS     20000      /* enough to grow the table a few times */
+#define NUM_THREADS  4
+
+static void keyName(char *key, uint64_t i)
+{
+	sprintf(key, "test.key.%llu", (unsigned long long) i);
+}
+
+static void *valueOf(uint64_t i)
+{
+	return (void *) (uintptr_t) (3 * i + 1);
+}
+
+
+struct ThreadArg {
+	phash_t           *map;
+	int               id;
+	volatile int      *stop;
+	uint64_t          found;
+};
+
+static void *writer(void *arg)
+{
+	ThreadArg *targ = (ThreadArg *) arg;
+	char      key[32];
+	uint64_t  i;
+
+	for (i = targ->id; i < NUM_KEYS; i += NUM_THREADS) {
+		keyName(key, NUM_KEYS + i);
+		phash_put(targ->map, key, strlen(key), valueOf(NUM_KEYS + i));
+	}
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	ThreadArg *targ = (ThreadArg *) arg;
+	char      key[32];
+	void      *value;
+	uint64_t  i = 0;
+
+	while (!*targ->stop) {
+		i = (i + 7919) % (2 * NUM_KEYS);
+		keyName(key, i);
+		if (phash_get(targ->map, key, strlen(key), &value)) {
+			if (value != valueOf(i)) {
+				targ->found = UINT64_MAX;
+				break;
+			}
+			targ->found++;
+		}
+	}
+	return NULL;
+}
+
+
+SUITE(SuitePersistentHash)
+{
+	TEST(PutGetRemove)
+	{
+		phash_t  *map = phash_open("test.phash");
+		char     key[32];
+		void     *value;
+		uint64_t i;
+
+		CHECK(map != NULL);
+		CHECK(phash_open("test.phash") == map);
+		phash_close(map);
+		for (i = 0; i < NUM_KEYS; i++) {
+			keyName(key, i);
+			CHECK_EQUAL(1, phash_put(map, key, strlen(key), valueOf(i)));
+		}
+		CHECK_EQUAL(NUM_KEYS, phash_count(map));
+		keyName(key, 5);
+		CHECK_EQUAL(0, phash_put(map, key, strlen(key), (void *) 5));
+		CHECK(phash_get(map, key, strlen(key), &value) && value == (void *) 5);
+		CHECK_EQUAL(0, phash_put(map, key, strlen(key), valueOf(5)));
+		for (i = 0; i < NUM_KEYS; i += 2) {
+			keyName(key, i);
+			CHECK_EQUAL(1, phash_remove(map, key, strlen(key)));
+		}
+		CHECK_EQUAL(0, phash_remove(map, key, strlen(key)));
+		for (i = 0; i < NUM_KEYS; i++) {
+			keyName(key, i);
+			value = NULL;
+			CHECK_EQUAL((int) (i % 2), phash_get(map, key, strlen(key), &value));
+			CHECK(i % 2 == 0 || value == valueOf(i));
+		}
+		CHECK_EQUAL(NUM_KEYS / 2, phash_count(map));
+		phash_close(map);
+	}
+
+	TEST(GetAfterRestart)
+	{
+		phash_t  *map = phash_open("test.phash");
+		char     key[32];
+		void     *value;
+		uint64_t i;
+
+		CHECK(map != NULL);
+		CHECK_EQUAL(NUM_KEYS / 2, phash_count(map));
+		for (i = 0; i < NUM_KEYS; i++) {
+			keyName(key, i);
+			value = NULL;
+			CHECK_EQUAL((int) (i % 2), phash_get(map, key, strlen(key), &value));
+			CHECK(i % 2 == 0 || value == valueOf(i));
+		}
+		phash_close(map);
+	}
+
+	TEST(Transactions)
+	{
+		phash::map<std::string, long> map("test.phash.tx");
+		long                          a = 0;
+		long                          b = 0;
+		bool                          found;
+
+		CHECK(map.valid());
+		/* Updates in one transaction commit together and are visible in it */
+		__tm_atomic {
+			map.put("a", 1);
+			map.put("b", 2);
+			found = map.get("a", &a);
+		}
+		CHECK(found);
+		CHECK_EQUAL(1, a);
+		CHECK(map.get("b", &b));
+		CHECK_EQUAL(2, b);
+		__tm_atomic {
+			map.remove("a");
+			found = map.get("a", &a);
+		}
+		CHECK(!found);
+		CHECK(!map.get("a", &a));
+		CHECK_EQUAL(1, map.size());
+	}
+
+	TEST(ConcurrentReaders)
+	{
+		phash_t      *map = phash_open("test.phash");
+		pthread_t    writers[NUM_THREADS];
+		pthread_t    readers[NUM_THREADS];
+		ThreadArg    wargs[NUM_THREADS];
+		ThreadArg    rargs[NUM_THREADS];
+		volatile int stop = 0;
+		int          i;
+
+		CHECK(map != NULL);
+		for (i = 0; i < NUM_THREADS; i++) {
+			rargs[i].map = wargs[i].map = map;
+			rargs[i].id = wargs[i].id = i;
+			rargs[i].stop = wargs[i].stop = &stop;
+			rargs[i].found = wargs[i].found = 0;
+			pthread_create(&readers[i], NULL, reader, &rargs[i]);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&writers[i], NULL, writer, &wargs[i]);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(writers[i], NULL);
+		}
+		stop = 1;
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(readers[i], NULL);
+			/* Readers never see a value that was not put */
+			CHECK(rargs[i].found != UINT64_MAX);
+		}
+		CHECK_EQUAL(NUM_KEYS / 2 + NUM_KEYS, phash_count(map));
+		phash_close(map);
+	}
+
+	TEST(CountAfterRestart)
+	{
+		phash_t  *map = phash_open("test.phash");
+		char     key[32];
+		void     *value;
+		uint64_t i;
+
+		CHECK(map != NULL);
+		CHECK_EQUAL(NUM_KEYS / 2 + NUM_KEYS, phash_count(map));
+		for (i = NUM_KEYS; i < 2 * NUM_KEYS; i++) {
+			keyName(key, i);
+			CHECK(phash_get(map, key, strlen(key), &value) && value == valueOf(i));
+		}
+		phash_close(map);
+	}
+}
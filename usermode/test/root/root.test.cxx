@@ -0,0 +1,119 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pmalloc.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include "../common/unittest.h"
+
+#define NUM_ROOTS 100
+
+static void rootName(char *name, int i)
+{
+	sprintf(name, "test.root.%d", i);
+}
+
+
+SUITE(SuiteRootDirectory)
+{
+	TEST(BadNames)
+	{
+		CHECK(m_root_get("test.root.missing") == NULL);
+		CHECK(m_root_get(NULL) == NULL);
+		CHECK_EQUAL(-1, m_root_set("", (void *) 1));
+		CHECK_EQUAL(EINVAL, errno);
+		CHECK_EQUAL(-1, m_root_set("a name that is far too long for the root directory", (void *) 1));
+		CHECK_EQUAL(EINVAL, errno);
+	}
+
+	TEST(SetInTransaction)
+	{
+		uint64_t *obj;
+		char     name[32];
+		int      i;
+
+		__tm_atomic {
+			obj = (uint64_t *) pmalloc(sizeof(uint64_t));
+			*obj = 42;
+			m_root_set("test.root.tx", obj);
+		}
+		CHECK(obj != NULL);
+		CHECK(m_root_get("test.root.tx") == obj);
+
+		for (i=0; i<NUM_ROOTS; i++) {
+			rootName(name, i);
+			__tm_atomic {
+				m_root_set(name, (void *) (uintptr_t) (i + 1));
+			}
+		}
+		/* Reading a root inside the transaction that set it sees the new value */
+		__tm_atomic {
+			m_root_set("test.root.0", (void *) 1000);
+			obj = (uint64_t *) m_root_get("test.root.0");
+		}
+		CHECK(obj == (void *) 1000);
+	}
+
+	TEST(GetAfterRestart)
+	{
+		uint64_t *obj;
+		char     name[32];
+		int      i;
+
+		__tm_atomic {
+			obj = (uint64_t *) m_root_get("test.root.tx");
+		}
+		CHECK(obj != NULL);
+		CHECK_EQUAL(42, *obj);
+		CHECK(m_root_get("test.root.0") == (void *) 1000);
+		for (i=1; i<NUM_ROOTS; i++) {
+			rootName(name, i);
+			CHECK(m_root_get(name) == (void *) (uintptr_t) (i + 1));
+		}
+	}
+
+	TEST(SetOutsideTransaction)
+	{
+		CHECK_EQUAL(0, m_root_set("test.root.plain", (void *) 0x1234));
+		CHECK_EQUAL(0, m_root_set("test.root.tx", NULL));
+		CHECK(m_root_get("test.root.plain") == (void *) 0x1234);
+	}
+
+	TEST(GetAfterRestartOutside)
+	{
+		CHECK(m_root_get("test.root.plain") == (void *) 0x1234);
+		CHECK(m_root_get("test.root.tx") == NULL);
+	}
+}
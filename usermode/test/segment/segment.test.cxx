@@ -0,0 +1,394 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <iostream>
+#include <mnemosyne.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <UnitTest++/UnitTest++.h>
+extern "C" {
+#include <segment.h>
+}
+
+#define PAGE_SZ               4096
+#define NUM_ITERATIONS        4096
+#define MAX_LIVE_SEGMENTS     512
+#define MAX_SEGMENT_PAGES     16
+#define NUM_LOOKUP_THREADS    4
+#define NUM_PINNED_SEGMENTS   32
+#define NUM_REINCARNATE       256
+
+struct segment_s {
+	uintptr_t start;
+	size_t    size;
+};
+
+
+/* Maps a segment of a random size and stamps its first and last word. */
+static bool mapSegment(struct segment_s *seg, unsigned int *seed)
+{
+	void *addr;
+
+	seg->size = (1 + rand_r(seed) % MAX_SEGMENT_PAGES) * PAGE_SZ;
+	addr = m_pmap(0, seg->size, PROT_READ|PROT_WRITE, 0);
+	if (addr == MAP_FAILED) {
+		return false;
+	}
+	seg->start = (uintptr_t) addr;
+	*((uintptr_t *) seg->start) = seg->start;
+	*((uintptr_t *) (seg->start + seg->size - sizeof(uintptr_t))) = seg->start;
+	return true;
+}
+
+
+/* Checks that every byte of the segment resolves to its own index entry. */
+static void checkSegmentIndexed(struct segment_s *seg)
+{
+	m_segidx_entry_t *ientry;
+
+	CHECK(m_segment_find_using_addr((void *) seg->start, &ientry) == M_R_SUCCESS);
+	CHECK(ientry->segtbl_entry->start == seg->start);
+	CHECK(ientry->segtbl_entry->size == seg->size);
+	CHECK(m_segment_find_using_addr((void *) (seg->start + seg->size/2), &ientry) == M_R_SUCCESS);
+	CHECK(ientry->segtbl_entry->start == seg->start);
+	CHECK(m_segment_find_using_addr((void *) (seg->start + seg->size - 1), &ientry) == M_R_SUCCESS);
+	CHECK(ientry->segtbl_entry->start == seg->start);
+	CHECK(*((uintptr_t *) seg->start) == seg->start);
+	CHECK(*((uintptr_t *) (seg->start + seg->size - sizeof(uintptr_t))) == seg->start);
+}
+
+
+static void checkSegmentNotIndexed(uintptr_t addr)
+{
+	m_segidx_entry_t *ientry;
+
+	if (m_segment_find_using_addr((void *) addr, &ientry) == M_R_SUCCESS) {
+		/* Only acceptable if a newer segment took over the range */
+		CHECK(ientry->segtbl_entry->start <= addr);
+		CHECK(addr < ientry->segtbl_entry->start + ientry->segtbl_entry->size);
+		CHECK(ientry->segtbl_entry->start != addr);
+	}
+}
+
+
+static void unmapSegment(struct segment_s *seg)
+{
+	CHECK(m_punmap((void *) seg->start, seg->size) == 0);
+}
+
+
+struct lookup_arg_s {
+	struct segment_s *pinned;
+	volatile bool    *stop;
+	unsigned long    lookups;
+	unsigned long    misses;
+};
+
+
+static void *lookupThread(void *arg)
+{
+	struct lookup_arg_s *larg = (struct lookup_arg_s *) arg;
+	m_segidx_entry_t    *ientry;
+	struct segment_s    *seg;
+	unsigned int        seed = (unsigned int) (uintptr_t) arg;
+	uintptr_t           addr;
+
+	while (!*larg->stop) {
+		seg = &larg->pinned[rand_r(&seed) % NUM_PINNED_SEGMENTS];
+		addr = seg->start + rand_r(&seed) % seg->size;
+		if (m_segment_find_using_addr((void *) addr, &ientry) != M_R_SUCCESS ||
+		    ientry->segtbl_entry->start != seg->start)
+		{
+			larg->misses++;
+		}
+		larg->lookups++;
+	}
+	return NULL;
+}
+
+
+SUITE(SuiteSegmentStress)
+{
+	TEST(MapUnmapMany)
+	{
+		struct segment_s live[MAX_LIVE_SEGMENTS];
+		int              nlive = 0;
+		unsigned int     seed = 1;
+		int              i;
+		int              j;
+		uintptr_t        addr;
+
+		for (i=0; i<NUM_ITERATIONS; i++) {
+			if (nlive < MAX_LIVE_SEGMENTS && (nlive == 0 || rand_r(&seed) % 3 != 0)) {
+				CHECK(mapSegment(&live[nlive], &seed));
+				checkSegmentIndexed(&live[nlive]);
+				nlive++;
+			} else {
+				j = rand_r(&seed) % nlive;
+				addr = live[j].start;
+				unmapSegment(&live[j]);
+				live[j] = live[--nlive];
+				checkSegmentNotIndexed(addr);
+			}
+			if (i % 256 == 0) {
+				for (j=0; j<nlive; j++) {
+					checkSegmentIndexed(&live[j]);
+				}
+			}
+		}
+		for (j=0; j<nlive; j++) {
+			checkSegmentIndexed(&live[j]);
+			unmapSegment(&live[j]);
+		}
+		for (j=0; j<nlive; j++) {
+			checkSegmentNotIndexed(live[j].start);
+		}
+	}
+
+	TEST(HoleReuse)
+	{
+		struct segment_s seg[3];
+		void             *addr;
+		int              i;
+
+		for (i=0; i<3; i++) {
+			seg[i].size = 4 * PAGE_SZ;
+			addr = m_pmap(0, seg[i].size, PROT_READ|PROT_WRITE, 0);
+			CHECK(addr != MAP_FAILED);
+			seg[i].start = (uintptr_t) addr;
+		}
+		unmapSegment(&seg[1]);
+
+		/* First fit must not place the new segment above the freed hole */
+		addr = m_pmap(0, 2 * PAGE_SZ, PROT_READ|PROT_WRITE, 0);
+		CHECK(addr != MAP_FAILED);
+		CHECK((uintptr_t) addr <= seg[1].start);
+		CHECK(m_punmap(addr, 2 * PAGE_SZ) == 0);
+
+		/* Partial and unknown unmaps are rejected */
+		CHECK(m_punmap((void *) seg[0].start, PAGE_SZ) == -1);
+		CHECK(errno == EINVAL);
+		CHECK(m_punmap((void *) (seg[0].start + PAGE_SZ), 3 * PAGE_SZ) == -1);
+		CHECK(m_punmap((void *) seg[1].start, seg[1].size) == -1);
+
+		unmapSegment(&seg[0]);
+		unmapSegment(&seg[2]);
+	}
+
+	TEST(ConcurrentLookup)
+	{
+		struct segment_s    pinned[NUM_PINNED_SEGMENTS];
+		struct segment_s    churn[MAX_LIVE_SEGMENTS];
+		struct lookup_arg_s args[NUM_LOOKUP_THREADS];
+		pthread_t           threads[NUM_LOOKUP_THREADS];
+		volatile bool       stop = false;
+		unsigned int        seed = 2;
+		int                 nchurn = 0;
+		int                 i;
+		int                 j;
+
+		for (i=0; i<NUM_PINNED_SEGMENTS; i++) {
+			CHECK(mapSegment(&pinned[i], &seed));
+		}
+		for (i=0; i<NUM_LOOKUP_THREADS; i++) {
+			args[i].pinned = pinned;
+			args[i].stop = &stop;
+			args[i].lookups = 0;
+			args[i].misses = 0;
+			pthread_create(&threads[i], NULL, lookupThread, &args[i]);
+		}
+
+		/* Republish the index over and over while the readers hammer it */
+		for (i=0; i<NUM_ITERATIONS; i++) {
+			if (nchurn < MAX_LIVE_SEGMENTS && (nchurn == 0 || rand_r(&seed) % 2)) {
+				CHECK(mapSegment(&churn[nchurn], &seed));
+				nchurn++;
+			} else {
+				j = rand_r(&seed) % nchurn;
+				unmapSegment(&churn[j]);
+				churn[j] = churn[--nchurn];
+			}
+		}
+
+		stop = true;
+		for (i=0; i<NUM_LOOKUP_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+			CHECK(args[i].lookups > 0);
+			CHECK(args[i].misses == 0);
+		}
+		for (j=0; j<nchurn; j++) {
+			unmapSegment(&churn[j]);
+		}
+		for (i=0; i<NUM_PINNED_SEGMENTS; i++) {
+			checkSegmentIndexed(&pinned[i]);
+			unmapSegment(&pinned[i]);
+		}
+	}
+}
+
+
+MNEMOSYNE_PERSISTENT struct segment_s reincarnate_segments[NUM_REINCARNATE];
+
+SUITE(SuiteSegmentReincarnate)
+{
+	/* Map a batch of segments and unmap every other one... */
+	TEST(Test1)
+	{
+		unsigned int seed = 3;
+		int          i;
+
+		for (i=0; i<NUM_REINCARNATE; i++) {
+			CHECK(mapSegment(&reincarnate_segments[i], &seed));
+		}
+		for (i=0; i<NUM_REINCARNATE; i+=2) {
+			unmapSegment(&reincarnate_segments[i]);
+		}
+	}
+
+	/* ...and check the index rebuilt on restart sees exactly the survivors */
+	TEST(Test2)
+	{
+		int i;
+
+		for (i=0; i<NUM_REINCARNATE; i++) {
+			if (i % 2) {
+				checkSegmentIndexed(&reincarnate_segments[i]);
+			} else {
+				checkSegmentNotIndexed(reincarnate_segments[i].start);
+			}
+		}
+	}
+}
+
+
+SUITE(SuiteBasedPointer)
+{
+	TEST(RoundTrip)
+	{
+		struct segment_s seg;
+		char             *base;
+		m_pptr_t         pptr;
+		m_pptr_t         other;
+		int              local;
+		size_t           off;
+
+		seg.size = 4 * PAGE_SZ;
+		base = (char *) m_pmap_relocatable(0, seg.size, PROT_READ|PROT_WRITE, 0);
+		CHECK(base != MAP_FAILED);
+		seg.start = (uintptr_t) base;
+
+		CHECK(m_pptr_make(NULL) == M_PPTR_NULL);
+		CHECK(m_pptr_get(M_PPTR_NULL) == NULL);
+		CHECK(m_pptr_make(&local) == M_PPTR_NULL);
+		for (off = 0; off < seg.size; off += 1000) {
+			pptr = m_pptr_make(base + off);
+			CHECK(pptr != M_PPTR_NULL);
+			CHECK((pptr & M_PPTR_OFFSET_MASK) == off);
+			CHECK(m_pptr_get(pptr) == base + off);
+		}
+		pptr = m_pptr_make(base);
+		other = m_pptr_make_near(pptr, base + seg.size - 1);
+		CHECK(other == m_pptr_make(base + seg.size - 1));
+		CHECK(m_pptr_make_near(pptr, NULL) == M_PPTR_NULL);
+
+		unmapSegment(&seg);
+		CHECK(m_pptr_make(base) == M_PPTR_NULL);
+	}
+}
+
+
+#define RELOCATE_PAGES 16
+
+MNEMOSYNE_PERSISTENT struct segment_s relocate_segment;
+MNEMOSYNE_PERSISTENT m_pptr_t         relocate_list;
+
+struct relocate_node_s {
+	m_pptr_t next;
+	int      value;
+};
+
+SUITE(SuiteSegmentRelocate)
+{
+	/* 
+	 * Build a list linked with based pointers in a relocatable segment, then
+	 * record the segment at the address of the segment table, which is 
+	 * always taken by the time segments are reincarnated...
+	 */
+	TEST(Test1)
+	{
+		struct relocate_node_s *node;
+		m_segidx_entry_t       *ientry;
+		char                   *base;
+		int                    i;
+
+		relocate_segment.size = RELOCATE_PAGES * PAGE_SZ;
+		base = (char *) m_pmap_relocatable(0, relocate_segment.size, PROT_READ|PROT_WRITE, 0);
+		CHECK(base != MAP_FAILED);
+		relocate_segment.start = (uintptr_t) base;
+		relocate_list = M_PPTR_NULL;
+		for (i = 0; i < 100; i++) {
+			node = (struct relocate_node_s *) (base + i * 128);
+			node->value = i;
+			node->next = relocate_list;
+			relocate_list = m_pptr_make(node);
+		}
+		CHECK(m_segment_find_using_addr(base, &ientry) == M_R_SUCCESS);
+		ientry->segtbl_entry->start = PSEGMENT_RESERVED_REGION_START;
+	}
+
+	/* ...so that it comes back somewhere else with the list intact. */
+	TEST(Test2)
+	{
+		struct relocate_node_s *node;
+		m_segidx_entry_t       *ientry;
+		m_pptr_t               pptr;
+		int                    i;
+
+		node = (struct relocate_node_s *) m_pptr_get(relocate_list);
+		CHECK(node != NULL);
+		CHECK(m_segment_find_using_addr(node, &ientry) == M_R_SUCCESS);
+		CHECK(ientry->segtbl_entry->start != PSEGMENT_RESERVED_REGION_START);
+		CHECK(ientry->segtbl_entry->size == relocate_segment.size);
+		for (i = 99, pptr = relocate_list; pptr != M_PPTR_NULL; i--) {
+			node = (struct relocate_node_s *) m_pptr_get(pptr);
+			CHECK(node->value == i);
+			CHECK(m_pptr_make(node) == pptr);
+			pptr = node->next;
+		}
+		CHECK(i == -1);
+		relocate_segment.start = ientry->segtbl_entry->start;
+		unmapSegment(&relocate_segment);
+	}
+}
@@ -0,0 +1,164 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include "../common/unittest.h"
+
+#define NUM_THREADS   4
+#define NUM_SNAPSHOTS 8
+#define SNAPSHOT_DIR  "/tmp/mnemosyne.snapshot.test"
+
+MNEMOSYNE_PERSISTENT uint64_t counter;
+MNEMOSYNE_PERSISTENT uint64_t slots[NUM_THREADS];
+
+static volatile int stop;
+
+
+static void removeSnapshot(const char *dir)
+{
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+}
+
+
+static uint64_t readSqn(const char *dir)
+{
+	char               path[256];
+	unsigned long long sqn = 0;
+	int                nsegments;
+	FILE               *info;
+
+	snprintf(path, sizeof(path), "%s/snapshot.info", dir);
+	if ((info = fopen(path, "r"))) {
+		if (fscanf(info, "sqn %llu segments %d", &sqn, &nsegments) != 2) {
+			sqn = 0;
+		}
+		fclose(info);
+	}
+	return sqn;
+}
+
+
+static void *incrementThread(void *arg)
+{
+	uint64_t id = (uint64_t) (uintptr_t) arg;
+
+	while (!stop) {
+		MNEMOSYNE_ATOMIC {
+			counter++;
+			slots[id]++;
+		}
+	}
+	return NULL;
+}
+
+
+SUITE(SuiteSnapshot)
+{
+	TEST(Take)
+	{
+		char        path[256];
+		struct stat st;
+		uint64_t    sqn = 0;
+
+		MNEMOSYNE_ATOMIC {
+			counter++;
+		}
+		removeSnapshot(SNAPSHOT_DIR);
+		CHECK(m_snapshot(SNAPSHOT_DIR, &sqn) == 0);
+		CHECK(sqn > 0);
+		CHECK(readSqn(SNAPSHOT_DIR) == sqn);
+		snprintf(path, sizeof(path), "%s/segment_table", SNAPSHOT_DIR);
+		CHECK(stat(path, &st) == 0 && st.st_size > 0);
+		removeSnapshot(SNAPSHOT_DIR);
+	}
+
+	/* Commits go on around the snapshots and each one is stamped later */
+	TEST(Busy)
+	{
+		pthread_t threads[NUM_THREADS];
+		char      dir[256];
+		uint64_t  sqn;
+		uint64_t  last = 0;
+		uint64_t  sum;
+		int       i;
+
+		stop = 0;
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&threads[i], NULL, incrementThread, (void *) (uintptr_t) i);
+		}
+		for (i = 0; i < NUM_SNAPSHOTS; i++) {
+			snprintf(dir, sizeof(dir), "%s.%d", SNAPSHOT_DIR, i);
+			removeSnapshot(dir);
+			usleep(10000);
+			CHECK(m_snapshot(dir, &sqn) == 0);
+			CHECK(sqn > last);
+			last = sqn;
+			removeSnapshot(dir);
+		}
+		stop = 1;
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		MNEMOSYNE_ATOMIC {
+			sum = 0;
+			for (i = 0; i < NUM_THREADS; i++) {
+				sum += slots[i];
+			}
+			sum = counter - sum;
+		}
+		/* The one increment of Take */
+		CHECK(sum == 1);
+	}
+
+	TEST(Exists)
+	{
+		uint64_t sqn = 0;
+
+		removeSnapshot(SNAPSHOT_DIR);
+		mkdir(SNAPSHOT_DIR, S_IRWXU);
+		CHECK(m_snapshot(SNAPSHOT_DIR, &sqn) == -1);
+		CHECK(errno == EEXIST);
+		CHECK(sqn == 0);
+		removeSnapshot(SNAPSHOT_DIR);
+	}
+}
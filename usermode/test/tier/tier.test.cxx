@@ -0,0 +1,84 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <UnitTest++/UnitTest++.h>
+#include "../common/memrandom.h"
+
+#define PREGION_BASE          0xd00000000
+#define PREGION_SIZE          (16*1024*1024)
+#define PREGION_PAGE          4096
+
+MNEMOSYNE_PERSISTENT uint64_t *pregion;
+
+SUITE(SuiteTier)
+{
+	/* The first half goes cold; reads and commits still see one region */
+	TEST(Demote)
+	{
+		pregion = (uint64_t *) m_pmap_tiered((void *) PREGION_BASE, PREGION_SIZE, PROT_READ|PROT_WRITE, 0);
+		CHECK(pregion != MAP_FAILED);
+		writeMemRandom((char *) pregion + PREGION_PAGE, PREGION_SIZE - PREGION_PAGE, 0x1);
+		m_persist_new((char *) pregion + PREGION_PAGE, PREGION_SIZE - PREGION_PAGE);
+
+		CHECK(m_ptier_demote(pregion, PREGION_SIZE / 2) == 0);
+		CHECK(m_ptier_cold_bytes() == PREGION_SIZE / 2);
+		assertMemRandom((char *) pregion + PREGION_PAGE, PREGION_SIZE - PREGION_PAGE, 0x1);
+		MNEMOSYNE_ATOMIC {
+			pregion[0] = 42;
+		}
+		CHECK(m_ptier_demote((char *) pregion + PREGION_SIZE, 1) == -1);
+	}
+
+	TEST(Recover)
+	{
+		CHECK(pregion != NULL);
+		CHECK(m_ptier_cold_bytes() == PREGION_SIZE / 2);
+		CHECK(pregion[0] == 42);
+		assertMemRandom((char *) pregion + PREGION_PAGE, PREGION_SIZE - PREGION_PAGE, 0x1);
+	}
+
+	TEST(Pin)
+	{
+		CHECK(m_ptier_pin(pregion, PREGION_SIZE) == 0);
+		CHECK(m_ptier_cold_bytes() == 0);
+		CHECK(m_ptier_demote(pregion, PREGION_SIZE) == 0);
+		CHECK(m_ptier_cold_bytes() == 0);
+		CHECK(pregion[0] == 42);
+		assertMemRandom((char *) pregion + PREGION_PAGE, PREGION_SIZE - PREGION_PAGE, 0x1);
+		CHECK(m_punmap(pregion, PREGION_SIZE) == 0);
+	}
+}
@@ -0,0 +1,256 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <txlock.h>
+#include "../common/unittest.h"
+
+#define NUM_THREADS 4
+#define NUM_INCS    10000
+
+static m_txmutex_t  mutex = M_TXMUTEX_INITIALIZER;
+static m_txrwlock_t rwlock = M_TXRWLOCK_INITIALIZER;
+
+static uint64_t     counter;
+static uint64_t     pair[2];
+static volatile int torn;
+
+
+/* Odd threads take the mutex outside transactions, even ones inside */
+static void *incrementThread(void *arg)
+{
+	uint64_t id = (uint64_t) (uintptr_t) arg;
+	uint64_t value;
+	int      i;
+
+	for (i = 0; i < NUM_INCS; i++) {
+		if (id & 1) {
+			m_txmutex_lock(&mutex);
+			value = counter;
+			sched_yield();
+			counter = value + 1;
+			m_txmutex_unlock(&mutex);
+		} else {
+			__tm_atomic {
+				m_txmutex_lock(&mutex);
+				counter++;
+				m_txmutex_unlock(&mutex);
+			}
+		}
+	}
+	return NULL;
+}
+
+
+/* Writers keep both halves of pair equal; readers check that they are */
+static void *pairThread(void *arg)
+{
+	uint64_t id = (uint64_t) (uintptr_t) arg;
+	uint64_t a;
+	uint64_t b;
+	int      i;
+
+	for (i = 0; i < NUM_INCS; i++) {
+		if (i % 4 == 0) {
+			if (id & 1) {
+				m_txrwlock_wrlock(&rwlock);
+				pair[0]++;
+				sched_yield();
+				pair[1]++;
+				m_txrwlock_unlock(&rwlock);
+			} else {
+				__tm_atomic {
+					m_txrwlock_wrlock(&rwlock);
+					pair[0]++;
+					pair[1]++;
+					m_txrwlock_unlock(&rwlock);
+				}
+			}
+		} else {
+			if (id & 1) {
+				m_txrwlock_rdlock(&rwlock);
+				a = pair[0];
+				b = pair[1];
+				m_txrwlock_unlock(&rwlock);
+			} else {
+				__tm_atomic {
+					m_txrwlock_rdlock(&rwlock);
+					a = pair[0];
+					b = pair[1];
+					m_txrwlock_unlock(&rwlock);
+				}
+			}
+			if (a != b) {
+				torn = 1;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+static volatile int outliveStop;
+
+static void *lockerThread(void *arg)
+{
+	uint64_t n = 0;
+
+	while (!outliveStop) {
+		m_txmutex_lock(&mutex);
+		counter++;
+		n++;
+		m_txmutex_unlock(&mutex);
+	}
+	return (void *) (uintptr_t) n;
+}
+
+
+static void *rdlockThread(void *arg)
+{
+	int ret;
+
+	if ((ret = m_txrwlock_rdlock(&rwlock)) == 0) {
+		ret = m_txrwlock_unlock(&rwlock);
+	}
+	return (void *) (uintptr_t) ret;
+}
+
+
+SUITE(SuiteTxLock)
+{
+	/* Outside transactions a thread may take a mutex it holds */
+	TEST(Recursive)
+	{
+		CHECK_EQUAL(0, m_txmutex_lock(&mutex));
+		CHECK_EQUAL(0, m_txmutex_lock(&mutex));
+		CHECK_EQUAL(0, m_txmutex_unlock(&mutex));
+		CHECK_EQUAL(EBUSY, m_txmutex_destroy(&mutex));
+		CHECK_EQUAL(0, m_txmutex_unlock(&mutex));
+		CHECK_EQUAL(EPERM, m_txmutex_unlock(&mutex));
+		CHECK_EQUAL(0, m_txmutex_destroy(&mutex));
+	}
+
+	/* Inside a transaction the lock is released at commit */
+	TEST(Deferred)
+	{
+		int busy;
+
+		__tm_atomic {
+			m_txmutex_lock(&mutex);
+			counter = 0;
+			m_txmutex_unlock(&mutex);
+			busy = m_txmutex_destroy(&mutex) == EBUSY;
+		}
+		CHECK(busy);
+		CHECK_EQUAL(0, m_txmutex_destroy(&mutex));
+	}
+
+	/* Readers share the lock, and only the sole reader can upgrade */
+	TEST(Shared)
+	{
+		pthread_t thread;
+		void      *ret;
+
+		CHECK_EQUAL(0, m_txrwlock_rdlock(&rwlock));
+		pthread_create(&thread, NULL, rdlockThread, NULL);
+		pthread_join(thread, &ret);
+		CHECK_EQUAL(0, (int) (uintptr_t) ret);
+		CHECK_EQUAL(0, m_txrwlock_wrlock(&rwlock));
+		CHECK_EQUAL(0, m_txrwlock_unlock(&rwlock));
+		CHECK_EQUAL(0, m_txrwlock_unlock(&rwlock));
+		CHECK_EQUAL(0, m_txrwlock_destroy(&rwlock));
+	}
+
+	/* Transactions and plain code exclude each other through the mutex */
+	TEST(Mutex)
+	{
+		pthread_t threads[NUM_THREADS];
+		int       i;
+
+		counter = 0;
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&threads[i], NULL, incrementThread, (void *) (uintptr_t) i);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		CHECK_EQUAL(NUM_THREADS * NUM_INCS, counter);
+		CHECK_EQUAL(0, m_txmutex_destroy(&mutex));
+	}
+
+	/* A lock taken in a transaction and released after it stays held */
+	TEST(Outlive)
+	{
+		pthread_t thread;
+		void      *n;
+		int       i;
+
+		counter = 0;
+		outliveStop = 0;
+		pthread_create(&thread, NULL, lockerThread, NULL);
+		for (i = 0; i < NUM_INCS; i++) {
+			__tm_atomic {
+				m_txmutex_lock(&mutex);
+			}
+			counter++;
+			m_txmutex_unlock(&mutex);
+		}
+		outliveStop = 1;
+		pthread_join(thread, &n);
+		CHECK_EQUAL(NUM_INCS + (uint64_t) (uintptr_t) n, counter);
+		CHECK_EQUAL(0, m_txmutex_destroy(&mutex));
+	}
+
+	TEST(RwLock)
+	{
+		pthread_t threads[NUM_THREADS];
+		int       i;
+
+		pair[0] = pair[1] = 0;
+		torn = 0;
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_create(&threads[i], NULL, pairThread, (void *) (uintptr_t) i);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		CHECK(!torn);
+		CHECK_EQUAL(NUM_THREADS * NUM_INCS / 4, pair[0]);
+		CHECK_EQUAL(pair[0], pair[1]);
+		CHECK_EQUAL(0, m_txrwlock_destroy(&rwlock));
+	}
+}
@@ -41,6 +41,7 @@
 #include <time.h>
 #include <getopt.h>
 #include <assert.h>
+#include <cpuid.h>
 #include <spinlock.h>
 #include "ut_barrier.h"
 
@@ -55,12 +56,14 @@ typedef enum {
 	TOOL_MEMCPY = 0,
 	TOOL_STORESEQ = 1,
 	TOOL_STOREPCM = 2,
+	TOOL_FLUSH = 3,
 	num_of_tools
 } tool_t;
 
 void tool_memcpy(int tid);
 void tool_storeseq_pcm(int tid);
 void tool_storeseq_ram(int tid);
+void tool_flush(int tid);
 
 typedef struct tool_functions_s {
 	char *str;
@@ -73,7 +76,8 @@ typedef uint64_t pcm_word_t;
 tool_functions_t tools[] = {
 	{"memcpy", tool_memcpy},
 	{"storeseq_ram", tool_storeseq_ram},
-	{"storeseq_pcm", tool_storeseq_pcm}
+	{"storeseq_pcm", tool_storeseq_pcm},
+	{"flush", tool_flush}
 };
 	
 
@@ -299,6 +303,18 @@ static inline void asm_clflush(pcm_word_t *addr)
 }
 
 
+static inline void asm_clflushopt(pcm_word_t *addr)
+{
+	__asm__ __volatile__ (".byte 0x66; clflush %0" : "+m"(*(volatile char *)addr));
+}
+
+
+static inline void asm_clwb(pcm_word_t *addr)
+{
+	__asm__ __volatile__ (".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)addr));
+}
+
+
 static inline void asm_mfence(void)
 {
 	__asm__ __volatile__ ("mfence");
@@ -533,6 +549,130 @@ void tool_storeseq_pcm(int tid)
 }
 
 
+/* 
+ * Write-back variants measured by the flush tool. Each variant dirties
+ * write_size bytes line by line and then writes them back; the per-line 
+ * variant is what a commit used to cost, the others are the batched 
+ * variants PCM_WB_FLUSH can select at runtime.
+ */
+typedef enum {
+	FLUSH_CLFLUSH_MFENCE = 0,  /* clflush + mfence per line */
+	FLUSH_CLFLUSH,             /* clflush per line, one mfence */
+	FLUSH_CLFLUSHOPT,          /* clflushopt per line, one sfence */
+	FLUSH_CLWB,                /* clwb per line, one sfence */
+	num_of_flush_variants
+} flush_variant_t;
+
+static char *flush_variant_str[] = {
+	"clflush+mfence",
+	"clflush",
+	"clflushopt",
+	"clwb"
+};
+
+
+static int flush_variant_supported(flush_variant_t variant)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (variant == FLUSH_CLFLUSHOPT || variant == FLUSH_CLWB) {
+		if (__get_cpuid_max(0, NULL) < 7) {
+			return 0;
+		}
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		return (variant == FLUSH_CLFLUSHOPT) ? (ebx >> 23) & 1 : (ebx >> 24) & 1;
+	}
+	return 1;
+}
+
+
+static inline void flush_range(flush_variant_t variant, char *A, int n)
+{
+	int k;
+
+	switch (variant) {
+		case FLUSH_CLFLUSH_MFENCE:
+			for (k=0; k<n; k+=CACHELINE_SIZE) {
+				asm_clflush((pcm_word_t *) &A[k]);
+				asm_mfence();
+			}
+			break;
+		case FLUSH_CLFLUSH:
+			for (k=0; k<n; k+=CACHELINE_SIZE) {
+				asm_clflush((pcm_word_t *) &A[k]);
+			}
+			asm_mfence();
+			break;
+		case FLUSH_CLFLUSHOPT:
+			for (k=0; k<n; k+=CACHELINE_SIZE) {
+				asm_clflushopt((pcm_word_t *) &A[k]);
+			}
+			asm_sfence();
+			break;
+		case FLUSH_CLWB:
+			for (k=0; k<n; k+=CACHELINE_SIZE) {
+				asm_clwb((pcm_word_t *) &A[k]);
+			}
+			asm_sfence();
+			break;
+		default:
+			assert(0);
+	}
+}
+
+
+void tool_flush(int tid)
+{
+	hrtime_t        start;
+	hrtime_t        stop;
+	hrtime_t        duration;
+	char            *A;
+	int             j;
+	int             k;
+	int             n;
+	int             nlines;
+	size_t          size;
+	double          throughput;
+	flush_variant_t variant;
+
+	size = 64*1024*1024;
+	posix_memalign((void **)&A, PAGE_SIZE, size);
+	memset(A, 0, size);
+	fprintf(stderr, "T%d: Memory allocation: DONE\n", tid);
+
+	for (variant=0; variant<num_of_flush_variants; variant++) {
+		if (!flush_variant_supported(variant)) {
+			printf("T%d: variant = %s: not supported by this CPU\n", tid, flush_variant_str[variant]);
+			continue;
+		}
+		for (n=range_low; n<=range_high; n+=range_step) {
+			nlines = (n + CACHELINE_SIZE - 1) / CACHELINE_SIZE;
+			if (nlines == 0 || nlines * CACHELINE_SIZE > size) {
+				continue;
+			}
+			ut_barrier_wait(&global_barrier);
+			duration = 0;
+			for (j=0; j<nloops;j++) {
+				/* Dirty the lines first; only the write-back is timed */
+				for (k=0; k<n; k+=CACHELINE_SIZE) {
+					asm_mov((pcm_word_t *) &A[k], (pcm_word_t) j);
+				}
+				asm_cpuid();
+				start = gethrtime();
+				flush_range(variant, A, n);
+				stop = gethrtime();
+				duration += stop - start;
+			}
+			duration = duration/nloops;
+			throughput = 1000*((double) nlines * CACHELINE_SIZE) / ((double) CYCLE2NS(duration));
+			printf("T%d: variant = %s, write_size = %d (bytes), lines = %d, duration = %llu cycles (%llu ns), cycles_per_line = %llu, throughput_bytes = %lf (MB/s) \n", 
+			       tid, flush_variant_str[variant], n, nlines, duration, CYCLE2NS(duration), duration/nlines, throughput);
+			fflush(stdout);
+		}
+	}
+}
+
+
 void *slave(void *arg)
 {
 	int tid = (int) arg;
@@ -556,7 +696,7 @@ void usage(FILE *fout, char *name)
 	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--pcmbw=PCM_BANDWIDTH (MB)");
 	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--drambw=DRAM_MEMORY_SYSTEM_PEAK_BANDWIDTH (MB)");
 	fprintf(fout, "\nValid arguments:\n");
-	fprintf(fout, "  --tool     [memcpy, storeseq_pcm, storeseq_ram]\n");
+	fprintf(fout, "  --tool     [memcpy, storeseq_pcm, storeseq_ram, flush]\n");
 	exit(1);
 }
 
@@ -0,0 +1,293 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Restores a snapshot taken with m_snapshot (see mtm/include/mtm.h)
+ * into an empty segments directory. 
+ *
+ * Only files are copied back; the logs in the snapshot still hold the 
+ * transactions that were not yet written back when it was taken, and 
+ * recovery replays them when a program next starts on the directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "files.h"
+
+char *prog_name = "mnemorestore";
+
+
+/* hugetlbfs files cannot be written, only mapped */
+static int
+copy_fd_mapped(int sfd, int dfd, off_t size)
+{
+	char    *p;
+	off_t   off;
+	ssize_t n;
+
+	if (ftruncate(dfd, size) < 0) {
+		return -1;
+	}
+	if ((p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, dfd, 0)) == MAP_FAILED) {
+		return -1;
+	}
+	for (off = 0; off < size; off += n) {
+		if ((n = read(sfd, p + off, size - off)) <= 0) {
+			munmap(p, size);
+			return -1;
+		}
+	}
+	return munmap(p, size);
+}
+
+
+/* 
+ * Copies src to the new file dst. With replace, a file already at dst is 
+ * removed first: one left behind by an earlier restore, or by the segment
+ * this one replaces.
+ */
+static int
+restore_file(const char *src, const char *dst, int hugetlbfs, int replace)
+{
+	int         sfd;
+	int         dfd;
+	struct stat st;
+	int         rv;
+
+	if ((sfd = open(src, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if (replace && unlink(dst) < 0 && errno != ENOENT) {
+		close(sfd);
+		return -1;
+	}
+	if (fstat(sfd, &st) < 0 || 
+	    (dfd = open(dst, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR)) < 0) 
+	{
+		close(sfd);
+		return -1;
+	}
+	if (hugetlbfs) {
+		rv = copy_fd_mapped(sfd, dfd, st.st_size);
+	} else {
+		rv = file_copy_fd(sfd, dfd, st.st_size);
+		if (rv == 0) {
+			rv = fsync(dfd);
+		}
+	}
+	close(dfd);
+	close(sfd);
+	return rv;
+}
+
+
+/* Copies every regular file of src_dir into dst_dir */
+static int
+restore_dir(const char *src_dir, const char *dst_dir, int hugetlbfs, int replace)
+{
+	DIR           *d;
+	struct dirent *e;
+	struct stat   st;
+	char          src[PATH_MAX];
+	char          dst[PATH_MAX];
+	int           n = 0;
+
+	if (!(d = opendir(src_dir))) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, src_dir, strerror(errno));
+		return -1;
+	}
+	while ((e = readdir(d))) {
+		snprintf(src, sizeof(src), "%s/%s", src_dir, e->d_name);
+		if (strcmp(e->d_name, "snapshot.info") == 0 || 
+		    stat(src, &st) < 0 || !S_ISREG(st.st_mode)) 
+		{
+			continue;
+		}
+		snprintf(dst, sizeof(dst), "%s/%s", dst_dir, e->d_name);
+		if (restore_file(src, dst, hugetlbfs, replace) < 0) {
+			fprintf(stderr, "%s: %s: %s\n", prog_name, dst, strerror(errno));
+			closedir(d);
+			return -1;
+		}
+		n++;
+	}
+	closedir(d);
+	return n;
+}
+
+
+/* Creates dir if it does not exist; fails if it has anything in it */
+static int
+prepare_dir(const char *dir)
+{
+	DIR           *d;
+	struct dirent *e;
+
+	if (mkdir(dir, S_IRWXU) == 0) {
+		return 0;
+	}
+	if (errno != EEXIST || !(d = opendir(dir))) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, dir, strerror(errno));
+		return -1;
+	}
+	while ((e = readdir(d))) {
+		if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) {
+			fprintf(stderr, "%s: %s is not empty\n", prog_name, dir);
+			closedir(d);
+			return -1;
+		}
+	}
+	closedir(d);
+	return 0;
+}
+
+
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [--hugepages=DIR] [--tier=DIR] SNAPSHOT SEGMENTS_DIR\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --hugepages  where the segments on hugetlbfs go (mcore.hugepages_dir)\n");
+	fprintf(fout, "  --tier       where the cold extents of tiered segments go (mcore.tier_dir)\n");
+	fprintf(fout, "\n");
+	fprintf(fout, "SEGMENTS_DIR (mcore.segments_dir) must be empty or not exist.\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char               path[PATH_MAX];
+	char               *hugepages_dir = NULL;
+	char               *tier_dir = NULL;
+	char               *snapshot_dir;
+	char               *segments_dir;
+	unsigned long long sqn;
+	int                nsegments;
+	int                n;
+	int                m = 0;
+	int                c;
+	FILE               *info;
+	struct stat        st;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"hugepages", required_argument, 0, 'H'},
+			{"tier", required_argument, 0, 'T'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "H:T:h", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'H':
+				hugepages_dir = optarg;
+				break;
+			case 'T':
+				tier_dir = optarg;
+				break;
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (optind != argc - 2) {
+		usage(stderr, prog_name);
+	}
+	snapshot_dir = argv[optind];
+	segments_dir = argv[optind + 1];
+
+	snprintf(path, sizeof(path), "%s/snapshot.info", snapshot_dir);
+	if (!(info = fopen(path, "r")) || 
+	    fscanf(info, "sqn %llu segments %d", &sqn, &nsegments) != 2) 
+	{
+		fprintf(stderr, "%s: %s is not a complete snapshot\n", prog_name, snapshot_dir);
+		exit(1);
+	}
+	fclose(info);
+
+	if (prepare_dir(segments_dir) < 0) {
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/hugepages", snapshot_dir);
+	if (stat(path, &st) == 0) {
+		if (!hugepages_dir) {
+			fprintf(stderr, "%s: snapshot has segments on hugetlbfs; use --hugepages\n", prog_name);
+			exit(1);
+		}
+		/* 
+		 * Unlike segments_dir this may hold files of other programs, so 
+		 * it is not required to be empty; files of our segments left 
+		 * there are replaced.
+		 */
+		if ((m = restore_dir(path, hugepages_dir, 1, 1)) < 0) {
+			exit(1);
+		}
+	}
+	snprintf(path, sizeof(path), "%s/tier", snapshot_dir);
+	if (stat(path, &st) == 0) {
+		if (!tier_dir) {
+			fprintf(stderr, "%s: snapshot has tiered segments; use --tier\n", prog_name);
+			exit(1);
+		}
+		mkdir(tier_dir, S_IRWXU);
+		if (restore_dir(path, tier_dir, 0, 1) < 0) {
+			exit(1);
+		}
+	}
+	if ((n = restore_dir(snapshot_dir, segments_dir, 0, 0)) < 0) {
+		exit(1);
+	}
+	/* The segment table is the only file that is not a segment */
+	if (n - 1 + m != nsegments) {
+		fprintf(stderr, "%s: restored %d segments, snapshot has %d\n", 
+		        prog_name, n - 1 + m, nsegments);
+		exit(1);
+	}
+	printf("restored %d segments at sqn %llu\n", nsegments, sqn);
+	return 0;
+}
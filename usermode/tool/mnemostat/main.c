@@ -0,0 +1,377 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Prints the transaction latency histograms of a running MTM 
+ * process from its shared-memory metrics snapshot (see mtm/include/metrics.h).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "metrics.h"
+
+typedef struct metrics_total_s {
+	uint64_t           nb_threads;
+	uint64_t           commits;
+	uint64_t           aborts;
+	mtm_metrics_hist_t hist[mtm_metrics_numofhists];
+} metrics_total_t;
+
+#define ACTION(name, unit) #name,
+static const char *hist_names[] = {
+	FOREACH_METRICS_HIST(ACTION)
+};
+#undef ACTION
+
+#define ACTION(name, unit) #unit,
+static const char *hist_units[] = {
+	FOREACH_METRICS_HIST(ACTION)
+};
+#undef ACTION
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+char   *prog_name = "mnemostat";
+double cycles_per_ns = 0;
+
+
+static inline 
+uint64_t 
+rdtsc(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t) lo) | (((uint64_t) hi) << 32);
+}
+
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+/* 
+ * The target recorded a (tsc, time) pair when it started; pairing it with
+ * ours gives the cycle rate without the target doing any calibration.
+ */
+static void
+calibrate(const mtm_metrics_shm_t *shm)
+{
+	uint64_t now_ns = monotonic_ns();
+
+	if (now_ns < shm->start_ns + 10000000ULL) {
+		usleep(10000);
+		now_ns = monotonic_ns();
+	}
+	cycles_per_ns = (double) (rdtsc() - shm->start_tsc) / 
+	                (double) (now_ns - shm->start_ns);
+}
+
+
+static void
+hist_add(mtm_metrics_hist_t *dst, const mtm_metrics_hist_t *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+	for (i = 0; i < MTM_METRICS_NUM_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+
+/* Subtract an earlier reading of the same histogram; max stays cumulative. */
+static void
+hist_sub(mtm_metrics_hist_t *dst, const mtm_metrics_hist_t *src)
+{
+	int i;
+
+	dst->count -= src->count;
+	dst->sum -= src->sum;
+	for (i = 0; i < MTM_METRICS_NUM_BUCKETS; i++) {
+		dst->buckets[i] -= src->buckets[i];
+	}
+}
+
+
+static uint64_t
+hist_percentile(const mtm_metrics_hist_t *hist, double pct)
+{
+	uint64_t target;
+	uint64_t seen = 0;
+	uint64_t high;
+	int      i;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+	target = (uint64_t) ((pct / 100.0) * hist->count + 0.5);
+	if (target == 0) {
+		target = 1;
+	}
+	for (i = 0; i < MTM_METRICS_NUM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			/* Report the highest value the bucket can hold */
+			high = i + 1 < MTM_METRICS_NUM_BUCKETS ? 
+			       mtm_metrics_bucket_low(i + 1) - 1 : UINT64_MAX;
+			return high < hist->max ? high : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+
+static double
+scale(int hist, uint64_t val)
+{
+	/* Latencies are printed in microseconds */
+	if (strcmp(hist_units[hist], "cycles") == 0) {
+		return (double) val / cycles_per_ns / 1000.0;
+	}
+	return (double) val;
+}
+
+
+static void
+snapshot(const mtm_metrics_shm_t *shm, int per_thread, metrics_total_t *total)
+{
+	const mtm_metrics_slot_t *slot;
+	uint32_t                 i;
+	int                      h;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < shm->nb_slots; i++) {
+		slot = &shm->slots[i];
+		if (slot->state == MTM_METRICS_SLOT_FREE) {
+			continue;
+		}
+		total->nb_threads++;
+		total->commits += slot->commits;
+		total->aborts += slot->aborts;
+		for (h = 0; h < mtm_metrics_numofhists; h++) {
+			hist_add(&total->hist[h], &slot->hist[h]);
+		}
+		if (per_thread) {
+			printf("  thread %-8u %-7s commits %12llu  aborts %12llu  p50 latency %10.2f us\n",
+			       slot->tid, 
+			       slot->state == MTM_METRICS_SLOT_ACTIVE ? "active" : "exited",
+			       (unsigned long long) slot->commits, 
+			       (unsigned long long) slot->aborts,
+			       scale(mtm_metrics_xact_latency_hist, 
+			             hist_percentile(&slot->hist[mtm_metrics_xact_latency_hist], 50.0)));
+		}
+	}
+}
+
+
+static void
+report(const metrics_total_t *total, double seconds)
+{
+	const mtm_metrics_hist_t *hist;
+	char                     label[16];
+	int                      h;
+	int                      p;
+
+	printf("threads %llu  commits %llu  aborts %llu", 
+	       (unsigned long long) total->nb_threads,
+	       (unsigned long long) total->commits, 
+	       (unsigned long long) total->aborts);
+	if (seconds > 0) {
+		printf("  (%.0f commits/s)", total->commits / seconds);
+	}
+	printf("\n");
+
+	printf("%-14s %8s %12s %12s", "histogram", "unit", "count", "mean");
+	for (p = 0; p < sizeof(percentiles)/sizeof(percentiles[0]); p++) {
+		snprintf(label, sizeof(label), "p%g", percentiles[p]);
+		printf(" %11s", label);
+	}
+	printf(" %12s\n", "max");
+	for (h = 0; h < mtm_metrics_numofhists; h++) {
+		hist = &total->hist[h];
+		printf("%-14s %8s %12llu %12.2f", 
+		       hist_names[h],
+		       strcmp(hist_units[h], "cycles") == 0 ? "us" : hist_units[h],
+		       (unsigned long long) hist->count,
+		       hist->count ? scale(h, hist->sum) / hist->count : 0.0);
+		for (p = 0; p < sizeof(percentiles)/sizeof(percentiles[0]); p++) {
+			printf(" %11.2f", scale(h, hist_percentile(hist, percentiles[p])));
+		}
+		printf(" %12.2f\n", scale(h, hist->max));
+	}
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [--interval=SECONDS] [--count=N] [--delta] [--threads] PID\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --interval   print a report every SECONDS (default: once)\n");
+	fprintf(fout, "  --count      stop after N reports\n");
+	fprintf(fout, "  --delta      report only what happened since the previous report\n");
+	fprintf(fout, "  --threads    also print a line per thread\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char                    shm_name[64];
+	int                     fd;
+	struct stat             st;
+	const mtm_metrics_shm_t *shm;
+	metrics_total_t         *cur;
+	metrics_total_t         *prev;
+	metrics_total_t         *tmp;
+	int                     interval = 0;
+	int                     count = 0;
+	int                     delta = 0;
+	int                     per_thread = 0;
+	int                     n;
+	int                     c;
+	int                     h;
+	pid_t                   pid;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"interval", required_argument, 0, 'i'},
+			{"count", required_argument, 0, 'c'},
+			{"delta", no_argument, 0, 'd'},
+			{"threads", no_argument, 0, 't'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "i:c:dth", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case 'c':
+				count = atoi(optarg);
+				break;
+			case 'd':
+				delta = 1;
+				break;
+			case 't':
+				per_thread = 1;
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(stderr, prog_name);
+	}
+	pid = (pid_t) atoi(argv[optind]);
+	snprintf(shm_name, sizeof(shm_name), MTM_METRICS_SHM_FMT, (int) pid);
+
+	if ((fd = shm_open(shm_name, O_RDONLY, 0)) < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: no metrics for process %d (is mtm.metrics enabled?)\n", 
+		        prog_name, (int) pid);
+		exit(1);
+	}
+	shm = (const mtm_metrics_shm_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	if (shm->magic != MTM_METRICS_MAGIC || 
+	    shm->version != MTM_METRICS_VERSION ||
+	    shm->nb_hists != mtm_metrics_numofhists ||
+	    shm->nb_buckets != MTM_METRICS_NUM_BUCKETS ||
+	    sizeof(mtm_metrics_shm_t) + shm->nb_slots * sizeof(mtm_metrics_slot_t) > st.st_size)
+	{
+		fprintf(stderr, "%s: incompatible metrics layout in %s\n", prog_name, shm_name);
+		exit(1);
+	}
+	calibrate(shm);
+
+	cur = (metrics_total_t *) calloc(1, sizeof(metrics_total_t));
+	prev = (metrics_total_t *) calloc(1, sizeof(metrics_total_t));
+	for (n = 1; ; n++) {
+		if (interval) {
+			printf("--- %d ---\n", n);
+		}
+		snapshot(shm, per_thread, cur);
+		if (delta && n > 1) {
+			tmp = (metrics_total_t *) malloc(sizeof(metrics_total_t));
+			memcpy(tmp, cur, sizeof(metrics_total_t));
+			tmp->commits -= prev->commits;
+			tmp->aborts -= prev->aborts;
+			for (h = 0; h < mtm_metrics_numofhists; h++) {
+				hist_sub(&tmp->hist[h], &prev->hist[h]);
+			}
+			report(tmp, interval);
+			free(tmp);
+		} else {
+			report(cur, 0);
+		}
+		fflush(stdout);
+		if (!interval || (count && n >= count)) {
+			break;
+		}
+		tmp = prev; prev = cur; cur = tmp;
+		sleep(interval);
+	}
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file main.c
+ *
+ * \brief Decode a binary PM trace written by the _ENABLE_TRACE tracer.
+ *
+ * Produces the same colon-separated text the old in-process tracer printed:
+ *
+ *   tid:usec:PM_W:addr:size:func:line
+ *   tid:usec:PM_I:addr:copied:count:func:line
+ *   tid:usec:PM_L:addr:done:count:func:line
+ *   tid:usec:PM_N:func:line
+ *
+ * Records are drained per thread, so by default they are merged by
+ * timestamp before printing; --unsorted streams them in file order using
+ * constant memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "pm_instr.h"
+#include "pm_trace.h"
+
+#define _HRTIME_CPUFREQ_DEFAULT 2500 /* MHz, see hrtime.h */
+
+typedef struct func_name_s {
+	uint64_t addr;
+	char     *name;
+} func_name_t;
+
+static const char *op_marker[PM_TRACE_OP_NUM] = {
+	PM_WRT_MARKER,
+	PM_DWRT_MARKER,
+	PM_DI_MARKER,
+	PM_RD_MARKER,
+	PM_NTI,
+	PM_FLUSH_MARKER,
+	PM_FLUSHOPT_MARKER,
+	PM_TX_START,
+	PM_FENCE_MARKER,
+	PM_COMMIT_MARKER,
+	PM_BARRIER_MARKER,
+	PM_TX_END
+};
+
+char                *prog_name = "pmtrace";
+static func_name_t  *funcs = NULL;
+static size_t       funcs_nb = 0;
+static size_t       funcs_size = 0;
+static pm_trace_rec_t *recs = NULL;
+static size_t       recs_nb = 0;
+static size_t       recs_size = 0;
+static uint64_t     start_tsc;
+static uint64_t     start_usec;
+static uint64_t     last_sync_tsc;
+static uint64_t     last_sync_usec;
+static uint64_t     stalls = 0;
+static double       cycles_per_usec = _HRTIME_CPUFREQ_DEFAULT;
+
+
+static int
+func_cmp(const void *a, const void *b)
+{
+	uint64_t x = ((const func_name_t *) a)->addr;
+	uint64_t y = ((const func_name_t *) b)->addr;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+
+static int
+rec_cmp(const void *a, const void *b)
+{
+	const pm_trace_rec_t *x = (const pm_trace_rec_t *) a;
+	const pm_trace_rec_t *y = (const pm_trace_rec_t *) b;
+
+	if (x->tsc != y->tsc) {
+		return x->tsc < y->tsc ? -1 : 1;
+	}
+	return x->tid < y->tid ? -1 : (x->tid > y->tid ? 1 : 0);
+}
+
+
+static const char *
+func_lookup(uint64_t addr)
+{
+	size_t lo = 0;
+	size_t hi = funcs_nb;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (funcs[mid].addr == addr) {
+			return funcs[mid].name;
+		} else if (funcs[mid].addr < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return "?";
+}
+
+
+/* Linear scan: names are looked up before funcs is sorted in streaming mode */
+static const char *
+func_lookup_unsorted(uint64_t addr)
+{
+	size_t i;
+
+	for (i = funcs_nb; i > 0; i--) {
+		if (funcs[i-1].addr == addr) {
+			return funcs[i-1].name;
+		}
+	}
+	return "?";
+}
+
+
+static void
+rec_print(FILE *fout, const pm_trace_rec_t *rec, const char *func)
+{
+	unsigned long long usec;
+	const char         *marker;
+
+	usec = (unsigned long long) ((double) (rec->tsc - start_tsc) / cycles_per_usec);
+	marker = rec->op < PM_TRACE_OP_NUM ? op_marker[rec->op] : "PM_?";
+
+	switch (rec->op) {
+		case PM_TRACE_OP_TX_START:
+		case PM_TRACE_OP_TX_END:
+		case PM_TRACE_OP_FENCE:
+		case PM_TRACE_OP_COMMIT:
+		case PM_TRACE_OP_BARRIER:
+			fprintf(fout, "%d:%llu:%s:%s:%d\n", 
+			        (int) rec->tid, usec, marker, func, (int) rec->line);
+			break;
+		case PM_TRACE_OP_FLUSH:
+		case PM_TRACE_OP_FLUSHOPT:
+			fprintf(fout, "%d:%llu:%s:%p:%u:%u:%s:%d\n",
+			        (int) rec->tid, usec, marker, (void *) (uintptr_t) rec->addr,
+			        rec->size, rec->count, func, (int) rec->line);
+			break;
+		case PM_TRACE_OP_NTI:
+			fprintf(fout, "%d:%llu:%s:%p:%lu:%lu:%s:%d\n",
+			        (int) rec->tid, usec, marker, (void *) (uintptr_t) rec->addr,
+			        (unsigned long) rec->size, (unsigned long) rec->count, 
+			        func, (int) rec->line);
+			break;
+		default:
+			fprintf(fout, "%d:%llu:%s:%p:%lu:%s:%d\n",
+			        (int) rec->tid, usec, marker, (void *) (uintptr_t) rec->addr,
+			        (unsigned long) rec->size, func, (int) rec->line);
+	}
+}
+
+
+static void
+usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage: %s [--unsorted] [--output=FILE] TRACE_FILE\n", name);
+	fprintf(fout, "\n");
+	fprintf(fout, "  --unsorted   print records in file order instead of merging threads by time\n");
+	fprintf(fout, "  --output     write the text trace to FILE instead of stdout\n");
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	FILE                *fin;
+	FILE                *fout = stdout;
+	pm_trace_file_hdr_t hdr;
+	pm_trace_chunk_t    chunk;
+	pm_trace_rec_t      rec;
+	int                 unsorted = 0;
+	int                 c;
+	uint32_t            i;
+	size_t              j;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"unsorted", no_argument, 0, 'u'},
+			{"output", required_argument, 0, 'o'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "uo:h", long_options, &option_index);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'u':
+				unsorted = 1;
+				break;
+			case 'o':
+				if ((fout = fopen(optarg, "w")) == NULL) {
+					perror(optarg);
+					exit(1);
+				}
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(stderr, prog_name);
+	}
+	if ((fin = fopen(argv[optind], "r")) == NULL) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fin) != 1 || hdr.magic != PM_TRACE_MAGIC) {
+		fprintf(stderr, "%s: %s is not a PM trace file\n", prog_name, argv[optind]);
+		exit(1);
+	}
+	if (hdr.version != PM_TRACE_VERSION || hdr.rec_size != sizeof(pm_trace_rec_t)) {
+		fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n", 
+		        prog_name, hdr.version, hdr.rec_size);
+		exit(1);
+	}
+	start_tsc = last_sync_tsc = hdr.start_tsc;
+	start_usec = last_sync_usec = hdr.start_usec;
+
+	/*
+	 * In streaming mode the cycle rate is not known until the last sync
+	 * chunk, so use the rate seen so far; the first sync arrives after the
+	 * first drain pass.
+	 */
+	while (fread(&chunk, sizeof(chunk), 1, fin) == 1) {
+		switch (chunk.type) {
+			case PM_TRACE_CHUNK_REC:
+				for (i = 0; i < chunk.nb; i++) {
+					if (fread(&rec, sizeof(rec), 1, fin) != 1) {
+						fprintf(stderr, "%s: truncated trace\n", prog_name);
+						goto done;
+					}
+					if (unsorted) {
+						rec_print(fout, &rec, func_lookup_unsorted(rec.func));
+						continue;
+					}
+					if (recs_nb == recs_size) {
+						recs_size = recs_size ? 2 * recs_size : 1 << 20;
+						recs = (pm_trace_rec_t *) realloc(recs, recs_size * sizeof(rec));
+						if (!recs) {
+							fprintf(stderr, "%s: out of memory, try --unsorted\n", prog_name);
+							exit(1);
+						}
+					}
+					recs[recs_nb++] = rec;
+				}
+				break;
+			case PM_TRACE_CHUNK_STR:
+				if (funcs_nb == funcs_size) {
+					funcs_size = funcs_size ? 2 * funcs_size : 256;
+					funcs = (func_name_t *) realloc(funcs, funcs_size * sizeof(func_name_t));
+				}
+				funcs[funcs_nb].addr = chunk.arg;
+				funcs[funcs_nb].name = (char *) malloc(chunk.nb + 1);
+				if (fread(funcs[funcs_nb].name, 1, chunk.nb, fin) != chunk.nb) {
+					fprintf(stderr, "%s: truncated trace\n", prog_name);
+					goto done;
+				}
+				funcs[funcs_nb].name[chunk.nb] = '\0';
+				funcs_nb++;
+				break;
+			case PM_TRACE_CHUNK_SYNC:
+				last_sync_tsc = chunk.arg;
+				last_sync_usec = chunk.arg2;
+				if (last_sync_usec > start_usec) {
+					cycles_per_usec = (double) (last_sync_tsc - start_tsc) / 
+					                  (double) (last_sync_usec - start_usec);
+				}
+				break;
+			case PM_TRACE_CHUNK_STALL:
+				stalls = chunk.arg;
+				break;
+			default:
+				fprintf(stderr, "%s: unknown chunk type %u\n", prog_name, chunk.type);
+				goto done;
+		}
+	}
+
+done:
+	if (!unsorted) {
+		qsort(funcs, funcs_nb, sizeof(func_name_t), func_cmp);
+		qsort(recs, recs_nb, sizeof(pm_trace_rec_t), rec_cmp);
+		for (j = 0; j < recs_nb; j++) {
+			rec_print(fout, &recs[j], func_lookup(recs[j].func));
+		}
+	}
+	if (stalls) {
+		fprintf(stderr, "%s: writers stalled on a full ring %llu times\n", 
+		        prog_name, (unsigned long long) stalls);
+	}
+	fclose(fin);
+	if (fout != stdout) {
+		fclose(fout);
+	}
+	return 0;
+}